@@ -0,0 +1,303 @@
+//
+//  batch.cpp
+//  ParserImproved
+//
+//  Copyright © 2020 MSD Katie Rose. All rights reserved.
+//
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include "batch.hpp"
+#include "parser.hpp"
+#include "catch.hpp"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define BATCH_HAS_AVX2 1
+#include <immintrin.h>
+#endif
+
+static const size_t TILE_ROWS = 1024;
+
+/*
+ An operand is a tile of ints, found either in a column, in a scratch register, or in a buffer filled with a constant.
+ */
+enum OperandKind { COLUMN, REGISTER, CONSTANT };
+
+struct Operand {
+    OperandKind kind;
+    size_t index;
+};
+
+enum Opcode { ADD, MULTIPLY };
+
+struct Instruction {
+    Opcode opcode;
+    Operand lhs;
+    Operand rhs;
+    size_t result;
+};
+
+struct BatchProgram {
+    vector<const vector<int>*> columns;
+    vector<int> constants;
+    vector<Instruction> instructions;
+    Operand output;
+};
+
+static Operand compileBatch(Expression* expr, BatchProgram &program, const map<string, vector<int>> &columns, map<string, Operand> &environment) {
+    
+    Number* number = dynamic_cast<Number*>(expr);
+    Variable* variable = dynamic_cast<Variable*>(expr);
+    Add* add = dynamic_cast<Add*>(expr);
+    Multiply* multiply = dynamic_cast<Multiply*>(expr);
+    LetExpression* let = dynamic_cast<LetExpression*>(expr);
+    
+    if (number != nullptr) {
+        
+        program.constants.push_back(number->value);
+        return Operand{CONSTANT, program.constants.size() - 1};
+    } else if (variable != nullptr) {
+        
+        auto bound = environment.find(variable->name);
+        if (bound != environment.end()) {
+            
+            return bound->second;
+        }
+        auto column = columns.find(variable->name);
+        if (column == columns.end()) {
+            
+            throw runtime_error((string)"no column for variable " + variable->name);
+        }
+        program.columns.push_back(&column->second);
+        Operand operand = Operand{COLUMN, program.columns.size() - 1};
+        environment[variable->name] = operand;
+        return operand;
+    } else if (add != nullptr || multiply != nullptr) {
+        
+        Expression* lhs = add != nullptr ? add->leftHandSide : multiply->leftHandSide;
+        Expression* rhs = add != nullptr ? add->rightHandSide : multiply->rightHandSide;
+        Instruction instruction;
+        instruction.opcode = add != nullptr ? ADD : MULTIPLY;
+        instruction.lhs = compileBatch(lhs, program, columns, environment);
+        instruction.rhs = compileBatch(rhs, program, columns, environment);
+        instruction.result = program.instructions.size();
+        program.instructions.push_back(instruction);
+        return Operand{REGISTER, instruction.result};
+    } else if (let != nullptr) {
+        
+        Operand value = compileBatch(let->subExpression, program, columns, environment);
+        map<string, Operand> bodyEnvironment = environment;
+        bodyEnvironment[let->subVariable->name] = value;
+        return compileBatch(let->subBody, program, columns, bodyEnvironment);
+    }
+    throw runtime_error((string)"batch evaluation only supports integer arithmetic, not " + expr->toString());
+}
+
+/*
+ Each kernel writes `count` results and returns true if any of them overflowed an int
+ */
+static bool addScalar(const int* lhs, const int* rhs, int* result, size_t count) {
+    
+    bool overflow = false;
+    for (size_t i = 0; i < count; i++) {
+        
+        overflow |= __builtin_add_overflow(lhs[i], rhs[i], &result[i]);
+    }
+    return overflow;
+}
+
+static bool multiplyScalar(const int* lhs, const int* rhs, int* result, size_t count) {
+    
+    bool overflow = false;
+    for (size_t i = 0; i < count; i++) {
+        
+        overflow |= __builtin_mul_overflow(lhs[i], rhs[i], &result[i]);
+    }
+    return overflow;
+}
+
+#ifdef BATCH_HAS_AVX2
+__attribute__((target("avx2")))
+static bool addAVX2(const int* lhs, const int* rhs, int* result, size_t count) {
+    
+    __m256i overflow = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        
+        __m256i a = _mm256_loadu_si256((const __m256i*)(lhs + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(rhs + i));
+        __m256i sum = _mm256_add_epi32(a, b);
+        //signed overflow happened where the sum's sign differs from both operands' signs
+        overflow = _mm256_or_si256(overflow, _mm256_and_si256(_mm256_xor_si256(a, sum), _mm256_xor_si256(b, sum)));
+        _mm256_storeu_si256((__m256i*)(result + i), sum);
+    }
+    bool tailOverflow = addScalar(lhs + i, rhs + i, result + i, count - i);
+    return tailOverflow || _mm256_movemask_ps(_mm256_castsi256_ps(overflow)) != 0;
+}
+
+__attribute__((target("avx2")))
+static __m256i productOverflow(__m256i product) {
+    
+    //a 64-bit product fits in an int when its high half is the sign extension of its low half
+    __m256i signExtension = _mm256_slli_epi64(_mm256_srai_epi32(product, 31), 32);
+    return _mm256_and_si256(_mm256_xor_si256(product, signExtension), _mm256_set1_epi64x((long long)0xFFFFFFFF00000000ULL));
+}
+
+__attribute__((target("avx2")))
+static bool multiplyAVX2(const int* lhs, const int* rhs, int* result, size_t count) {
+    
+    __m256i overflow = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        
+        __m256i a = _mm256_loadu_si256((const __m256i*)(lhs + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(rhs + i));
+        __m256i evenProducts = _mm256_mul_epi32(a, b);
+        __m256i oddProducts = _mm256_mul_epi32(_mm256_srli_epi64(a, 32), _mm256_srli_epi64(b, 32));
+        overflow = _mm256_or_si256(overflow, _mm256_or_si256(productOverflow(evenProducts), productOverflow(oddProducts)));
+        _mm256_storeu_si256((__m256i*)(result + i), _mm256_mullo_epi32(a, b));
+    }
+    bool tailOverflow = multiplyScalar(lhs + i, rhs + i, result + i, count - i);
+    return tailOverflow || !_mm256_testz_si256(overflow, overflow);
+}
+#endif
+
+typedef bool (*Kernel)(const int* lhs, const int* rhs, int* result, size_t count);
+
+static bool cpuHasAVX2() {
+
+#ifdef BATCH_HAS_AVX2
+    static bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+#else
+    return false;
+#endif
+}
+
+vector<int> evaluateBatch(Expression* expr, const map<string, vector<int>> &columns) {
+    
+    BatchProgram program;
+    map<string, Operand> environment;
+    program.output = compileBatch(expr, program, columns, environment);
+    
+    size_t rows = columns.empty() ? 0 : columns.begin()->second.size();
+    for (auto &column : columns) {
+        
+        if (column.second.size() != rows) {
+            
+            throw runtime_error((string)"column " + column.first + " has the wrong number of rows");
+        }
+    }
+    
+    Kernel add = addScalar;
+    Kernel multiply = multiplyScalar;
+#ifdef BATCH_HAS_AVX2
+    if (cpuHasAVX2()) {
+        
+        add = addAVX2;
+        multiply = multiplyAVX2;
+    }
+#endif
+    
+    vector<vector<int>> constants;
+    for (int constant : program.constants) {
+        
+        constants.push_back(vector<int>(TILE_ROWS, constant));
+    }
+    vector<vector<int>> registers(program.instructions.size(), vector<int>(TILE_ROWS));
+    vector<int> output(rows);
+    
+    for (size_t start = 0; start < rows; start += TILE_ROWS) {
+        
+        size_t count = min(TILE_ROWS, rows - start);
+        auto tile = [&](Operand operand) -> int* {
+            switch (operand.kind) {
+                case COLUMN:
+                    return const_cast<int*>(program.columns[operand.index]->data() + start);
+                case REGISTER:
+                    return registers[operand.index].data();
+                default:
+                    return constants[operand.index].data();
+            }
+        };
+        
+        bool overflow = false;
+        for (Instruction &instruction : program.instructions) {
+            
+            Kernel kernel = instruction.opcode == ADD ? add : multiply;
+            overflow |= kernel(tile(instruction.lhs), tile(instruction.rhs), registers[instruction.result].data(), count);
+        }
+        if (overflow) {
+            
+            throw runtime_error("batch result does not fit in an int");
+        }
+        int* result = tile(program.output);
+        copy(result, result + count, output.begin() + start);
+    }
+    return output;
+}
+
+/* for tests */
+static Expression *parse_str(string s) {
+    std::istringstream in(s);
+    return parse(in);
+}
+
+TEST_CASE( "evaluateBatch" ) {
+    
+    map<string, vector<int>> columns;
+    for (int row = 0; row < 2500; row++) {
+        
+        columns["x"].push_back(row - 1000);
+        columns["y"].push_back(row % 7);
+    }
+    
+    Expression* expr = parse_str("x * y + 3");
+    vector<int> results = evaluateBatch(expr, columns);
+    REQUIRE( results.size() == 2500 );
+    bool allMatch = true;
+    for (int row = 0; row < 2500; row++) {
+        
+        Expression* bound = expr->substitute("x", new NumericValue(columns["x"][row]))->substitute("y", new NumericValue(columns["y"][row]));
+        allMatch = allMatch && bound->evaluate()->equals(new NumericValue(results[row]));
+    }
+    CHECK( allMatch );
+    
+    CHECK( evaluateBatch(parse_str("_let z = x + 1 _in z * z"), columns)[1001] == 4 );
+    CHECK( evaluateBatch(parse_str("_let x = 2 _in x * y"), columns)[6] == 12 );
+    CHECK( evaluateBatch(parse_str("7"), columns)[2499] == 7 );
+    
+    CHECK_THROWS_WITH( evaluateBatch(parse_str("x + w"), columns), "no column for variable w" );
+    CHECK_THROWS_WITH( evaluateBatch(parse_str("x * 2000000000"), columns), "batch result does not fit in an int" );
+    CHECK_THROWS_WITH( evaluateBatch(parse_str("x + _true"), columns), "batch evaluation only supports integer arithmetic, not _true" );
+}
+
+TEST_CASE( "evaluateBatch benchmark", "[.benchmark]" ) {
+    
+    const size_t rows = 10000000;
+    mt19937 generator(27);
+    uniform_int_distribution<int> value(-10000, 10000);
+    map<string, vector<int>> columns;
+    for (size_t row = 0; row < rows; row++) {
+        
+        columns["x"].push_back(value(generator));
+        columns["y"].push_back(value(generator));
+    }
+    Expression* expr = parse_str("x * y + 3");
+    
+    auto start = chrono::steady_clock::now();
+    vector<int> results = evaluateBatch(expr, columns);
+    double batchSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    
+    const size_t substituteRows = 200000;
+    start = chrono::steady_clock::now();
+    for (size_t row = 0; row < substituteRows; row++) {
+        
+        expr->substitute("x", new NumericValue(columns["x"][row]))->substitute("y", new NumericValue(columns["y"][row]))->evaluate();
+    }
+    double substituteSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    
+    cout << "x * y + 3 (" << (cpuHasAVX2() ? "avx2" : "scalar") << "): batch " << rows / batchSeconds << " rows/sec, substitute and evaluate " << substituteRows / substituteSeconds << " rows/sec\n";
+}
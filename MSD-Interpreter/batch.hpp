@@ -0,0 +1,24 @@
+//
+//  batch.hpp
+//  ParserImproved
+//
+//  Copyright © 2020 MSD Katie Rose. All rights reserved.
+//
+
+#ifndef batch_hpp
+#define batch_hpp
+
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "expression.hpp"
+
+using namespace std;
+
+/*
+ Evaluates `expr` once per row, where `columns` holds one value per row for each free variable of `expr`.  Rows are processed a tile at a time with AVX2 kernels when the CPU supports them and scalar loops otherwise.  Only integer arithmetic (Numbers, Variables, `+`, `*` and `_let`) is supported, and results must fit in an int.  Throws `runtime_error` otherwise.
+ */
+vector<int> evaluateBatch(Expression* expr, const map<string, vector<int>> &columns);
+
+#endif /* batch_hpp */
@@ -0,0 +1,286 @@
+//
+//  cache.cpp
+//  ParserImproved
+//
+//  Copyright © 2020 MSD Katie Rose. All rights reserved.
+//
+
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include "cache.hpp"
+#include "context.hpp"
+#include "interpreter.hpp"
+#include "parser.hpp"
+#include "catch.hpp"
+
+ResultCache::ResultCache(size_t maxBytes, size_t minSubtreeNodes) {
+    
+    this->byteBudget = maxBytes;
+    this->subtreeThreshold = minSubtreeNodes;
+    this->hits = 0;
+    this->misses = 0;
+    this->evictions = 0;
+    this->bytesUsed = 0;
+}
+
+Value* ResultCache::lookup(StructuralHash hash) {
+    
+    auto found = this->index.find(hash);
+    if (found == this->index.end()) {
+        
+        this->misses++;
+        return nullptr;
+    }
+    this->entries.splice(this->entries.begin(), this->entries, found->second);
+    this->hits++;
+    return found->second->value;
+}
+
+/*
+ An entry is charged for its list and index nodes, and a BigIntValue for its limbs too
+ */
+static size_t entryBytes(Value* value) {
+    
+    size_t valueBytes = sizeof(NumericValue);
+    if (BigIntValue* big = dynamic_cast<BigIntValue*>(value)) {
+        
+        valueBytes = sizeof(BigIntValue) + big->limbs.capacity() * sizeof(uint32_t);
+    }
+    return 64 + sizeof(StructuralHash) + sizeof(Value*) + sizeof(size_t) + valueBytes;
+}
+
+void ResultCache::insert(StructuralHash hash, Value* value) {
+    
+    size_t bytes = entryBytes(value);
+    if (bytes > this->byteBudget || this->index.count(hash) != 0) {
+        
+        return;
+    }
+    while (this->bytesUsed + bytes > this->byteBudget) {
+        
+        evictLeastRecentlyUsed();
+    }
+    this->entries.push_front({ hash, value, bytes });
+    this->index[hash] = this->entries.begin();
+    this->bytesUsed += bytes;
+}
+
+void ResultCache::evictLeastRecentlyUsed() {
+    
+    list<Entry>::iterator last = prev(this->entries.end());
+    this->index.erase(last->hash);
+    this->bytesUsed -= last->bytes;
+    this->entries.erase(last);
+    this->evictions++;
+}
+
+size_t ResultCache::size() {
+    
+    return this->entries.size();
+}
+
+/*
+ Evaluates like `evaluate()`, except that subtrees of at least `cache->subtreeThreshold` nodes go through the cache
+ */
+static Value* evaluateCached(Expression* expr, ResultCache* cache) {
+    
+    if (expr->nodeCount() < cache->subtreeThreshold) {
+        
+        return expr->evaluate();
+    }
+    StructuralHash hash = expr->structuralHash();
+    Value* cached = cache->lookup(hash);
+    if (cached != nullptr) {
+        
+        return cached;
+    }
+    Value* result;
+    EvaluationContext* context = EvaluationContext::current();
+    Add* add = dynamic_cast<Add*>(expr);
+    Multiply* multiply = dynamic_cast<Multiply*>(expr);
+    LetExpression* let = dynamic_cast<LetExpression*>(expr);
+    EqualsExpression* comparison = dynamic_cast<EqualsExpression*>(expr);
+    IfExpression* conditional = dynamic_cast<IfExpression*>(expr);
+    if (add != nullptr) {
+        
+        EvaluationContext::countStep();
+        Value* lhs = evaluateCached(add->leftHandSide, cache);
+        result = lhs->addTo(evaluateCached(add->rightHandSide, cache));
+    } else if (multiply != nullptr) {
+        
+        EvaluationContext::countStep();
+        Value* lhs = evaluateCached(multiply->leftHandSide, cache);
+        result = lhs->multiplyWith(evaluateCached(multiply->rightHandSide, cache));
+    } else if (let != nullptr && (context == nullptr || !context->lazyLet)) {
+        
+        EvaluationContext::countStep();
+        Value* bound = evaluateCached(let->subExpression, cache);
+        result = evaluateCached(let->subBody->substitute(let->subVariable->name, bound), cache);
+    } else if (comparison != nullptr) {
+        
+        EvaluationContext::countStep();
+        Value* lhs = evaluateCached(comparison->leftHandSide, cache);
+        result = new BoolValue(lhs->equals(evaluateCached(comparison->rightHandSide, cache)));
+    } else if (conditional != nullptr) {
+        
+        EvaluationContext::countStep();
+        BoolValue* test = dynamic_cast<BoolValue*>(evaluateCached(conditional->test, cache));
+        if (test == nullptr) {
+            
+            throw runtime_error("_if test is not a boolean");
+        }
+        result = evaluateCached(test->value ? conditional->thenBranch : conditional->elseBranch, cache);
+    } else {
+        
+        result = expr->evaluate();
+    }
+    cache->insert(hash, result);
+    return result;
+}
+
+Value *interpret(Expression* inputExpression, ResultCache* cache) {
+    
+    if (cache->subtreeThreshold == 0) {
+        
+        StructuralHash hash = inputExpression->structuralHash();
+        Value* cached = cache->lookup(hash);
+        if (cached == nullptr) {
+            
+            cached = inputExpression->evaluate();
+            cache->insert(hash, cached);
+        }
+        return cached;
+    }
+    return evaluateCached(inputExpression, cache);
+}
+
+/* for tests */
+static Expression *parse_str(string s) {
+    std::istringstream in(s);
+    return parse(in);
+}
+
+TEST_CASE( "ResultCache" ) {
+    
+    ResultCache cache(1 << 20);
+    CHECK( interpret(parse_str("(2 + 3) * 7"), &cache)->equals(new NumericValue(35)) );
+    CHECK( cache.misses == 1 );
+    CHECK( interpret(parse_str("(2 + 3) * 7"), &cache)->equals(new NumericValue(35)) );
+    CHECK( cache.hits == 1 );
+    CHECK( interpret(parse_str("(2 + 3) * 8"), &cache)->equals(new NumericValue(40)) );
+    CHECK( cache.misses == 2 );
+    CHECK( cache.size() == 2 );
+    
+    //errors are not cached
+    CHECK_THROWS( interpret(parse_str("_true + 1"), &cache) );
+    CHECK_THROWS( interpret(parse_str("_true + 1"), &cache) );
+    CHECK( cache.hits == 1 );
+    CHECK( cache.size() == 2 );
+    
+    //the least recently used entry goes first
+    Expression* first = parse_str("1 + 1");
+    size_t oneEntry = entryBytes(new NumericValue(2));
+    ResultCache small(oneEntry * 2);
+    interpret(first, &small);
+    interpret(parse_str("2 + 2"), &small);
+    interpret(parse_str("1 + 1"), &small);
+    interpret(parse_str("3 + 3"), &small);
+    CHECK( small.evictions == 1 );
+    CHECK( small.size() == 2 );
+    CHECK( small.bytesUsed <= small.byteBudget );
+    long hits = small.hits;
+    interpret(parse_str("1 + 1"), &small);
+    CHECK( small.hits == hits + 1 );
+    interpret(parse_str("2 + 2"), &small);
+    CHECK( small.hits == hits + 1 );
+    
+    //entries larger than the whole budget are not stored
+    ResultCache tiny(16);
+    interpret(first, &tiny);
+    CHECK( tiny.size() == 0 );
+    CHECK( tiny.bytesUsed == 0 );
+    
+    //with a threshold, expressions that only share a large subtree hit on it
+    ResultCache subtrees(1 << 20, 5);
+    string shared = "(_let x = 4 * 5 _in x * x + 3 * x)";
+    CHECK( interpret(parse_str(shared + " + 1"), &subtrees)->equals(new NumericValue(461)) );
+    hits = subtrees.hits;
+    CHECK( interpret(parse_str(shared + " * 2"), &subtrees)->equals(new NumericValue(920)) );
+    CHECK( subtrees.hits == hits + 1 );
+    
+    EvaluationContext context;
+    {
+        EvaluationScope scope(&context);
+        CHECK( interpret(parse_str(shared + " + 2"), &subtrees)->equals(new NumericValue(462)) );
+    }
+    CHECK( context.steps == 1 );
+    
+    //the shared subtree is found in whichever branch is taken
+    hits = subtrees.hits;
+    CHECK( interpret(parse_str("_if 1 == 2 _then 0 _else " + shared), &subtrees)->equals(new NumericValue(460)) );
+    CHECK( subtrees.hits == hits + 1 );
+}
+
+/*
+ Traffic that repeats a few hundred expressions, each of which also shares a large subtree with the others
+ */
+static vector<Expression*> generatedTraffic(int requests, int distinct, unsigned &seed) {
+    
+    vector<string> common;
+    for (int i = 0; i < 8; i++) {
+        
+        std::ostringstream subtree;
+        subtree << "(";
+        for (int term = 0; term < 200; term++) {
+            
+            seed = seed * 1103515245 + 12345;
+            subtree << (term == 0 ? "" : " + ") << (seed >> 16) % 100 << " * " << (seed >> 8) % 100;
+        }
+        subtree << ")";
+        common.push_back(subtree.str());
+    }
+    vector<string> expressions;
+    for (int i = 0; i < distinct; i++) {
+        
+        seed = seed * 1103515245 + 12345;
+        expressions.push_back(common[(seed >> 16) % common.size()] + " * " + to_string(i) + " + " + common[(seed >> 8) % common.size()]);
+    }
+    vector<Expression*> traffic;
+    for (int i = 0; i < requests; i++) {
+        
+        seed = seed * 1103515245 + 12345;
+        traffic.push_back(parse_str(expressions[(seed >> 16) % distinct]));
+    }
+    return traffic;
+}
+
+TEST_CASE( "ResultCache benchmark", "[.benchmark]" ) {
+    
+    unsigned seed = 40;
+    vector<Expression*> traffic = generatedTraffic(5000, 500, seed);
+    auto start = std::chrono::steady_clock::now();
+    for (Expression* request : traffic) {
+        
+        interpret(request);
+    }
+    double plainMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    cout << traffic.size() << " requests, uncached: " << plainMilliseconds << " ms\n";
+    
+    for (size_t threshold : {(size_t)0, (size_t)100}) {
+        
+        for (size_t budget : {(size_t)1 << 14, (size_t)1 << 20}) {
+            
+            ResultCache cache(budget, threshold);
+            start = std::chrono::steady_clock::now();
+            for (Expression* request : traffic) {
+                
+                interpret(request, &cache);
+            }
+            double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            cout << "threshold " << threshold << ", budget " << budget << " bytes: " << milliseconds << " ms, " << cache.hits << " hits, " << cache.misses << " misses, "
+                 << cache.evictions << " evictions, " << cache.bytesUsed << " bytes used\n";
+        }
+    }
+}
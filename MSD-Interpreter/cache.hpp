@@ -0,0 +1,59 @@
+//
+//  cache.hpp
+//  ParserImproved
+//
+//  Copyright © 2020 MSD Katie Rose. All rights reserved.
+//
+
+#ifndef cache_hpp
+#define cache_hpp
+
+#include <stdio.h>
+#include <list>
+#include <unordered_map>
+#include "expression.hpp"
+
+using namespace std;
+
+/*
+ ResultCache remembers the values of expressions it has evaluated, keyed by their 128-bit `structuralHash()`, so the expressions themselves are not kept alive.  Entries are charged an estimate of the bytes they hold, and when the total would pass `byteBudget` the least recently used entries are evicted.
+ */
+class ResultCache {
+public:
+    
+    size_t byteBudget;
+    
+    //when nonzero, subtrees with at least this many nodes are cached as well as whole expressions
+    size_t subtreeThreshold;
+    
+    long hits;
+    long misses;
+    long evictions;
+    size_t bytesUsed;
+    
+    ResultCache(size_t maxBytes, size_t minSubtreeNodes = 0);
+    Value* lookup(StructuralHash hash);
+    void insert(StructuralHash hash, Value* value);
+    size_t size();
+
+private:
+    
+    struct Entry {
+        StructuralHash hash;
+        Value* value;
+        size_t bytes;
+    };
+    
+    //most recently used first
+    list<Entry> entries;
+    unordered_map<StructuralHash, list<Entry>::iterator, StructuralHashHasher> index;
+    
+    void evictLeastRecentlyUsed();
+};
+
+/*
+ Interprets `parsedExpression` through `cache`, returning a cached value when an equal expression has been evaluated before.  With a `subtreeThreshold`, the `+`, `*` and `_let` nodes of large subtrees are evaluated through the cache too, so expressions that only share parts benefit.  Errors are never cached.
+ */
+Value *interpret(Expression* parsedExpression, ResultCache* cache);
+
+#endif /* cache_hpp */
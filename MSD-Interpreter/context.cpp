@@ -0,0 +1,112 @@
+//
+//  context.cpp
+//  ParserImproved
+//
+//  Copyright © 2020 MSD Katie Rose. All rights reserved.
+//
+
+#include "context.hpp"
+
+thread_local EvaluationContext* EvaluationContext::installed = nullptr;
+
+EvaluationContext::EvaluationContext() {
+    
+    this->lazyLet = false;
+    this->lazyBindings = 0;
+    this->lazyBindingsForced = 0;
+    this->memoizeCalls = false;
+    this->memoCapacity = 4096;
+    this->memoHits = 0;
+    this->memoMisses = 0;
+    this->memoEvictions = 0;
+    this->memoTable = nullptr;
+    this->specializeNodes = false;
+    this->specializations = 0;
+    this->deoptimizations = 0;
+    this->stepBudget = 0;
+    this->byteBudget = 0;
+    this->steps = 0;
+    this->bytesAllocated = 0;
+    this->allocations = 0;
+    this->cancelled = false;
+}
+
+long EvaluationContext::unforcedBindings() {
+    
+    return this->lazyBindings - this->lazyBindingsForced;
+}
+
+double EvaluationContext::memoHitRate() {
+    
+    long calls = this->memoHits + this->memoMisses;
+    return calls == 0 ? 0 : (double)this->memoHits / calls;
+}
+
+void EvaluationContext::cancel() {
+    
+    this->cancelled.store(true, memory_order_relaxed);
+}
+
+/*
+ Cancellation is checked every this many steps
+ */
+static const long CANCELLATION_INTERVAL = 1024;
+
+void EvaluationContext::takeStep() {
+    
+    long taken = this->steps.fetch_add(1, memory_order_relaxed) + 1;
+    if (this->stepBudget != 0 && taken > this->stepBudget) {
+        
+        throw EvaluationLimitError(EvaluationLimitError::STEP_BUDGET, "step budget of " + to_string(this->stepBudget) + " exceeded", taken, this->bytesAllocated);
+    }
+    if (taken % CANCELLATION_INTERVAL == 0 && this->cancelled.load(memory_order_relaxed)) {
+        
+        throw EvaluationLimitError(EvaluationLimitError::CANCELLED, "evaluation cancelled", taken, this->bytesAllocated);
+    }
+}
+
+void EvaluationContext::takeSteps(long count) {
+    
+    long taken = this->steps.fetch_add(count, memory_order_relaxed) + count;
+    if (this->stepBudget != 0 && taken > this->stepBudget) {
+        
+        throw EvaluationLimitError(EvaluationLimitError::STEP_BUDGET, "step budget of " + to_string(this->stepBudget) + " exceeded", taken, this->bytesAllocated);
+    }
+    if (taken / CANCELLATION_INTERVAL != (taken - count) / CANCELLATION_INTERVAL && this->cancelled.load(memory_order_relaxed)) {
+        
+        throw EvaluationLimitError(EvaluationLimitError::CANCELLED, "evaluation cancelled", taken, this->bytesAllocated);
+    }
+}
+
+void EvaluationContext::allocate(size_t bytes) {
+    
+    size_t allocated = this->bytesAllocated.fetch_add(bytes, memory_order_relaxed) + bytes;
+    this->allocations.fetch_add(1, memory_order_relaxed);
+    if (this->byteBudget != 0 && allocated > this->byteBudget) {
+        
+        throw EvaluationLimitError(EvaluationLimitError::BYTE_BUDGET, "byte budget of " + to_string(this->byteBudget) + " exceeded", this->steps, allocated);
+    }
+}
+
+EvaluationContext* EvaluationContext::current() {
+    
+    return installed;
+}
+
+EvaluationScope::EvaluationScope(EvaluationContext* context) {
+    
+    this->previous = EvaluationContext::installed;
+    EvaluationContext::installed = context;
+}
+
+EvaluationScope::~EvaluationScope() {
+    
+    EvaluationContext::installed = this->previous;
+}
+
+EvaluationLimitError::EvaluationLimitError(Kind limitKind, string message, long stepsTaken, size_t bytes) : runtime_error(message) {
+    
+    this->kind = limitKind;
+    this->steps = stepsTaken;
+    this->bytesAllocated = bytes;
+}
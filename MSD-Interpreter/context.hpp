@@ -0,0 +1,126 @@
+//
+//  context.hpp
+//  ParserImproved
+//
+//  Copyright © 2020 MSD Katie Rose. All rights reserved.
+//
+
+#ifndef context_hpp
+#define context_hpp
+
+#include <stdio.h>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+class MemoTable;
+
+/*
+ EvaluationContext holds the options and statistics for the evaluations running on one thread, or on the threads of an `evaluateParallel()`.  `evaluate()` takes no arguments, so the context in use is installed per thread with an EvaluationScope, and evaluation reads it through `EvaluationContext::current()`.  With no context installed, evaluation behaves exactly as before.  The counters are atomic and the memo tables are guarded by `memoLock`, so several threads can share a context.
+ */
+class EvaluationContext {
+public:
+    
+    //bind `_let` variables to thunks that are evaluated on first use instead of evaluating them up front
+    bool lazyLet;
+    
+    atomic<long> lazyBindings;
+    atomic<long> lazyBindingsForced;
+    
+    //remember the results of function calls, at most `memoCapacity` of them in all, and reuse them for calls with equal arguments (see MemoTable)
+    bool memoizeCalls;
+    size_t memoCapacity;
+    atomic<long> memoHits;
+    atomic<long> memoMisses;
+    atomic<long> memoEvictions;
+    //made by the first memoized call, and guarded by `memoLock`
+    MemoTable* memoTable;
+    mutex memoLock;
+    
+    //let `+` and `*` nodes rewrite themselves for the kinds of values they see (see feedback.hpp)
+    bool specializeNodes;
+    atomic<long> specializations;
+    atomic<long> deoptimizations;
+    
+    //limits on the work done by `evaluate()` and `substitute()`, where 0 means unlimited
+    long stepBudget;
+    size_t byteBudget;
+    atomic<long> steps;
+    atomic<size_t> bytesAllocated;
+    atomic<long> allocations;
+    
+    EvaluationContext();
+    long unforcedBindings();
+    
+    //the fraction of memoizable calls answered from a memo table, or 0 before there were any
+    double memoHitRate();
+    
+    //may be called from any thread; evaluation stops at the next cancellation check
+    void cancel();
+    
+    static EvaluationContext* current();
+    
+    /*
+     Called for every compound node evaluated or substituted, and for every Expression or Value allocated.  Each is a single test of the thread's context when none is installed.  countStep() returns the context, so a caller that needs its options as well does not look it up again.
+     */
+    static inline EvaluationContext* countStep() {
+        if (installed != nullptr) {
+            installed->takeStep();
+        }
+        return installed;
+    }
+    //for evaluators that count their steps themselves and charge them at once
+    static inline void countSteps(long count) {
+        if (installed != nullptr) {
+            installed->takeSteps(count);
+        }
+    }
+    static inline void countBytes(size_t bytes) {
+        if (installed != nullptr) {
+            installed->allocate(bytes);
+        }
+    }
+    
+private:
+    
+    friend class EvaluationScope;
+    static thread_local EvaluationContext* installed;
+    atomic<bool> cancelled;
+    
+    void takeStep();
+    void takeSteps(long count);
+    void allocate(size_t bytes);
+};
+
+/*
+ Thrown when an evaluation runs past one of its context's limits or is cancelled
+ */
+class EvaluationLimitError : public runtime_error {
+public:
+    
+    enum Kind { STEP_BUDGET, BYTE_BUDGET, CANCELLED };
+    
+    Kind kind;
+    long steps;
+    size_t bytesAllocated;
+    EvaluationLimitError(Kind limitKind, string message, long stepsTaken, size_t bytes);
+};
+
+/*
+ Installs a context on the current thread for as long as the scope lives, restoring the previous one afterwards
+ */
+class EvaluationScope {
+public:
+    
+    EvaluationScope(EvaluationContext* context);
+    ~EvaluationScope();
+    
+private:
+    
+    EvaluationContext* previous;
+};
+
+#endif /* context_hpp */
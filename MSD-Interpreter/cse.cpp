@@ -0,0 +1,630 @@
+//
+//  cse.cpp
+//  ParserImproved
+//
+//  Copyright © 2020 MSD Katie Rose. All rights reserved.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <unordered_map>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <vector>
+#include "cse.hpp"
+#include "context.hpp"
+#include "parser.hpp"
+#include "catch.hpp"
+
+CSEStats::CSEStats() {
+    
+    this->hoisted = 0;
+    this->occurrencesReplaced = 0;
+    this->nodesBefore = 0;
+    this->nodesAfter = 0;
+}
+
+/*
+ The state of one run of the pass.  Nodes that are not rebuilt keep their pointers from one round to the next, so their free variables are only computed once.
+ */
+struct CSEPass {
+    
+    /*
+     One class of structurally equal subtrees.  Positions are preorder indices in which a node takes up `nodeCount()` positions, so the positions of a subtree are contiguous.
+     */
+    struct Occurrences {
+        Expression* representative;
+        size_t count;
+        size_t first;
+        size_t last;
+    };
+    
+    unordered_map<Expression*, set<string>> free;
+    unordered_map<size_t, vector<Occurrences>> table;
+    map<string, int> bound;
+    long binders;
+    
+    CSEPass() {
+        
+        this->binders = 0;
+    }
+    
+    const set<string> &freeIn(Expression* expr) {
+        
+        auto found = free.find(expr);
+        if (found != free.end()) {
+            
+            return found->second;
+        }
+        set<string> variables;
+        if (Variable* variable = dynamic_cast<Variable*>(expr)) {
+            
+            variables.insert(variable->name);
+        } else if (Add* add = dynamic_cast<Add*>(expr)) {
+            
+            variables = freeIn(add->leftHandSide);
+            const set<string> &right = freeIn(add->rightHandSide);
+            variables.insert(right.begin(), right.end());
+        } else if (Multiply* multiply = dynamic_cast<Multiply*>(expr)) {
+            
+            variables = freeIn(multiply->leftHandSide);
+            const set<string> &right = freeIn(multiply->rightHandSide);
+            variables.insert(right.begin(), right.end());
+        } else if (LetExpression* let = dynamic_cast<LetExpression*>(expr)) {
+            
+            variables = freeIn(let->subBody);
+            variables.erase(let->subVariable->name);
+            const set<string> &value = freeIn(let->subExpression);
+            variables.insert(value.begin(), value.end());
+        } else if (EqualsExpression* comparison = dynamic_cast<EqualsExpression*>(expr)) {
+            
+            variables = freeIn(comparison->leftHandSide);
+            const set<string> &right = freeIn(comparison->rightHandSide);
+            variables.insert(right.begin(), right.end());
+        } else if (IfExpression* conditional = dynamic_cast<IfExpression*>(expr)) {
+            
+            variables = freeIn(conditional->test);
+            for (Expression* branch : { conditional->thenBranch, conditional->elseBranch }) {
+                
+                const set<string> &inBranch = freeIn(branch);
+                variables.insert(inBranch.begin(), inBranch.end());
+            }
+        } else if (FunExpression* function = dynamic_cast<FunExpression*>(expr)) {
+            
+            variables = freeIn(function->body);
+            variables.erase(function->formalArgument->name);
+        } else if (CallExpression* call = dynamic_cast<CallExpression*>(expr)) {
+            
+            variables = freeIn(call->toBeCalled);
+            const set<string> &argument = freeIn(call->actualArgument);
+            variables.insert(argument.begin(), argument.end());
+        }
+        return free[expr] = variables;
+    }
+    
+    //true if a `_let` around the current position binds one of the variables of `expr`
+    bool captured(Expression* expr) {
+        
+        if (binders == 0) {
+            
+            return false;
+        }
+        for (const string &name : freeIn(expr)) {
+            
+            auto binding = bound.find(name);
+            if (binding != bound.end() && binding->second > 0) {
+                
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    void count(Expression* expr, size_t position) {
+        
+        if (expr->nodeCount() >= CSE_MIN_NODES && !captured(expr)) {
+            
+            vector<Occurrences> &bucket = table[expr->structuralHash().low];
+            bool found = false;
+            for (Occurrences &occurrences : bucket) {
+                
+                if (occurrences.representative == expr || occurrences.representative->equals(expr)) {
+                    
+                    occurrences.count++;
+                    occurrences.last = position;
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) {
+                
+                bucket.push_back({ expr, 1, position, position });
+            }
+        }
+        if (Add* add = dynamic_cast<Add*>(expr)) {
+            
+            count(add->leftHandSide, position + 1);
+            count(add->rightHandSide, position + 1 + add->leftHandSide->nodeCount());
+        } else if (Multiply* multiply = dynamic_cast<Multiply*>(expr)) {
+            
+            count(multiply->leftHandSide, position + 1);
+            count(multiply->rightHandSide, position + 1 + multiply->leftHandSide->nodeCount());
+        } else if (LetExpression* let = dynamic_cast<LetExpression*>(expr)) {
+            
+            count(let->subExpression, position + 2);
+            bound[let->subVariable->name]++;
+            binders++;
+            count(let->subBody, position + 2 + let->subExpression->nodeCount());
+            bound[let->subVariable->name]--;
+            binders--;
+        } else if (EqualsExpression* comparison = dynamic_cast<EqualsExpression*>(expr)) {
+            
+            count(comparison->leftHandSide, position + 1);
+            count(comparison->rightHandSide, position + 1 + comparison->leftHandSide->nodeCount());
+        } else if (IfExpression* conditional = dynamic_cast<IfExpression*>(expr)) {
+            
+            //only the test is always evaluated, and branches were handled on their own (see eliminateInBranches)
+            count(conditional->test, position + 1);
+        } else if (CallExpression* call = dynamic_cast<CallExpression*>(expr)) {
+            
+            //a function's body is a region of its own like a branch, so only the call itself is looked into
+            count(call->toBeCalled, position + 1);
+            count(call->actualArgument, position + 1 + call->toBeCalled->nodeCount());
+        }
+    }
+    
+    //the child of `expr` whose positions include all of `occurrences`, or nullptr if `expr` is the lowest node that does
+    static Expression* childContaining(Expression* expr, size_t &position, Occurrences &occurrences, bool &inBody) {
+        
+        Expression* children[2];
+        size_t starts[2];
+        int childCount = 2;
+        inBody = false;
+        if (Add* add = dynamic_cast<Add*>(expr)) {
+            
+            children[0] = add->leftHandSide;
+            children[1] = add->rightHandSide;
+            starts[0] = position + 1;
+        } else if (Multiply* multiply = dynamic_cast<Multiply*>(expr)) {
+            
+            children[0] = multiply->leftHandSide;
+            children[1] = multiply->rightHandSide;
+            starts[0] = position + 1;
+        } else if (LetExpression* let = dynamic_cast<LetExpression*>(expr)) {
+            
+            children[0] = let->subExpression;
+            children[1] = let->subBody;
+            starts[0] = position + 2;
+        } else if (EqualsExpression* comparison = dynamic_cast<EqualsExpression*>(expr)) {
+            
+            children[0] = comparison->leftHandSide;
+            children[1] = comparison->rightHandSide;
+            starts[0] = position + 1;
+        } else if (IfExpression* conditional = dynamic_cast<IfExpression*>(expr)) {
+            
+            children[0] = conditional->test;
+            starts[0] = position + 1;
+            childCount = 1;
+        } else if (CallExpression* call = dynamic_cast<CallExpression*>(expr)) {
+            
+            children[0] = call->toBeCalled;
+            children[1] = call->actualArgument;
+            starts[0] = position + 1;
+        } else {
+            
+            return nullptr;
+        }
+        starts[1] = starts[0] + children[0]->nodeCount();
+        for (int i = 0; i < childCount; i++) {
+            
+            if (starts[i] <= occurrences.first && occurrences.last < starts[i] + children[i]->nodeCount()) {
+                
+                position = starts[i];
+                inBody = i == 1 && dynamic_cast<LetExpression*>(expr) != nullptr;
+                return children[i];
+            }
+        }
+        return nullptr;
+    }
+    
+    //the number of nodes in the lowest subtree of `expr` that contains all of `occurrences`
+    static size_t enclosingSize(Expression* expr, Occurrences &occurrences) {
+        
+        size_t position = 0;
+        bool inBody;
+        for (Expression* child = expr; child != nullptr; child = childContaining(expr, position, occurrences, inBody)) {
+            
+            expr = child;
+        }
+        return expr->nodeCount();
+    }
+    
+    //replaces `occurrences` by `variable`, bound by a `_let` around the lowest subtree that contains them all
+    Expression* hoist(Expression* expr, size_t position, Occurrences &occurrences, Variable* variable, long &replaced) {
+        
+        bool inBody;
+        size_t childPosition = position;
+        Expression* child = childContaining(expr, childPosition, occurrences, inBody);
+        if (child == nullptr) {
+            
+            Expression* target = occurrences.representative;
+            return new LetExpression(variable, target, replace(expr, target, variable, replaced));
+        }
+        if (inBody) {
+            
+            LetExpression* let = dynamic_cast<LetExpression*>(expr);
+            bound[let->subVariable->name]++;
+            binders++;
+            Expression* body = hoist(child, childPosition, occurrences, variable, replaced);
+            bound[let->subVariable->name]--;
+            binders--;
+            return new LetExpression(let->subVariable, let->subExpression, body);
+        }
+        bool left = childPosition == position + 1;
+        Expression* rebuilt = hoist(child, childPosition, occurrences, variable, replaced);
+        if (Add* add = dynamic_cast<Add*>(expr)) {
+            
+            return left ? new Add(rebuilt, add->rightHandSide) : new Add(add->leftHandSide, rebuilt);
+        } else if (Multiply* multiply = dynamic_cast<Multiply*>(expr)) {
+            
+            return left ? new Multiply(rebuilt, multiply->rightHandSide) : new Multiply(multiply->leftHandSide, rebuilt);
+        } else if (EqualsExpression* comparison = dynamic_cast<EqualsExpression*>(expr)) {
+            
+            return left ? new EqualsExpression(rebuilt, comparison->rightHandSide) : new EqualsExpression(comparison->leftHandSide, rebuilt);
+        } else if (IfExpression* conditional = dynamic_cast<IfExpression*>(expr)) {
+            
+            return new IfExpression(rebuilt, conditional->thenBranch, conditional->elseBranch);
+        } else if (CallExpression* call = dynamic_cast<CallExpression*>(expr)) {
+            
+            return left ? new CallExpression(rebuilt, call->actualArgument) : new CallExpression(call->toBeCalled, rebuilt);
+        }
+        LetExpression* let = dynamic_cast<LetExpression*>(expr);
+        return new LetExpression(let->subVariable, rebuilt, let->subBody);
+    }
+    
+    Expression* replace(Expression* expr, Expression* target, Variable* variable, long &replaced) {
+        
+        if (expr->nodeCount() == target->nodeCount() && expr->structuralHash() == target->structuralHash() && !captured(expr) && expr->equals(target)) {
+            
+            replaced++;
+            return variable;
+        }
+        if (expr->nodeCount() <= target->nodeCount()) {
+            
+            return expr;
+        }
+        if (Add* add = dynamic_cast<Add*>(expr)) {
+            
+            Expression* left = replace(add->leftHandSide, target, variable, replaced);
+            Expression* right = replace(add->rightHandSide, target, variable, replaced);
+            return left == add->leftHandSide && right == add->rightHandSide ? expr : new Add(left, right);
+        } else if (Multiply* multiply = dynamic_cast<Multiply*>(expr)) {
+            
+            Expression* left = replace(multiply->leftHandSide, target, variable, replaced);
+            Expression* right = replace(multiply->rightHandSide, target, variable, replaced);
+            return left == multiply->leftHandSide && right == multiply->rightHandSide ? expr : new Multiply(left, right);
+        } else if (LetExpression* let = dynamic_cast<LetExpression*>(expr)) {
+            
+            Expression* value = replace(let->subExpression, target, variable, replaced);
+            bound[let->subVariable->name]++;
+            binders++;
+            Expression* body = replace(let->subBody, target, variable, replaced);
+            bound[let->subVariable->name]--;
+            binders--;
+            return value == let->subExpression && body == let->subBody ? expr : new LetExpression(let->subVariable, value, body);
+        } else if (EqualsExpression* comparison = dynamic_cast<EqualsExpression*>(expr)) {
+            
+            Expression* left = replace(comparison->leftHandSide, target, variable, replaced);
+            Expression* right = replace(comparison->rightHandSide, target, variable, replaced);
+            return left == comparison->leftHandSide && right == comparison->rightHandSide ? expr : new EqualsExpression(left, right);
+        } else if (IfExpression* conditional = dynamic_cast<IfExpression*>(expr)) {
+            
+            Expression* test = replace(conditional->test, target, variable, replaced);
+            return test == conditional->test ? expr : new IfExpression(test, conditional->thenBranch, conditional->elseBranch);
+        } else if (CallExpression* call = dynamic_cast<CallExpression*>(expr)) {
+            
+            Expression* function = replace(call->toBeCalled, target, variable, replaced);
+            Expression* argument = replace(call->actualArgument, target, variable, replaced);
+            return function == call->toBeCalled && argument == call->actualArgument ? expr : new CallExpression(function, argument);
+        }
+        return expr;
+    }
+};
+
+static void collectNames(Expression* expr, set<string> &names) {
+    
+    if (Variable* variable = dynamic_cast<Variable*>(expr)) {
+        
+        names.insert(variable->name);
+    } else if (Add* add = dynamic_cast<Add*>(expr)) {
+        
+        collectNames(add->leftHandSide, names);
+        collectNames(add->rightHandSide, names);
+    } else if (Multiply* multiply = dynamic_cast<Multiply*>(expr)) {
+        
+        collectNames(multiply->leftHandSide, names);
+        collectNames(multiply->rightHandSide, names);
+    } else if (LetExpression* let = dynamic_cast<LetExpression*>(expr)) {
+        
+        names.insert(let->subVariable->name);
+        collectNames(let->subExpression, names);
+        collectNames(let->subBody, names);
+    } else if (EqualsExpression* comparison = dynamic_cast<EqualsExpression*>(expr)) {
+        
+        collectNames(comparison->leftHandSide, names);
+        collectNames(comparison->rightHandSide, names);
+    } else if (IfExpression* conditional = dynamic_cast<IfExpression*>(expr)) {
+        
+        collectNames(conditional->test, names);
+        collectNames(conditional->thenBranch, names);
+        collectNames(conditional->elseBranch, names);
+    } else if (FunExpression* function = dynamic_cast<FunExpression*>(expr)) {
+        
+        names.insert(function->formalArgument->name);
+        collectNames(function->body, names);
+    } else if (CallExpression* call = dynamic_cast<CallExpression*>(expr)) {
+        
+        collectNames(call->toBeCalled, names);
+        collectNames(call->actualArgument, names);
+    }
+}
+
+/*
+ Variables may only contain letters, so fresh names count in base 26: `csea`, `cseb`, ..., `cseaa`
+ */
+static string freshName(set<string> &names, long &counter) {
+    
+    while (true) {
+        
+        string suffix;
+        long n = counter++;
+        do {
+            
+            suffix.insert(suffix.begin(), (char)('a' + n % 26));
+            n = n / 26 - 1;
+        } while (n >= 0);
+        string name = "cse" + suffix;
+        if (names.insert(name).second) {
+            
+            return name;
+        }
+    }
+}
+
+static Expression* eliminate(Expression* expr, CSEStats &stats, set<string> &names, long &counter) {
+    
+    CSEPass pass;
+    while (true) {
+        
+        pass.table.clear();
+        pass.count(expr, 0);
+        
+        /*
+         Evaluating a `_let` substitutes its value through its whole body, so each binding goes around the lowest subtree that contains all of its occurrences, and is only made when the copies it removes are larger than that body.  This also means every round shrinks the tree.  The largest class that pays for itself is hoisted, the one seen first among equals.
+         */
+        vector<CSEPass::Occurrences*> candidates;
+        for (auto &bucket : pass.table) {
+            
+            for (CSEPass::Occurrences &occurrences : bucket.second) {
+                
+                size_t size = occurrences.representative->nodeCount();
+                if (occurrences.count > 1 && (occurrences.count - 1) * size > occurrences.count + 2) {
+                    
+                    candidates.push_back(&occurrences);
+                }
+            }
+        }
+        sort(candidates.begin(), candidates.end(), [](CSEPass::Occurrences* a, CSEPass::Occurrences* b) {
+            size_t aSize = a->representative->nodeCount();
+            size_t bSize = b->representative->nodeCount();
+            return aSize != bSize ? aSize > bSize : a->first < b->first;
+        });
+        CSEPass::Occurrences* best = nullptr;
+        for (CSEPass::Occurrences* occurrences : candidates) {
+            
+            size_t size = occurrences->representative->nodeCount();
+            size_t body = CSEPass::enclosingSize(expr, *occurrences) - occurrences->count * (size - 1);
+            if ((occurrences->count - 1) * size > body + 2) {
+                
+                best = occurrences;
+                break;
+            }
+        }
+        if (best == nullptr) {
+            
+            break;
+        }
+        Variable* variable = new Variable(freshName(names, counter));
+        long replaced = 0;
+        expr = pass.hoist(expr, 0, *best, variable, replaced);
+        stats.hoisted++;
+        stats.occurrencesReplaced += replaced;
+    }
+    return expr;
+}
+
+/*
+ A `_let` hoisted above an `_if` would evaluate what only one branch needs, so each branch is its own region: repeats within it are hoisted inside it, and the enclosing pass does not look into it.  A function's body is a region for the same reason, and because its formal argument is only bound when it is called.
+ */
+static Expression* eliminateInBranches(Expression* expr, CSEStats &stats, set<string> &names, long &counter) {
+    
+    if (Add* add = dynamic_cast<Add*>(expr)) {
+        
+        Expression* left = eliminateInBranches(add->leftHandSide, stats, names, counter);
+        Expression* right = eliminateInBranches(add->rightHandSide, stats, names, counter);
+        return left == add->leftHandSide && right == add->rightHandSide ? expr : new Add(left, right);
+    } else if (Multiply* multiply = dynamic_cast<Multiply*>(expr)) {
+        
+        Expression* left = eliminateInBranches(multiply->leftHandSide, stats, names, counter);
+        Expression* right = eliminateInBranches(multiply->rightHandSide, stats, names, counter);
+        return left == multiply->leftHandSide && right == multiply->rightHandSide ? expr : new Multiply(left, right);
+    } else if (LetExpression* let = dynamic_cast<LetExpression*>(expr)) {
+        
+        Expression* value = eliminateInBranches(let->subExpression, stats, names, counter);
+        Expression* body = eliminateInBranches(let->subBody, stats, names, counter);
+        return value == let->subExpression && body == let->subBody ? expr : new LetExpression(let->subVariable, value, body);
+    } else if (EqualsExpression* comparison = dynamic_cast<EqualsExpression*>(expr)) {
+        
+        Expression* left = eliminateInBranches(comparison->leftHandSide, stats, names, counter);
+        Expression* right = eliminateInBranches(comparison->rightHandSide, stats, names, counter);
+        return left == comparison->leftHandSide && right == comparison->rightHandSide ? expr : new EqualsExpression(left, right);
+    } else if (IfExpression* conditional = dynamic_cast<IfExpression*>(expr)) {
+        
+        Expression* test = eliminateInBranches(conditional->test, stats, names, counter);
+        Expression* thenBranch = eliminate(eliminateInBranches(conditional->thenBranch, stats, names, counter), stats, names, counter);
+        Expression* elseBranch = eliminate(eliminateInBranches(conditional->elseBranch, stats, names, counter), stats, names, counter);
+        if (test == conditional->test && thenBranch == conditional->thenBranch && elseBranch == conditional->elseBranch) {
+            
+            return expr;
+        }
+        return new IfExpression(test, thenBranch, elseBranch);
+    } else if (FunExpression* function = dynamic_cast<FunExpression*>(expr)) {
+        
+        Expression* body = eliminate(eliminateInBranches(function->body, stats, names, counter), stats, names, counter);
+        return body == function->body ? expr : new FunExpression(function->formalArgument, body);
+    } else if (CallExpression* call = dynamic_cast<CallExpression*>(expr)) {
+        
+        Expression* callee = eliminateInBranches(call->toBeCalled, stats, names, counter);
+        Expression* argument = eliminateInBranches(call->actualArgument, stats, names, counter);
+        return callee == call->toBeCalled && argument == call->actualArgument ? expr : new CallExpression(callee, argument);
+    }
+    return expr;
+}
+
+Expression* eliminateCommonSubexpressions(Expression* expr, CSEStats &stats) {
+    
+    stats.nodesBefore = expr->nodeCount();
+    set<string> names;
+    collectNames(expr, names);
+    long counter = 0;
+    expr = eliminateInBranches(expr, stats, names, counter);
+    expr = eliminate(expr, stats, names, counter);
+    stats.nodesAfter = expr->nodeCount();
+    return expr;
+}
+
+/* for tests */
+static Expression *parse_str(string s) {
+    std::istringstream in(s);
+    return parse(in);
+}
+
+static long stepsToEvaluate(Expression* expr, Value* &result) {
+    
+    EvaluationContext context;
+    EvaluationScope scope(&context);
+    result = expr->evaluate();
+    return context.steps;
+}
+
+TEST_CASE( "eliminateCommonSubexpressions" ) {
+    
+    CSEStats stats;
+    Expression* cube = eliminateCommonSubexpressions(parse_str("(a * b + c) * (a * b + c) * (a * b + c)"), stats);
+    CHECK( cube->equals(parse_str("_let csea = a * b + c _in csea * csea * csea")) );
+    CHECK( stats.hoisted == 1 );
+    CHECK( stats.occurrencesReplaced == 3 );
+    
+    //substituting `csea` through `csea * csea` costs as much as the copy it saves
+    stats = CSEStats();
+    CHECK( eliminateCommonSubexpressions(parse_str("(a * b + c) * (a * b + c)"), stats)->equals(parse_str("(a * b + c) * (a * b + c)")) );
+    CHECK( stats.hoisted == 0 );
+    
+    //a repeat inside a hoisted value is found on the next round
+    stats = CSEStats();
+    string inner = "(x * y + z * w)";
+    string outer = "(" + inner + " * " + inner + " * " + inner + " + 1)";
+    Expression* nested = eliminateCommonSubexpressions(parse_str(outer + " * " + outer + " * " + outer), stats);
+    CHECK( nested->equals(parse_str("_let csea = (_let cseb = x * y + z * w _in cseb * cseb * cseb) + 1 _in csea * csea * csea")) );
+    CHECK( stats.hoisted == 2 );
+    CHECK( stats.nodesAfter < stats.nodesBefore );
+    
+    //`x * x * x + 1` under the `_let` is a different value from the outer ones
+    stats = CSEStats();
+    Expression* shadowed = eliminateCommonSubexpressions(parse_str("(x * x * x + 1) * (x * x * x + 1) * (x * x * x + 1) * (x * x * x + 1) + (_let x = 2 _in x * x * x + 1)"), stats);
+    CHECK( shadowed->equals(parse_str("(_let csea = x * x * x + 1 _in csea * csea * csea * csea) + (_let x = 2 _in x * x * x + 1)")) );
+    
+    //fresh names avoid the names already in use, and bindings go around the smallest subtree that needs them
+    stats = CSEStats();
+    Expression* named = eliminateCommonSubexpressions(parse_str("_let csea = 4 _in csea + (q * q * q + 1) * (q * q * q + 1) * (q * q * q + 1)"), stats);
+    CHECK( named->equals(parse_str("_let csea = 4 _in csea + (_let cseb = q * q * q + 1 _in cseb * cseb * cseb)")) );
+    
+    Value* before;
+    Value* after;
+    Expression* original = parse_str(outer + " * " + outer + " * " + outer);
+    Expression* eliminated = eliminateCommonSubexpressions(original, stats);
+    for (char name : {'x', 'y', 'z', 'w'}) {
+        original = original->substitute(string(1, name), new NumericValue(name - 'w' + 1));
+        eliminated = eliminated->substitute(string(1, name), new NumericValue(name - 'w' + 1));
+    }
+    CHECK( stepsToEvaluate(eliminated, after) < stepsToEvaluate(original, before) );
+    CHECK( before->equals(after) );
+    
+    //repeats within a branch stay in it, and repeats across branches are not hoisted above the `_if`
+    stats = CSEStats();
+    string repeated = "(a * b + c) * (a * b + c) * (a * b + c)";
+    CHECK( eliminateCommonSubexpressions(parse_str("_if p == 1 _then " + repeated + " _else 0"), stats)->equals(parse_str("_if p == 1 _then (_let csea = a * b + c _in csea * csea * csea) _else 0")) );
+    CHECK( stats.hoisted == 1 );
+    stats = CSEStats();
+    string branches = "(_if p == 1 _then (a * b + c) * 2 _else (a * b + c) * 3)";
+    CHECK( eliminateCommonSubexpressions(parse_str(branches + " + " + branches), stats)->equals(parse_str("_let csea = " + branches + " _in csea + csea")) );
+    
+    //repeats in a function body are hoisted inside it, where they may use its argument
+    stats = CSEStats();
+    string cubed = "(n * n + 1) * (n * n + 1) * (n * n + 1)";
+    CHECK( eliminateCommonSubexpressions(parse_str("_fun (n) " + cubed), stats)->equals(parse_str("_fun (n) _let csea = n * n + 1 _in csea * csea * csea")) );
+    stats = CSEStats();
+    CHECK( eliminateCommonSubexpressions(parse_str("f(a * b + c) + f(a * b + c) + f(a * b + c)"), stats)->equals(parse_str("_let csea = f(a * b + c) _in csea + csea + csea")) );
+}
+
+/*
+ A corpus of generated expressions like the ones that motivated the pass.  Each level combines pairs of expressions from the level below, so the printed tree doubles in size with every level while only `width` subtrees per level are distinct.
+ */
+static string generatedExpression(int levels, int width, unsigned &seed) {
+    
+    vector<string> level;
+    for (int i = 0; i < width; i++) {
+        
+        level.push_back(string(1, (char)('a' + i % 6)));
+    }
+    for (int depth = 0; depth < levels; depth++) {
+        
+        vector<string> next;
+        for (int i = 0; i < width; i++) {
+            
+            seed = seed * 1103515245 + 12345;
+            string left = level[(seed >> 16) % width];
+            string right = level[(seed >> 8) % width];
+            next.push_back("(" + left + ((seed >> 24) % 2 == 0 ? " + " : " * ") + right + ")");
+        }
+        level = next;
+    }
+    return level[0];
+}
+
+TEST_CASE( "eliminateCommonSubexpressions benchmark", "[.benchmark]" ) {
+    
+    unsigned seed = 37;
+    for (int levels : {8, 11, 14}) {
+        
+        Expression* original = parse_str(generatedExpression(levels, 4, seed));
+        CSEStats stats;
+        auto start = std::chrono::steady_clock::now();
+        Expression* eliminated = eliminateCommonSubexpressions(original, stats);
+        double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        
+        for (char name = 'a'; name <= 'f'; name++) {
+            original = original->substitute(string(1, name), new NumericValue(1));
+            eliminated = eliminated->substitute(string(1, name), new NumericValue(1));
+        }
+        Value* before;
+        Value* after;
+        long stepsBefore = stepsToEvaluate(original, before);
+        long stepsAfter = stepsToEvaluate(eliminated, after);
+        CHECK( before->equals(after) );
+        cout << levels << " levels: " << stats.hoisted << " bindings, " << stats.nodesBefore << " nodes -> " << stats.nodesAfter << " nodes in " << milliseconds
+             << " ms; evaluation visits " << stepsBefore << " nodes -> " << stepsAfter << " (" << 100.0 * (stepsBefore - stepsAfter) / stepsBefore << "% saved)\n";
+    }
+}
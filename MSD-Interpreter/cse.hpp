@@ -0,0 +1,38 @@
+//
+//  cse.hpp
+//  ParserImproved
+//
+//  Copyright © 2020 MSD Katie Rose. All rights reserved.
+//
+
+#ifndef cse_hpp
+#define cse_hpp
+
+#include <stdio.h>
+#include <string>
+#include "expression.hpp"
+
+using namespace std;
+
+/*
+ Repeated subtrees with fewer nodes than this, according to `nodeCount()`, are left in place.  Larger ones are hoisted only when the copies removed outweigh the `_let`, which costs a step and a substitution through its body.
+ */
+const size_t CSE_MIN_NODES = 3;
+
+/*
+ Counts what eliminateCommonSubexpressions() did
+ */
+struct CSEStats {
+    long hoisted;
+    long occurrencesReplaced;
+    size_t nodesBefore;
+    size_t nodesAfter;
+    CSEStats();
+};
+
+/*
+ Finds subtrees of at least CSE_MIN_NODES nodes that occur more than once, grouping them by `structuralHash()`, and hoists each into a `_let` with a fresh variable, so it is evaluated once.  The `_let` goes around the smallest subtree that contains every occurrence.  Since evaluating a `_let` substitutes through its body, this pays off for large repeats, like those of generated code, and small ones are left in place.  Larger subtrees are hoisted first, and the smaller repeats inside them are then found in the hoisted values.  Occurrences under a `_let` that binds one of their variables are a different value and are left alone, and repeats inside an `_if` branch are only hoisted within that branch, so that the untaken branch stays unevaluated.
+ */
+Expression* eliminateCommonSubexpressions(Expression* expr, CSEStats &stats);
+
+#endif /* cse_hpp */
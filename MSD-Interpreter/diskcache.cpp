@@ -0,0 +1,535 @@
+//
+//  diskcache.cpp
+//  ParserImproved
+//
+//  Copyright © 2020 MSD Katie Rose. All rights reserved.
+//
+
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include "diskcache.hpp"
+#include "interpreter.hpp"
+#include "parser.hpp"
+#include "catch.hpp"
+
+static void writeVarint(uint64_t integer, string &out) {
+    
+    while (integer >= 0x80) {
+        
+        out.push_back((char)(integer | 0x80));
+        integer >>= 7;
+    }
+    out.push_back((char)integer);
+}
+
+static uint64_t readVarint(const uint8_t* &data, const uint8_t* end) {
+    
+    uint64_t integer = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        
+        if (data == end) {
+            
+            throw runtime_error("truncated compiled expression");
+        }
+        uint8_t byte = *data++;
+        integer |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            
+            return integer;
+        }
+    }
+    throw runtime_error("malformed varint in compiled expression");
+}
+
+static void writeString(const string &text, string &out) {
+    
+    writeVarint(text.size(), out);
+    out += text;
+}
+
+static string readString(const uint8_t* &data, const uint8_t* end) {
+    
+    uint64_t length = readVarint(data, end);
+    if (length > (uint64_t)(end - data)) {
+        
+        throw runtime_error("truncated compiled expression");
+    }
+    string text((const char*)data, length);
+    data += length;
+    return text;
+}
+
+void serializeExpression(Expression* expr, string &out) {
+    
+    if (Number* number = dynamic_cast<Number*>(expr)) {
+        
+        out.push_back('n');
+        int64_t value = number->value;
+        writeVarint(((uint64_t)value << 1) ^ (uint64_t)(value >> 63), out);
+    } else if (BigNumber* big = dynamic_cast<BigNumber*>(expr)) {
+        
+        out.push_back('g');
+        out.push_back(big->value->negative ? 1 : 0);
+        writeVarint(big->value->limbs.size(), out);
+        for (uint32_t limb : big->value->limbs) {
+            
+            writeVarint(limb, out);
+        }
+    } else if (BoolExpression* boolean = dynamic_cast<BoolExpression*>(expr)) {
+        
+        out.push_back(boolean->boolean ? 't' : 'f');
+    } else if (Variable* variable = dynamic_cast<Variable*>(expr)) {
+        
+        out.push_back('v');
+        writeString(variable->name, out);
+    } else if (Add* add = dynamic_cast<Add*>(expr)) {
+        
+        out.push_back('+');
+        serializeExpression(add->leftHandSide, out);
+        serializeExpression(add->rightHandSide, out);
+    } else if (Multiply* multiply = dynamic_cast<Multiply*>(expr)) {
+        
+        out.push_back('*');
+        serializeExpression(multiply->leftHandSide, out);
+        serializeExpression(multiply->rightHandSide, out);
+    } else if (LetExpression* let = dynamic_cast<LetExpression*>(expr)) {
+        
+        out.push_back('l');
+        writeString(let->subVariable->name, out);
+        serializeExpression(let->subExpression, out);
+        serializeExpression(let->subBody, out);
+    } else if (EqualsExpression* comparison = dynamic_cast<EqualsExpression*>(expr)) {
+        
+        out.push_back('=');
+        serializeExpression(comparison->leftHandSide, out);
+        serializeExpression(comparison->rightHandSide, out);
+    } else if (IfExpression* conditional = dynamic_cast<IfExpression*>(expr)) {
+        
+        out.push_back('?');
+        serializeExpression(conditional->test, out);
+        serializeExpression(conditional->thenBranch, out);
+        serializeExpression(conditional->elseBranch, out);
+    } else if (FunExpression* function = dynamic_cast<FunExpression*>(expr)) {
+        
+        out.push_back('F');
+        writeString(function->formalArgument->name, out);
+        serializeExpression(function->body, out);
+    } else if (CallExpression* call = dynamic_cast<CallExpression*>(expr)) {
+        
+        out.push_back('C');
+        serializeExpression(call->toBeCalled, out);
+        serializeExpression(call->actualArgument, out);
+    } else {
+        
+        throw runtime_error("cannot serialize " + expr->toString());
+    }
+}
+
+Expression* deserializeExpression(const uint8_t* &data, const uint8_t* end) {
+    
+    if (data == end) {
+        
+        throw runtime_error("truncated compiled expression");
+    }
+    char tag = (char)*data++;
+    if (tag == 'n') {
+        
+        uint64_t zigzag = readVarint(data, end);
+        return new Number((int)(int64_t)((zigzag >> 1) ^ (~(zigzag & 1) + 1)));
+    } else if (tag == 'g') {
+        
+        if (data == end) {
+            
+            throw runtime_error("truncated compiled expression");
+        }
+        bool negative = *data++ != 0;
+        uint64_t count = readVarint(data, end);
+        if (count > (uint64_t)(end - data)) {
+            
+            throw runtime_error("truncated compiled expression");
+        }
+        vector<uint32_t> limbs;
+        for (uint64_t i = 0; i < count; i++) {
+            
+            limbs.push_back((uint32_t)readVarint(data, end));
+        }
+        return new BigNumber(new BigIntValue(negative, limbs));
+    } else if (tag == 't' || tag == 'f') {
+        
+        return new BoolExpression(tag == 't');
+    } else if (tag == 'v') {
+        
+        return new Variable(readString(data, end));
+    } else if (tag == '+') {
+        
+        Expression* lhs = deserializeExpression(data, end);
+        return new Add(lhs, deserializeExpression(data, end));
+    } else if (tag == '*') {
+        
+        Expression* lhs = deserializeExpression(data, end);
+        return new Multiply(lhs, deserializeExpression(data, end));
+    } else if (tag == 'l') {
+        
+        Variable* variable = new Variable(readString(data, end));
+        Expression* value = deserializeExpression(data, end);
+        return new LetExpression(variable, value, deserializeExpression(data, end));
+    } else if (tag == '=') {
+        
+        Expression* lhs = deserializeExpression(data, end);
+        return new EqualsExpression(lhs, deserializeExpression(data, end));
+    } else if (tag == '?') {
+        
+        Expression* test = deserializeExpression(data, end);
+        Expression* thenBranch = deserializeExpression(data, end);
+        return new IfExpression(test, thenBranch, deserializeExpression(data, end));
+    } else if (tag == 'F') {
+        
+        Variable* formal = new Variable(readString(data, end));
+        return new FunExpression(formal, deserializeExpression(data, end));
+    } else if (tag == 'C') {
+        
+        Expression* function = deserializeExpression(data, end);
+        return new CallExpression(function, deserializeExpression(data, end));
+    }
+    throw runtime_error("unknown tag in compiled expression");
+}
+
+CompiledExpressionCache::CompiledExpressionCache(string cacheDirectory, string passes) {
+    
+    this->directory = cacheDirectory;
+    this->pipeline = passes;
+    this->hits = 0;
+    this->misses = 0;
+    this->writes = 0;
+    this->failedWrites = 0;
+    //a directory that cannot be created is left to fail in load() and store(), which only makes every lookup a miss
+    mkdir(cacheDirectory.c_str(), 0755);
+}
+
+/*
+ Files are named by a 128-bit FNV-1a hash, computed twice with different offsets, of the pipeline and the source
+ */
+string CompiledExpressionCache::pathFor(const string &source) {
+    
+    uint64_t high = 0xcbf29ce484222325ULL;
+    uint64_t low = 0x84222325cbf29ce4ULL;
+    string key = this->pipeline + '\0' + source;
+    for (unsigned char character : key) {
+        
+        high = (high ^ character) * 0x100000001b3ULL;
+        low = (low ^ character) * 0x100000001b3ULL;
+        low ^= low >> 29;
+    }
+    char name[33];
+    snprintf(name, sizeof(name), "%016llx%016llx", (unsigned long long)high, (unsigned long long)low);
+    return this->directory + "/" + name + ".msdx";
+}
+
+Expression* CompiledExpressionCache::load(const string &source) {
+    
+    int file = open(pathFor(source).c_str(), O_RDONLY);
+    if (file < 0) {
+        
+        this->misses++;
+        return nullptr;
+    }
+    struct stat status;
+    void* mapped = MAP_FAILED;
+    if (fstat(file, &status) == 0 && status.st_size > 0) {
+        
+        mapped = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    }
+    close(file);
+    if (mapped == MAP_FAILED) {
+        
+        this->misses++;
+        return nullptr;
+    }
+    const uint8_t* data = (const uint8_t*)mapped;
+    const uint8_t* end = data + status.st_size;
+    Expression* expr = nullptr;
+    try {
+        
+        uint32_t version;
+        uint32_t optimizer;
+        if (end - data < (long)(sizeof(COMPILED_MAGIC) + sizeof(version) + sizeof(optimizer)) || memcmp(data, COMPILED_MAGIC, sizeof(COMPILED_MAGIC)) != 0) {
+            
+            throw runtime_error("not a compiled expression");
+        }
+        memcpy(&version, data + sizeof(COMPILED_MAGIC), sizeof(version));
+        memcpy(&optimizer, data + sizeof(COMPILED_MAGIC) + sizeof(version), sizeof(optimizer));
+        data += sizeof(COMPILED_MAGIC) + sizeof(version) + sizeof(optimizer);
+        if (version == COMPILED_FORMAT_VERSION && optimizer == OPTIMIZER_VERSION && readString(data, end) == source) {
+            
+            expr = deserializeExpression(data, end);
+        }
+    } catch (runtime_error &) {
+        
+        //unreadable entries are misses, and are replaced by the next store()
+        expr = nullptr;
+    }
+    munmap(mapped, status.st_size);
+    if (expr == nullptr) {
+        
+        this->misses++;
+    } else {
+        
+        this->hits++;
+    }
+    return expr;
+}
+
+bool CompiledExpressionCache::store(const string &source, Expression* optimized) {
+    
+    string contents(COMPILED_MAGIC, sizeof(COMPILED_MAGIC));
+    uint32_t version = COMPILED_FORMAT_VERSION;
+    contents.append((const char*)&version, sizeof(version));
+    uint32_t optimizer = OPTIMIZER_VERSION;
+    contents.append((const char*)&optimizer, sizeof(optimizer));
+    writeString(source, contents);
+    try {
+        
+        serializeExpression(optimized, contents);
+    } catch (runtime_error &) {
+        
+        this->failedWrites++;
+        return false;
+    }
+    
+    //written to a temporary file first, so that a concurrent load never sees half an entry
+    string path = pathFor(source);
+    string temporary = path + ".tmp" + to_string(getpid());
+    std::ofstream out(temporary, std::ios::binary);
+    out.write(contents.data(), contents.size());
+    out.close();
+    if (!out || rename(temporary.c_str(), path.c_str()) != 0) {
+        
+        remove(temporary.c_str());
+        this->failedWrites++;
+        return false;
+    }
+    this->writes++;
+    return true;
+}
+
+Expression* CompiledExpressionCache::compile(const string &source) {
+    
+    Expression* expr = load(source);
+    if (expr != nullptr) {
+        
+        return expr;
+    }
+    std::istringstream in(source);
+    expr = parse(in);
+    if (this->pipeline.empty()) {
+        
+        expr = optimize(expr);
+    } else {
+        
+        PassManager passes(this->pipeline);
+        expr = optimize(expr, passes);
+    }
+    //an entry that cannot be written is a miss next time too, which is no reason not to run
+    store(source, expr);
+    return expr;
+}
+
+/* for tests */
+static Expression *parse_str(string s) {
+    std::istringstream in(s);
+    return parse(in);
+}
+
+static string temporaryDirectory() {
+    
+    char pattern[] = "/tmp/msdxXXXXXX";
+    return mkdtemp(pattern);
+}
+
+static void removeDirectory(string directory) {
+    
+    DIR* listing = opendir(directory.c_str());
+    if (listing != nullptr) {
+        
+        while (dirent* entry = readdir(listing)) {
+            
+            string name = entry->d_name;
+            if (name != "." && name != "..") {
+                
+                remove((directory + "/" + name).c_str());
+            }
+        }
+        closedir(listing);
+    }
+    rmdir(directory.c_str());
+}
+
+static Expression* roundTrip(Expression* expr) {
+    
+    string encoded;
+    serializeExpression(expr, encoded);
+    const uint8_t* data = (const uint8_t*)encoded.data();
+    Expression* decoded = deserializeExpression(data, data + encoded.size());
+    CHECK( data == (const uint8_t*)encoded.data() + encoded.size() );
+    return decoded;
+}
+
+TEST_CASE( "serializeExpression" ) {
+    
+    for (string source : { "1 + 2 * x", "_let abc = 5 _in abc * 7", "_true + _false", "123456789012345678901234567890 * y", "2147483647 + 0", "_if x == 1 _then y _else _let z = 2 _in z * y",
+                           "_let twice = _fun (f) _fun (x) f(f(x)) _in twice(_fun (y) y * 2)(3)" }) {
+        
+        Expression* expr = parse_str(source);
+        CHECK( roundTrip(expr)->equals(expr) );
+    }
+    CHECK( roundTrip(new Number(-7))->equals(new Number(-7)) );
+    CHECK( roundTrip(new Number(INT_MIN))->equals(new Number(INT_MIN)) );
+    CHECK_THROWS( roundTrip(new ThunkExpression(new ThunkValue(new Number(1)))) );
+    
+    string encoded;
+    serializeExpression(parse_str("(a + 1) * 2"), encoded);
+    for (size_t length = 0; length < encoded.size(); length++) {
+        
+        const uint8_t* data = (const uint8_t*)encoded.data();
+        CHECK_THROWS( deserializeExpression(data, data + length) );
+    }
+}
+
+TEST_CASE( "CompiledExpressionCache" ) {
+    
+    string directory = temporaryDirectory();
+    CompiledExpressionCache cache(directory);
+    CHECK( cache.compile("1 + x + 2")->equals(parse_str("x + 3")) );
+    CHECK( cache.misses == 1 );
+    CHECK( cache.writes == 1 );
+    
+    //a later run finds the optimized expression without parsing
+    CompiledExpressionCache restarted(directory);
+    CHECK( restarted.compile("1 + x + 2")->equals(parse_str("x + 3")) );
+    CHECK( restarted.hits == 1 );
+    CHECK( restarted.writes == 0 );
+    
+    //a different pipeline is a different entry
+    CompiledExpressionCache folded(directory, "fold");
+    CHECK( folded.compile("1 + x + 2")->equals(parse_str("1 + x + 2")) );
+    CHECK( folded.misses == 1 );
+    
+    //other versions and damaged files are misses, and are replaced
+    CompiledExpressionCache damaged(directory);
+    damaged.store("(y + 1) * 2", parse_str("_true"));
+    CHECK( damaged.load("(y + 1) * 2")->equals(new BoolExpression(true)) );
+    DIR* listing = opendir(directory.c_str());
+    while (dirent* entry = readdir(listing)) {
+        
+        string name = entry->d_name;
+        if (name.size() > 5 && name.substr(name.size() - 5) == ".msdx") {
+            
+            std::fstream file(directory + "/" + name, std::ios::in | std::ios::out | std::ios::binary);
+            file.seekp(sizeof(COMPILED_MAGIC));
+            uint32_t version = COMPILED_FORMAT_VERSION + 1;
+            file.write((const char*)&version, sizeof(version));
+        }
+    }
+    closedir(listing);
+    CHECK( damaged.load("(y + 1) * 2") == nullptr );
+    CHECK( damaged.load("1 + x + 2") == nullptr );
+    CHECK( damaged.compile("1 + x + 2")->equals(parse_str("x + 3")) );
+    CHECK( damaged.load("1 + x + 2")->equals(parse_str("x + 3")) );
+    
+    //so are entries an older optimizer made
+    listing = opendir(directory.c_str());
+    while (dirent* entry = readdir(listing)) {
+        
+        string name = entry->d_name;
+        if (name.size() > 5 && name.substr(name.size() - 5) == ".msdx") {
+            
+            std::fstream file(directory + "/" + name, std::ios::in | std::ios::out | std::ios::binary);
+            file.seekp(sizeof(COMPILED_MAGIC) + sizeof(uint32_t));
+            uint32_t optimizer = OPTIMIZER_VERSION - 1;
+            file.write((const char*)&optimizer, sizeof(optimizer));
+        }
+    }
+    closedir(listing);
+    CHECK( damaged.load("1 + x + 2") == nullptr );
+    CHECK( damaged.compile("1 + x + 2")->equals(parse_str("x + 3")) );
+    CHECK( damaged.load("1 + x + 2")->equals(parse_str("x + 3")) );
+    
+    CHECK_THROWS( cache.compile("1 +") );
+    CHECK_THROWS( cache.compile("_true + 1") );
+    removeDirectory(directory);
+    
+    //a directory that cannot be created or written to only makes every compile() a miss
+    CompiledExpressionCache unwritable(directory + "/missing/parent");
+    CHECK( unwritable.compile("1 + x + 2")->equals(parse_str("x + 3")) );
+    CHECK( unwritable.compile("1 + x + 2")->equals(parse_str("x + 3")) );
+    CHECK( unwritable.misses == 2 );
+    CHECK( unwritable.writes == 0 );
+    CHECK( unwritable.failedWrites == 2 );
+    CHECK_FALSE( unwritable.store("y", parse_str("y")) );
+}
+
+/*
+ A few thousand distinct expressions with variables, so that optimize() has work to do
+ */
+static vector<string> hotExpressions(int count, int terms, unsigned &seed) {
+    
+    vector<string> sources;
+    for (int i = 0; i < count; i++) {
+        
+        std::ostringstream out;
+        for (int term = 0; term < terms; term++) {
+            
+            seed = seed * 1103515245 + 12345;
+            out << (term == 0 ? "" : " + ") << (seed >> 16) % 100 << " * " << (char)('a' + (seed >> 8) % 5) << " + " << (seed >> 20) % 10;
+        }
+        sources.push_back(out.str());
+    }
+    return sources;
+}
+
+TEST_CASE( "CompiledExpressionCache benchmark", "[.benchmark]" ) {
+    
+    unsigned seed = 41;
+    vector<string> sources = hotExpressions(3000, 50, seed);
+    string directory = temporaryDirectory();
+    
+    auto start = std::chrono::steady_clock::now();
+    for (const string &source : sources) {
+        
+        std::istringstream in(source);
+        optimize(parse(in));
+    }
+    double uncachedMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    
+    CompiledExpressionCache cold(directory);
+    start = std::chrono::steady_clock::now();
+    for (const string &source : sources) {
+        
+        cold.compile(source);
+    }
+    double coldMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    
+    CompiledExpressionCache warm(directory);
+    start = std::chrono::steady_clock::now();
+    for (const string &source : sources) {
+        
+        warm.compile(source);
+    }
+    double warmMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    CHECK( warm.hits == (long)sources.size() );
+    
+    cout << sources.size() << " expressions: parse and optimize " << uncachedMilliseconds << " ms, cold start (and store) " << coldMilliseconds
+         << " ms, warm start from the cache " << warmMilliseconds << " ms\n";
+    removeDirectory(directory);
+}
@@ -0,0 +1,67 @@
+//
+//  diskcache.hpp
+//  ParserImproved
+//
+//  Copyright © 2020 MSD Katie Rose. All rights reserved.
+//
+
+#ifndef diskcache_hpp
+#define diskcache_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include "expression.hpp"
+
+using namespace std;
+
+/*
+ Files in a cache directory start with this magic number, format version and optimizer version.  Files with any other version are treated as missing and overwritten, so the format version must be bumped whenever the encoding below changes, and the optimizer version whenever `optimize()` or one of the passes changes what it makes of some input, or an old cache directory keeps serving what the old optimizer made.
+ */
+const char COMPILED_MAGIC[4] = { 'M', 'S', 'D', 'X' };
+const uint32_t COMPILED_FORMAT_VERSION = 2;
+const uint32_t OPTIMIZER_VERSION = 1;
+
+/*
+ Appends a compact binary encoding of `expr` to `out`: a one-byte tag per node in prefix order, with integers as zigzag varints, names as a length and their bytes, and BigNumbers as a sign and their base-10^9 limbs.  Throws `runtime_error` for expressions that only exist during evaluation, like lazy `_let` thunks.
+ */
+void serializeExpression(Expression* expr, string &out);
+
+/*
+ Decodes one expression encoded by serializeExpression() starting at `data`, advancing it.  Throws `runtime_error` if the encoding runs past `end` or is malformed.
+ */
+Expression* deserializeExpression(const uint8_t* &data, const uint8_t* end);
+
+/*
+ CompiledExpressionCache keeps already-optimized expressions in a directory across runs, so that hot expressions skip `parse()` and `optimize()` after a restart.  Each source text is stored in its own file, named by a 128-bit hash of the pass pipeline and the text, holding the magic number, the format and optimizer versions, the source itself (to rule out hash collisions) and the serialized optimized expression.  Files are mapped with mmap to be decoded.
+ */
+class CompiledExpressionCache {
+public:
+    
+    string directory;
+    
+    //the PassManager pipeline used to optimize, or "" for optimize()
+    string pipeline;
+    
+    long hits;
+    long misses;
+    long writes;
+    long failedWrites;
+    
+    //the directory is created if it does not exist; if it cannot be, every load() misses and every store() fails
+    CompiledExpressionCache(string cacheDirectory, string passes = "");
+    
+    //nullptr when `source` has no usable entry
+    Expression* load(const string &source);
+    //false, leaving the cache as it was, when the entry cannot be written
+    bool store(const string &source, Expression* optimized);
+    
+    //the optimized expression for `source`, from the cache if possible and otherwise parsed, optimized and stored; throws for a `source` that does not parse, and with no pipeline, since optimize() evaluates closed programs, for one whose evaluation fails, like `_true + 1`
+    Expression* compile(const string &source);
+
+private:
+    
+    string pathFor(const string &source);
+};
+
+#endif /* diskcache_hpp */
@@ -0,0 +1,503 @@
+//
+//  egraph.cpp
+//  ParserImproved
+//
+//  Copyright © 2020 MSD Katie Rose. All rights reserved.
+//
+
+#include <functional>
+#include <limits>
+#include <sstream>
+#include <unordered_set>
+#include "egraph.hpp"
+#include "parser.hpp"
+#include "catch.hpp"
+
+EGraphOptions::EGraphOptions() {
+    
+    this->maxIterations = 16;
+    this->maxNodes = 20000;
+    this->costModel = NODE_COUNT;
+    this->iterations = 0;
+    this->nodes = 0;
+    this->classes = 0;
+    this->saturated = false;
+    this->costBefore = 0;
+    this->costAfter = 0;
+}
+
+static bool hasIntValue(Value* value, int integer) {
+    
+    NumericValue* numeric = dynamic_cast<NumericValue*>(value);
+    return numeric != nullptr && numeric->value == integer;
+}
+
+static ENode makeNode(ENodeOp op, vector<int> children) {
+    
+    return ENode{op, "", nullptr, nullptr, children};
+}
+
+EGraph::EGraph() {
+    
+    this->totalNodes = 0;
+}
+
+int EGraph::find(int id) {
+    
+    while (parents[id] != id) {
+        
+        parents[id] = parents[parents[id]];
+        id = parents[id];
+    }
+    return id;
+}
+
+string EGraph::keyFor(ENode &node) {
+    
+    ostringstream key;
+    key << node.op << ':' << node.name << ':' << (node.constant != nullptr ? node.constant->toString() : "") << ':' << node.opaque;
+    for (int &child : node.children) {
+        
+        child = find(child);
+        key << ',' << child;
+    }
+    return key.str();
+}
+
+int EGraph::add(ENode node) {
+    
+    string key = keyFor(node);
+    auto existing = hashcons.find(key);
+    if (existing != hashcons.end()) {
+        
+        return find(existing->second);
+    }
+    
+    int id = (int)parents.size();
+    parents.push_back(id);
+    classNodes.push_back(vector<ENode>{node});
+    hashcons[key] = id;
+    totalNodes++;
+    
+    //constant analysis: a class whose value is known also gets a literal node
+    Value* constant = node.constant;
+    //an `_if` or a call might be a boolean too, so it is treated like one, and so is a function, which is not a number either
+    bool boolean = node.opaque != nullptr && (dynamic_cast<BoolExpression*>(node.opaque) != nullptr || dynamic_cast<EqualsExpression*>(node.opaque) != nullptr
+                                              || dynamic_cast<IfExpression*>(node.opaque) != nullptr || dynamic_cast<FunExpression*>(node.opaque) != nullptr
+                                              || dynamic_cast<CallExpression*>(node.opaque) != nullptr);
+    if ((node.op == E_ADD || node.op == E_MULTIPLY) && constantOf(node.children[0]) != nullptr && constantOf(node.children[1]) != nullptr) {
+        
+        Value* lhs = constantOf(node.children[0]);
+        Value* rhs = constantOf(node.children[1]);
+        constant = node.op == E_ADD ? lhs->addTo(rhs) : lhs->multiplyWith(rhs);
+    }
+    if (node.op == E_ADD || node.op == E_MULTIPLY) {
+        
+        boolean = booleans[find(node.children[0])] || booleans[find(node.children[1])];
+    }
+    constants.push_back(constant);
+    booleans.push_back(boolean);
+    if (constant != nullptr && node.op != E_NUMBER) {
+        
+        ENode literal = makeNode(E_NUMBER, {});
+        literal.constant = constant;
+        merge(id, add(literal));
+    }
+    return find(id);
+}
+
+int EGraph::add(Expression* expr) {
+    
+    ENode node = makeNode(E_OPAQUE, {});
+    if (dynamic_cast<Number*>(expr) != nullptr || dynamic_cast<BigNumber*>(expr) != nullptr) {
+        
+        node.op = E_NUMBER;
+        node.constant = expr->evaluate();
+    } else if (Variable* variable = dynamic_cast<Variable*>(expr)) {
+        
+        node.op = E_VARIABLE;
+        node.name = variable->name;
+    } else if (Add* addition = dynamic_cast<Add*>(expr)) {
+        
+        node = makeNode(E_ADD, {add(addition->leftHandSide), add(addition->rightHandSide)});
+    } else if (Multiply* multiply = dynamic_cast<Multiply*>(expr)) {
+        
+        node = makeNode(E_MULTIPLY, {add(multiply->leftHandSide), add(multiply->rightHandSide)});
+    } else if (LetExpression* let = dynamic_cast<LetExpression*>(expr)) {
+        
+        node = makeNode(E_LET, {add(let->subExpression), add(let->subBody)});
+        node.name = let->subVariable->name;
+    } else {
+        
+        node.opaque = expr;
+    }
+    return add(node);
+}
+
+bool EGraph::merge(int lhs, int rhs) {
+    
+    lhs = find(lhs);
+    rhs = find(rhs);
+    if (lhs == rhs) {
+        
+        return false;
+    }
+    if (classNodes[lhs].size() < classNodes[rhs].size()) {
+        
+        swap(lhs, rhs);
+    }
+    parents[rhs] = lhs;
+    classNodes[lhs].insert(classNodes[lhs].end(), classNodes[rhs].begin(), classNodes[rhs].end());
+    classNodes[rhs].clear();
+    if (constants[lhs] == nullptr) {
+        
+        constants[lhs] = constants[rhs];
+    }
+    booleans[lhs] = booleans[lhs] || booleans[rhs];
+    return true;
+}
+
+/*
+ Re-canonicalizes every node and merges classes that have come to contain the same node, until that stops happening (congruence closure)
+ */
+void EGraph::rebuild() {
+    
+    bool changed = true;
+    while (changed) {
+        
+        changed = false;
+        hashcons.clear();
+        for (int id = 0; id < (int)classNodes.size(); id++) {
+            
+            if (find(id) != id) {
+                
+                continue;
+            }
+            vector<ENode> nodes = classNodes[id];
+            vector<ENode> unique;
+            unordered_set<string> seen;
+            for (ENode &node : nodes) {
+                
+                string key = keyFor(node);
+                auto existing = hashcons.find(key);
+                if (existing != hashcons.end() && find(existing->second) != find(id)) {
+                    
+                    merge(existing->second, id);
+                    changed = true;
+                }
+                hashcons[key] = find(id);
+                if (seen.insert(key).second) {
+                    
+                    unique.push_back(node);
+                }
+            }
+            if (find(id) == id) {
+                
+                classNodes[id] = unique;
+            }
+        }
+    }
+    totalNodes = 0;
+    for (auto &nodes : classNodes) {
+        
+        totalNodes += nodes.size();
+    }
+}
+
+Value* EGraph::constantOf(int id) {
+    
+    return constants[find(id)];
+}
+
+bool EGraph::hasOp(int id, ENodeOp op, ENode &found) {
+    
+    for (ENode &node : classNodes[find(id)]) {
+        
+        if (node.op == op) {
+            
+            found = node;
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t EGraph::nodeCount() {
+    
+    return totalNodes;
+}
+
+size_t EGraph::classCount() {
+    
+    size_t count = 0;
+    for (int id = 0; id < (int)parents.size(); id++) {
+        
+        count += find(id) == id ? 1 : 0;
+    }
+    return count;
+}
+
+/*
+ Matches every rule against every node once and adds what they produce.  Returns true if anything changed.
+ */
+bool EGraph::applyRewrites(size_t maxNodes) {
+    
+    size_t nodesBefore = nodeCount();
+    size_t classesBefore = classCount();
+    bool merged = false;
+    
+    vector<pair<int, ENode>> matches;
+    for (int id = 0; id < (int)classNodes.size(); id++) {
+        
+        if (find(id) == id) {
+            
+            for (ENode &node : classNodes[id]) {
+                
+                if (node.op == E_ADD || node.op == E_MULTIPLY) {
+                    
+                    matches.push_back(make_pair(id, node));
+                }
+            }
+        }
+    }
+    
+    for (auto &match : matches) {
+        
+        if (nodeCount() > maxNodes) {
+            
+            break;
+        }
+        int id = match.first;
+        ENodeOp op = match.second.op;
+        int a = match.second.children[0];
+        int b = match.second.children[1];
+        ENodeOp other = op == E_ADD ? E_MULTIPLY : E_ADD;
+        ENode inner;
+        
+        //commutativity
+        merged |= merge(id, add(makeNode(op, {b, a})));
+        
+        //associativity, in both directions
+        if (hasOp(b, op, inner)) {
+            
+            merged |= merge(id, add(makeNode(op, {add(makeNode(op, {a, inner.children[0]})), inner.children[1]})));
+        }
+        if (hasOp(a, op, inner)) {
+            
+            merged |= merge(id, add(makeNode(op, {inner.children[0], add(makeNode(op, {inner.children[1], b}))})));
+        }
+        
+        //identities, which are skipped next to booleans so that evaluation still reports the type error
+        Value* constant = constantOf(b);
+        if (constant != nullptr && !booleans[find(a)]) {
+            
+            if (op == E_ADD && hasIntValue(constant, 0)) {
+                
+                merged |= merge(id, a);
+            } else if (op == E_MULTIPLY && hasIntValue(constant, 1)) {
+                
+                merged |= merge(id, a);
+            } else if (op == E_MULTIPLY && hasIntValue(constant, 0)) {
+                
+                merged |= merge(id, b);
+            }
+        }
+        
+        //distributivity: a * (c + d) = a * c + a * d
+        if (op == E_MULTIPLY && hasOp(b, other, inner)) {
+            
+            int lhs = add(makeNode(E_MULTIPLY, {a, inner.children[0]}));
+            int rhs = add(makeNode(E_MULTIPLY, {a, inner.children[1]}));
+            merged |= merge(id, add(makeNode(E_ADD, {lhs, rhs})));
+        }
+        
+        //factoring: a * c + a * d = a * (c + d)
+        ENode lhsProduct;
+        ENode rhsProduct;
+        if (op == E_ADD && hasOp(a, E_MULTIPLY, lhsProduct)) {
+            
+            for (ENode &node : vector<ENode>(classNodes[find(b)])) {
+                
+                if (node.op == E_MULTIPLY && find(node.children[0]) == find(lhsProduct.children[0])) {
+                    
+                    int sum = add(makeNode(E_ADD, {lhsProduct.children[1], node.children[1]}));
+                    merged |= merge(id, add(makeNode(E_MULTIPLY, {lhsProduct.children[0], sum})));
+                    break;
+                }
+            }
+        }
+    }
+    rebuild();
+    return merged || nodeCount() != nodesBefore || classCount() != classesBefore;
+}
+
+static double nodeCost(ENode &node, CostModel model) {
+    
+    if (model == NODE_COUNT) {
+        
+        return node.op == E_OPAQUE ? node.opaque->nodeCount() : 1;
+    }
+    switch (node.op) {
+        case E_MULTIPLY:
+            return 3;
+        case E_LET:
+            return 4;
+        case E_OPAQUE:
+            return 2 * node.opaque->nodeCount();
+        default:
+            return 1;
+    }
+}
+
+/*
+ Picks the cheapest node of every class by relaxing costs until they stop improving, then builds the cheapest expression for `root`
+ */
+Expression* EGraph::extract(int root, CostModel model, double &cost) {
+    
+    const double unknown = numeric_limits<double>::infinity();
+    vector<double> costs(classNodes.size(), unknown);
+    vector<ENode*> best(classNodes.size(), nullptr);
+    bool improved = true;
+    while (improved) {
+        
+        improved = false;
+        for (int id = 0; id < (int)classNodes.size(); id++) {
+            
+            for (ENode &node : classNodes[id]) {
+                
+                double total = nodeCost(node, model);
+                for (int child : node.children) {
+                    
+                    total += costs[find(child)];
+                }
+                if (total < costs[id]) {
+                    
+                    costs[id] = total;
+                    best[id] = &node;
+                    improved = true;
+                }
+            }
+        }
+    }
+    
+    root = find(root);
+    cost = costs[root];
+    vector<Expression*> built(classNodes.size(), nullptr);
+    function<Expression*(int)> build = [&](int id) -> Expression* {
+        id = find(id);
+        if (built[id] != nullptr) {
+            return built[id];
+        }
+        ENode &node = *best[id];
+        Expression* expr;
+        switch (node.op) {
+            case E_NUMBER:
+                expr = node.constant->toExpression();
+                break;
+            case E_VARIABLE:
+                expr = new Variable(node.name);
+                break;
+            case E_ADD:
+                expr = new Add(build(node.children[0]), build(node.children[1]));
+                break;
+            case E_MULTIPLY:
+                expr = new Multiply(build(node.children[0]), build(node.children[1]));
+                break;
+            case E_LET:
+                expr = new LetExpression(new Variable(node.name), build(node.children[0]), build(node.children[1]));
+                break;
+            default:
+                expr = node.opaque;
+                break;
+        }
+        built[id] = expr;
+        return expr;
+    };
+    return build(root);
+}
+
+Expression* saturate(Expression* expr, EGraphOptions &options) {
+    
+    EGraph graph;
+    int root = graph.add(expr);
+    graph.rebuild();
+    graph.extract(root, options.costModel, options.costBefore);
+    
+    options.saturated = false;
+    for (options.iterations = 0; options.iterations < options.maxIterations; ) {
+        
+        if (graph.nodeCount() > options.maxNodes) {
+            
+            break;
+        }
+        options.iterations++;
+        if (!graph.applyRewrites(options.maxNodes)) {
+            
+            options.saturated = true;
+            break;
+        }
+    }
+    options.nodes = graph.nodeCount();
+    options.classes = graph.classCount();
+    return graph.extract(root, options.costModel, options.costAfter);
+}
+
+/* for tests */
+static Expression *parse_str(string s) {
+    std::istringstream in(s);
+    return parse(in);
+}
+
+TEST_CASE( "saturate" ) {
+    
+    EGraphOptions options;
+    Expression* combined = saturate(parse_str("x * 2 + x * 3"), options);
+    CHECK( (combined->equals(parse_str("x * 5")) || combined->equals(parse_str("5 * x"))) );
+    CHECK( options.costBefore == 7 );
+    CHECK( options.costAfter == 3 );
+    
+    options = EGraphOptions();
+    Expression* factored = saturate(parse_str("a * b + a * c"), options);
+    CHECK( factored->nodeCount() == 5 );
+    CHECK( options.saturated );
+    
+    options = EGraphOptions();
+    CHECK( saturate(parse_str("(y + 0) * 1 + 2 * 3"), options)->nodeCount() == 3 );
+    
+    //booleans are opaque, and identities next to them are not applied
+    options = EGraphOptions();
+    Expression* boolean = saturate(parse_str("_true * 0"), options);
+    CHECK( boolean->nodeCount() == 3 );
+    CHECK_THROWS( boolean->evaluate() );
+    options = EGraphOptions();
+    Expression* comparison = saturate(parse_str("(1 == 1) * 0"), options);
+    CHECK( comparison->nodeCount() == 5 );
+    CHECK_THROWS( comparison->evaluate() );
+    options = EGraphOptions();
+    Expression* function = saturate(parse_str("(_fun (x) x) * 0"), options);
+    CHECK( function->nodeCount() == 5 );
+    CHECK_THROWS( function->evaluate() );
+    
+    //let bodies are optimized in place
+    options = EGraphOptions();
+    Expression* let = saturate(parse_str("_let z = 4 _in z * w + w * 6"), options);
+    CHECK( let->nodeCount() == 8 );
+    CHECK( let->substitute("w", new NumericValue(2))->evaluate()->equals(new NumericValue(20)) );
+    
+    //limits stop saturation early but still return an equivalent expression
+    options = EGraphOptions();
+    options.maxIterations = 2;
+    options.costModel = ESTIMATED_CYCLES;
+    Expression* original = parse_str("(a + b + c) * (d + e + f) * (g + 1)");
+    Expression* limited = saturate(original, options);
+    CHECK( options.iterations == 2 );
+    CHECK( ! options.saturated );
+    CHECK( options.costAfter <= options.costBefore );
+    Expression* bound[2] = { original, limited };
+    for (int i = 0; i < 2; i++) {
+        for (char name = 'a'; name <= 'g'; name++) {
+            bound[i] = bound[i]->substitute(string(1, name), new NumericValue(name - 'a' + 1));
+        }
+    }
+    CHECK( bound[0]->evaluate()->equals(bound[1]->evaluate()) );
+}
@@ -0,0 +1,91 @@
+//
+//  egraph.hpp
+//  ParserImproved
+//
+//  Copyright © 2020 MSD Katie Rose. All rights reserved.
+//
+
+#ifndef egraph_hpp
+#define egraph_hpp
+
+#include <stdio.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "expression.hpp"
+
+using namespace std;
+
+/*
+ How extraction prices an expression: every node costs 1, or each node costs roughly what evaluating it does (a multiplication about three additions).
+ */
+enum CostModel { NODE_COUNT, ESTIMATED_CYCLES };
+
+/*
+ Limits and statistics for saturate().  Saturation stops when no rewrite adds anything new, after `maxIterations` rounds, or once the e-graph holds more than `maxNodes` nodes, whichever comes first.
+ */
+struct EGraphOptions {
+    int maxIterations;
+    size_t maxNodes;
+    CostModel costModel;
+    
+    int iterations;
+    size_t nodes;
+    size_t classes;
+    bool saturated;
+    double costBefore;
+    double costAfter;
+    
+    EGraphOptions();
+};
+
+enum ENodeOp { E_NUMBER, E_VARIABLE, E_ADD, E_MULTIPLY, E_LET, E_OPAQUE };
+
+/*
+ An ENode is an operator applied to e-classes rather than to expressions.  `name` is the variable of a E_VARIABLE or E_LET, `constant` the value of a E_NUMBER, and `opaque` an expression the e-graph does not look inside (like a boolean).
+ */
+struct ENode {
+    ENodeOp op;
+    string name;
+    Value* constant;
+    Expression* opaque;
+    vector<int> children;
+};
+
+/*
+ EGraph stores many equivalent expressions at once, as e-classes of ENodes that share their equivalent subexpressions.  Classes are merged with a union-find, and `rebuild()` restores the invariant that no two classes contain the same node.
+ */
+class EGraph {
+public:
+    
+    EGraph();
+    int add(Expression* expr);
+    int add(ENode node);
+    int find(int id);
+    bool merge(int lhs, int rhs);
+    void rebuild();
+    bool applyRewrites(size_t maxNodes);
+    Expression* extract(int root, CostModel model, double &cost);
+    size_t nodeCount();
+    size_t classCount();
+
+private:
+    
+    vector<int> parents;
+    vector<vector<ENode>> classNodes;
+    vector<Value*> constants;
+    vector<bool> booleans;
+    unordered_map<string, int> hashcons;
+    size_t totalNodes;
+    
+    string keyFor(ENode &node);
+    bool hasOp(int id, ENodeOp op, ENode &found);
+    Value* constantOf(int id);
+};
+
+/*
+ Optimizes `expr` by equality saturation: the expression is added to an e-graph, commutativity, associativity, distributivity, factoring and identity rewrites are applied until nothing changes or a limit is hit, and the cheapest equivalent expression is extracted.  Much slower than rewrite(), so meant for the hottest expressions.
+ */
+Expression* saturate(Expression* expr, EGraphOptions &options);
+
+#endif /* egraph_hpp */
@@ -6,10 +6,150 @@
 //  Copyright © 2020 MSD Katie Rose. All rights reserved.
 //
 
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <vector>
 #include "expression.hpp"
 #include "catch.hpp"
+#include "context.hpp"
+#include "feedback.hpp"
+#include "function.hpp"
+#include "inliner.hpp"
 #include "value.hpp"
 
+bool StructuralHash::operator==(const StructuralHash &other) const {
+    
+    return this->high == other.high && this->low == other.low;
+}
+
+bool StructuralHash::operator!=(const StructuralHash &other) const {
+    
+    return !(*this == other);
+}
+
+size_t StructuralHashHasher::operator()(const StructuralHash &hash) const {
+    
+    return (size_t)hash.low;
+}
+
+static uint64_t mix64(uint64_t bits) {
+    
+    bits ^= bits >> 30;
+    bits *= 0xbf58476d1ce4e5b9ULL;
+    bits ^= bits >> 27;
+    bits *= 0x94d049bb133111ebULL;
+    return bits ^ (bits >> 31);
+}
+
+/*
+ Folds `part` into `seed`.  The two halves are mixed with different constants so that they are independent.
+ */
+static StructuralHash combineHash(StructuralHash seed, StructuralHash part) {
+    
+    return { mix64(seed.high ^ mix64(part.high + 0x9e3779b97f4a7c15ULL)), mix64(seed.low + mix64(part.low ^ 0x2545f4914f6cdd1dULL) * 3) };
+}
+
+static StructuralHash hashOf(uint64_t tag, uint64_t bits) {
+    
+    return combineHash({ tag, ~tag }, { bits, bits });
+}
+
+static StructuralHash hashOf(uint64_t tag, const string &text) {
+    
+    //FNV-1a, once for each half with a different offset
+    StructuralHash hash = { 0xcbf29ce484222325ULL, 0x84222325cbf29ce4ULL };
+    for (unsigned char character : text) {
+        
+        hash.high = (hash.high ^ character) * 0x100000001b3ULL;
+        hash.low = (hash.low ^ character) * 0x100000001b3ULL;
+    }
+    return combineHash({ tag, ~tag }, hash);
+}
+
+void Expression::print(ostream &out) {
+    
+    write(out, true);
+}
+
+string Expression::toString() {
+    
+    ostringstream out;
+    print(out);
+    return out.str();
+}
+
+/*
+ The printers write straight into the stream's buffer, skipping the sentry object, locale and formatting flags that every `<<` goes through.  A buffer that takes fewer characters than it was given sets `badbit`, as `<<` would.
+ */
+static inline void printCharacters(ostream &out, const char* characters, size_t length) {
+    
+    if (out.rdbuf()->sputn(characters, length) != (streamsize)length) {
+        
+        out.setstate(ios::badbit);
+    }
+}
+
+template <size_t length>
+static inline void printText(ostream &out, const char (&text)[length]) {
+    
+    printCharacters(out, text, length - 1);
+}
+
+/*
+ Writes `integer` in decimal, filling a small buffer from its last digit back
+ */
+static void printInteger(ostream &out, long long integer) {
+    
+    char digits[20];
+    char* end = digits + sizeof(digits);
+    char* start = end;
+    
+    // negate in unsigned arithmetic so that LLONG_MIN does not overflow
+    unsigned long long magnitude = integer < 0 ? 0ULL - (unsigned long long)integer : (unsigned long long)integer;
+    do {
+        
+        *--start = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    if (integer < 0) {
+        
+        *--start = '-';
+    }
+    printCharacters(out, start, end - start);
+}
+
+Precedence Expression::precedence() {
+    
+    return ATOM_PRECEDENCE;
+}
+
+bool Expression::extendsRight() {
+    
+    return false;
+}
+
+bool needsParentheses(Expression* expr, Precedence precedence, bool open) {
+    
+    return expr->precedence() < precedence || (!open && expr->extendsRight());
+}
+
+/*
+ Writes an operand of `+`, `*`, `==` or a call, in parentheses when it needs them
+ */
+static void writeOperand(ostream &out, Expression* operand, Precedence precedence, bool open) {
+    
+    if (needsParentheses(operand, precedence, open)) {
+        
+        printText(out, "(");
+        operand->write(out, true);
+        printText(out, ")");
+    } else {
+        
+        operand->write(out, open);
+    }
+}
+
 Number::Number(int val) {
     
     this->value = val;
@@ -49,15 +189,97 @@ Expression* Number::simplify() {
     return this;
 }
 
-string Number::toString() {
+void Number::write(ostream &out, bool open) {
+    
+    printInteger(out, this->value);
+}
+
+size_t Number::nodeCount() {
+    
+    return 1;
+}
+
+StructuralHash Number::structuralHash() {
+    
+    return hashOf(1, (uint64_t)(int64_t)this->value);
+}
+
+BigNumber::BigNumber(BigIntValue* inputValue) {
+    
+    this->value = inputValue;
+}
+
+bool BigNumber::equals(Expression *expr) {
+    
+    BigNumber *num = dynamic_cast<BigNumber*>(expr);
+    if (num == nullptr) {
+        
+        return false;
+    } else {
+        
+        return value->equals(num->value);
+    }
+}
+
+Value* BigNumber::evaluate() {
+    
+    return this->value;
+}
+
+bool BigNumber::containsVariables() {
+    return false;
+}
+
+Expression* BigNumber::substitute(string variable, Value* value) {
+    return this;
+}
+
+Expression* BigNumber::simplify() {
+    
+    return this;
+}
+
+void BigNumber::write(ostream &out, bool open) {
     
-    return to_string(this->value);
+    string digits = this->value->toString();
+    printCharacters(out, digits.data(), digits.size());
+}
+
+size_t BigNumber::nodeCount() {
+    
+    return 1;
+}
+
+StructuralHash BigNumber::structuralHash() {
+    
+    StructuralHash hash = hashOf(2, (uint64_t)this->value->negative);
+    for (uint32_t limb : this->value->limbs) {
+        
+        hash = combineHash(hash, { limb, limb });
+    }
+    return hash;
+}
+
+/*
+ Returns the value of `expr` if it is an integer literal, otherwise nullptr
+ */
+static Value* literalValue(Expression* expr) {
+    
+    if (dynamic_cast<Number*>(expr) != nullptr || dynamic_cast<BigNumber*>(expr) != nullptr) {
+        
+        return expr->evaluate();
+    }
+    return nullptr;
 }
 
 Add::Add(Expression *lhs, Expression *rhs) {
     
     this->leftHandSide = lhs;
     this->rightHandSide = rhs;
+    this->nodes = 1 + lhs->nodeCount() + rhs->nodeCount();
+    this->hash = combineHash(combineHash(hashOf(5, 0), lhs->structuralHash()), rhs->structuralHash());
+    this->specialization.store(UNSPECIALIZED, memory_order_relaxed);
+    this->shape.store(nullptr, memory_order_relaxed);
 }
 
 bool Add::equals(Expression *expr) {
@@ -75,14 +297,7 @@ bool Add::equals(Expression *expr) {
 
 Value* Add::evaluate() {
     
-    Value* lhs = this->leftHandSide->evaluate();
-    Value* rhs = this->rightHandSide->evaluate();
-    if (lhs == nullptr || rhs == nullptr) {
-        
-        throw runtime_error((string)"Current version only supports addition of integers");
-    }
-    
-    return lhs->addTo(rhs);
+    return evaluateTagged(this).toValue();
 }
 
 bool Add::containsVariables() {
@@ -92,7 +307,12 @@ bool Add::containsVariables() {
 
 Expression* Add::substitute(string variable, Value* value) {
     
-    return new Add(leftHandSide->substitute(variable, value), rightHandSide->substitute(variable, value));
+    EvaluationContext::countStep();
+    Add* substituted = new Add(leftHandSide->substitute(variable, value), rightHandSide->substitute(variable, value));
+    
+    //what this node has learned is only a prediction, checked on every evaluation, so the copy can start from it, though not from its shape, whose operands are not the copy's
+    substituted->specialization.store(this->specialization.load(memory_order_relaxed), memory_order_relaxed);
+    return substituted;
 }
 
 Expression* Add::simplify() {
@@ -101,25 +321,46 @@ Expression* Add::simplify() {
     Expression* rhs = rightHandSide->simplify();
     
     //add check to see if lhs and rhs are Numbers.  if they are numbers, you can combine them
-    Number* numlhs = dynamic_cast<Number*>(lhs);
-    Number* numrhs = dynamic_cast<Number*>(rhs);
+    Value* numlhs = literalValue(lhs);
+    Value* numrhs = literalValue(rhs);
     if (numlhs != nullptr && numrhs != nullptr) {
         
-        return new Number(numrhs->value + numlhs->value);
+        return numlhs->addTo(numrhs)->toExpression();
     }
     
     return new Add(lhs, rhs);
 }
 
-string Add::toString() {
+void Add::write(ostream &out, bool open) {
     
-    return (this->leftHandSide->toString() + " + " + this->rightHandSide->toString());
+    writeOperand(out, this->leftHandSide, MULTIPLY_PRECEDENCE, false);
+    printText(out, " + ");
+    writeOperand(out, this->rightHandSide, ADD_PRECEDENCE, open);
+}
+
+Precedence Add::precedence() {
+    
+    return ADD_PRECEDENCE;
+}
+
+size_t Add::nodeCount() {
+    
+    return this->nodes;
+}
+
+StructuralHash Add::structuralHash() {
+    
+    return this->hash;
 }
 
 Multiply::Multiply (Expression *lhs, Expression *rhs) {
     
     this->leftHandSide = lhs;
     this->rightHandSide = rhs;
+    this->nodes = 1 + lhs->nodeCount() + rhs->nodeCount();
+    this->hash = combineHash(combineHash(hashOf(6, 0), lhs->structuralHash()), rhs->structuralHash());
+    this->specialization.store(UNSPECIALIZED, memory_order_relaxed);
+    this->shape.store(nullptr, memory_order_relaxed);
 }
 
 bool Multiply::equals(Expression *expr) {
@@ -136,15 +377,8 @@ bool Multiply::equals(Expression *expr) {
 }
 
 Value* Multiply::evaluate() {
-    Value* lhs = this->leftHandSide->evaluate();
-    Value* rhs = this->rightHandSide->evaluate();
     
-    if (lhs == nullptr || rhs == nullptr) {
-        
-        throw runtime_error((string)"Current version only supports multiplication of integers");
-    }
-    
-    return lhs->multiplyWith(rhs);
+    return evaluateTagged(this).toValue();
 }
 
 bool Multiply::containsVariables() {
@@ -154,26 +388,48 @@ bool Multiply::containsVariables() {
 
 Expression* Multiply::substitute(string variable, Value* value) {
     
-    return new Multiply(leftHandSide->substitute(variable, value), rightHandSide->substitute(variable, value));
+    EvaluationContext::countStep();
+    Multiply* substituted = new Multiply(leftHandSide->substitute(variable, value), rightHandSide->substitute(variable, value));
+    
+    //what this node has learned is only a prediction, checked on every evaluation, so the copy can start from it, though not from its shape, whose operands are not the copy's
+    substituted->specialization.store(this->specialization.load(memory_order_relaxed), memory_order_relaxed);
+    return substituted;
 }
 
 Expression* Multiply::simplify() {
     
     Expression* lhs = leftHandSide->simplify();
     Expression* rhs = rightHandSide->simplify();
-    Number* numlhs = dynamic_cast<Number*>(lhs);
-    Number* numrhs = dynamic_cast<Number*>(rhs);
+    Value* numlhs = literalValue(lhs);
+    Value* numrhs = literalValue(rhs);
     if (numlhs != nullptr && numrhs != nullptr) {
         
-        return new Number(numrhs->value * numlhs->value);
+        return numlhs->multiplyWith(numrhs)->toExpression();
     }
     
     return new Multiply(lhs, rhs);
 }
 
-string Multiply::toString() {
+void Multiply::write(ostream &out, bool open) {
     
-    return (this->leftHandSide->toString() + " * " + this->rightHandSide->toString());
+    writeOperand(out, this->leftHandSide, CALL_PRECEDENCE, false);
+    printText(out, " * ");
+    writeOperand(out, this->rightHandSide, MULTIPLY_PRECEDENCE, open);
+}
+
+Precedence Multiply::precedence() {
+    
+    return MULTIPLY_PRECEDENCE;
+}
+
+size_t Multiply::nodeCount() {
+    
+    return this->nodes;
+}
+
+StructuralHash Multiply::structuralHash() {
+    
+    return this->hash;
 }
 
 Variable::Variable(string inputName) {
@@ -217,9 +473,19 @@ Expression* Variable::simplify() {
     return this;
 }
 
-string Variable::toString() {
+void Variable::write(ostream &out, bool open) {
+    
+    printCharacters(out, this->name.data(), this->name.size());
+}
+
+size_t Variable::nodeCount() {
+    
+    return 1;
+}
+
+StructuralHash Variable::structuralHash() {
     
-    return this->name;
+    return hashOf(4, this->name);
 }
 
 BoolExpression::BoolExpression(bool conditional) {
@@ -256,9 +522,83 @@ Expression* BoolExpression::simplify() {
     return this;
 }
 
-string BoolExpression::toString() {
+void BoolExpression::write(ostream &out, bool open) {
+    
+    if (this->boolean) {
+        
+        printText(out, "_true");
+    } else {
+        
+        printText(out, "_false");
+    }
+}
+
+size_t BoolExpression::nodeCount() {
+    
+    return 1;
+}
+
+StructuralHash BoolExpression::structuralHash() {
+    
+    return hashOf(3, (uint64_t)this->boolean);
+}
+
+ThunkExpression::ThunkExpression(ThunkValue* delayed) {
+    
+    this->thunk = delayed;
+}
+
+bool ThunkExpression::equals(Expression* expr) {
+    
+    ThunkExpression* other = dynamic_cast<ThunkExpression*>(expr);
+    if (other == NULL)
+        return false;
+    else
+        return (this->thunk == other->thunk);
+}
+
+Value* ThunkExpression::evaluate() {
+    
+    return this->thunk->force();
+}
+
+bool ThunkExpression::containsVariables() {
+    
+    return false;
+}
+
+Expression* ThunkExpression::substitute(string variable, Value* value) {
+    
+    return this;
+}
+
+Expression* ThunkExpression::simplify() {
+    
+    return this;
+}
+
+void ThunkExpression::write(ostream &out, bool open) {
+    
+    if (this->thunk->forced != nullptr) {
+        
+        string value = this->thunk->forced->toString();
+        printCharacters(out, value.data(), value.size());
+        return;
+    }
+    printText(out, "(");
+    this->thunk->expression->write(out, true);
+    printText(out, ")");
+}
+
+size_t ThunkExpression::nodeCount() {
     
-    return this->boolean ? "true" : "false";
+    return 1;
+}
+
+StructuralHash ThunkExpression::structuralHash() {
+    
+    //a thunk is only equal to itself
+    return hashOf(8, (uint64_t)(uintptr_t)this->thunk);
 }
 
 LetExpression::LetExpression(Variable* substituteVariable, Expression* substituteValue, Expression* substituteBody) {
@@ -266,6 +606,8 @@ LetExpression::LetExpression(Variable* substituteVariable, Expression* substitut
     this->subVariable = substituteVariable;
     this->subExpression = substituteValue;
     this->subBody = substituteBody;
+    this->nodes = 1 + substituteVariable->nodeCount() + substituteValue->nodeCount() + substituteBody->nodeCount();
+    this->hash = combineHash(combineHash(combineHash(hashOf(7, 0), substituteVariable->structuralHash()), substituteValue->structuralHash()), substituteBody->structuralHash());
 }
 
 bool LetExpression::equals(Expression *expr) {
@@ -279,7 +621,18 @@ bool LetExpression::equals(Expression *expr) {
 
 Value* LetExpression::evaluate() {
     
-    Expression* newExpression = subBody->substitute(subVariable->name, subExpression->evaluate());
+    EvaluationContext::countStep();
+    Value* boundValue;
+    EvaluationContext* context = EvaluationContext::current();
+    if (context != nullptr && context->lazyLet) {
+        
+        boundValue = new ThunkValue(subExpression);
+        context->lazyBindings++;
+    } else {
+        
+        boundValue = subExpression->evaluate();
+    }
+    Expression* newExpression = subBody->substitute(subVariable->name, boundValue);
     return newExpression->evaluate();
 }
 
@@ -290,17 +643,368 @@ bool LetExpression::containsVariables() {
 
 Expression* LetExpression::substitute(string variable, Value* value) {
     
-    return new LetExpression(subVariable, subExpression->substitute(variable, value), subBody->substitute(variable, value));
+    EvaluationContext::countStep();
+    //the body's occurrences of this let's own variable refer to the let, not to the outer binding
+    Expression* body = variable == subVariable->name ? subBody : subBody->substitute(variable, value);
+    return new LetExpression(subVariable, subExpression->substitute(variable, value), body);
 }
 
 Expression* LetExpression::simplify() {
     
-    return new LetExpression(subVariable, subExpression->simplify(), subBody->simplify());
+    InlineStats stats;
+    return inlineLets(this, stats, true);
+}
+
+void LetExpression::write(ostream &out, bool open) {
+    
+    printText(out, "_let ");
+    this->subVariable->write(out, true);
+    printText(out, " = ");
+    this->subExpression->write(out, true);
+    printText(out, " _in ");
+    this->subBody->write(out, open);
+}
+
+bool LetExpression::extendsRight() {
+    
+    return true;
+}
+
+size_t LetExpression::nodeCount() {
+    
+    return this->nodes;
+}
+
+StructuralHash LetExpression::structuralHash() {
+    
+    return this->hash;
+}
+
+EqualsExpression::EqualsExpression(Expression* lhs, Expression* rhs) {
+    
+    this->leftHandSide = lhs;
+    this->rightHandSide = rhs;
+    this->nodes = 1 + lhs->nodeCount() + rhs->nodeCount();
+    this->hash = combineHash(combineHash(hashOf(9, 0), lhs->structuralHash()), rhs->structuralHash());
+}
+
+bool EqualsExpression::equals(Expression *expr) {
+    
+    EqualsExpression* other = dynamic_cast<EqualsExpression*>(expr);
+    if (other == nullptr) {
+        
+        return false;
+    }
+    return this->leftHandSide->equals(other->leftHandSide) && this->rightHandSide->equals(other->rightHandSide);
 }
 
-string LetExpression::toString() {
+Value* EqualsExpression::evaluate() {
     
-    return "_let " + this->subVariable->toString() + " = " + this->subExpression->toString() + " _in " + this->subBody->toString();
+    return evaluateTagged(this).toValue();
+}
+
+bool EqualsExpression::containsVariables() {
+    
+    return this->leftHandSide->containsVariables() || this->rightHandSide->containsVariables();
+}
+
+Expression* EqualsExpression::substitute(string variable, Value* value) {
+    
+    EvaluationContext::countStep();
+    return new EqualsExpression(this->leftHandSide->substitute(variable, value), this->rightHandSide->substitute(variable, value));
+}
+
+Expression* EqualsExpression::simplify() {
+    
+    Expression* lhs = this->leftHandSide->simplify();
+    Expression* rhs = this->rightHandSide->simplify();
+    bool lhsConstant = literalValue(lhs) != nullptr || dynamic_cast<BoolExpression*>(lhs) != nullptr;
+    bool rhsConstant = literalValue(rhs) != nullptr || dynamic_cast<BoolExpression*>(rhs) != nullptr;
+    if (lhsConstant && rhsConstant) {
+        
+        return new BoolExpression(lhs->evaluate()->equals(rhs->evaluate()));
+    }
+    return new EqualsExpression(lhs, rhs);
+}
+
+void EqualsExpression::write(ostream &out, bool open) {
+    
+    writeOperand(out, this->leftHandSide, ADD_PRECEDENCE, false);
+    printText(out, " == ");
+    writeOperand(out, this->rightHandSide, EQUALS_PRECEDENCE, open);
+}
+
+Precedence EqualsExpression::precedence() {
+    
+    return EQUALS_PRECEDENCE;
+}
+
+size_t EqualsExpression::nodeCount() {
+    
+    return this->nodes;
+}
+
+StructuralHash EqualsExpression::structuralHash() {
+    
+    return this->hash;
+}
+
+IfExpression::IfExpression(Expression* testExpression, Expression* thenExpression, Expression* elseExpression) {
+    
+    this->test = testExpression;
+    this->thenBranch = thenExpression;
+    this->elseBranch = elseExpression;
+    this->nodes = 1 + testExpression->nodeCount() + thenExpression->nodeCount() + elseExpression->nodeCount();
+    this->hash = combineHash(combineHash(combineHash(hashOf(10, 0), testExpression->structuralHash()), thenExpression->structuralHash()), elseExpression->structuralHash());
+}
+
+bool IfExpression::equals(Expression *expr) {
+    
+    IfExpression* other = dynamic_cast<IfExpression*>(expr);
+    if (other == nullptr) {
+        
+        return false;
+    }
+    return this->test->equals(other->test) && this->thenBranch->equals(other->thenBranch) && this->elseBranch->equals(other->elseBranch);
+}
+
+/*
+ Returns whether the value of an `_if` test is `_true`, throwing `runtime_error` if it is not a boolean
+ */
+static bool testResult(TaggedValue value) {
+    
+    if (!value.isBool()) {
+        
+        throw runtime_error("_if test is not a boolean");
+    }
+    return value.boolValue();
+}
+
+Value* IfExpression::evaluate() {
+    
+    EvaluationContext::countStep();
+    if (testResult(evaluateTagged(this->test))) {
+        
+        return this->thenBranch->evaluate();
+    }
+    return this->elseBranch->evaluate();
+}
+
+bool IfExpression::containsVariables() {
+    
+    return this->test->containsVariables() || this->thenBranch->containsVariables() || this->elseBranch->containsVariables();
+}
+
+Expression* IfExpression::substitute(string variable, Value* value) {
+    
+    EvaluationContext::countStep();
+    return new IfExpression(this->test->substitute(variable, value), this->thenBranch->substitute(variable, value), this->elseBranch->substitute(variable, value));
+}
+
+Expression* IfExpression::simplify() {
+    
+    Expression* simplifiedTest = this->test->simplify();
+    if (BoolExpression* boolean = dynamic_cast<BoolExpression*>(simplifiedTest)) {
+        
+        return boolean->boolean ? this->thenBranch->simplify() : this->elseBranch->simplify();
+    }
+    return new IfExpression(simplifiedTest, this->thenBranch->simplify(), this->elseBranch->simplify());
+}
+
+void IfExpression::write(ostream &out, bool open) {
+    
+    printText(out, "_if ");
+    this->test->write(out, true);
+    printText(out, " _then ");
+    this->thenBranch->write(out, true);
+    printText(out, " _else ");
+    this->elseBranch->write(out, open);
+}
+
+bool IfExpression::extendsRight() {
+    
+    return true;
+}
+
+size_t IfExpression::nodeCount() {
+    
+    return this->nodes;
+}
+
+StructuralHash IfExpression::structuralHash() {
+    
+    return this->hash;
+}
+
+FunExpression::FunExpression(Variable* formal, Expression* functionBody) {
+    
+    this->formalArgument = formal;
+    this->body = functionBody;
+    this->nodes = 1 + formal->nodeCount() + functionBody->nodeCount();
+    this->hash = combineHash(combineHash(hashOf(11, 0), formal->structuralHash()), functionBody->structuralHash());
+}
+
+bool FunExpression::equals(Expression *expr) {
+    
+    FunExpression* other = dynamic_cast<FunExpression*>(expr);
+    if (other == nullptr) {
+        
+        return false;
+    }
+    return this->formalArgument->equals(other->formalArgument) && this->body->equals(other->body);
+}
+
+Value* FunExpression::evaluate() {
+    
+    //by the time a function is evaluated, everything bound around it has been substituted into its body
+    return new FunValue(this, nullptr);
+}
+
+bool FunExpression::containsVariables() {
+    
+    return true;
+}
+
+Expression* FunExpression::substitute(string variable, Value* value) {
+    
+    EvaluationContext::countStep();
+    //like a let, the body's occurrences of the formal argument refer to the argument, not to the outer binding
+    if (variable == this->formalArgument->name) {
+        
+        return this;
+    }
+    return new FunExpression(this->formalArgument, this->body->substitute(variable, value));
+}
+
+Expression* FunExpression::simplify() {
+    
+    return new FunExpression(this->formalArgument, this->body->simplify());
+}
+
+void FunExpression::write(ostream &out, bool open) {
+    
+    printText(out, "_fun (");
+    this->formalArgument->write(out, true);
+    printText(out, ") ");
+    this->body->write(out, open);
+}
+
+bool FunExpression::extendsRight() {
+    
+    return true;
+}
+
+size_t FunExpression::nodeCount() {
+    
+    return this->nodes;
+}
+
+StructuralHash FunExpression::structuralHash() {
+    
+    return this->hash;
+}
+
+CallExpression::CallExpression(Expression* function, Expression* argument) {
+    
+    this->toBeCalled = function;
+    this->actualArgument = argument;
+    this->nodes = 1 + function->nodeCount() + argument->nodeCount();
+    this->hash = combineHash(combineHash(hashOf(12, 0), function->structuralHash()), argument->structuralHash());
+}
+
+bool CallExpression::equals(Expression *expr) {
+    
+    CallExpression* other = dynamic_cast<CallExpression*>(expr);
+    if (other == nullptr) {
+        
+        return false;
+    }
+    return this->toBeCalled->equals(other->toBeCalled) && this->actualArgument->equals(other->actualArgument);
+}
+
+Value* CallExpression::evaluate() {
+    
+    EvaluationContext::countStep();
+    Value* function = this->toBeCalled->evaluate();
+    return callFunction(function, this->actualArgument->evaluate());
+}
+
+bool CallExpression::containsVariables() {
+    
+    return this->toBeCalled->containsVariables() || this->actualArgument->containsVariables();
+}
+
+Expression* CallExpression::substitute(string variable, Value* value) {
+    
+    EvaluationContext::countStep();
+    return new CallExpression(this->toBeCalled->substitute(variable, value), this->actualArgument->substitute(variable, value));
+}
+
+Expression* CallExpression::simplify() {
+    
+    return new CallExpression(this->toBeCalled->simplify(), this->actualArgument->simplify());
+}
+
+void CallExpression::write(ostream &out, bool open) {
+    
+    writeOperand(out, this->toBeCalled, CALL_PRECEDENCE, false);
+    printText(out, "(");
+    this->actualArgument->write(out, true);
+    printText(out, ")");
+}
+
+Precedence CallExpression::precedence() {
+    
+    return CALL_PRECEDENCE;
+}
+
+size_t CallExpression::nodeCount() {
+    
+    return this->nodes;
+}
+
+StructuralHash CallExpression::structuralHash() {
+    
+    return this->hash;
+}
+
+TaggedValue evaluateTagged(Expression* expr) {
+    
+    if (Add* add = dynamic_cast<Add*>(expr)) {
+        
+        EvaluationContext* context = EvaluationContext::countStep();
+        if (context != nullptr && context->specializeNodes) {
+            
+            return evaluateWithFeedback(add, nullptr);
+        }
+        TaggedValue lhs = evaluateTagged(add->leftHandSide);
+        return lhs.add(evaluateTagged(add->rightHandSide));
+    } else if (Multiply* multiply = dynamic_cast<Multiply*>(expr)) {
+        
+        EvaluationContext* context = EvaluationContext::countStep();
+        if (context != nullptr && context->specializeNodes) {
+            
+            return evaluateWithFeedback(multiply, nullptr);
+        }
+        TaggedValue lhs = evaluateTagged(multiply->leftHandSide);
+        return lhs.multiply(evaluateTagged(multiply->rightHandSide));
+    } else if (Number* number = dynamic_cast<Number*>(expr)) {
+        
+        return TaggedValue::fromInt(number->value);
+    } else if (BoolExpression* boolean = dynamic_cast<BoolExpression*>(expr)) {
+        
+        return TaggedValue::fromBool(boolean->boolean);
+    } else if (EqualsExpression* comparison = dynamic_cast<EqualsExpression*>(expr)) {
+        
+        EvaluationContext::countStep();
+        TaggedValue lhs = evaluateTagged(comparison->leftHandSide);
+        return TaggedValue::fromBool(lhs.equals(evaluateTagged(comparison->rightHandSide)));
+    } else if (IfExpression* conditional = dynamic_cast<IfExpression*>(expr)) {
+        
+        EvaluationContext::countStep();
+        return evaluateTagged(testResult(evaluateTagged(conditional->test)) ? conditional->thenBranch : conditional->elseBranch);
+    }
+    return TaggedValue::of(expr->evaluate());
 }
 
 TEST_CASE( "equals" ) {
@@ -311,6 +1015,24 @@ TEST_CASE( "equals" ) {
     CHECK( (new Variable("x"))->equals(new Variable("x")) );
 }
 
+TEST_CASE( "nodeCount" ) {
+    
+    CHECK( (new Number(1))->nodeCount() == 1 );
+    CHECK( (new Add(new Number(2), (new Multiply(new Number(6), new Variable("x") )) ))->nodeCount() == 5 );
+    CHECK( (new LetExpression(new Variable("x"), new Number(5), (new Add (new Variable("x"), new Number(11)))))->nodeCount() == 6 );
+}
+
+TEST_CASE( "structuralHash" ) {
+    
+    CHECK( (new Add(new Variable("a"), new Number(3)))->structuralHash() == (new Add(new Variable("a"), new Number(3)))->structuralHash() );
+    CHECK( (new LetExpression(new Variable("x"), new Number(1), new Variable("x")))->structuralHash() == (new LetExpression(new Variable("x"), new Number(1), new Variable("x")))->structuralHash() );
+    CHECK( (new Add(new Variable("a"), new Variable("b")))->structuralHash() != (new Multiply(new Variable("a"), new Variable("b")))->structuralHash() );
+    CHECK( (new Add(new Variable("a"), new Variable("b")))->structuralHash() != (new Add(new Variable("b"), new Variable("a")))->structuralHash() );
+    CHECK( (new Number(1))->structuralHash() != (new BoolExpression(true))->structuralHash() );
+    CHECK( (new BigNumber(new BigIntValue(10000000000LL)))->structuralHash() == (new Multiply(new Number(100000), new Number(100000)))->simplify()->structuralHash() );
+    CHECK( (new Variable("ab"))->structuralHash() != (new Variable("ba"))->structuralHash() );
+}
+
 TEST_CASE( "evaluate" ) {
     
     CHECK( (new Multiply(new Number(6), new Number(4)) )->evaluate()->equals(new NumericValue(24)) ) ;
@@ -323,6 +1045,145 @@ TEST_CASE( "evaluate" ) {
     CHECK( ( new LetExpression(new Variable("x"), new Number(1), (new LetExpression(new Variable("y"), new Number(2), (new Add(new Variable("x"), new Variable("y")) )) )) )->evaluate()->equals(new NumericValue(3)) );
 }
 
+TEST_CASE( "lazy let" ) {
+    
+    EvaluationContext context;
+    context.lazyLet = true;
+    EvaluationScope scope(&context);
+    
+    //an unused binding is never evaluated, so it cannot fail
+    CHECK( (new LetExpression(new Variable("x"), new Variable("unbound"), new Number(3)))->evaluate()->equals(new NumericValue(3)) );
+    CHECK( context.lazyBindings == 1 );
+    CHECK( context.unforcedBindings() == 1 );
+    
+    //a binding used twice is forced once
+    CHECK( (new LetExpression(new Variable("x"), new Add(new Number(2), new Number(3)), new Multiply(new Variable("x"), new Variable("x"))))->evaluate()->equals(new NumericValue(25)) );
+    CHECK( context.lazyBindings == 2 );
+    CHECK( context.lazyBindingsForced == 1 );
+    
+    //nested bindings, where the inner one refers to the outer one
+    CHECK( (new LetExpression(new Variable("x"), new Number(1), new LetExpression(new Variable("y"), new Add(new Variable("x"), new Number(1)), new Add(new Variable("x"), new Variable("y")))))->evaluate()->equals(new NumericValue(3)) );
+    CHECK( context.unforcedBindings() == 1 );
+    
+    CHECK_THROWS_WITH( (new LetExpression(new Variable("x"), new Variable("unbound"), new Variable("x")))->evaluate(), "Incomplete substitution" );
+}
+
+/* for tests: _let x0 = 1 _in _let x1 = x0 + x0 _in ... _in xn, whose substitutions are quadratic in n */
+static Expression* letChain(int length) {
+    
+    Expression* body = new Variable("x" + string(length, 'a'));
+    for (int i = length; i > 0; i--) {
+        
+        Variable* previous = new Variable("x" + string(i - 1, 'a'));
+        body = new LetExpression(new Variable("x" + string(i, 'a')), new Add(previous, previous), body);
+    }
+    return new LetExpression(new Variable("x"), new Number(1), body);
+}
+
+TEST_CASE( "evaluation limits" ) {
+    
+    EvaluationContext unlimited;
+    {
+        EvaluationScope scope(&unlimited);
+        CHECK( letChain(20)->evaluate()->equals(new NumericValue(1 << 20)) );
+    }
+    CHECK( unlimited.steps > 0 );
+    CHECK( unlimited.bytesAllocated > 0 );
+    
+    EvaluationContext steps;
+    steps.stepBudget = 100;
+    {
+        EvaluationScope scope(&steps);
+        CHECK_THROWS_WITH( letChain(200)->evaluate(), "step budget of 100 exceeded" );
+    }
+    
+    EvaluationContext bytes;
+    bytes.byteBudget = 4096;
+    try {
+        
+        EvaluationScope scope(&bytes);
+        letChain(200)->evaluate();
+        FAIL( "expected the byte budget to run out" );
+    } catch (EvaluationLimitError &error) {
+        
+        CHECK( error.kind == EvaluationLimitError::BYTE_BUDGET );
+        CHECK( error.bytesAllocated > 4096 );
+    }
+    
+    //squaring 3 twenty-two times allocates few Values but about 830 KB of limbs
+    Expression* squares = new Variable("x" + string(22, 'a'));
+    for (int i = 22; i > 0; i--) {
+        
+        Variable* previous = new Variable("x" + string(i - 1, 'a'));
+        squares = new LetExpression(new Variable("x" + string(i, 'a')), new Multiply(previous, previous), squares);
+    }
+    squares = new LetExpression(new Variable("x"), new Number(3), squares);
+    EvaluationContext limbs;
+    limbs.byteBudget = 100000;
+    try {
+        
+        EvaluationScope scope(&limbs);
+        squares->evaluate();
+        FAIL( "expected the limbs to run past the byte budget" );
+    } catch (EvaluationLimitError &error) {
+        
+        CHECK( error.kind == EvaluationLimitError::BYTE_BUDGET );
+    }
+    
+    EvaluationContext cancelled;
+    cancelled.cancel();
+    {
+        EvaluationScope scope(&cancelled);
+        CHECK_THROWS_AS( letChain(200)->evaluate(), EvaluationLimitError );
+        CHECK( cancelled.steps <= 1024 );
+    }
+}
+
+/* for tests: the `index`th of the names xa, xb, ..., xz, xba, ... */
+static string chainName(int index) {
+    
+    string name;
+    do {
+        
+        name.insert(name.begin(), (char)('a' + index % 26));
+        index = index / 26;
+    } while (index > 0);
+    return "x" + name;
+}
+
+TEST_CASE( "evaluation limits benchmark", "[.benchmark]" ) {
+    
+    //`_let xa = 1 _in _let xb = xa + 1 _in ...`, whose substitutions allocate a node per step, so both hooks are on the hot path
+    const int length = 1500;
+    Expression* chain = new Variable(chainName(length - 1));
+    for (int i = length - 1; i > 0; i--) {
+        
+        chain = new LetExpression(new Variable(chainName(i)), new Add(new Variable(chainName(i - 1)), new Number(1)), chain);
+    }
+    chain = new LetExpression(new Variable(chainName(0)), new Number(1), chain);
+    
+    const int rounds = 5;
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++) {
+        
+        CHECK( chain->evaluate()->equals(new NumericValue(length)) );
+    }
+    double plainMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / rounds;
+    
+    EvaluationContext context;
+    context.stepBudget = 1L << 40;
+    context.byteBudget = 1L << 40;
+    start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++) {
+        
+        EvaluationScope scope(&context);
+        CHECK( chain->evaluate()->equals(new NumericValue(length)) );
+    }
+    double limitedMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / rounds;
+    cout << context.steps / rounds << " steps and " << context.bytesAllocated / rounds / 1024 << " KB a run: no context " << plainMilliseconds
+         << " ms, counted against budgets " << limitedMilliseconds << " ms\n";
+}
+
 TEST_CASE( "contains Variables" ) {
     
     CHECK( (new Number(90))->containsVariables() == false );
@@ -339,7 +1200,8 @@ TEST_CASE( "substitution" ) {
     CHECK( (new Variable("squib"))->substitute("toad", (new NumericValue(3)))->equals(new Variable("squib")) );
     CHECK( (new Variable("toad"))->substitute("toad", (new BoolValue(true)))->equals(new BoolExpression(true)));
     CHECK( (new Variable("squib"))->substitute("toad", (new BoolValue(false)))->equals(new Variable("squib")));
-    CHECK( (new LetExpression(new Variable("x"), new Number(5), (new Add (new Variable("x"), new Number(11)))))->substitute("x", new NumericValue(5))->equals((new LetExpression(new Variable("x"), new Number(5), (new Add (new Number(5), new Number(11)))))) );
+    CHECK( (new LetExpression(new Variable("x"), new Number(5), (new Add (new Variable("x"), new Number(11)))))->substitute("x", new NumericValue(5))->equals((new LetExpression(new Variable("x"), new Number(5), (new Add (new Variable("x"), new Number(11)))))) );
+    CHECK( (new LetExpression(new Variable("y"), new Variable("x"), (new Add (new Variable("x"), new Variable("y")))))->substitute("x", new NumericValue(2))->equals((new LetExpression(new Variable("y"), new Number(2), (new Add (new Number(2), new Variable("y")))))) );
     CHECK( ((new LetExpression(new Variable("y"), new Number(5), (new Add (new Variable("x"), new Number(11)))))->substitute("y", new NumericValue(5)))->equals(new LetExpression(new Variable("y"), new Number(5), (new Add (new Variable("x"), new Number(11))))) );
 }
 
@@ -358,9 +1220,53 @@ TEST_CASE( "simplify" ) {
     CHECK( (new Multiply(new Number(6), new Variable("x")) )->simplify()->equals(new Multiply(new Number(6), new Variable("x")) ) ) ;
     CHECK( (new Add(new Variable("test"), new Number(4)) )->simplify()->equals(new Add(new Variable("test"), new Number(4)) ));
     CHECK( (new Add(new Variable("one"), (new Multiply(new Number(6), new Number(4) )) ))->simplify()->equals(new Add(new Variable("one"), new Number(24))) );
+    CHECK( (new Multiply(new Number(100000), new Number(100000)) )->simplify()->equals(new BigNumber(new BigIntValue(10000000000LL))) );
     
     //check LetExpressions
-    //    CHECK( (new LetExpression(new Variable("x"), new Number(5), (new Add (new Variable("x"), new Number(11)))))->simplify()->equals((new LetExpression(new Variable("x"), new Number(5), (new Add (new Number(5), new Number(11)))))) );
+    CHECK( (new LetExpression(new Variable("x"), new Number(5), (new Add (new Variable("x"), new Number(11)))))->simplify()->equals(new Number(16)) );
+    CHECK( (new LetExpression(new Variable("x"), new Add(new Variable("y"), new Number(1)), (new Multiply (new Variable("x"), new Variable("x")))))->simplify()->equals(new LetExpression(new Variable("x"), new Add(new Variable("y"), new Number(1)), (new Multiply (new Variable("x"), new Variable("x"))))) );
+}
+
+TEST_CASE( "conditionals" ) {
+    
+    CHECK( (new EqualsExpression(new Number(3), new Add(new Number(1), new Number(2))))->evaluate()->equals(new BoolValue(true)) );
+    CHECK( (new EqualsExpression(new Number(3), new Number(4)))->evaluate()->equals(new BoolValue(false)) );
+    CHECK( (new EqualsExpression(new Number(1), new BoolExpression(true)))->evaluate()->equals(new BoolValue(false)) );
+    CHECK( (new EqualsExpression(new BoolExpression(false), new BoolExpression(false)))->evaluate()->equals(new BoolValue(true)) );
+    CHECK( (new EqualsExpression(new Multiply(new Number(100000), new Number(100000)), new BigNumber(new BigIntValue(10000000000LL))))->evaluate()->equals(new BoolValue(true)) );
+    
+    //only the selected branch is evaluated, so the other one cannot fail
+    CHECK( (new IfExpression(new BoolExpression(true), new Number(1), new Variable("unbound")))->evaluate()->equals(new NumericValue(1)) );
+    CHECK( (new IfExpression(new EqualsExpression(new Number(1), new Number(2)), new Add(new BoolExpression(true), new Number(1)), new Number(2)))->evaluate()->equals(new NumericValue(2)) );
+    CHECK_THROWS_WITH( (new IfExpression(new Number(1), new Number(2), new Number(3)))->evaluate(), "_if test is not a boolean" );
+    
+    Expression* conditional = new IfExpression(new EqualsExpression(new Variable("x"), new Number(0)), new Number(1), new Multiply(new Variable("x"), new Number(2)));
+    CHECK( conditional->substitute("x", new NumericValue(0))->evaluate()->equals(new NumericValue(1)) );
+    CHECK( conditional->substitute("x", new NumericValue(5))->evaluate()->equals(new NumericValue(10)) );
+    CHECK( conditional->containsVariables() );
+    CHECK( conditional->nodeCount() == 8 );
+    CHECK( conditional->toString() == "_if x == 0 _then 1 _else x * 2" );
+    CHECK( conditional->structuralHash() != (new IfExpression(new EqualsExpression(new Variable("x"), new Number(0)), new Multiply(new Variable("x"), new Number(2)), new Number(1)))->structuralHash() );
+    
+    CHECK( (new IfExpression(new EqualsExpression(new Number(2), new Add(new Number(1), new Number(1))), new Variable("a"), new Variable("b")))->simplify()->equals(new Variable("a")) );
+    CHECK( conditional->simplify()->equals(conditional) );
+}
+
+/* for tests: 1 + 2 * (3 + 4 * (5 + ...)) with `length` operators, nested to the right the way the parser builds them */
+static Expression* rightNestedChain(int length) {
+    
+    Expression* chain = new Number(length + 1);
+    for (int i = length; i >= 1; i--) {
+        
+        if (i % 2 == 0) {
+            
+            chain = new Multiply(new Number(i), chain);
+        } else {
+            
+            chain = new Add(new Number(i), chain);
+        }
+    }
+    return chain;
 }
 
 TEST_CASE( "toString" ) {
@@ -371,4 +1277,140 @@ TEST_CASE( "toString" ) {
     CHECK( (new Multiply (new Number(12), new Number(11)))->toString() == "12 * 11");
     CHECK( (new LetExpression(new Variable("x"), new Number(5), (new Add (new Variable("x"), new Number(11)))))->toString() == "_let x = 5 _in x + 11");
     CHECK( ( new LetExpression(new Variable("x"), new Number(1), (new LetExpression(new Variable("y"), new Number(2), (new Add(new Variable("x"), new Variable("y")) )) )) )->toString() == "_let x = 1 _in _let y = 2 _in x + y");
+    CHECK( (new Number(-2147483647 - 1))->toString() == "-2147483648" );
+    CHECK( (new Number(0))->toString() == "0" );
+    CHECK( (new BigNumber(new BigIntValue(-12345678901234LL)))->toString() == "-12345678901234" );
+}
+
+/* for tests: a stream buffer that takes `room` characters and then fails, like a full disk */
+class LimitedBuffer : public std::streambuf {
+public:
+    
+    size_t room;
+    
+    LimitedBuffer(size_t characters) {
+        
+        this->room = characters;
+    }
+    
+protected:
+    
+    int overflow(int character) override {
+        
+        if (this->room == 0 || character == EOF) {
+            
+            return EOF;
+        }
+        this->room--;
+        return character;
+    }
+};
+
+TEST_CASE( "print" ) {
+    
+    //print() writes what toString() returns, after whatever the stream holds already
+    Expression* expr = new IfExpression(new EqualsExpression(new Variable("n"), new Number(-7)), new CallExpression(new FunExpression(new Variable("x"), new Multiply(new Variable("x"), new Number(3))), new Number(4)), new BoolExpression(false));
+    std::ostringstream out;
+    out << "value: ";
+    expr->print(out);
+    CHECK( out.str() == "value: " + expr->toString() );
+    CHECK( expr->toString() == "_if n == -7 _then (_fun (x) x * 3)(4) _else _false" );
+    
+    //a long chain nested to the right, which took time quadratic in its length to concatenate
+    string expected;
+    for (int i = 1; i < 100000; i++) {
+        
+        expected += to_string(i) + (i % 2 == 0 ? " * (" : " + ");
+    }
+    expected += "100000 * 100001" + string(49999, ')');
+    CHECK( rightNestedChain(100000)->toString() == expected );
+    
+    //a stream that cannot take everything goes bad, as it would with `<<`
+    for (size_t room : { 0, 3, 10, 40 }) {
+        
+        LimitedBuffer buffer(room);
+        std::ostream limited(&buffer);
+        expr->print(limited);
+        CHECK( limited.bad() );
+    }
+    LimitedBuffer buffer(100);
+    std::ostream roomy(&buffer);
+    expr->print(roomy);
+    CHECK( roomy.good() );
+}
+
+/* for tests: a balanced tree of `+` and `*` over small literals */
+static Expression* arithmeticTree(int depth, unsigned &seed) {
+    
+    seed = seed * 1103515245 + 12345;
+    if (depth == 0) {
+        
+        return new Number(1 + (seed >> 16) % 3);
+    }
+    Expression* lhs = arithmeticTree(depth - 1, seed);
+    Expression* rhs = arithmeticTree(depth - 1, seed);
+    if ((seed >> 20) % 4 == 0) {
+        
+        return new Multiply(lhs, rhs);
+    }
+    return new Add(lhs, rhs);
+}
+
+TEST_CASE( "conditionals benchmark", "[.benchmark]" ) {
+    
+    //`_if 3 == 0 _then ... _else _if 3 == 1 _then ... _else ...`, against computing every branch and picking one as generators had to before
+    unsigned seed = 42;
+    const int branches = 16;
+    vector<Expression*> values;
+    for (int i = 0; i < branches; i++) {
+        
+        values.push_back(arithmeticTree(16, seed));
+    }
+    const int rounds = 5;
+    vector<Expression*> chains;
+    for (int round = 0; round < rounds; round++) {
+        
+        Expression* chain = values.back();
+        for (int i = branches - 2; i >= 0; i--) {
+            
+            chain = new IfExpression(new EqualsExpression(new Number(round), new Number(i)), values[i], chain);
+        }
+        chains.push_back(chain);
+    }
+    
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++) {
+        
+        vector<Value*> all;
+        for (Expression* value : values) {
+            
+            all.push_back(value->evaluate());
+        }
+        CHECK( all[round] != nullptr );
+    }
+    double eagerMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / rounds;
+    
+    start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++) {
+        
+        CHECK( chains[round]->evaluate() != nullptr );
+    }
+    double conditionalMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / rounds;
+    cout << branches << " branches of " << values[0]->nodeCount() << " nodes: every branch " << eagerMilliseconds << " ms, _if chain " << conditionalMilliseconds << " ms\n";
+}
+
+TEST_CASE( "printing benchmark", "[.benchmark]" ) {
+    
+    unsigned seed = 48;
+    vector<pair<string, Expression*>> workloads = {
+        { "balanced tree, 2^20 leaves", arithmeticTree(20, seed) },
+        { "right-nested chain, 20000 operators", rightNestedChain(20000) },
+    };
+    for (auto &workload : workloads) {
+        
+        auto start = std::chrono::steady_clock::now();
+        string printed = workload.second->toString();
+        double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        cout << workload.first << ": toString() " << milliseconds << " ms for " << printed.size() << " characters\n";
+    }
 }
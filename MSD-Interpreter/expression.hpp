@@ -10,11 +10,33 @@
 #define expression_hpp
 
 #include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+#include <ostream>
 #include <string>
 #include "value.hpp"
 
 using namespace std;
 
+/*
+ A 128-bit hash of the structure of an expression.  Trees that are `equals()` hash the same, and with 128 well-mixed bits, trees that are not are taken never to collide.
+ */
+struct StructuralHash {
+    uint64_t high;
+    uint64_t low;
+    bool operator==(const StructuralHash &other) const;
+    bool operator!=(const StructuralHash &other) const;
+};
+
+struct StructuralHashHasher {
+    size_t operator()(const StructuralHash &hash) const;
+};
+
+
+/*
+ How tightly the grammar binds an expression, from `==`, which binds loosest, to literals, variables and parenthesized expressions
+ */
+enum Precedence { EQUALS_PRECEDENCE, ADD_PRECEDENCE, MULTIPLY_PRECEDENCE, CALL_PRECEDENCE, ATOM_PRECEDENCE };
 
 /*
  Expression is an abstract class.  Things that are considered Expressions are Numbers, Variables, and any combination of Numbers and Variables seperated by arithmetic operators.
@@ -22,12 +44,34 @@ using namespace std;
 class Expression {
 public:
     
+    //allocations are charged to the current EvaluationContext's byte budget; both are inline, so the compiler sees each allocation freed by the matching global function
+    static void* operator new(size_t size) {
+        EvaluationContext::countBytes(size);
+        return ::operator new(size);
+    }
+    static void operator delete(void* pointer) {
+        ::operator delete(pointer);
+    }
+    
     virtual bool equals(Expression *expr) = 0;
     virtual Value* evaluate() = 0;
     virtual bool containsVariables() = 0;
     virtual Expression* substitute(string variable, Value* value) = 0;
     virtual Expression* simplify() = 0;
-    virtual string toString() = 0;
+    //writes the expression to `out` in a single walk over the tree, with only the parentheses that `parse()` needs to read back an equal tree
+    void print(ostream &out);
+    //what `print()` writes, as a string
+    string toString();
+    //prints the expression at a place where its text may run on to whatever follows only if `open` (see needsParentheses())
+    virtual void write(ostream &out, bool open) = 0;
+    //ATOM_PRECEDENCE unless overridden
+    virtual Precedence precedence();
+    //whether the last part of the expression takes in as much of the text after it as it can, like the body of a `_let`
+    virtual bool extendsRight();
+    //number of nodes in the tree, computed when the node is constructed
+    virtual size_t nodeCount() = 0;
+    //computed when the node is constructed for `+`, `*` and `_let`, and on demand for leaves
+    virtual StructuralHash structuralHash() = 0;
 };
 
 /*
@@ -43,7 +87,27 @@ public:
     bool containsVariables() override;
     Expression* substitute(string variable, Value* value) override;
     Expression* simplify() override;
-    string toString() override;
+    void write(ostream &out, bool open) override;
+    size_t nodeCount() override;
+    StructuralHash structuralHash() override;
+};
+
+/*
+ BigNumber is an integer literal too large to fit in a Number
+ */
+class BigNumber : public Expression {
+public:
+    
+    BigIntValue* value;
+    BigNumber(BigIntValue* inputValue);
+    bool equals(Expression *expr) override;
+    Value* evaluate() override;
+    bool containsVariables() override;
+    Expression* substitute(string variable, Value* value) override;
+    Expression* simplify() override;
+    void write(ostream &out, bool open) override;
+    size_t nodeCount() override;
+    StructuralHash structuralHash() override;
 };
 
 /*
@@ -59,9 +123,19 @@ public:
     bool containsVariables() override;
     Expression* substitute(string variable, Value* value) override;
     Expression* simplify() override;
-    string toString() override;
+    void write(ostream &out, bool open) override;
+    size_t nodeCount() override;
+    StructuralHash structuralHash() override;
 };
 
+/*
+ What a `+` or `*` node has learned about its operands from being evaluated in a context that specializes nodes (see feedback.hpp).  A node starts UNSPECIALIZED, and the first time it is evaluated it becomes INT_INT if both operands were ints and GENERIC otherwise.  An INT_INT node that sees anything else goes GENERIC for good.
+ */
+enum Specialization { UNSPECIALIZED, INT_INT, GENERIC };
+
+//what an INT_INT node found its operands to be, defined in feedback.cpp
+struct NodeShape;
+
 /*
  Add is responsible for coordinating the left hand side and right hand sife of a '+'
  */
@@ -70,6 +144,10 @@ public:
     
     Expression *leftHandSide;
     Expression *rightHandSide;
+    size_t nodes;
+    StructuralHash hash;
+    atomic<Specialization> specialization;
+    atomic<NodeShape*> shape;
     
     Add(Expression *lhs, Expression *rhs);
     bool equals(Expression *expr) override;
@@ -77,7 +155,10 @@ public:
     bool containsVariables() override;
     Expression* substitute(string variable, Value* value) override;
     Expression* simplify() override;
-    string toString() override;
+    void write(ostream &out, bool open) override;
+    Precedence precedence() override;
+    size_t nodeCount() override;
+    StructuralHash structuralHash() override;
 };
 
 /*
@@ -88,6 +169,10 @@ public:
     
     Expression *leftHandSide;
     Expression *rightHandSide;
+    size_t nodes;
+    StructuralHash hash;
+    atomic<Specialization> specialization;
+    atomic<NodeShape*> shape;
        
     Multiply(Expression *lhs, Expression *rhs);
     bool equals(Expression *expr) override;
@@ -95,7 +180,10 @@ public:
     bool containsVariables() override;
     Expression* substitute(string variable, Value* value) override;
     Expression* simplify() override;
-    string toString() override;
+    void write(ostream &out, bool open) override;
+    Precedence precedence() override;
+    size_t nodeCount() override;
+    StructuralHash structuralHash() override;
 };
 
 class BoolExpression : public Expression {
@@ -108,7 +196,27 @@ public:
     bool containsVariables() override;
     Expression * substitute(string variable, Value *value) override;
     Expression* simplify() override;
-    string toString() override;
+    void write(ostream &out, bool open) override;
+    size_t nodeCount() override;
+    StructuralHash structuralHash() override;
+};
+
+/*
+ ThunkExpression is a use of a lazy `_let` variable.  Evaluating it forces the binding's ThunkValue.
+ */
+class ThunkExpression : public Expression {
+public:
+    ThunkValue* thunk;
+    
+    ThunkExpression(ThunkValue* delayed);
+    bool equals(Expression *expr) override;
+    Value* evaluate() override;
+    bool containsVariables() override;
+    Expression* substitute(string variable, Value* value) override;
+    Expression* simplify() override;
+    void write(ostream &out, bool open) override;
+    size_t nodeCount() override;
+    StructuralHash structuralHash() override;
 };
 
 class LetExpression : public Expression {
@@ -116,6 +224,8 @@ public:
     Variable* subVariable;
     Expression* subExpression;
     Expression* subBody;
+    size_t nodes;
+    StructuralHash hash;
     
     LetExpression(Variable* substituteVariable, Expression* substituteExpression, Expression* substituteBody);
     bool equals(Expression *expr) override;
@@ -123,7 +233,109 @@ public:
     bool containsVariables() override;
     Expression* substitute(string variable, Value* value) override;
     Expression* simplify() override;
-    string toString() override;
+    void write(ostream &out, bool open) override;
+    bool extendsRight() override;
+    size_t nodeCount() override;
+    StructuralHash structuralHash() override;
+};
+
+/*
+ EqualsExpression is `lhs == rhs`.  It evaluates both sides and is `_true` when their values are equal, so comparing a number with a boolean is `_false` rather than an error.
+ */
+class EqualsExpression : public Expression {
+public:
+    Expression* leftHandSide;
+    Expression* rightHandSide;
+    size_t nodes;
+    StructuralHash hash;
+    
+    EqualsExpression(Expression* lhs, Expression* rhs);
+    bool equals(Expression *expr) override;
+    Value* evaluate() override;
+    bool containsVariables() override;
+    Expression* substitute(string variable, Value* value) override;
+    Expression* simplify() override;
+    void write(ostream &out, bool open) override;
+    Precedence precedence() override;
+    size_t nodeCount() override;
+    StructuralHash structuralHash() override;
+};
+
+/*
+ IfExpression is `_if test _then thenBranch _else elseBranch`.  Only the branch that the test selects is evaluated, and a test that is not a boolean is an error.
+ */
+class IfExpression : public Expression {
+public:
+    Expression* test;
+    Expression* thenBranch;
+    Expression* elseBranch;
+    size_t nodes;
+    StructuralHash hash;
+    
+    IfExpression(Expression* testExpression, Expression* thenExpression, Expression* elseExpression);
+    bool equals(Expression *expr) override;
+    Value* evaluate() override;
+    bool containsVariables() override;
+    Expression* substitute(string variable, Value* value) override;
+    Expression* simplify() override;
+    void write(ostream &out, bool open) override;
+    bool extendsRight() override;
+    size_t nodeCount() override;
+    StructuralHash structuralHash() override;
 };
 
+/*
+ FunExpression is `_fun (formalArgument) body`.  It evaluates to a FunValue that closes over the variables bound around it.
+ */
+class FunExpression : public Expression {
+public:
+    Variable* formalArgument;
+    Expression* body;
+    size_t nodes;
+    StructuralHash hash;
+    
+    FunExpression(Variable* formal, Expression* functionBody);
+    bool equals(Expression *expr) override;
+    Value* evaluate() override;
+    bool containsVariables() override;
+    Expression* substitute(string variable, Value* value) override;
+    Expression* simplify() override;
+    void write(ostream &out, bool open) override;
+    bool extendsRight() override;
+    size_t nodeCount() override;
+    StructuralHash structuralHash() override;
+};
+
+/*
+ CallExpression is `toBeCalled(actualArgument)`.  The function and the argument are evaluated, and then the function's body with its formal argument bound to the argument's value.  Calls in tail position do not grow the C++ stack (see function.hpp).
+ */
+class CallExpression : public Expression {
+public:
+    Expression* toBeCalled;
+    Expression* actualArgument;
+    size_t nodes;
+    StructuralHash hash;
+    
+    CallExpression(Expression* function, Expression* argument);
+    bool equals(Expression *expr) override;
+    Value* evaluate() override;
+    bool containsVariables() override;
+    Expression* substitute(string variable, Value* value) override;
+    Expression* simplify() override;
+    void write(ostream &out, bool open) override;
+    Precedence precedence() override;
+    size_t nodeCount() override;
+    StructuralHash structuralHash() override;
+};
+
+/*
+ Whether `expr` needs parentheses to be parsed back where the grammar wants something binding at least as tightly as `precedence`.  Unless the place is `open`, meaning only the end of the text, a closing parenthesis or a keyword can follow it, an expression that `extendsRight()` needs them as well.  The binary operators associate to the right, so `(1 + 2) + 3` keeps its parentheses and `1 + (2 + 3)` loses them.
+ */
+bool needsParentheses(Expression* expr, Precedence precedence, bool open);
+
+/*
+ Evaluates `expr` like `evaluate()`, but the literals, `+`, `*`, `==` and `_if`s at the top of it are evaluated on TaggedValues, so only the value of the whole is ever allocated
+ */
+TaggedValue evaluateTagged(Expression* expr);
+
 #endif
@@ -0,0 +1,478 @@
+//
+//  feedback.cpp
+//  ParserImproved
+//
+//  Copyright © 2020 MSD Katie Rose. All rights reserved.
+//
+
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <climits>
+#include <typeinfo>
+#include "feedback.hpp"
+#include "context.hpp"
+#include "function.hpp"
+#include "parser.hpp"
+#include "catch.hpp"
+
+/*
+ The two operations a node can specialize, as an int operation and as the operation on any values
+ */
+struct AddOperation {
+    
+    static long long onInts(long long lhs, long long rhs) {
+        
+        return lhs + rhs;
+    }
+    static TaggedValue onValues(TaggedValue lhs, TaggedValue rhs) {
+        
+        return lhs.add(rhs);
+    }
+};
+
+struct MultiplyOperation {
+    
+    static long long onInts(long long lhs, long long rhs) {
+        
+        return lhs * rhs;
+    }
+    static TaggedValue onValues(TaggedValue lhs, TaggedValue rhs) {
+        
+        return lhs.multiply(rhs);
+    }
+};
+
+template <class Operation, class Node>
+static TaggedValue evaluateNode(Node* node, Environment* environment);
+
+/*
+ Evaluates an operand of a node that is being specialized.  The usual evaluators find out what kind of node the operand is with a chain of `dynamic_cast`s; comparing its exact class finds the common ones, literals, variables bound to ints or booleans and other `+` and `*` nodes, more cheaply, and the rest are handed to the usual evaluators.
+ */
+static inline TaggedValue operandValue(Expression* operand, Environment* environment) {
+    
+    const type_info &kind = typeid(*operand);
+    if (kind == typeid(Number)) {
+        
+        return TaggedValue::fromInt(static_cast<Number*>(operand)->value);
+    } else if (kind == typeid(Variable) && environment != nullptr) {
+        
+        TaggedValue value = lookup(environment, static_cast<Variable*>(operand)->name);
+        if (!value.isNull() && !value.isPointer()) {
+            
+            return value;
+        }
+    } else if (kind == typeid(Add)) {
+        
+        EvaluationContext::countStep();
+        return evaluateNode<AddOperation>(static_cast<Add*>(operand), environment);
+    } else if (kind == typeid(Multiply)) {
+        
+        EvaluationContext::countStep();
+        return evaluateNode<MultiplyOperation>(static_cast<Multiply*>(operand), environment);
+    }
+    return environment == nullptr ? evaluateTagged(operand) : evaluateIn(operand, environment);
+}
+
+/*
+ An int is what a NumericValue holds, which an immediate TaggedValue may not
+ */
+static inline bool isInt(TaggedValue value) {
+    
+    return value.isInt() && value.intValue() >= INT_MIN && value.intValue() <= INT_MAX;
+}
+
+enum OperandKind { OTHER_OPERAND, LITERAL_OPERAND, VARIABLE_OPERAND, ADD_OPERAND, MULTIPLY_OPERAND };
+
+/*
+ What an INT_INT node found its operands to be: each operand, the kind of node it is, and for a literal its int.  A shape is made when the node specializes and never changes, so threads read it without locking.  An operand that has been replaced since, by a pass that rewrites in place, does not match its shape and is dispatched as if there were none.
+ */
+struct NodeShape {
+    Expression* operands[2];
+    OperandKind kinds[2];
+    long long literals[2];
+};
+
+static OperandKind kindOf(Expression* operand) {
+    
+    const type_info &kind = typeid(*operand);
+    if (kind == typeid(Number)) {
+        
+        return LITERAL_OPERAND;
+    } else if (kind == typeid(Variable)) {
+        
+        return VARIABLE_OPERAND;
+    } else if (kind == typeid(Add)) {
+        
+        return ADD_OPERAND;
+    } else if (kind == typeid(Multiply)) {
+        
+        return MULTIPLY_OPERAND;
+    }
+    return OTHER_OPERAND;
+}
+
+template <class Node>
+static NodeShape* shapeOf(Node* node) {
+    
+    NodeShape* shape = new NodeShape;
+    shape->operands[0] = node->leftHandSide;
+    shape->operands[1] = node->rightHandSide;
+    for (int side = 0; side < 2; side++) {
+        
+        shape->kinds[side] = kindOf(shape->operands[side]);
+        shape->literals[side] = shape->kinds[side] == LITERAL_OPERAND ? static_cast<Number*>(shape->operands[side])->value : 0;
+    }
+    return shape;
+}
+
+/*
+ Evaluates the operand on `side` of an INT_INT node by what its shape says the operand is, so it is not told apart by its class again, and a literal's int is read from the shape
+ */
+static inline TaggedValue shapedOperand(NodeShape* shape, int side, Expression* operand, Environment* environment) {
+    
+    if (shape != nullptr && shape->operands[side] == operand) {
+        
+        switch (shape->kinds[side]) {
+            
+            case LITERAL_OPERAND:
+                return TaggedValue::fromInt(shape->literals[side]);
+            case VARIABLE_OPERAND: {
+                
+                if (environment != nullptr) {
+                    
+                    TaggedValue value = lookup(environment, static_cast<Variable*>(operand)->name);
+                    if (!value.isNull() && !value.isPointer()) {
+                        
+                        return value;
+                    }
+                }
+                break;
+            }
+            case ADD_OPERAND:
+                EvaluationContext::countStep();
+                return evaluateNode<AddOperation>(static_cast<Add*>(operand), environment);
+            case MULTIPLY_OPERAND:
+                EvaluationContext::countStep();
+                return evaluateNode<MultiplyOperation>(static_cast<Multiply*>(operand), environment);
+            case OTHER_OPERAND:
+                return environment == nullptr ? evaluateTagged(operand) : evaluateIn(operand, environment);
+        }
+    }
+    return operandValue(operand, environment);
+}
+
+/*
+ Leaves `node` GENERIC after INT_INT saw `lhs` and `rhs`, and finishes with them
+ */
+template <class Operation, class Node>
+static TaggedValue deoptimize(Node* node, TaggedValue lhs, TaggedValue rhs) {
+    
+    node->specialization.store(GENERIC, memory_order_relaxed);
+    EvaluationContext* context = EvaluationContext::current();
+    if (context != nullptr) {
+        
+        context->deoptimizations++;
+    }
+    return Operation::onValues(lhs, rhs);
+}
+
+template <class Operation, class Node>
+static TaggedValue evaluateNode(Node* node, Environment* environment) {
+    
+    Specialization specialization = node->specialization.load(memory_order_acquire);
+    if (specialization == INT_INT) {
+        
+        //a node copied by substitute() has no shape of its own until its first evaluation
+        NodeShape* shape = node->shape.load(memory_order_acquire);
+        TaggedValue lhs = shapedOperand(shape, 0, node->leftHandSide, environment);
+        TaggedValue rhs = shapedOperand(shape, 1, node->rightHandSide, environment);
+        if (isInt(lhs) && isInt(rhs)) {
+            
+            if (shape == nullptr) {
+                
+                node->shape.store(shapeOf(node), memory_order_release);
+            }
+            //the sum or product of two ints always fits a long long
+            return TaggedValue::fromInt(Operation::onInts(lhs.intValue(), rhs.intValue()));
+        }
+        return deoptimize<Operation>(node, lhs, rhs);
+    }
+    TaggedValue lhs = operandValue(node->leftHandSide, environment);
+    TaggedValue rhs = operandValue(node->rightHandSide, environment);
+    if (specialization == UNSPECIALIZED) {
+        
+        if (isInt(lhs) && isInt(rhs)) {
+            
+            //the shape is complete before any thread can see the node as INT_INT
+            node->shape.store(shapeOf(node), memory_order_release);
+            node->specialization.store(INT_INT, memory_order_release);
+            EvaluationContext* context = EvaluationContext::current();
+            if (context != nullptr) {
+                
+                context->specializations++;
+            }
+        } else {
+            
+            node->specialization.store(GENERIC, memory_order_relaxed);
+        }
+    }
+    return Operation::onValues(lhs, rhs);
+}
+
+TaggedValue evaluateWithFeedback(Add* node, Environment* environment) {
+    
+    return evaluateNode<AddOperation>(node, environment);
+}
+
+TaggedValue evaluateWithFeedback(Multiply* node, Environment* environment) {
+    
+    return evaluateNode<MultiplyOperation>(node, environment);
+}
+
+/* for tests */
+static Expression *parse_str(string s) {
+    std::istringstream in(s);
+    return parse(in);
+}
+
+/* for tests: the body of `_fun (x) ...`, with its FunValue in `function` */
+static Expression* bodyOf(string s, Value* &function) {
+    
+    FunExpression* fun = dynamic_cast<FunExpression*>(parse_str(s));
+    function = fun->evaluate();
+    return fun->body;
+}
+
+/* for tests: the message evaluating `s` throws, or "" */
+static string errorOf(string s) {
+    
+    try {
+        
+        parse_str(s)->evaluate();
+    } catch (runtime_error &error) {
+        
+        return error.what();
+    }
+    return "";
+}
+
+TEST_CASE( "node specialization" ) {
+    
+    SECTION( "nodes only change in a context that asks for it" ) {
+        
+        Add* add = dynamic_cast<Add*>(parse_str("1 + 2"));
+        CHECK( add->evaluate()->toString() == "3" );
+        CHECK( add->specialization == UNSPECIALIZED );
+        
+        EvaluationContext context;
+        EvaluationScope scope(&context);
+        CHECK( add->evaluate()->toString() == "3" );
+        CHECK( add->specialization == UNSPECIALIZED );
+        CHECK( context.specializations == 0 );
+    }
+    SECTION( "int operands specialize the node" ) {
+        
+        EvaluationContext context;
+        context.specializeNodes = true;
+        EvaluationScope scope(&context);
+        
+        Value* function;
+        Multiply* constantRight = dynamic_cast<Multiply*>(bodyOf("_fun (x) x * 3", function));
+        CHECK( callFunction(function, new NumericValue(4))->toString() == "12" );
+        CHECK( constantRight->specialization == INT_INT );
+        CHECK( callFunction(function, new NumericValue(5))->toString() == "15" );
+        
+        Multiply* ints = dynamic_cast<Multiply*>(bodyOf("_fun (x) x * x", function));
+        CHECK( callFunction(function, new NumericValue(3))->toString() == "9" );
+        CHECK( ints->specialization == INT_INT );
+        
+        //a result too large for an int is not a different kind of operand
+        CHECK( callFunction(function, new NumericValue(100000))->toString() == "10000000000" );
+        CHECK( ints->specialization == INT_INT );
+        
+        //operands that are `+` and `*` nodes are evaluated, and specialized, by way of the node above them
+        Add* sum = dynamic_cast<Add*>(bodyOf("_fun (x) 2 * x + x * x", function));
+        CHECK( callFunction(function, new NumericValue(4))->toString() == "24" );
+        CHECK( dynamic_cast<Multiply*>(sum->leftHandSide)->specialization == INT_INT );
+        CHECK( dynamic_cast<Multiply*>(sum->rightHandSide)->specialization == INT_INT );
+        CHECK( sum->specialization == INT_INT );
+        CHECK( context.specializations == 5 );
+        CHECK( context.deoptimizations == 0 );
+    }
+    SECTION( "an INT_INT node keeps the shape of its operands" ) {
+        
+        EvaluationContext context;
+        context.specializeNodes = true;
+        EvaluationScope scope(&context);
+        
+        Value* function;
+        Add* add = dynamic_cast<Add*>(bodyOf("_fun (x) x * 2 + 5", function));
+        CHECK( add->shape.load() == nullptr );
+        CHECK( callFunction(function, new NumericValue(1))->toString() == "7" );
+        CHECK( add->shape.load() != nullptr );
+        CHECK( dynamic_cast<Multiply*>(add->leftHandSide)->shape.load() != nullptr );
+        CHECK( callFunction(function, new NumericValue(3))->toString() == "11" );
+        
+        //a copy made by substitution starts INT_INT and makes a shape of its own on its first evaluation
+        Add* copy = dynamic_cast<Add*>(add->substitute("x", new NumericValue(4)));
+        CHECK( copy->specialization == INT_INT );
+        CHECK( copy->shape.load() == nullptr );
+        CHECK( copy->evaluate()->toString() == "13" );
+        CHECK( copy->shape.load() != nullptr );
+        CHECK( context.deoptimizations == 0 );
+    }
+    SECTION( "operands rewritten in place are evaluated as what they are now" ) {
+        
+        EvaluationContext context;
+        context.specializeNodes = true;
+        EvaluationScope scope(&context);
+        
+        Value* function;
+        Add* add = dynamic_cast<Add*>(bodyOf("_fun (x) x + 1", function));
+        CHECK( callFunction(function, new NumericValue(1))->toString() == "2" );
+        CHECK( add->specialization == INT_INT );
+        add->rightHandSide = new Multiply(new Variable("x"), new Number(10));
+        CHECK( callFunction(function, new NumericValue(2))->toString() == "22" );
+        add->rightHandSide = new BoolExpression(true);
+        CHECK_THROWS_WITH( callFunction(function, new NumericValue(2)), errorOf("2 + _true") );
+        CHECK( add->specialization == GENERIC );
+    }
+    SECTION( "other operands deoptimize the node for good" ) {
+        
+        EvaluationContext context;
+        context.specializeNodes = true;
+        EvaluationScope scope(&context);
+        
+        Value* function;
+        Add* add = dynamic_cast<Add*>(bodyOf("_fun (x) x + 1", function));
+        CHECK( callFunction(function, new NumericValue(1))->toString() == "2" );
+        CHECK( add->specialization == INT_INT );
+        CHECK( callFunction(function, BigIntValue::fromDigits("99999999999999999999"))->toString() == "100000000000000000000" );
+        CHECK( add->specialization == GENERIC );
+        CHECK( context.deoptimizations == 1 );
+        CHECK( callFunction(function, new NumericValue(1))->toString() == "2" );
+        CHECK( add->specialization == GENERIC );
+        
+        Multiply* multiply = dynamic_cast<Multiply*>(bodyOf("_fun (x) x * x", function));
+        CHECK( callFunction(function, new NumericValue(2))->toString() == "4" );
+        string expected = errorOf("_true * _true");
+        CHECK_THROWS_WITH( callFunction(function, new BoolValue(true)), expected );
+        CHECK( multiply->specialization == GENERIC );
+        CHECK( context.deoptimizations == 2 );
+    }
+    SECTION( "errors are the same as without specializing" ) {
+        
+        string expected = errorOf("_true + 1");
+        EvaluationContext context;
+        context.specializeNodes = true;
+        EvaluationScope scope(&context);
+        Add* add = dynamic_cast<Add*>(parse_str("_true + 1"));
+        CHECK_THROWS_WITH( add->evaluate(), expected );
+        CHECK( add->specialization == GENERIC );
+        CHECK( context.specializations == 0 );
+    }
+    SECTION( "substitution keeps what a node has learned" ) {
+        
+        EvaluationContext context;
+        context.specializeNodes = true;
+        EvaluationScope scope(&context);
+        Add* add = dynamic_cast<Add*>(parse_str("x + 1"));
+        CHECK( add->substitute("x", new NumericValue(1))->evaluate()->toString() == "2" );
+        CHECK( add->specialization == UNSPECIALIZED );
+        add->specialization = INT_INT;
+        Add* copy = dynamic_cast<Add*>(add->substitute("x", new NumericValue(2)));
+        CHECK( copy->specialization == INT_INT );
+        CHECK( copy->evaluate()->toString() == "3" );
+    }
+    SECTION( "results match evaluation without specializing" ) {
+        
+        vector<string> programs = {
+            "_let x = 3 _in x * x + 2 * x + 1",
+            "_let f = _fun (x) x * 2 + 1 _in f(f(f(1)))",
+            "_let f = _fun (x) x * x _in f(1000000) + f(3)",
+            "_let f = _fun (x) _if x == 1 _then _true _else x + 1 _in f(2) == 3",
+            "(2 + 3) * (4 + 5) * 99999999999",
+        };
+        for (string program : programs) {
+            
+            Expression* expr = parse_str(program);
+            Value* expected = expr->evaluate();
+            EvaluationContext context;
+            context.specializeNodes = true;
+            EvaluationScope scope(&context);
+            CHECK( expr->evaluate()->equals(expected) );
+            CHECK( expr->evaluate()->equals(expected) );
+        }
+    }
+}
+
+/* for tests: the time in milliseconds to call `function` `calls` times with arguments from 1 to 100 */
+static double timeCalls(Value* function, int calls) {
+    
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 1; i <= calls; i++) {
+        
+        callFunction(function, new NumericValue(i % 100 + 1));
+    }
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/* for tests: leaves every `+` and `*` node of `expr` GENERIC, as if each had seen something other than ints */
+static void generalize(Expression* expr) {
+    
+    if (Add* add = dynamic_cast<Add*>(expr)) {
+        
+        add->specialization = GENERIC;
+        generalize(add->leftHandSide);
+        generalize(add->rightHandSide);
+    } else if (Multiply* multiply = dynamic_cast<Multiply*>(expr)) {
+        
+        multiply->specialization = GENERIC;
+        generalize(multiply->leftHandSide);
+        generalize(multiply->rightHandSide);
+    }
+}
+
+TEST_CASE( "node specialization benchmark", "[.benchmark]" ) {
+    
+    //a function body of 160 operations, most of them on a literal, evaluated without feedback, with every node GENERIC, and specialized
+    string body = "0";
+    for (int i = 1; i <= 40; i++) {
+        
+        body += " + (x * " + to_string(i) + " + " + to_string(i) + ") * x";
+    }
+    Value* generic;
+    generalize(bodyOf("_fun (x) " + body, generic));
+    Value* polynomial;
+    bodyOf("_fun (x) " + body, polynomial);
+    double plainPolynomial = timeCalls(polynomial, 100000);
+    {
+        EvaluationContext context;
+        context.specializeNodes = true;
+        EvaluationScope scope(&context);
+        double genericPolynomial = timeCalls(generic, 100000);
+        double specializedPolynomial = timeCalls(polynomial, 100000);
+        cout << "100000 calls of a 160-operation polynomial: " << plainPolynomial << " ms, GENERIC " << genericPolynomial << " ms, specialized "
+             << specializedPolynomial << " ms, " << genericPolynomial / specializedPolynomial << "x over GENERIC, " << context.specializations
+             << " specializations, " << context.deoptimizations << " deoptimizations\n";
+    }
+    
+    //a loop of 1000000 iterations with an accumulator that outgrows an int partway
+    Expression* program = parse_str("_let loop = _fun (f) _fun (n) _fun (total) _if n == 1000000 _then total _else f(f)(n + 1)(total + (n * 3 + 2) * (n + 7))"
+                                     " _in loop(loop)(0)(0)");
+    auto start = std::chrono::steady_clock::now();
+    Value* expected = program->evaluate();
+    double plainMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    
+    EvaluationContext context;
+    context.specializeNodes = true;
+    EvaluationScope scope(&context);
+    start = std::chrono::steady_clock::now();
+    Value* result = program->evaluate();
+    double specializedMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    CHECK( result->equals(expected) );
+    cout << "loop of 1000000 iterations: " << plainMilliseconds << " ms, specialized " << specializedMilliseconds << " ms, "
+         << plainMilliseconds / specializedMilliseconds << "x, " << context.specializations << " specializations, "
+         << context.deoptimizations << " deoptimizations\n";
+}
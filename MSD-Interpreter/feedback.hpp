@@ -0,0 +1,22 @@
+//
+//  feedback.hpp
+//  ParserImproved
+//
+//  Copyright © 2020 MSD Katie Rose. All rights reserved.
+//
+
+#ifndef feedback_hpp
+#define feedback_hpp
+
+#include <stdio.h>
+#include "expression.hpp"
+
+using namespace std;
+
+/*
+ Evaluates `node` by way of its Specialization, with the variables of `environment` bound, or with the operands evaluated by `evaluateTagged()` when `environment` is nullptr.  `Add::evaluate()`, `Multiply::evaluate()` and `evaluateIn()` come here when the installed context has `specializeNodes` set, so a tree that is evaluated many times, like the body of a `_fun`, learns which of its nodes only ever see ints.  Those nodes then add or multiply the ints directly.  The operands of every node evaluated here are told apart by their exact class instead of the usual chain of `dynamic_cast`s, and `+` and `*` operands are evaluated here too, so an arithmetic subtree is evaluated without the usual dispatch.  An INT_INT node also keeps the shape of its operands, which kind of node each one is and the int of a literal, so it evaluates them without telling them apart again; an operand replaced in place no longer matches the shape and is told apart the usual way.  INT_INT nodes still test that the operands are ints, and a node whose test fails finishes the evaluation it is in the usual way and stays GENERIC afterwards, so results and errors are the same as without specializing.  Changes of state are single atomic stores, so a tree can be evaluated on several threads at once.
+ */
+TaggedValue evaluateWithFeedback(Add* node, Environment* environment);
+TaggedValue evaluateWithFeedback(Multiply* node, Environment* environment);
+
+#endif /* feedback_hpp */
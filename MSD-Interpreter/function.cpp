@@ -0,0 +1,633 @@
+//
+//  function.cpp
+//  ParserImproved
+//
+//  Copyright © 2020 MSD Katie Rose. All rights reserved.
+//
+
+#include <chrono>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include "function.hpp"
+#include "cache.hpp"
+#include "context.hpp"
+#include "cse.hpp"
+#include "feedback.hpp"
+#include "inliner.hpp"
+#include "parser.hpp"
+#include "catch.hpp"
+
+void* Environment::operator new(size_t size) {
+    
+    EvaluationContext::countBytes(size);
+    return ::operator new(size);
+}
+
+TaggedValue lookup(Environment* environment, const string &name) {
+    
+    for (; environment != nullptr; environment = environment->next) {
+        
+        if (environment->variable->name == name) {
+            
+            return environment->value;
+        }
+    }
+    return { 0 };
+}
+
+Expression* closeOver(Expression* expr, Environment* environment) {
+    
+    set<string> shadowed;
+    for (; environment != nullptr; environment = environment->next) {
+        
+        if (shadowed.insert(environment->variable->name).second) {
+            
+            expr = expr->substitute(environment->variable->name, environment->value.toValue());
+        }
+    }
+    return expr;
+}
+
+static FunValue* asFunction(Value* value) {
+    
+    FunValue* function = dynamic_cast<FunValue*>(value);
+    if (function == nullptr) {
+        
+        throw runtime_error("not a function: " + value->toString());
+    }
+    return function;
+}
+
+MemoTable::MemoTable(size_t maxEntries) {
+    
+    this->capacity = maxEntries;
+}
+
+const vector<Variable*> &MemoTable::capturedBy(FunExpression* function) {
+    
+    auto found = this->captured.find(function);
+    if (found != this->captured.end()) {
+        
+        return found->second;
+    }
+    if (this->captured.size() >= this->capacity) {
+        
+        this->captured.clear();
+    }
+    std::set<string> names;
+    freeVariables(function, names);
+    vector<Variable*> &variables = this->captured[function];
+    for (const string &name : names) {
+        
+        variables.push_back(new Variable(name));
+    }
+    return variables;
+}
+
+/*
+ Mixes `value`'s hash into `hash`, consistently with sameValue(), or returns false for values that cannot be hashed without evaluating them
+ */
+static bool hashValue(TaggedValue value, uint64_t &hash) {
+    
+    auto mix = [&hash](uint64_t word) {
+        hash = (hash ^ word) * 0x100000001b3ULL;
+        hash ^= hash >> 29;
+    };
+    if (!value.isPointer()) {
+        
+        //the encoding is canonical, so an integer or a boolean is its word
+        mix(value.bits);
+        return true;
+    }
+    if (BigIntValue* big = dynamic_cast<BigIntValue*>(value.pointer())) {
+        
+        mix(2 + big->negative);
+        for (uint32_t limb : big->limbs) {
+            
+            mix(limb);
+        }
+    } else if (FunValue* function = dynamic_cast<FunValue*>(value.pointer())) {
+        
+        mix((uint64_t)(uintptr_t)function->function);
+        mix((uint64_t)(uintptr_t)function->environment);
+    } else {
+        
+        return false;
+    }
+    return true;
+}
+
+bool MemoTable::keyFor(FunValue* callee, TaggedValue argument, MemoKey &key) {
+    
+    key.function = callee->function;
+    key.hash = (0xcbf29ce484222325ULL ^ (uint64_t)(uintptr_t)callee->function) * 0x100000001b3ULL;
+    key.values.clear();
+    for (Variable* variable : capturedBy(callee->function)) {
+        
+        //a closure made by substitution has its captured values in its body already, and then it has no environment
+        TaggedValue value = ::lookup(callee->environment, variable->name);
+        if (!value.isNull() && !hashValue(value, key.hash)) {
+            
+            return false;
+        }
+        key.values.push_back(value);
+    }
+    key.values.push_back(argument);
+    return hashValue(argument, key.hash);
+}
+
+/*
+ `==` throws for functions, but a closure of the same `_fun` in the same environment is certainly the same argument
+ */
+static bool sameValue(TaggedValue lhs, TaggedValue rhs) {
+    
+    FunValue* lhsFunction = lhs.isPointer() ? dynamic_cast<FunValue*>(lhs.pointer()) : nullptr;
+    FunValue* rhsFunction = rhs.isPointer() ? dynamic_cast<FunValue*>(rhs.pointer()) : nullptr;
+    if (lhsFunction != nullptr || rhsFunction != nullptr) {
+        
+        return lhsFunction != nullptr && rhsFunction != nullptr && lhsFunction->function == rhsFunction->function && lhsFunction->environment == rhsFunction->environment;
+    }
+    return lhs.equals(rhs);
+}
+
+static bool sameKey(const MemoKey &lhs, const MemoKey &rhs) {
+    
+    if (lhs.function != rhs.function) {
+        
+        return false;
+    }
+    for (size_t i = 0; i < lhs.values.size(); i++) {
+        
+        if (lhs.values[i].bits != rhs.values[i].bits && (lhs.values[i].isNull() || rhs.values[i].isNull() || !sameValue(lhs.values[i], rhs.values[i]))) {
+            
+            return false;
+        }
+    }
+    return true;
+}
+
+TaggedValue MemoTable::lookup(const MemoKey &key) {
+    
+    auto candidates = this->index.equal_range(key.hash);
+    for (auto found = candidates.first; found != candidates.second; found++) {
+        
+        if (sameKey(found->second->key, key)) {
+            
+            this->entries.splice(this->entries.begin(), this->entries, found->second);
+            return found->second->result;
+        }
+    }
+    return { 0 };
+}
+
+bool MemoTable::insert(const MemoKey &key, TaggedValue result) {
+    
+    if (this->capacity == 0) {
+        
+        return false;
+    }
+    bool evicted = false;
+    if (this->entries.size() >= this->capacity) {
+        
+        list<Entry>::iterator last = prev(this->entries.end());
+        auto candidates = this->index.equal_range(last->key.hash);
+        for (auto found = candidates.first; found != candidates.second; found++) {
+            
+            if (found->second == last) {
+                
+                this->index.erase(found);
+                break;
+            }
+        }
+        this->entries.erase(last);
+        evicted = true;
+    }
+    this->entries.push_front({ key, result });
+    this->index.insert({ key.hash, this->entries.begin() });
+    return evicted;
+}
+
+size_t MemoTable::size() {
+    
+    return this->entries.size();
+}
+
+/*
+ The keys of the calls in a tail chain, which all get the chain's result once it is known.  Only the last `memoCapacity` are kept, since recording more would only evict the earlier ones again, so once `keys` is full each new key replaces the oldest, at `oldest`.
+ */
+struct PendingCalls {
+    vector<MemoKey> keys;
+    size_t oldest;
+    
+    PendingCalls() {
+        
+        this->oldest = 0;
+    }
+};
+
+/*
+ Starts calling `callee` with `argument` by pointing `expr` and `environment` at its body, unless the installed context has its result memoized, which is returned instead
+ */
+static TaggedValue enterCall(FunValue* callee, TaggedValue argument, Expression* &expr, Environment* &environment, PendingCalls &pending) {
+    
+    EvaluationContext* context = EvaluationContext::current();
+    if (context != nullptr && context->memoizeCalls) {
+        
+        lock_guard<mutex> guard(context->memoLock);
+        if (context->memoTable == nullptr) {
+            
+            context->memoTable = new MemoTable(context->memoCapacity);
+        }
+        MemoKey key;
+        if (context->memoTable->keyFor(callee, argument, key)) {
+            
+            TaggedValue remembered = context->memoTable->lookup(key);
+            if (!remembered.isNull()) {
+                
+                context->memoHits++;
+                return remembered;
+            }
+            context->memoMisses++;
+            if (pending.keys.size() < context->memoCapacity) {
+                
+                pending.keys.push_back(move(key));
+            } else if (context->memoCapacity > 0) {
+                
+                pending.keys[pending.oldest] = move(key);
+                pending.oldest = (pending.oldest + 1) % pending.keys.size();
+                context->memoEvictions++;
+            }
+        }
+    }
+    environment = new Environment{ callee->function->formalArgument, argument, callee->environment };
+    expr = callee->function->body;
+    return { 0 };
+}
+
+static TaggedValue evaluateLoop(Expression* expr, Environment* environment, PendingCalls &pending) {
+    
+    while (true) {
+        
+        if (Variable* variable = dynamic_cast<Variable*>(expr)) {
+            
+            TaggedValue value = lookup(environment, variable->name);
+            if (value.isNull()) {
+                
+                throw runtime_error((string)"Incomplete substitution");
+            }
+            if (value.isPointer()) {
+                
+                if (ThunkValue* thunk = dynamic_cast<ThunkValue*>(value.pointer())) {
+                    
+                    return TaggedValue::of(thunk->force());
+                }
+            }
+            return value;
+        } else if (Add* add = dynamic_cast<Add*>(expr)) {
+            
+            EvaluationContext* context = EvaluationContext::countStep();
+            if (context != nullptr && context->specializeNodes) {
+                
+                return evaluateWithFeedback(add, environment);
+            }
+            TaggedValue lhs = evaluateIn(add->leftHandSide, environment);
+            return lhs.add(evaluateIn(add->rightHandSide, environment));
+        } else if (Multiply* multiply = dynamic_cast<Multiply*>(expr)) {
+            
+            EvaluationContext* context = EvaluationContext::countStep();
+            if (context != nullptr && context->specializeNodes) {
+                
+                return evaluateWithFeedback(multiply, environment);
+            }
+            TaggedValue lhs = evaluateIn(multiply->leftHandSide, environment);
+            return lhs.multiply(evaluateIn(multiply->rightHandSide, environment));
+        } else if (Number* number = dynamic_cast<Number*>(expr)) {
+            
+            return TaggedValue::fromInt(number->value);
+        } else if (BoolExpression* boolean = dynamic_cast<BoolExpression*>(expr)) {
+            
+            return TaggedValue::fromBool(boolean->boolean);
+        } else if (dynamic_cast<BigNumber*>(expr) != nullptr || dynamic_cast<ThunkExpression*>(expr) != nullptr) {
+            
+            return TaggedValue::of(expr->evaluate());
+        } else if (EqualsExpression* comparison = dynamic_cast<EqualsExpression*>(expr)) {
+            
+            EvaluationContext::countStep();
+            TaggedValue lhs = evaluateIn(comparison->leftHandSide, environment);
+            return TaggedValue::fromBool(lhs.equals(evaluateIn(comparison->rightHandSide, environment)));
+        } else if (LetExpression* let = dynamic_cast<LetExpression*>(expr)) {
+            
+            EvaluationContext::countStep();
+            TaggedValue bound;
+            EvaluationContext* context = EvaluationContext::current();
+            if (context != nullptr && context->lazyLet) {
+                
+                bound = TaggedValue::of(new ThunkValue(closeOver(let->subExpression, environment)));
+                context->lazyBindings++;
+            } else {
+                
+                bound = evaluateIn(let->subExpression, environment);
+            }
+            environment = new Environment{ let->subVariable, bound, environment };
+            expr = let->subBody;
+        } else if (IfExpression* conditional = dynamic_cast<IfExpression*>(expr)) {
+            
+            EvaluationContext::countStep();
+            TaggedValue test = evaluateIn(conditional->test, environment);
+            if (!test.isBool()) {
+                
+                throw runtime_error("_if test is not a boolean");
+            }
+            expr = test.boolValue() ? conditional->thenBranch : conditional->elseBranch;
+        } else if (FunExpression* function = dynamic_cast<FunExpression*>(expr)) {
+            
+            return TaggedValue::of(new FunValue(function, environment));
+        } else if (CallExpression* call = dynamic_cast<CallExpression*>(expr)) {
+            
+            //a tail call: the callee's body replaces this expression instead of being evaluated by a nested call
+            EvaluationContext::countStep();
+            FunValue* callee = asFunction(evaluateIn(call->toBeCalled, environment).toValue());
+            TaggedValue argument = evaluateIn(call->actualArgument, environment);
+            TaggedValue remembered = enterCall(callee, argument, expr, environment, pending);
+            if (!remembered.isNull()) {
+                
+                return remembered;
+            }
+        } else {
+            
+            //anything this loop does not know about is evaluated the usual way
+            return TaggedValue::of(closeOver(expr, environment)->evaluate());
+        }
+    }
+}
+
+/*
+ Records `result` for every call that was waiting for it
+ */
+static TaggedValue finishCalls(TaggedValue result, PendingCalls &pending) {
+    
+    EvaluationContext* context = EvaluationContext::current();
+    lock_guard<mutex> guard(context->memoLock);
+    for (MemoKey &key : pending.keys) {
+        
+        if (context->memoTable->insert(key, result)) {
+            
+            context->memoEvictions++;
+        }
+    }
+    return result;
+}
+
+TaggedValue evaluateIn(Expression* expr, Environment* environment) {
+    
+    PendingCalls pending;
+    TaggedValue result = evaluateLoop(expr, environment, pending);
+    return pending.keys.empty() ? result : finishCalls(result, pending);
+}
+
+Value* callFunction(Value* function, Value* argument) {
+    
+    PendingCalls pending;
+    Expression* body;
+    Environment* environment;
+    TaggedValue remembered = enterCall(asFunction(function), TaggedValue::of(argument), body, environment, pending);
+    if (!remembered.isNull()) {
+        
+        return remembered.toValue();
+    }
+    TaggedValue result = evaluateLoop(body, environment, pending);
+    return (pending.keys.empty() ? result : finishCalls(result, pending)).toValue();
+}
+
+/* for tests */
+static Expression *parse_str(string s) {
+    std::istringstream in(s);
+    return parse(in);
+}
+
+/* for tests: counts up from `start` to `limit` with self-application, every call a tail call */
+static string countingLoop(long limit) {
+    
+    return "_let count = _fun (f) _fun (n) _if n == " + to_string(limit) + " _then n _else f(f)(n + 1) _in count(count)";
+}
+
+TEST_CASE( "functions" ) {
+    
+    CHECK( parse_str("(_fun (x) x + 1)(2)")->evaluate()->equals(new NumericValue(3)) );
+    CHECK( parse_str("_let f = _fun (x) x * x _in f(3) + f(4)")->evaluate()->equals(new NumericValue(25)) );
+    
+    //closures keep the bindings around them, and curried arguments are applied one at a time
+    CHECK( parse_str("_let add = _fun (x) _fun (y) x + y _in _let addFive = add(5) _in addFive(1) + addFive(2)")->evaluate()->equals(new NumericValue(13)) );
+    CHECK( parse_str("_let y = 10 _in _let f = _fun (x) x + y _in _let y = 20 _in f(1)")->evaluate()->equals(new NumericValue(11)) );
+    
+    //the formal argument shadows outer bindings of the same name
+    CHECK( parse_str("_let x = 1 _in (_fun (x) x * 2)(5) + x")->evaluate()->equals(new NumericValue(11)) );
+    CHECK( parse_str("(_fun (f) f(f(1)))(_fun (x) x * 3)")->evaluate()->equals(new NumericValue(9)) );
+    
+    //functions are values, so they can be returned but not added or compared
+    CHECK_THROWS_WITH( parse_str("_let f = _fun (x) x _in f == f")->evaluate(), "comparison of functions not supported" );
+    CHECK_THROWS_WITH( parse_str("1 == _fun (x) x")->evaluate(), "comparison of functions not supported" );
+    CHECK_THROWS_WITH( parse_str("(_fun (x) x) + 1")->evaluate(), "adding of functions not supported" );
+    CHECK_THROWS_WITH( parse_str("5(1)")->evaluate(), "not a function: 5" );
+    CHECK_THROWS_WITH( parse_str("(_fun (x) y)(1)")->evaluate(), "Incomplete substitution" );
+    CHECK( parse_str("(_fun (x) _fun (y) x + y)(2)")->evaluate()->toString() == "_fun (y) 2 + y" );
+    
+    //a million tail calls run in constant stack space
+    Expression* loop = parse_str(countingLoop(1000000) + "(0)");
+    CHECK( loop->evaluate()->equals(new NumericValue(1000000)) );
+    
+    EvaluationContext context;
+    context.stepBudget = 1000;
+    {
+        EvaluationScope scope(&context);
+        CHECK_THROWS_AS( loop->evaluate(), EvaluationLimitError );
+    }
+    
+    CHECK( parse_str("_fun (x) x + 1")->toString() == "_fun (x) x + 1" );
+    CHECK( parse_str("f(1)(2)")->equals(new CallExpression(new CallExpression(new Variable("f"), new Number(1)), new Number(2))) );
+    CHECK( parse_str("_fun (x) x")->structuralHash() != parse_str("_fun (y) y")->structuralHash() );
+    CHECK( parse_str("(_fun (x) x + y)(1)")->substitute("y", new NumericValue(2))->evaluate()->equals(new NumericValue(3)) );
+    CHECK( parse_str("(_fun (y) x + y)(1)")->substitute("y", new NumericValue(2))->equals(parse_str("(_fun (y) x + y)(1)")) );
+}
+
+/* for tests: the `limit`th Fibonacci number by naive recursion, counting up from 0 since there is no subtraction */
+static string fibonacci(int limit) {
+    
+    string last = to_string(limit);
+    return "_let fib = _fun (f) _fun (i) _if i == " + last + " _then 0 _else _if i + 1 == " + last + " _then 1 _else f(f)(i + 1) + f(f)(i + 2) _in fib(fib)(0)";
+}
+
+TEST_CASE( "comparing functions" ) {
+    
+    //sharing equal `_fun`s, as CSE and a ResultCache do, must not change the result of `==`
+    string source = "(_fun (x) x + x * x) == (_fun (x) x + x * x)";
+    CHECK_THROWS_WITH( parse_str(source)->evaluate(), "comparison of functions not supported" );
+    CSEStats stats;
+    Expression* shared = eliminateCommonSubexpressions(parse_str(source), stats);
+    CHECK( stats.hoisted == 1 );
+    CHECK_THROWS_WITH( shared->evaluate(), "comparison of functions not supported" );
+    ResultCache cache(1 << 20, 1);
+    CHECK( interpret(parse_str("(_fun (x) x + x * x)(2)"), &cache)->equals(new NumericValue(6)) );
+    CHECK_THROWS_WITH( interpret(parse_str(source), &cache), "comparison of functions not supported" );
+    CHECK_THROWS_WITH( interpret(parse_str(source), &cache), "comparison of functions not supported" );
+}
+
+TEST_CASE( "memoized calls" ) {
+    
+    Expression* fib = parse_str(fibonacci(20));
+    EvaluationContext plain;
+    Value* expected;
+    {
+        EvaluationScope scope(&plain);
+        expected = fib->evaluate();
+    }
+    CHECK( expected->equals(new NumericValue(6765)) );
+    CHECK( plain.memoHits == 0 );
+    
+    //each `f(f)(i)` is computed once, and every other call to it is a hit
+    EvaluationContext memoized;
+    memoized.memoizeCalls = true;
+    {
+        EvaluationScope scope(&memoized);
+        CHECK( fib->evaluate()->equals(expected) );
+    }
+    CHECK( memoized.memoMisses < 50 );
+    CHECK( memoized.memoHits > 0 );
+    CHECK( memoized.memoHitRate() > 0.4 );
+    CHECK( memoized.steps * 100 < plain.steps );
+    
+    //the table is bounded, and the results stay right when entries are evicted
+    EvaluationContext small;
+    small.memoizeCalls = true;
+    small.memoCapacity = 2;
+    {
+        EvaluationScope scope(&small);
+        CHECK( fib->evaluate()->equals(expected) );
+    }
+    CHECK( small.memoEvictions > 0 );
+    CHECK( small.memoTable->size() <= 2 );
+    
+    //the bound is on all functions together, so fresh `_fun`s cannot grow the table
+    string distinct = "0";
+    for (int i = 0; i < 100; i++) {
+        
+        distinct += " + (_fun (x) x + " + to_string(i) + ")(1)";
+    }
+    EvaluationContext shared;
+    shared.memoizeCalls = true;
+    shared.memoCapacity = 8;
+    {
+        EvaluationScope scope(&shared);
+        CHECK( parse_str(distinct)->evaluate()->equals(new NumericValue(5050)) );
+    }
+    CHECK( shared.memoMisses == 100 );
+    CHECK( shared.memoTable->size() == 8 );
+    CHECK( shared.memoEvictions == 92 );
+    
+    //a long tail chain records only its last `memoCapacity` calls, and calling into that part of it again is a hit
+    EvaluationContext chain;
+    chain.memoizeCalls = true;
+    chain.memoCapacity = 16;
+    {
+        EvaluationScope scope(&chain);
+        CHECK( parse_str(countingLoop(100000) + "(0)")->evaluate()->equals(new NumericValue(100000)) );
+    }
+    CHECK( chain.memoTable->size() == 16 );
+    EvaluationContext again;
+    again.memoizeCalls = true;
+    again.memoCapacity = 16;
+    {
+        EvaluationScope scope(&again);
+        CHECK( parse_str(countingLoop(100000) + "(0) + count(count)(99990)")->evaluate()->equals(new NumericValue(200000)) );
+    }
+    //`count(count)` was evicted by the chain and misses again, and `count(count)(99990)` hits at once
+    CHECK( again.memoMisses == chain.memoMisses + 1 );
+    CHECK( again.memoHits == chain.memoHits + 1 );
+    
+    //captured variables are part of the key, so `add(1)` and `add(2)` do not share results
+    EvaluationContext curried;
+    curried.memoizeCalls = true;
+    {
+        EvaluationScope scope(&curried);
+        CHECK( parse_str("_let add = _fun (x) _fun (y) x + y _in add(1)(5) + add(2)(5) + add(1)(5)")->evaluate()->equals(new NumericValue(19)) );
+        CHECK( parse_str(fibonacci(90))->evaluate()->toString() == "2880067194370816120" );
+    }
+    CHECK( curried.memoHits > 0 );
+    
+    //calls that capture a lazy binding are not memoized rather than forcing it
+    EvaluationContext lazy;
+    lazy.memoizeCalls = true;
+    lazy.lazyLet = true;
+    {
+        EvaluationScope scope(&lazy);
+        CHECK( evaluateIn(parse_str("_let unused = _true + 1 _in _let g = _fun (x) x + 1 _in g(1) + g(1)"), nullptr).equals(TaggedValue::fromInt(4)) );
+    }
+    CHECK( lazy.unforcedBindings() == 1 );
+}
+
+TEST_CASE( "memoized calls benchmark", "[.benchmark]" ) {
+    
+    //without memoization fib(n) makes about 2 * fib(n) calls, so the largest is only run memoized
+    for (int limit : {20, 25, 1000}) {
+        
+        Expression* fib = parse_str(fibonacci(limit));
+        for (bool memoize : {false, true}) {
+            
+            if (!memoize && limit > 25) {
+                
+                continue;
+            }
+            EvaluationContext context;
+            context.memoizeCalls = memoize;
+            auto start = std::chrono::steady_clock::now();
+            Value* result;
+            {
+                EvaluationScope scope(&context);
+                result = fib->evaluate();
+            }
+            double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            cout << "fib(" << limit << ") = " << result->toString() << (memoize ? ", memoized: " : ", plain: ") << milliseconds << " ms, " << context.steps << " steps";
+            if (memoize) {
+                
+                cout << ", " << context.memoHits << " hits, " << context.memoMisses << " misses, hit rate " << context.memoHitRate();
+            }
+            cout << "\n";
+        }
+    }
+}
+
+TEST_CASE( "functions benchmark", "[.benchmark]" ) {
+    
+    const long iterations = 10000000;
+    Expression* counter = parse_str(countingLoop(iterations) + "(0)");
+    EvaluationContext context;
+    auto start = std::chrono::steady_clock::now();
+    Value* result;
+    {
+        EvaluationScope scope(&context);
+        result = counter->evaluate();
+    }
+    double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    CHECK( result->equals(new NumericValue((int)iterations)) );
+    cout << iterations << " tail calls counting up: " << milliseconds << " ms, " << milliseconds * 1e6 / iterations << " ns per iteration, "
+         << context.bytesAllocated / iterations << " bytes allocated per iteration\n";
+}
+
+TEST_CASE( "memoized tail calls benchmark", "[.benchmark]" ) {
+    
+    const long iterations = 10000000;
+    Expression* counter = parse_str(countingLoop(iterations) + "(0)");
+    EvaluationContext context;
+    context.memoizeCalls = true;
+    auto start = std::chrono::steady_clock::now();
+    Value* result;
+    {
+        EvaluationScope scope(&context);
+        result = counter->evaluate();
+    }
+    double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    CHECK( result->equals(new NumericValue((int)iterations)) );
+    cout << iterations << " memoized tail calls counting up: " << milliseconds << " ms, " << context.memoEvictions << " evictions\n";
+}
@@ -0,0 +1,96 @@
+//
+//  function.hpp
+//  ParserImproved
+//
+//  Copyright © 2020 MSD Katie Rose. All rights reserved.
+//
+
+#ifndef function_hpp
+#define function_hpp
+
+#include <stdio.h>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "expression.hpp"
+
+using namespace std;
+
+/*
+ Environment binds one variable to a value, in front of the bindings around it.  Environments never change once made, so closures share them.  Integers and booleans are held in the binding itself rather than allocated.
+ */
+struct Environment {
+    Variable* variable;
+    TaggedValue value;
+    Environment* next;
+    
+    /* counted against the installed EvaluationContext like a Value */
+    static void* operator new(size_t size);
+};
+
+/*
+ A call to memoize: the `_fun` called, and the values of the variables it captures followed by the argument
+ */
+struct MemoKey {
+    FunExpression* function;
+    vector<TaggedValue> values;
+    uint64_t hash;
+};
+
+/*
+ MemoTable remembers the results of calls for a whole EvaluationContext.  Evaluation is pure, so a call gives the same result whenever the `_fun`, the argument and the values of the variables the function captures are the same, and those make up the key.  Keying on them rather than on the closure object means that the fresh closure a recursive function makes for each call, as in `f(f)(n)`, still shares its results.  At most `capacity` results are kept for all functions together, and the least recently used goes first, so substitution making fresh `_fun` nodes cannot make the table grow without bound.  Keys that include a lazy `_let` thunk are not memoized, since hashing one would force it.
+ */
+class MemoTable {
+public:
+    
+    size_t capacity;
+    
+    MemoTable(size_t maxEntries);
+    
+    //fills `key` for calling `callee` with `argument`, or returns false if the call cannot be memoized
+    bool keyFor(FunValue* callee, TaggedValue argument, MemoKey &key);
+    
+    //no value if there is no result for `key` yet
+    TaggedValue lookup(const MemoKey &key);
+    
+    //returns true if an older result was evicted to make room
+    bool insert(const MemoKey &key, TaggedValue result);
+    size_t size();
+
+private:
+    
+    struct Entry {
+        MemoKey key;
+        TaggedValue result;
+    };
+    list<Entry> entries;
+    unordered_multimap<uint64_t, list<Entry>::iterator> index;
+    
+    //the free variables of the `_fun`s called recently; only a cache, so it is cleared rather than growing past `capacity`
+    unordered_map<FunExpression*, vector<Variable*>> captured;
+    
+    const vector<Variable*> &capturedBy(FunExpression* function);
+};
+
+/*
+ The innermost value bound to `name` in `environment`, or no value if there is none
+ */
+TaggedValue lookup(Environment* environment, const string &name);
+
+/*
+ Substitutes the values bound in `environment` for the free variables of `expr`, innermost bindings first, so that the result means the same thing without the environment
+ */
+Expression* closeOver(Expression* expr, Environment* environment);
+
+/*
+ Evaluates `expr` with the variables of `environment` bound, looking them up instead of substituting them like `evaluate()` does.  Tail positions (the body of a `_let`, the branches of an `_if` and the body of a called function) are evaluated by the same loop rather than by recursion, so a chain of tail calls runs in constant C++ stack space however long it is.  Values are passed around as TaggedValues, so integer and boolean arithmetic allocates nothing.  When the installed context memoizes calls, every call in such a chain has the chain's result, so they are recorded once it is known, at most the last `memoCapacity` of them, since the table would evict any earlier ones anyway.
+ */
+TaggedValue evaluateIn(Expression* expr, Environment* environment);
+
+/*
+ Calls `function`, which must be a FunValue, with `argument`.  Throws `runtime_error` otherwise.
+ */
+Value* callFunction(Value* function, Value* argument);
+
+#endif /* function_hpp */
@@ -0,0 +1,500 @@
+//
+//  incremental.cpp
+//  ParserImproved
+//
+//  Copyright © 2020 MSD Katie Rose. All rights reserved.
+//
+
+#include <chrono>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include "incremental.hpp"
+#include "function.hpp"
+#include "inliner.hpp"
+#include "interpreter.hpp"
+#include "parser.hpp"
+#include "catch.hpp"
+
+IncrementalEvaluator::IncrementalEvaluator(Expression* expr) {
+    
+    this->recomputed = 0;
+    map<string, int> environment;
+    this->root = build(expr, environment);
+}
+
+int IncrementalEvaluator::addNode(IncrementalOp op, int left, int right, Value* value, int test) {
+    
+    int index = (int)this->nodes.size();
+    this->nodes.push_back({ op, left, right, test, {}, value, nullptr, op != I_CONSTANT, nullptr, {} });
+    if (test >= 0) {
+        
+        this->nodes[test].parents.push_back(index);
+    }
+    if (left >= 0) {
+        
+        this->nodes[left].parents.push_back(index);
+    }
+    if (right >= 0) {
+        
+        this->nodes[right].parents.push_back(index);
+    }
+    return index;
+}
+
+/*
+ Subtrees outside every `_let` mean the same thing wherever they occur, so those are built once per Expression and shared
+ */
+int IncrementalEvaluator::build(Expression* expr, map<string, int> &environment) {
+    
+    if (environment.empty()) {
+        
+        auto found = this->shared.find(expr);
+        if (found != this->shared.end()) {
+            
+            return found->second;
+        }
+    }
+    int index;
+    if (Variable* variable = dynamic_cast<Variable*>(expr)) {
+        
+        auto bound = environment.find(variable->name);
+        if (bound != environment.end()) {
+            
+            return bound->second;
+        }
+        auto input = this->inputs.find(variable->name);
+        if (input != this->inputs.end()) {
+            
+            return input->second;
+        }
+        index = addNode(I_INPUT, -1, -1, nullptr);
+        this->inputs[variable->name] = index;
+    } else if (Add* add = dynamic_cast<Add*>(expr)) {
+        
+        int left = build(add->leftHandSide, environment);
+        int right = build(add->rightHandSide, environment);
+        index = addNode(I_ADD, left, right, nullptr);
+    } else if (Multiply* multiply = dynamic_cast<Multiply*>(expr)) {
+        
+        int left = build(multiply->leftHandSide, environment);
+        int right = build(multiply->rightHandSide, environment);
+        index = addNode(I_MULTIPLY, left, right, nullptr);
+    } else if (LetExpression* let = dynamic_cast<LetExpression*>(expr)) {
+        
+        int value = build(let->subExpression, environment);
+        string name = let->subVariable->name;
+        auto outer = environment.find(name);
+        int shadowed = outer == environment.end() ? -1 : outer->second;
+        environment[name] = value;
+        int body = build(let->subBody, environment);
+        if (shadowed >= 0) {
+            
+            environment[name] = shadowed;
+        } else {
+            
+            environment.erase(name);
+        }
+        index = addNode(I_LET, value, body, nullptr);
+    } else if (EqualsExpression* comparison = dynamic_cast<EqualsExpression*>(expr)) {
+        
+        int left = build(comparison->leftHandSide, environment);
+        int right = build(comparison->rightHandSide, environment);
+        index = addNode(I_EQUALS, left, right, nullptr);
+    } else if (IfExpression* conditional = dynamic_cast<IfExpression*>(expr)) {
+        
+        int test = build(conditional->test, environment);
+        int thenBranch = build(conditional->thenBranch, environment);
+        int elseBranch = build(conditional->elseBranch, environment);
+        index = addNode(I_IF, thenBranch, elseBranch, nullptr, test);
+    } else if (CallExpression* call = dynamic_cast<CallExpression*>(expr)) {
+        
+        int function = build(call->toBeCalled, environment);
+        int argument = build(call->actualArgument, environment);
+        index = addNode(I_CALL, function, argument, nullptr);
+    } else if (FunExpression* function = dynamic_cast<FunExpression*>(expr)) {
+        
+        //the body is not part of the graph, since it is evaluated anew on every call, but the variables it captures are
+        std::set<string> captured;
+        freeVariables(function, captured);
+        vector<pair<Variable*, int>> captures;
+        for (const string &name : captured) {
+            
+            Variable* variable = new Variable(name);
+            captures.push_back({ variable, build(variable, environment) });
+        }
+        if (captures.empty()) {
+            
+            index = addNode(I_CONSTANT, -1, -1, function->evaluate());
+        } else {
+            
+            index = addNode(I_FUN, -1, -1, nullptr);
+            this->nodes[index].function = function;
+            this->nodes[index].captures = captures;
+            for (pair<Variable*, int> &capture : captures) {
+                
+                this->nodes[capture.second].parents.push_back(index);
+            }
+        }
+    } else {
+        
+        index = addNode(I_CONSTANT, -1, -1, expr->evaluate());
+    }
+    if (environment.empty()) {
+        
+        this->shared[expr] = index;
+    }
+    return index;
+}
+
+/*
+ A node that is already dirty stops the walk: its parents are dirty too, or an `_if` or lazy `_let` that does not currently need it
+ */
+void IncrementalEvaluator::markDirty(int node) {
+    
+    vector<int> pending = { node };
+    while (!pending.empty()) {
+        
+        int next = pending.back();
+        pending.pop_back();
+        for (int parent : this->nodes[next].parents) {
+            
+            if (!this->nodes[parent].dirty) {
+                
+                this->nodes[parent].dirty = true;
+                pending.push_back(parent);
+            }
+        }
+    }
+}
+
+void IncrementalEvaluator::set(string variable, Value* value) {
+    
+    auto input = this->inputs.find(variable);
+    if (input == this->inputs.end()) {
+        
+        return;
+    }
+    IncrementalNode &node = this->nodes[input->second];
+    node.value = value;
+    node.dirty = true;
+    markDirty(input->second);
+}
+
+/*
+ The value of `node`, rethrowing its error if it has none
+ */
+Value* IncrementalEvaluator::operand(int node) {
+    
+    if (this->nodes[node].error) {
+        
+        rethrow_exception(this->nodes[node].error);
+    }
+    return this->nodes[node].value;
+}
+
+/*
+ Brings `index` up to date, computing first the children its value needs.  An `_if` computes its test and then only the selected branch, and a `_let` its body alone when lets are lazy, so the nodes nothing needs yet stay dirty.
+ */
+void IncrementalEvaluator::compute(int index) {
+    
+    IncrementalNode &node = this->nodes[index];
+    if (!node.dirty) {
+        
+        return;
+    }
+    try {
+        
+        if (node.op == I_INPUT) {
+            
+            if (node.value == nullptr) {
+                
+                throw runtime_error((string)"Incomplete substitution");
+            }
+        } else if (node.op == I_ADD) {
+            
+            compute(node.left);
+            compute(node.right);
+            node.value = operand(node.left)->addTo(operand(node.right));
+            this->recomputed++;
+        } else if (node.op == I_MULTIPLY) {
+            
+            compute(node.left);
+            compute(node.right);
+            node.value = operand(node.left)->multiplyWith(operand(node.right));
+            this->recomputed++;
+        } else if (node.op == I_LET) {
+            
+            //like evaluate(), an eager `_let` fails with its value even when the body does not use it
+            EvaluationContext* context = EvaluationContext::current();
+            if (context == nullptr || !context->lazyLet) {
+                
+                compute(node.left);
+                operand(node.left);
+            }
+            compute(node.right);
+            node.value = operand(node.right);
+            this->recomputed++;
+        } else if (node.op == I_EQUALS) {
+            
+            compute(node.left);
+            compute(node.right);
+            node.value = new BoolValue(operand(node.left)->equals(operand(node.right)));
+            this->recomputed++;
+        } else if (node.op == I_IF) {
+            
+            compute(node.test);
+            BoolValue* test = dynamic_cast<BoolValue*>(operand(node.test));
+            if (test == nullptr) {
+                
+                throw runtime_error("_if test is not a boolean");
+            }
+            int branch = test->value ? node.left : node.right;
+            compute(branch);
+            node.value = operand(branch);
+            this->recomputed++;
+        } else if (node.op == I_FUN) {
+            
+            Environment* environment = nullptr;
+            for (pair<Variable*, int> &capture : node.captures) {
+                
+                compute(capture.second);
+                TaggedValue captured = TaggedValue::of(operand(capture.second));
+                environment = new Environment{ capture.first, captured, environment };
+            }
+            node.value = new FunValue(node.function, environment);
+            this->recomputed++;
+        } else if (node.op == I_CALL) {
+            
+            compute(node.left);
+            compute(node.right);
+            node.value = callFunction(operand(node.left), operand(node.right));
+            this->recomputed++;
+        }
+        node.error = nullptr;
+    } catch (...) {
+        
+        //the error stays with this node until one of its children changes
+        if (node.op != I_INPUT) {
+            
+            node.value = nullptr;
+        }
+        node.error = current_exception();
+    }
+    node.dirty = false;
+}
+
+Value* IncrementalEvaluator::value() {
+    
+    this->recomputed = 0;
+    compute(this->root);
+    return operand(this->root);
+}
+
+size_t IncrementalEvaluator::size() {
+    
+    return this->nodes.size();
+}
+
+/* for tests */
+static Expression *parse_str(string s) {
+    std::istringstream in(s);
+    return parse(in);
+}
+
+TEST_CASE( "IncrementalEvaluator" ) {
+    
+    IncrementalEvaluator sum(parse_str("x * 2 + y"));
+    CHECK_THROWS_WITH( sum.value(), "Incomplete substitution" );
+    sum.set("x", new NumericValue(3));
+    sum.set("y", new NumericValue(4));
+    CHECK( sum.value()->equals(new NumericValue(10)) );
+    sum.set("y", new NumericValue(5));
+    CHECK( sum.value()->equals(new NumericValue(11)) );
+    CHECK( sum.recomputed == 1 );
+    CHECK( sum.value()->equals(new NumericValue(11)) );
+    CHECK( sum.recomputed == 0 );
+    sum.set("unused", new NumericValue(1));
+    CHECK( sum.value()->equals(new NumericValue(11)) );
+    
+    //`z` is computed once and both of its uses depend on it
+    IncrementalEvaluator let(parse_str("_let z = x + 1 _in z * z + w"));
+    let.set("x", new NumericValue(2));
+    let.set("w", new NumericValue(1));
+    CHECK( let.value()->equals(new NumericValue(10)) );
+    let.set("w", new NumericValue(2));
+    CHECK( let.value()->equals(new NumericValue(11)) );
+    CHECK( let.recomputed == 2 );
+    let.set("x", new NumericValue(3));
+    CHECK( let.value()->equals(new NumericValue(18)) );
+    CHECK( let.recomputed == 4 );
+    
+    //an eager `_let` fails with its value even when the body does not use it, and a lazy one only when it does
+    IncrementalEvaluator unused(parse_str("_let z = a + 1 _in 5"));
+    unused.set("a", new BoolValue(true));
+    CHECK_THROWS_WITH( unused.value(), "adding of booleans not supported" );
+    {
+        
+        EvaluationContext context;
+        context.lazyLet = true;
+        EvaluationScope scope(&context);
+        IncrementalEvaluator lazy(parse_str("_let z = a + 1 _in 5"));
+        lazy.set("a", new BoolValue(true));
+        CHECK( lazy.value()->equals(new NumericValue(5)) );
+    }
+    
+    //the inner `x` is the `_let`'s, so it does not depend on the input
+    IncrementalEvaluator shadowed(parse_str("x + _let x = 5 _in x * 2"));
+    shadowed.set("x", new NumericValue(1));
+    CHECK( shadowed.value()->equals(new NumericValue(11)) );
+    shadowed.set("x", new NumericValue(2));
+    CHECK( shadowed.value()->equals(new NumericValue(12)) );
+    CHECK( shadowed.recomputed == 1 );
+    
+    //type errors leave the affected nodes dirty until the binding is fixed
+    IncrementalEvaluator typed(parse_str("(a + 1) * b"));
+    typed.set("a", new BoolValue(true));
+    typed.set("b", new NumericValue(2));
+    CHECK_THROWS( typed.value() );
+    typed.set("a", new NumericValue(6));
+    CHECK( typed.value()->equals(new NumericValue(14)) );
+    
+    //only the selected branch is computed, and the other one waits until a change of test selects it
+    IncrementalEvaluator conditional(parse_str("_if mode == 0 _then x * 2 _else y + 1"));
+    conditional.set("mode", new NumericValue(0));
+    conditional.set("x", new NumericValue(4));
+    CHECK( conditional.value()->equals(new NumericValue(8)) );
+    conditional.set("y", new NumericValue(1));
+    CHECK( conditional.value()->equals(new NumericValue(8)) );
+    CHECK( conditional.recomputed == 0 );
+    conditional.set("mode", new NumericValue(1));
+    CHECK( conditional.value()->equals(new NumericValue(2)) );
+    CHECK( conditional.recomputed == 3 );
+    conditional.set("y", new BoolValue(true));
+    CHECK_THROWS( conditional.value() );
+    conditional.set("mode", new NumericValue(0));
+    CHECK( conditional.value()->equals(new NumericValue(8)) );
+    CHECK( conditional.recomputed == 2 );
+    IncrementalEvaluator endless(parse_str("_let w = _fun (f) _fun (i) f(f)(i + 1) _in _if flag _then 1 _else w(w)(0)"));
+    endless.set("flag", new BoolValue(true));
+    CHECK( endless.value()->equals(new NumericValue(1)) );
+    IncrementalEvaluator flag(parse_str("_if flag _then 1 _else 2"));
+    flag.set("flag", new NumericValue(3));
+    CHECK_THROWS_WITH( flag.value(), "_if test is not a boolean" );
+    
+    //a function is remade when a variable it captures changes, and calls to it are redone
+    IncrementalEvaluator call(parse_str("_let scale = _fun (x) x * k _in scale(a) + scale(2)"));
+    call.set("k", new NumericValue(3));
+    call.set("a", new NumericValue(5));
+    CHECK( call.value()->equals(new NumericValue(21)) );
+    call.set("a", new NumericValue(6));
+    CHECK( call.value()->equals(new NumericValue(24)) );
+    CHECK( call.recomputed == 3 );
+    call.set("k", new NumericValue(10));
+    CHECK( call.value()->equals(new NumericValue(80)) );
+    CHECK( call.recomputed == 5 );
+    IncrementalEvaluator closed(parse_str("(_fun (x) x + 1)(y)"));
+    closed.set("y", new NumericValue(1));
+    CHECK( closed.value()->equals(new NumericValue(2)) );
+    closed.set("y", new BoolValue(true));
+    CHECK_THROWS( closed.value() );
+    
+    //agrees with substitution
+    Expression* expr = parse_str("(a * b + c) * (a + 7) + _let d = a * a _in d * c + d");
+    IncrementalEvaluator incremental(expr);
+    map<string, Value*> bindings;
+    for (int round = 0; round < 10; round++) {
+        
+        string name(1, (char)('a' + round % 3));
+        bindings[name] = new NumericValue(round * 37 % 11 - 5);
+        incremental.set(name, bindings[name]);
+        if (bindings.size() == 3) {
+            
+            CHECK( incremental.value()->equals(specialize(expr, bindings)->evaluate()) );
+        }
+    }
+}
+
+static string variableName(int index) {
+    
+    string name;
+    do {
+        
+        name.insert(name.begin(), (char)('a' + index % 26));
+        index = index / 26;
+    } while (index > 0);
+    return "v" + name;
+}
+
+/*
+ A balanced tree of `nodes` nodes, which must be odd, over `variables` variables.  An expression this large is too deep to parse as a chain.
+ */
+static Expression* balancedExpression(long nodes, int variables, unsigned &seed) {
+    
+    if (nodes < 3) {
+        
+        seed = seed * 1103515245 + 12345;
+        return new Variable(variableName((seed >> 16) % variables));
+    }
+    seed = seed * 1103515245 + 12345;
+    if ((seed >> 16) % 8 == 0) {
+        
+        return new Multiply(balancedExpression(nodes - 2, variables, seed), new Number(1 + (seed >> 20) % 2));
+    }
+    long leftNodes = (nodes - 1) / 2 % 2 == 1 ? (nodes - 1) / 2 : (nodes - 1) / 2 - 1;
+    Expression* left = balancedExpression(leftNodes, variables, seed);
+    return new Add(left, balancedExpression(nodes - 1 - leftNodes, variables, seed));
+}
+
+TEST_CASE( "IncrementalEvaluator benchmark", "[.benchmark]" ) {
+    
+    unsigned seed = 39;
+    const int variables = 1000;
+    Expression* expr = balancedExpression(1000001, variables, seed);
+    map<string, Value*> bindings;
+    for (int i = 0; i < variables; i++) {
+        
+        bindings[variableName(i)] = new NumericValue(i % 7);
+    }
+    
+    auto start = std::chrono::steady_clock::now();
+    IncrementalEvaluator incremental(expr);
+    for (auto &binding : bindings) {
+        
+        incremental.set(binding.first, binding.second);
+    }
+    Value* initial = incremental.value();
+    double buildMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    
+    const int fullUpdates = 5;
+    start = std::chrono::steady_clock::now();
+    Value* full = nullptr;
+    for (int update = 0; update < fullUpdates; update++) {
+        
+        bindings[variableName(update)] = new NumericValue(update);
+        full = specialize(expr, bindings)->evaluate();
+    }
+    double fullMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / fullUpdates;
+    
+    const int updates = 1000;
+    long recomputed = 0;
+    start = std::chrono::steady_clock::now();
+    for (int update = 0; update < fullUpdates; update++) {
+        
+        incremental.set(variableName(update), new NumericValue(update));
+    }
+    CHECK( incremental.value()->equals(full) );
+    for (int update = 0; update < updates; update++) {
+        
+        seed = seed * 1103515245 + 12345;
+        incremental.set(variableName((seed >> 16) % variables), new NumericValue((seed >> 8) % 7));
+        incremental.value();
+        recomputed += incremental.recomputed;
+    }
+    double incrementalMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / (updates + 1);
+    CHECK( initial != nullptr );
+    cout << expr->nodeCount() << " nodes, " << incremental.size() << " graph nodes built and evaluated in " << buildMilliseconds << " ms\n"
+         << "single-variable update: specialize and evaluate " << fullMilliseconds << " ms, incremental " << incrementalMilliseconds << " ms ("
+         << recomputed / updates << " nodes recomputed on average)\n";
+}
@@ -0,0 +1,71 @@
+//
+//  incremental.hpp
+//  ParserImproved
+//
+//  Copyright © 2020 MSD Katie Rose. All rights reserved.
+//
+
+#ifndef incremental_hpp
+#define incremental_hpp
+
+#include <stdio.h>
+#include <exception>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "expression.hpp"
+
+using namespace std;
+
+enum IncrementalOp { I_CONSTANT, I_INPUT, I_ADD, I_MULTIPLY, I_LET, I_EQUALS, I_IF, I_FUN, I_CALL };
+
+/*
+ One node of the dependency graph.  `left` and `right` are the nodes it is computed from, the value and body of an I_LET, or the branches of an I_IF whose `test` is the node of its test, or the function and argument of an I_CALL, and `parents` the nodes computed from it.  An I_FUN makes a closure of `function` over the nodes of its free variables, which are its `captures`; a function with no free variables is an I_CONSTANT.  Occurrences of a `_let`'s variable are edges to the node of its value, so they have no node of their own.  A node whose computation failed has no value and keeps the `error` instead, which only reaches the result through the nodes that use it.
+ */
+struct IncrementalNode {
+    IncrementalOp op;
+    int left;
+    int right;
+    int test;
+    vector<int> parents;
+    Value* value;
+    exception_ptr error;
+    bool dirty;
+    FunExpression* function;
+    vector<pair<Variable*, int>> captures;
+};
+
+/*
+ IncrementalEvaluator keeps an expression live while its free variables change, like the cells of a spreadsheet.  It mirrors the expression as a dependency graph that caches the value of every subtree, with one input node per free variable and shared subtrees shared.  Changing a binding marks only the nodes that depend on it dirty, and `value()` recomputes just those the result needs, children before parents.  Only the branch an `_if`'s test selects is computed, as by evaluate(), so the other branch may fail or never finish without affecting the result; it is brought up to date when a change of test selects it.
+ */
+class IncrementalEvaluator {
+public:
+    
+    //nodes recomputed by the last call to value()
+    long recomputed;
+    
+    IncrementalEvaluator(Expression* expr);
+    
+    //binding a variable that does not occur free in the expression does nothing
+    void set(string variable, Value* value);
+    
+    //throws `runtime_error` like evaluate() when a variable the result depends on has no value, or for a type error
+    Value* value();
+    size_t size();
+
+private:
+    
+    vector<IncrementalNode> nodes;
+    map<string, int> inputs;
+    unordered_map<Expression*, int> shared;
+    int root;
+    
+    int build(Expression* expr, map<string, int> &environment);
+    int addNode(IncrementalOp op, int left, int right, Value* value, int test = -1);
+    Value* operand(int node);
+    void compute(int index);
+    void markDirty(int node);
+};
+
+#endif /* incremental_hpp */
@@ -0,0 +1,498 @@
+//
+//  inliner.cpp
+//  ParserImproved
+//
+//  Copyright © 2020 MSD Katie Rose. All rights reserved.
+//
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+#include "context.hpp"
+#include "inliner.hpp"
+#include "parser.hpp"
+#include "catch.hpp"
+
+InlineStats::InlineStats() {
+    
+    this->propagated = 0;
+    this->inlined = 0;
+    this->eliminated = 0;
+}
+
+static bool isLeaf(Expression* expr) {
+    
+    return dynamic_cast<Number*>(expr) != nullptr || dynamic_cast<BigNumber*>(expr) != nullptr
+        || dynamic_cast<BoolExpression*>(expr) != nullptr || dynamic_cast<ThunkExpression*>(expr) != nullptr;
+}
+
+static void collectFreeVariables(Expression* expr, set<string> &bound, set<string> &variables) {
+    
+    if (Variable* variable = dynamic_cast<Variable*>(expr)) {
+        
+        if (bound.count(variable->name) == 0) {
+            
+            variables.insert(variable->name);
+        }
+    } else if (Add* add = dynamic_cast<Add*>(expr)) {
+        
+        collectFreeVariables(add->leftHandSide, bound, variables);
+        collectFreeVariables(add->rightHandSide, bound, variables);
+    } else if (Multiply* multiply = dynamic_cast<Multiply*>(expr)) {
+        
+        collectFreeVariables(multiply->leftHandSide, bound, variables);
+        collectFreeVariables(multiply->rightHandSide, bound, variables);
+    } else if (LetExpression* let = dynamic_cast<LetExpression*>(expr)) {
+        
+        collectFreeVariables(let->subExpression, bound, variables);
+        bool shadows = bound.insert(let->subVariable->name).second;
+        collectFreeVariables(let->subBody, bound, variables);
+        if (shadows) {
+            
+            bound.erase(let->subVariable->name);
+        }
+    } else if (EqualsExpression* comparison = dynamic_cast<EqualsExpression*>(expr)) {
+        
+        collectFreeVariables(comparison->leftHandSide, bound, variables);
+        collectFreeVariables(comparison->rightHandSide, bound, variables);
+    } else if (IfExpression* conditional = dynamic_cast<IfExpression*>(expr)) {
+        
+        collectFreeVariables(conditional->test, bound, variables);
+        collectFreeVariables(conditional->thenBranch, bound, variables);
+        collectFreeVariables(conditional->elseBranch, bound, variables);
+    } else if (FunExpression* function = dynamic_cast<FunExpression*>(expr)) {
+        
+        bool shadows = bound.insert(function->formalArgument->name).second;
+        collectFreeVariables(function->body, bound, variables);
+        if (shadows) {
+            
+            bound.erase(function->formalArgument->name);
+        }
+    } else if (CallExpression* call = dynamic_cast<CallExpression*>(expr)) {
+        
+        collectFreeVariables(call->toBeCalled, bound, variables);
+        collectFreeVariables(call->actualArgument, bound, variables);
+    }
+}
+
+void freeVariables(Expression* expr, set<string> &variables) {
+    
+    set<string> bound;
+    collectFreeVariables(expr, bound, variables);
+}
+
+/*
+ A bit standing for `name` in a set of names kept as a 64-bit mask.  Different names can share a bit, which only ever makes the capture test in Inliner more cautious.
+ */
+static uint64_t nameBit(const string &name) {
+    
+    return 1ULL << (hash<string>()(name) % 64);
+}
+
+/*
+ What UseCounter finds out about one `_let`: how often its variable occurs free in the body, an occurrence inside a `_fun` counting as two since the function may run any number of times, and for the first occurrence, the names bound by the `_let`s and `_fun`s between the binding and it
+ */
+struct BindingUse {
+    size_t occurrences;
+    uint64_t boundBetween;
+};
+
+/*
+ Binders further apart than this from an occurrence are not looked at one by one; the occurrence is taken to be captured
+ */
+static const size_t MAX_BINDERS_BETWEEN = 64;
+
+/*
+ The first walk of inlineLets(), over the whole tree at once.  It keeps a stack of the `_let`s and `_fun`s around the current node and, for every name, the positions in that stack that bind it, so each occurrence is charged to its binding in constant time.  A `_let` whose variable turns out to be unused has a dead value, so the value is only walked, and its variables counted, when the body used the variable.
+ */
+class UseCounter {
+public:
+    
+    unordered_map<LetExpression*, BindingUse> uses;
+    
+    UseCounter() {
+        
+        this->functionDepth = 0;
+    }
+    
+    void walk(Expression* expr) {
+        
+        if (Variable* variable = dynamic_cast<Variable*>(expr)) {
+            
+            occurrence(variable->name);
+        } else if (Add* add = dynamic_cast<Add*>(expr)) {
+            
+            walk(add->leftHandSide);
+            walk(add->rightHandSide);
+        } else if (Multiply* multiply = dynamic_cast<Multiply*>(expr)) {
+            
+            walk(multiply->leftHandSide);
+            walk(multiply->rightHandSide);
+        } else if (LetExpression* let = dynamic_cast<LetExpression*>(expr)) {
+            
+            this->uses[let] = { 0, 0 };
+            push(let->subVariable->name, let);
+            walk(let->subBody);
+            pop(let->subVariable->name);
+            if (this->uses[let].occurrences != 0) {
+                
+                walk(let->subExpression);
+            }
+        } else if (EqualsExpression* comparison = dynamic_cast<EqualsExpression*>(expr)) {
+            
+            walk(comparison->leftHandSide);
+            walk(comparison->rightHandSide);
+        } else if (IfExpression* conditional = dynamic_cast<IfExpression*>(expr)) {
+            
+            walk(conditional->test);
+            walk(conditional->thenBranch);
+            walk(conditional->elseBranch);
+        } else if (FunExpression* function = dynamic_cast<FunExpression*>(expr)) {
+            
+            push(function->formalArgument->name, nullptr);
+            this->functionDepth++;
+            walk(function->body);
+            this->functionDepth--;
+            pop(function->formalArgument->name);
+        } else if (CallExpression* call = dynamic_cast<CallExpression*>(expr)) {
+            
+            walk(call->toBeCalled);
+            walk(call->actualArgument);
+        } else if (!isLeaf(expr)) {
+            
+            //an expression this pass does not know about might use anything, any number of times
+            for (Binder &binder : this->binders) {
+                
+                if (binder.let != nullptr) {
+                    
+                    this->uses[binder.let].occurrences = SIZE_MAX;
+                }
+            }
+        }
+    }
+    
+private:
+    
+    //`let` is nullptr for the argument of a `_fun`
+    struct Binder {
+        const string* name;
+        LetExpression* let;
+        size_t functionDepth;
+    };
+    vector<Binder> binders;
+    unordered_map<string, vector<size_t>> scopes;
+    size_t functionDepth;
+    
+    void push(const string &name, LetExpression* let) {
+        
+        this->scopes[name].push_back(this->binders.size());
+        this->binders.push_back({ &name, let, this->functionDepth });
+    }
+    
+    void pop(const string &name) {
+        
+        this->scopes[name].pop_back();
+        this->binders.pop_back();
+    }
+    
+    void occurrence(const string &name) {
+        
+        auto scope = this->scopes.find(name);
+        if (scope == this->scopes.end() || scope->second.empty()) {
+            
+            return;
+        }
+        size_t position = scope->second.back();
+        Binder &binder = this->binders[position];
+        if (binder.let == nullptr) {
+            
+            return;
+        }
+        BindingUse &use = this->uses[binder.let];
+        size_t weight = this->functionDepth > binder.functionDepth ? 2 : 1;
+        if (use.occurrences == 0 && weight == 1) {
+            
+            if (this->binders.size() - 1 - position > MAX_BINDERS_BETWEEN) {
+                
+                use.boundBetween = ~0ULL;
+            }
+            for (size_t i = position + 1; i < this->binders.size() && use.boundBetween != ~0ULL; i++) {
+                
+                use.boundBetween |= nameBit(*this->binders[i].name);
+            }
+        }
+        use.occurrences = use.occurrences > SIZE_MAX - weight ? SIZE_MAX : use.occurrences + weight;
+    }
+};
+
+static Value* literalValue(Expression* expr) {
+    
+    if (dynamic_cast<Number*>(expr) != nullptr || dynamic_cast<BigNumber*>(expr) != nullptr) {
+        
+        return expr->evaluate();
+    }
+    return nullptr;
+}
+
+static bool isConstant(Expression* expr) {
+    
+    return literalValue(expr) != nullptr || dynamic_cast<BoolExpression*>(expr) != nullptr;
+}
+
+/*
+ The second walk of inlineLets(), which rebuilds the tree top-down.  A binding that is removed goes into `replacements` while its body is rebuilt, so each occurrence is replaced where the walk meets it and no body is substituted into or walked twice.  The bindings that stay, and the arguments of `_fun`s, are recorded as nullptr, which shadows any replacement for the same name further out.  Every rebuilt expression comes with the mask of the names of the variables in it, which is what the capture test needs to know about a value.
+ */
+class Inliner {
+public:
+    
+    struct Rebuilt {
+        Expression* expr;
+        uint64_t names;
+    };
+    
+    unordered_map<LetExpression*, BindingUse> &uses;
+    InlineStats &stats;
+    
+    Inliner(unordered_map<LetExpression*, BindingUse> &bindingUses, InlineStats &inlineStats) : uses(bindingUses), stats(inlineStats) {
+    }
+    
+    //constant `+`, `*`, `==` and `_if` tests are folded when `fold` is set, as simplify() would
+    Rebuilt walk(Expression* expr, bool fold) {
+        
+        if (Variable* variable = dynamic_cast<Variable*>(expr)) {
+            
+            auto scope = this->replacements.find(variable->name);
+            if (scope != this->replacements.end() && !scope->second.empty() && scope->second.back().expr != nullptr) {
+                
+                return scope->second.back();
+            }
+            return { variable, nameBit(variable->name) };
+        } else if (Add* add = dynamic_cast<Add*>(expr)) {
+            
+            Rebuilt lhs = walk(add->leftHandSide, fold);
+            Rebuilt rhs = walk(add->rightHandSide, fold);
+            if (fold && literalValue(lhs.expr) != nullptr && literalValue(rhs.expr) != nullptr) {
+                
+                return { literalValue(lhs.expr)->addTo(literalValue(rhs.expr))->toExpression(), 0 };
+            }
+            return { new Add(lhs.expr, rhs.expr), lhs.names | rhs.names };
+        } else if (Multiply* multiply = dynamic_cast<Multiply*>(expr)) {
+            
+            Rebuilt lhs = walk(multiply->leftHandSide, fold);
+            Rebuilt rhs = walk(multiply->rightHandSide, fold);
+            if (fold && literalValue(lhs.expr) != nullptr && literalValue(rhs.expr) != nullptr) {
+                
+                return { literalValue(lhs.expr)->multiplyWith(literalValue(rhs.expr))->toExpression(), 0 };
+            }
+            return { new Multiply(lhs.expr, rhs.expr), lhs.names | rhs.names };
+        } else if (LetExpression* let = dynamic_cast<LetExpression*>(expr)) {
+            
+            return walkLet(let, fold);
+        } else if (EqualsExpression* comparison = dynamic_cast<EqualsExpression*>(expr)) {
+            
+            Rebuilt lhs = walk(comparison->leftHandSide, fold);
+            Rebuilt rhs = walk(comparison->rightHandSide, fold);
+            if (fold && isConstant(lhs.expr) && isConstant(rhs.expr)) {
+                
+                return { new BoolExpression(lhs.expr->evaluate()->equals(rhs.expr->evaluate())), 0 };
+            }
+            return { new EqualsExpression(lhs.expr, rhs.expr), lhs.names | rhs.names };
+        } else if (IfExpression* conditional = dynamic_cast<IfExpression*>(expr)) {
+            
+            Rebuilt test = walk(conditional->test, fold);
+            BoolExpression* boolean = dynamic_cast<BoolExpression*>(test.expr);
+            if (fold && boolean != nullptr) {
+                
+                return walk(boolean->boolean ? conditional->thenBranch : conditional->elseBranch, fold);
+            }
+            Rebuilt thenBranch = walk(conditional->thenBranch, fold);
+            Rebuilt elseBranch = walk(conditional->elseBranch, fold);
+            return { new IfExpression(test.expr, thenBranch.expr, elseBranch.expr), test.names | thenBranch.names | elseBranch.names };
+        } else if (FunExpression* function = dynamic_cast<FunExpression*>(expr)) {
+            
+            const string &name = function->formalArgument->name;
+            this->replacements[name].push_back({ nullptr, 0 });
+            Rebuilt body = walk(function->body, fold);
+            this->replacements[name].pop_back();
+            return { new FunExpression(function->formalArgument, body.expr), body.names | nameBit(name) };
+        } else if (CallExpression* call = dynamic_cast<CallExpression*>(expr)) {
+            
+            Rebuilt callee = walk(call->toBeCalled, fold);
+            Rebuilt argument = walk(call->actualArgument, fold);
+            return { new CallExpression(callee.expr, argument.expr), callee.names | argument.names };
+        }
+        return { expr, isLeaf(expr) ? 0 : ~0ULL };
+    }
+    
+private:
+    
+    unordered_map<string, vector<Rebuilt>> replacements;
+    
+    Rebuilt walkLet(LetExpression* let, bool fold) {
+        
+        const string &name = let->subVariable->name;
+        BindingUse use = this->uses[let];
+        if (use.occurrences == 0) {
+            
+            this->stats.eliminated++;
+            return walk(let->subBody, fold);
+        }
+        Rebuilt value = walk(let->subExpression, fold);
+        Rebuilt replacement = { nullptr, 0 };
+        if (isLeaf(value.expr) && dynamic_cast<ThunkExpression*>(value.expr) == nullptr) {
+            
+            this->stats.propagated++;
+            replacement = { value.expr->evaluate()->toExpression(), 0 };
+        } else if (use.occurrences == 1 && (use.boundBetween & value.names) == 0) {
+            
+            //none of the value's variables is bound again between here and the occurrence, so moving it there keeps its meaning
+            this->stats.inlined++;
+            replacement = value;
+        }
+        this->replacements[name].push_back(replacement);
+        //like substituting and then simplifying, removing a binding folds the constants it may have made in the body
+        Rebuilt body = walk(let->subBody, fold || replacement.expr != nullptr);
+        this->replacements[name].pop_back();
+        if (replacement.expr != nullptr) {
+            
+            return body;
+        }
+        return { new LetExpression(let->subVariable, value.expr, body.expr), value.names | body.names | nameBit(name) };
+    }
+};
+
+Expression* inlineLets(Expression* expr, InlineStats &stats, bool fold) {
+    
+    UseCounter counter;
+    counter.walk(expr);
+    Inliner inliner(counter.uses, stats);
+    return inliner.walk(expr, fold).expr;
+}
+
+/* for tests */
+static Expression *parse_str(string s) {
+    std::istringstream in(s);
+    return parse(in);
+}
+
+TEST_CASE( "inlineLets" ) {
+    
+    InlineStats stats;
+    CHECK( inlineLets(parse_str("_let x = 5 _in x + 11"), stats)->equals(new Number(16)) );
+    CHECK( stats.propagated == 1 );
+    
+    stats = InlineStats();
+    CHECK( inlineLets(parse_str("_let unused = y * y _in z + 1"), stats)->equals(parse_str("z + 1")) );
+    CHECK( stats.eliminated == 1 );
+    
+    stats = InlineStats();
+    CHECK( inlineLets(parse_str("_let s = a + b _in s * 2"), stats)->equals(parse_str("(a + b) * 2")) );
+    CHECK( stats.inlined == 1 );
+    
+    //bindings used more than once stay
+    stats = InlineStats();
+    CHECK( inlineLets(parse_str("_let s = a + b _in s * s"), stats)->equals(parse_str("_let s = a + b _in s * s")) );
+    CHECK( stats.inlined == 0 );
+    
+    //shadowing: the inner binding hides the outer one
+    stats = InlineStats();
+    CHECK( inlineLets(parse_str("_let x = 1 _in _let x = 2 _in x"), stats)->equals(new Number(2)) );
+    CHECK( inlineLets(parse_str("_let x = 1 _in x + _let x = w _in x * x"), stats)->equals(parse_str("1 + _let x = w _in x * x")) );
+    
+    //capture: inlining `y` into the inner let would bind it to the wrong y
+    stats = InlineStats();
+    CHECK( inlineLets(parse_str("_let x = y _in _let y = q * q _in x + y + y"), stats)->equals(parse_str("_let x = y _in _let y = q * q _in x + y + y")) );
+    CHECK( stats.inlined == 0 );
+    
+    //propagation cascades through a chain of constant bindings, each value being folded before its binding is looked at
+    stats = InlineStats();
+    CHECK( inlineLets(parse_str("_let a = 2 _in _let b = a * 3 _in _let c = b + a _in c * c"), stats)->equals(new Number(64)) );
+    CHECK( stats.inlined == 0 );
+    CHECK( stats.propagated == 3 );
+    
+    //a binding used once, in one branch, moves into that branch and is only evaluated when it is taken
+    stats = InlineStats();
+    CHECK( inlineLets(parse_str("_let s = a * b _in _if c == 0 _then 0 _else s + 1"), stats)->equals(parse_str("_if c == 0 _then 0 _else a * b + 1")) );
+    CHECK( stats.inlined == 1 );
+    
+    set<string> variables;
+    freeVariables(parse_str("a + _let b = c _in b * d"), variables);
+    CHECK( variables == set<string>({"a", "c", "d"}) );
+    variables.clear();
+    freeVariables(parse_str("_if p == q _then r _else _let r = 1 _in r"), variables);
+    CHECK( variables == set<string>({"p", "q", "r"}) );
+    
+    //a binding used once inside a function body is not moved there, where it could be evaluated on every call
+    stats = InlineStats();
+    CHECK( inlineLets(parse_str("_let s = a * b _in _fun (x) x + s"), stats)->equals(parse_str("_let s = a * b _in _fun (x) x + s")) );
+    CHECK( inlineLets(parse_str("_let s = a * b _in f(s)"), stats)->equals(parse_str("f(a * b)")) );
+    CHECK( inlineLets(parse_str("_let x = 3 _in _fun (x) x + 1"), stats)->equals(parse_str("_fun (x) x + 1")) );
+    CHECK( inlineLets(parse_str("_let s = x _in (_fun (x) x + s)(1) + s"), stats)->equals(parse_str("_let s = x _in (_fun (x) x + s)(1) + s")) );
+    variables.clear();
+    freeVariables(parse_str("_fun (x) x + y(z)"), variables);
+    CHECK( variables == set<string>({"y", "z"}) );
+}
+
+//variable names are letters only, so the i-th variable of a chain is `v` followed by i in base 26
+static string chainVariable(int i) {
+    
+    string name = "v";
+    do {
+        
+        name += char('a' + i % 26);
+        i /= 26;
+    } while (i != 0);
+    return name;
+}
+
+//`_let va = a * b _in _let vb = va + c _in ... vz` with every binding used once
+static string letChain(int length) {
+    
+    string source = "_let " + chainVariable(0) + " = a * b _in ";
+    for (int i = 1; i < length; i++) {
+        
+        source += "_let " + chainVariable(i) + " = " + chainVariable(i - 1) + " + c _in ";
+    }
+    return source + chainVariable(length - 1);
+}
+
+TEST_CASE( "inlineLets scales linearly with the length of a let chain" ) {
+    
+    //the Expressions allocated while inlining a chain twice as long should be about twice as many
+    long allocations[2];
+    for (int i = 0; i < 2; i++) {
+        
+        Expression* chain = parse_str(letChain(1000 * (i + 1)));
+        EvaluationContext context;
+        InlineStats stats;
+        {
+            EvaluationScope scope(&context);
+            inlineLets(chain, stats);
+        }
+        CHECK( stats.inlined == 1000 * (i + 1) );
+        allocations[i] = context.allocations;
+    }
+    CHECK( allocations[1] < allocations[0] * 5 / 2 );
+    
+    //and so should simplify(), which inlines the same way
+    InlineStats stats;
+    Expression* simplified = parse_str(letChain(3))->simplify();
+    CHECK( simplified->equals(inlineLets(parse_str(letChain(3)), stats)) );
+    CHECK( simplified->equals(parse_str("(a * b + c) + c")) );
+}
+
+TEST_CASE( "inlineLets let chain benchmark", "[.benchmark]" ) {
+    
+    for (int length = 1000; length <= 8000; length *= 2) {
+        
+        Expression* chain = parse_str(letChain(length));
+        InlineStats stats;
+        auto start = chrono::steady_clock::now();
+        chain->simplify();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << length << " lets: " << seconds << " s" << endl;
+    }
+}
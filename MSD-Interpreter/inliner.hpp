@@ -0,0 +1,42 @@
+//
+//  inliner.hpp
+//  ParserImproved
+//
+//  Copyright © 2020 MSD Katie Rose. All rights reserved.
+//
+
+#ifndef inliner_hpp
+#define inliner_hpp
+
+#include <stdio.h>
+#include <set>
+#include <string>
+#include "expression.hpp"
+
+using namespace std;
+
+/*
+ Counts what inlineLets() did to the `_let` bindings it saw
+ */
+struct InlineStats {
+    long propagated;
+    long inlined;
+    long eliminated;
+    InlineStats();
+};
+
+/*
+ Removes `_let` bindings wherever that preserves meaning:
+   a binding whose variable does not occur free in the body is deleted,
+   a binding to a literal is substituted into the body, which is then simplified,
+   a binding used exactly once is inlined, unless a `_let` or `_fun` in the body would capture one of its variables.
+ Substitution respects shadowing, so `_let x = 1 _in _let x = 2 _in x` becomes `2`.  The work is linear in the size of `expr`: one walk counts the uses of every binding, and a second rebuilds the tree with the removed bindings in a table, replacing their variables where it meets them instead of substituting into each body.  With `fold` set, constant `+`, `*`, `==` and `_if` tests are folded everywhere, as `simplify()` does, rather than only in the bodies of removed bindings.
+ */
+Expression* inlineLets(Expression* expr, InlineStats &stats, bool fold = false);
+
+/*
+ Adds the variables that occur free in `expr` to `variables`
+ */
+void freeVariables(Expression* expr, set<string> &variables);
+
+#endif /* inliner_hpp */
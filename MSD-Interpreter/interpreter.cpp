@@ -6,6 +6,7 @@
 //  Copyright © 2020 MSD Katie Rose. All rights reserved.
 //
 
+#include <sstream>
 #include "interpreter.hpp"
 #include "parser.hpp"
 #include "catch.hpp"
@@ -15,13 +16,240 @@ Value *interpret(Expression* inputExpression) {
     return inputExpression->evaluate();
 }
 
+Value *interpret(Expression* inputExpression, EvaluationContext* context) {
+    
+    EvaluationScope scope(context);
+    return inputExpression->evaluate();
+}
+
 Expression* optimize(Expression* inputExpression) {
     
+    RewriteStats stats;
+    return optimize(inputExpression, stats);
+}
+
+Expression* optimize(Expression* inputExpression, RewriteStats &stats) {
+    
     if (inputExpression->containsVariables()) {
         
-        return inputExpression->simplify();
+        return rewrite(inputExpression, stats);
     } else {
         
         return inputExpression->evaluate()->toExpression();
     }
 }
+
+Expression* optimize(Expression* inputExpression, EGraphOptions &options) {
+    
+    Expression* rewritten = optimize(inputExpression);
+    if (!rewritten->containsVariables()) {
+        
+        return rewritten;
+    }
+    return saturate(rewritten, options);
+}
+
+Expression* optimize(Expression* inputExpression, PassManager &passes) {
+    
+    return passes.run(inputExpression);
+}
+
+/*
+ Returns the value of `expr` if it is a literal, otherwise nullptr
+ */
+static Value* constantValue(Expression* expr) {
+    
+    if (dynamic_cast<Number*>(expr) != nullptr || dynamic_cast<BigNumber*>(expr) != nullptr || dynamic_cast<BoolExpression*>(expr) != nullptr) {
+        
+        return expr->evaluate();
+    }
+    return nullptr;
+}
+
+static Expression* specializeWith(Expression* expr, map<string, Value*> &bindings);
+
+/*
+ Specializes `body` with `name` bound to `value`, or unbound if `value` is nullptr, in `bindings` itself rather than a copy of it, and puts back the outer binding of `name` afterwards
+ */
+static Expression* specializeShadowed(Expression* body, const string &name, Value* value, map<string, Value*> &bindings) {
+    
+    auto outer = bindings.find(name);
+    Value* outerValue = outer == bindings.end() ? nullptr : outer->second;
+    if (value != nullptr) {
+        
+        bindings[name] = value;
+    } else if (outer != bindings.end()) {
+        
+        bindings.erase(outer);
+    }
+    Expression* specialized = specializeWith(body, bindings);
+    if (outerValue != nullptr) {
+        
+        bindings[name] = outerValue;
+    } else {
+        
+        bindings.erase(name);
+    }
+    return specialized;
+}
+
+static Expression* specializeWith(Expression* expr, map<string, Value*> &bindings) {
+    
+    if (Variable* variable = dynamic_cast<Variable*>(expr)) {
+        
+        auto bound = bindings.find(variable->name);
+        return bound == bindings.end() ? variable : bound->second->toExpression();
+    }
+    
+    Add* add = dynamic_cast<Add*>(expr);
+    Multiply* multiply = dynamic_cast<Multiply*>(expr);
+    if (add != nullptr || multiply != nullptr) {
+        
+        Expression* lhs = specializeWith(add != nullptr ? add->leftHandSide : multiply->leftHandSide, bindings);
+        Expression* rhs = specializeWith(add != nullptr ? add->rightHandSide : multiply->rightHandSide, bindings);
+        Value* lhsValue = constantValue(lhs);
+        Value* rhsValue = constantValue(rhs);
+        if (lhsValue != nullptr && rhsValue != nullptr) {
+            
+            //ill-typed constants like `_true + 1` are left for evaluation to report
+            try {
+                
+                return (add != nullptr ? lhsValue->addTo(rhsValue) : lhsValue->multiplyWith(rhsValue))->toExpression();
+            } catch (runtime_error &) {
+            }
+        }
+        if (add != nullptr) {
+            
+            return new Add(lhs, rhs);
+        }
+        return new Multiply(lhs, rhs);
+    }
+    
+    if (LetExpression* let = dynamic_cast<LetExpression*>(expr)) {
+        
+        Expression* value = specializeWith(let->subExpression, bindings);
+        Value* constant = constantValue(value);
+        if (constant != nullptr) {
+            
+            return specializeShadowed(let->subBody, let->subVariable->name, constant, bindings);
+        }
+        //the let's own variable shadows any known binding of the same name
+        return new LetExpression(let->subVariable, value, specializeShadowed(let->subBody, let->subVariable->name, nullptr, bindings));
+    }
+    
+    if (EqualsExpression* comparison = dynamic_cast<EqualsExpression*>(expr)) {
+        
+        Expression* lhs = specializeWith(comparison->leftHandSide, bindings);
+        Expression* rhs = specializeWith(comparison->rightHandSide, bindings);
+        Value* lhsValue = constantValue(lhs);
+        Value* rhsValue = constantValue(rhs);
+        if (lhsValue != nullptr && rhsValue != nullptr) {
+            
+            return new BoolExpression(lhsValue->equals(rhsValue));
+        }
+        return new EqualsExpression(lhs, rhs);
+    }
+    
+    if (IfExpression* conditional = dynamic_cast<IfExpression*>(expr)) {
+        
+        //a known test leaves only the branch it selects, and the other one is never looked at
+        Expression* test = specializeWith(conditional->test, bindings);
+        if (BoolExpression* boolean = dynamic_cast<BoolExpression*>(test)) {
+            
+            return specializeWith(boolean->boolean ? conditional->thenBranch : conditional->elseBranch, bindings);
+        }
+        return new IfExpression(test, specializeWith(conditional->thenBranch, bindings), specializeWith(conditional->elseBranch, bindings));
+    }
+    
+    if (FunExpression* function = dynamic_cast<FunExpression*>(expr)) {
+        
+        //the formal argument shadows any known binding of the same name, like a let's variable
+        return new FunExpression(function->formalArgument, specializeShadowed(function->body, function->formalArgument->name, nullptr, bindings));
+    }
+    
+    if (CallExpression* call = dynamic_cast<CallExpression*>(expr)) {
+        
+        return new CallExpression(specializeWith(call->toBeCalled, bindings), specializeWith(call->actualArgument, bindings));
+    }
+    
+    //literals are left alone, and anything else is substituted one binding at a time
+    if (constantValue(expr) != nullptr) {
+        
+        return expr;
+    }
+    for (auto &binding : bindings) {
+        
+        expr = expr->substitute(binding.first, binding.second);
+    }
+    return expr;
+}
+
+Expression* specialize(Expression* inputExpression, map<string, Value*> bindings) {
+    
+    return specializeWith(inputExpression, bindings);
+}
+
+TEST_CASE( "optimize" ) {
+    
+    std::istringstream constant("(1 + 2) * 3");
+    CHECK( optimize(parse(constant))->equals(new Number(9)) );
+    
+    std::istringstream variables("1 + x * 1 + 2");
+    RewriteStats stats;
+    CHECK( optimize(parse(variables), stats)->equals(new Add(new Variable("x"), new Number(3))) );
+    CHECK( stats.fired["multiply-one"] == 1 );
+    CHECK( stats.fired["fold-constants"] == 1 );
+    
+    std::istringstream hot("a * b + 1 + a * c * 1");
+    EGraphOptions options;
+    CHECK( optimize(parse(hot), options)->nodeCount() == 7 );
+    CHECK( options.costAfter < options.costBefore );
+}
+
+TEST_CASE( "specialize" ) {
+    
+    std::istringstream in("_let scale = factor * 10 _in scale * x + offset + 2");
+    Expression* expr = parse(in);
+    map<string, Value*> configuration = { {"factor", new NumericValue(3)}, {"offset", new NumericValue(5)} };
+    Expression* residual = specialize(expr, configuration);
+    CHECK( residual->equals(new Add(new Multiply(new Number(30), new Variable("x")), new Number(7))) );
+    CHECK( residual->substitute("x", new NumericValue(2))->evaluate()->equals(new NumericValue(67)) );
+    
+    //a let whose value is not constant stays, and shadows the binding of the same name
+    std::istringstream shadowed("x + _let x = y + 1 _in x * 2");
+    CHECK( specialize(parse(shadowed), { {"x", new NumericValue(4)} })->equals(new Add(new Number(4), new LetExpression(new Variable("x"), new Add(new Variable("y"), new Number(1)), new Multiply(new Variable("x"), new Number(2))))) );
+    
+    //the outer binding is back once the body that shadows it is done
+    std::istringstream restored("(_let x = y _in x) + (_let x = 1 _in x) + x");
+    CHECK( specialize(parse(restored), { {"x", new NumericValue(4)} })->equals(new Add(new LetExpression(new Variable("x"), new Variable("y"), new Variable("x")), new Number(5))) );
+    
+    //fully known expressions specialize to their value
+    std::istringstream known("_let b = _true _in a * a");
+    CHECK( specialize(parse(known), { {"a", new NumericValue(100000)} })->equals(new BigNumber(new BigIntValue(10000000000LL))) );
+    
+    //a known `_if` test selects its branch
+    std::istringstream conditional("_if mode == 1 _then x * 2 _else y + 3");
+    CHECK( specialize(parse(conditional), { {"mode", new NumericValue(1)} })->equals(new Multiply(new Variable("x"), new Number(2))) );
+    std::istringstream unknown("_if mode == 1 _then x * 2 _else y + 3");
+    CHECK( specialize(parse(unknown), { {"y", new NumericValue(1)} })->equals(new IfExpression(new EqualsExpression(new Variable("mode"), new Number(1)), new Multiply(new Variable("x"), new Number(2)), new Number(4))) );
+    
+    //known bindings reach into function bodies, except where the formal argument hides them
+    std::istringstream function("_fun (x) x * scale + offset");
+    CHECK( specialize(parse(function), { {"scale", new NumericValue(2)}, {"x", new NumericValue(9)} })->equals(new FunExpression(new Variable("x"), new Add(new Multiply(new Variable("x"), new Number(2)), new Variable("offset")))) );
+    std::istringstream call("f(a + 1)");
+    CHECK( specialize(parse(call), { {"a", new NumericValue(1)} })->equals(new CallExpression(new Variable("f"), new Number(2))) );
+    
+    //type errors are left for evaluation
+    CHECK( specialize(new Add(new Variable("t"), new Number(1)), { {"t", new BoolValue(true)} })->equals(new Add(new BoolExpression(true), new Number(1))) );
+}
+
+TEST_CASE( "interpret with lazy let" ) {
+    
+    EvaluationContext context;
+    context.lazyLet = true;
+    std::istringstream in("_let a = 1 + 2 _in _let b = a * 100 _in a + 1");
+    CHECK( interpret(parse(in), &context)->equals(new NumericValue(4)) );
+    CHECK( context.lazyBindings == 2 );
+    CHECK( context.unforcedBindings() == 1 );
+    CHECK( EvaluationContext::current() == nullptr );
+}
@@ -9,10 +9,41 @@
 #ifndef interpreter_hpp
 #define interpreter_hpp
 #include "expression.hpp"
+#include "context.hpp"
+#include "cache.hpp"
+#include "rewrite.hpp"
+#include "egraph.hpp"
+#include "passes.hpp"
 
 #include <stdio.h>
+#include <map>
+#include <string>
 
 Value *interpret(Expression* parsedExpression);
 
+/*
+ Interprets `parsedExpression` with `context` installed, so its options apply and its statistics are updated
+ */
+Value *interpret(Expression* parsedExpression, EvaluationContext* context);
+
+/*
+ Evaluates expressions without variables down to a literal, and otherwise applies the algebraic rewrite rules in rewrite.hpp until they stop firing.  `stats` reports which rules fired.
+ */
 Expression* optimize(Expression* inputExpression);
+Expression* optimize(Expression* inputExpression, RewriteStats &stats);
+
+/*
+ The higher tier of optimize(): after the rewrite rules, expressions that still have variables go through equality saturation (see egraph.hpp), bounded by the limits in `options`
+ */
+Expression* optimize(Expression* inputExpression, EGraphOptions &options);
+
+/*
+ Runs the pipeline of `passes` to a fixpoint, after which `passes.reports` says what each pass cost.  Unlike optimize(), it does not evaluate expressions without variables, which is left to interpret(), so the pipeline and its report cover every input.
+ */
+Expression* optimize(Expression* inputExpression, PassManager &passes);
+
+/*
+ Partially evaluates `inputExpression` against the variables whose values are already known.  All of `bindings` are substituted in a single traversal, constants are folded, and `_let`s whose values become constant are inlined, leaving a residual expression over the remaining variables that can be evaluated many times.
+ */
+Expression* specialize(Expression* inputExpression, map<string, Value*> bindings);
 #endif /* interpreter_hpp */
@@ -6,20 +6,98 @@
 //  Copyright © 2020 MSD Katie Rose. All rights reserved.
 //
 
+#include <climits>
+#include <cstdlib>
 #include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
 #define CATCH_CONFIG_RUNNER
 #include "catch.hpp"
 #include "expression.hpp"
 #include "parser.hpp"
 #include "interpreter.hpp"
+#include "diskcache.hpp"
+#include "typecheck.hpp"
+#include "pretty.hpp"
 
 using namespace std;
 
 int main(int argc, const char * argv[]) {
-    Catch::Session().run(argc, argv);
 
-    Expression* e = parse(cin);
-    Value* output = interpret(e);
+    //`--passes=fold,cse,inline` optimizes the input with that pipeline before interpreting it; every other argument goes to Catch
+    //`--cache-dir=DIR` keeps the optimized input in DIR, so running the same input again skips parsing and optimizing it
+    //`--typed` type checks the input before interpreting it, and runs integer programs without checking values
+    //`--pretty=WIDTH` prints the input, optimized if passes are given, in lines of WIDTH columns instead of interpreting it
+    string pipeline;
+    string cacheDirectory;
+    bool typed = false;
+    int prettyWidth = 0;
+    vector<const char*> catchArguments;
+    for (int i = 0; i < argc; i++) {
+        
+        string argument = argv[i];
+        if (argument.compare(0, 9, "--passes=") == 0) {
+            
+            pipeline = argument.substr(9);
+        } else if (argument.compare(0, 12, "--cache-dir=") == 0) {
+            
+            cacheDirectory = argument.substr(12);
+        } else if (argument == "--typed") {
+            
+            typed = true;
+        } else if (argument.compare(0, 9, "--pretty=") == 0) {
+            
+            string width = argument.substr(9);
+            char* end = nullptr;
+            long columns = width.empty() ? 0 : strtol(width.c_str(), &end, 10);
+            if (columns <= 0 || columns > INT_MAX || *end != '\0') {
+                
+                cerr << "usage: --pretty=WIDTH, where WIDTH is a positive number of columns, not '" << width << "'\n";
+                return 1;
+            }
+            prettyWidth = (int)columns;
+        } else {
+            
+            catchArguments.push_back(argv[i]);
+        }
+    }
+    Catch::Session().run((int)catchArguments.size(), catchArguments.data());
+    
+    //the input is type checked as written, since optimizing a closed program evaluates it
+    Expression* e;
+    if (!cacheDirectory.empty()) {
+        
+        string source((istreambuf_iterator<char>(cin)), istreambuf_iterator<char>());
+        if (typed) {
+            
+            istringstream in(source);
+            inferType(parse(in));
+        }
+        CompiledExpressionCache cache(cacheDirectory, pipeline);
+        e = cache.compile(source);
+    } else {
+        
+        e = parse(cin);
+        if (typed) {
+            
+            inferType(e);
+        }
+        if (!pipeline.empty()) {
+            
+            PassManager passes(pipeline);
+            e = optimize(e, passes);
+            passes.printReport(cerr);
+        }
+    }
+    if (prettyWidth > 0) {
+        
+        prettyPrint(e, cout, prettyWidth);
+        cout << "\n";
+        return 0;
+    }
+    Value* output = typed ? interpretTyped(e) : interpret(e);
 
     cout << output->toString() + "\n";
     return 0;
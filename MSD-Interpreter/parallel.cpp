@@ -0,0 +1,312 @@
+//
+//  parallel.cpp
+//  ParserImproved
+//
+//  Copyright © 2020 MSD Katie Rose. All rights reserved.
+//
+
+#include <chrono>
+#include <iostream>
+#include "parallel.hpp"
+#include "catch.hpp"
+
+/*
+ Index of the deque owned by the current thread.  The thread that calls evaluateParallel owns deque 0.
+ */
+static thread_local unsigned workerIndex = 0;
+
+TaskPool::TaskPool(unsigned threadCount, EvaluationContext* evaluationContext) : queues(threadCount) {
+    
+    this->context = evaluationContext;
+    this->stopping = false;
+    for (unsigned index = 1; index < threadCount; index++) {
+        
+        threads.push_back(thread(&TaskPool::work, this, index));
+    }
+}
+
+TaskPool::~TaskPool() {
+    
+    this->stopping = true;
+    for (thread &worker : threads) {
+        
+        worker.join();
+    }
+}
+
+void TaskPool::fork(ParallelTask* task) {
+    
+    WorkQueue &queue = queues[workerIndex];
+    lock_guard<mutex> guard(queue.lock);
+    queue.tasks.push_back(task);
+}
+
+/*
+ Waits for `task`, running other tasks in the meantime.  The task is usually still at the back of this thread's own deque, in which case it just runs here.
+ */
+void TaskPool::join(ParallelTask* task) {
+    
+    while (!task->done.load(memory_order_acquire)) {
+        
+        ParallelTask* other = findTask(workerIndex);
+        if (other != nullptr) {
+            
+            run(other);
+        } else {
+            
+            this_thread::yield();
+        }
+    }
+}
+
+ParallelTask* TaskPool::findTask(unsigned index) {
+    
+    {
+        WorkQueue &own = queues[index];
+        lock_guard<mutex> guard(own.lock);
+        if (!own.tasks.empty()) {
+            
+            ParallelTask* task = own.tasks.back();
+            own.tasks.pop_back();
+            return task;
+        }
+    }
+    for (size_t offset = 1; offset < queues.size(); offset++) {
+        
+        WorkQueue &victim = queues[(index + offset) % queues.size()];
+        lock_guard<mutex> guard(victim.lock);
+        if (!victim.tasks.empty()) {
+            
+            ParallelTask* task = victim.tasks.front();
+            victim.tasks.pop_front();
+            return task;
+        }
+    }
+    return nullptr;
+}
+
+void TaskPool::run(ParallelTask* task) {
+    
+    try {
+        
+        EvaluationScope scope(this->context);
+        task->result = evaluate(task->expr);
+    } catch (...) {
+        
+        task->error = current_exception();
+    }
+    task->done.store(true, memory_order_release);
+}
+
+void TaskPool::work(unsigned index) {
+    
+    workerIndex = index;
+    int misses = 0;
+    while (!stopping.load()) {
+        
+        ParallelTask* task = findTask(index);
+        if (task != nullptr) {
+            
+            run(task);
+            misses = 0;
+        } else if (++misses < 64) {
+            
+            this_thread::yield();
+        } else {
+            
+            this_thread::sleep_for(chrono::microseconds(50));
+        }
+    }
+}
+
+Value* TaskPool::evaluate(Expression* expr) {
+    
+    if (expr->nodeCount() < PARALLEL_CUTOFF) {
+        
+        return expr->evaluate();
+    }
+    
+    Add* add = dynamic_cast<Add*>(expr);
+    Multiply* multiply = dynamic_cast<Multiply*>(expr);
+    LetExpression* let = dynamic_cast<LetExpression*>(expr);
+    IfExpression* conditional = dynamic_cast<IfExpression*>(expr);
+    if (add != nullptr || multiply != nullptr) {
+        
+        EvaluationContext::countStep();
+        ParallelTask right;
+        right.expr = add != nullptr ? add->rightHandSide : multiply->rightHandSide;
+        right.result = nullptr;
+        right.done = false;
+        fork(&right);
+        
+        //the forked task points into this frame, so it has to be joined even when the left side throws
+        Value* lhs = nullptr;
+        exception_ptr error;
+        try {
+            
+            lhs = evaluate(add != nullptr ? add->leftHandSide : multiply->leftHandSide);
+        } catch (...) {
+            
+            error = current_exception();
+        }
+        join(&right);
+        if (error) {
+            
+            rethrow_exception(error);
+        }
+        if (right.error) {
+            
+            rethrow_exception(right.error);
+        }
+        return add != nullptr ? lhs->addTo(right.result) : lhs->multiplyWith(right.result);
+    } else if (let != nullptr && (this->context == nullptr || !this->context->lazyLet)) {
+        
+        //bound eagerly here only without lazyLet; a lazy binding is left to `evaluate()`, so its thunk is only ever forced on the thread that made it
+        EvaluationContext::countStep();
+        Value* value = evaluate(let->subExpression);
+        return evaluate(let->subBody->substitute(let->subVariable->name, value));
+    } else if (conditional != nullptr) {
+        
+        //the test is evaluated first, so the untaken branch is never forked
+        EvaluationContext::countStep();
+        BoolValue* test = dynamic_cast<BoolValue*>(evaluate(conditional->test));
+        if (test == nullptr) {
+            
+            throw runtime_error("_if test is not a boolean");
+        }
+        return evaluate(test->value ? conditional->thenBranch : conditional->elseBranch);
+    }
+    return expr->evaluate();
+}
+
+Value* evaluateParallel(Expression* expr, unsigned threadCount) {
+    
+    if (threadCount == 0) {
+        
+        threadCount = max(1u, thread::hardware_concurrency());
+    }
+    if (expr->nodeCount() < PARALLEL_CUTOFF) {
+        
+        return expr->evaluate();
+    }
+    
+    TaskPool pool(threadCount, EvaluationContext::current());
+    unsigned callerIndex = workerIndex;
+    workerIndex = 0;
+    try {
+        
+        Value* result = pool.evaluate(expr);
+        workerIndex = callerIndex;
+        return result;
+    } catch (...) {
+        
+        workerIndex = callerIndex;
+        throw;
+    }
+}
+
+/* for tests */
+static Expression* balancedTree(int depth, int leaf) {
+    
+    if (depth == 0) {
+        
+        return new Number(leaf);
+    }
+    Expression* lhs = balancedTree(depth - 1, leaf);
+    Expression* rhs = balancedTree(depth - 1, leaf);
+    if (depth % 2 == 0) {
+        
+        return new Multiply(lhs, rhs);
+    }
+    return new Add(lhs, rhs);
+}
+
+/* for tests: a spine whose left children are balanced trees of decreasing depth */
+static Expression* skewedTree(int depth, int leaf) {
+    
+    Expression* expr = new Number(leaf);
+    for (int i = 1; i <= depth; i++) {
+        
+        expr = new Add(balancedTree(i, leaf), expr);
+    }
+    return expr;
+}
+
+TEST_CASE( "evaluateParallel" ) {
+    
+    Expression* balanced = balancedTree(15, 1);
+    CHECK( evaluateParallel(balanced, 4)->equals(balanced->evaluate()) );
+    CHECK( evaluateParallel(balanced, 1)->equals(balanced->evaluate()) );
+    
+    Expression* skewed = skewedTree(16, 2);
+    CHECK( evaluateParallel(skewed, 3)->equals(skewed->evaluate()) );
+    
+    Expression* let = new LetExpression(new Variable("x"), balancedTree(13, 1), new Add(new Variable("x"), balancedTree(14, 1)));
+    CHECK( evaluateParallel(let, 4)->equals(let->evaluate()) );
+    
+    Expression* conditional = new IfExpression(new EqualsExpression(balancedTree(13, 1), balancedTree(13, 1)), balancedTree(14, 1), new Variable("unused"));
+    CHECK( evaluateParallel(conditional, 4)->equals(conditional->evaluate()) );
+    
+    Expression* failing = new Add(balancedTree(14, 1), new Add(balancedTree(14, 1), new Variable("y")));
+    CHECK_THROWS_WITH( evaluateParallel(failing, 4), "Incomplete substitution" );
+    
+    CHECK( evaluateParallel(new Add(new Number(1), new Number(2)), 4)->equals(new NumericValue(3)) );
+    
+    //every thread counts against the caller's context
+    EvaluationContext sequential;
+    {
+        EvaluationScope scope(&sequential);
+        balanced->evaluate();
+    }
+    EvaluationContext shared;
+    {
+        EvaluationScope scope(&shared);
+        evaluateParallel(balanced, 4);
+    }
+    CHECK( shared.steps == sequential.steps );
+    CHECK( shared.bytesAllocated == sequential.bytesAllocated );
+    
+    EvaluationContext budget;
+    budget.stepBudget = sequential.steps / 2;
+    {
+        EvaluationScope scope(&budget);
+        CHECK_THROWS_AS( evaluateParallel(balanced, 4), EvaluationLimitError );
+    }
+    
+    EvaluationContext cancelled;
+    cancelled.cancel();
+    {
+        EvaluationScope scope(&cancelled);
+        CHECK_THROWS_AS( evaluateParallel(balanced, 4), EvaluationLimitError );
+        CHECK( cancelled.steps < sequential.steps );
+    }
+    
+    //a lazy binding that is never used is never evaluated
+    EvaluationContext lazy;
+    lazy.lazyLet = true;
+    {
+        EvaluationScope scope(&lazy);
+        Expression* unused = new LetExpression(new Variable("x"), new Variable("unbound"), balancedTree(14, 1));
+        CHECK( evaluateParallel(unused, 4)->equals(balancedTree(14, 1)->evaluate()) );
+    }
+}
+
+TEST_CASE( "evaluateParallel benchmark", "[.benchmark]" ) {
+    
+    Expression* trees[] = { balancedTree(22, 1), skewedTree(21, 1) };
+    const char* names[] = { "balanced", "skewed" };
+    for (int i = 0; i < 2; i++) {
+        
+        auto start = chrono::steady_clock::now();
+        Value* expected = trees[i]->evaluate();
+        double sequential = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        cout << names[i] << " sequential: " << sequential << " ms\n";
+        for (unsigned threads = 1; threads <= max(1u, thread::hardware_concurrency()); threads *= 2) {
+            
+            start = chrono::steady_clock::now();
+            CHECK( evaluateParallel(trees[i], threads)->equals(expected) );
+            double parallel = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            cout << names[i] << " " << threads << " threads: " << parallel << " ms (" << sequential / parallel << "x)\n";
+        }
+    }
+}
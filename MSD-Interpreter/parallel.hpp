@@ -0,0 +1,72 @@
+//
+//  parallel.hpp
+//  ParserImproved
+//
+//  Copyright © 2020 MSD Katie Rose. All rights reserved.
+//
+
+#ifndef parallel_hpp
+#define parallel_hpp
+
+#include <stdio.h>
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "expression.hpp"
+#include "context.hpp"
+
+using namespace std;
+
+/*
+ A ParallelTask is one subtree whose evaluation has been forked onto the pool
+ */
+struct ParallelTask {
+    Expression* expr;
+    Value* result;
+    exception_ptr error;
+    atomic<bool> done;
+};
+
+/*
+ TaskPool runs forked ParallelTasks on a fixed set of threads.  Each thread pushes and pops its own tasks at the back of its deque, and idle threads steal from the front of other threads' deques, where the oldest and therefore largest subtrees are.  Every task runs with `context` installed, so the budgets, cancellation and options of the caller's EvaluationContext hold for stolen subtrees too.
+ */
+class TaskPool {
+public:
+    
+    TaskPool(unsigned threadCount, EvaluationContext* evaluationContext);
+    ~TaskPool();
+    void fork(ParallelTask* task);
+    void join(ParallelTask* task);
+    Value* evaluate(Expression* expr);
+
+private:
+    
+    struct WorkQueue {
+        mutex lock;
+        deque<ParallelTask*> tasks;
+    };
+    
+    vector<WorkQueue> queues;
+    EvaluationContext* context;
+    vector<thread> threads;
+    atomic<bool> stopping;
+    
+    void work(unsigned index);
+    ParallelTask* findTask(unsigned index);
+    void run(ParallelTask* task);
+};
+
+/*
+ Subtrees with fewer nodes than this, according to `nodeCount()`, are evaluated sequentially
+ */
+const size_t PARALLEL_CUTOFF = 4096;
+
+/*
+ Evaluates `expr` like `evaluate()`, forking the evaluation of large independent subtrees of `+` and `*` onto `threadCount` threads (the hardware concurrency when 0), all of them running with the caller's EvaluationContext installed.  Integer `+` and `*` are associative and exact, so the result does not depend on scheduling.
+ */
+Value* evaluateParallel(Expression* expr, unsigned threadCount = 0);
+
+#endif /* parallel_hpp */
@@ -5,48 +5,125 @@
 //  Created by Katie Rose on 2/2/20.
 //  Copyright © 2020 MSD Katie Rose. All rights reserved.
 //
+#include <chrono>
 #include <iostream>
+#include <random>
 #include <sstream>
 #include "parser.hpp"
 #include "catch.hpp"
 
 using namespace std;
 
-static Expression *parseExpression(istream &in);
-static Expression *parseAddend(istream &in);
-static Expression *parseInner(istream &in);
-static Expression *parseNumber(istream &in);
+/*
+ The result of parsing part of an expression.  While folding constants, an integer constant is kept as `constant` with `expr` left nullptr, and only becomes a node when it meets something that is not constant.  `unfoldedNodes` is how many nodes the constant would have taken without folding.
+ */
+struct Parsed {
+    Expression *expr;
+    Value *constant;
+    long unfoldedNodes;
+};
+
+static Parsed parseExpression(istream &in, ParseOptions &options);
+static Parsed parseComparg(istream &in, ParseOptions &options);
+static Parsed parseAddend(istream &in, ParseOptions &options);
+static Parsed parseMulticand(istream &in, ParseOptions &options);
+static Parsed parseInner(istream &in, ParseOptions &options);
+static Value *parseNumber(istream &in);
+static Expression *materialize(Parsed parsed, ParseOptions &options);
 static Variable *parseVariable(istream &in);
 static string parseAlphabetic(istream &input, string prefix);
 static string parseKeyword(istream &input);
 static char peekAfterSpaces(istream &in);
 
+ParseOptions::ParseOptions() {
+    
+    this->foldConstants = false;
+    this->nodesCreated = 0;
+    this->nodesFolded = 0;
+}
+
 /*
  Take an input stream that contains an expression, and returns the parsed representation of that expression. Throws `runtime_error` for parse errors.
  */
 Expression *parse(istream &input) {
     
-    Expression *expr = parseExpression(input);
+    ParseOptions options;
+    return parse(input, options);
+}
+
+Expression *parse(istream &input, ParseOptions &options) {
+    
+    Parsed parsed = parseExpression(input, options);
     char inputCharacter = peekAfterSpaces(input);
     if (!input.eof()) {
         
         throw runtime_error((string)"expected end of file at " + inputCharacter);
     }
-    return expr;
+    return materialize(parsed, options);
+}
+
+static Parsed node(Expression *expr, ParseOptions &options) {
+    
+    options.nodesCreated++;
+    return Parsed{expr, nullptr, 0};
+}
+
+static Parsed constant(Value *value) {
+    
+    return Parsed{nullptr, value, 1};
+}
+
+/*
+ Returns the node for `parsed`, creating the single Number or BigNumber that stands for a folded constant
+ */
+static Expression *materialize(Parsed parsed, ParseOptions &options) {
+    
+    if (parsed.expr != nullptr) {
+        
+        return parsed.expr;
+    }
+    options.nodesCreated++;
+    options.nodesFolded += parsed.unfoldedNodes - 1;
+    return parsed.constant->toExpression();
 }
 
 /*
  Takes an input stream that starts with an expression, consuming the largest initial expression possible.
  */
-static Expression *parseExpression(istream &input) {
+static Parsed parseExpression(istream &input, ParseOptions &options) {
     
-    Expression *expr = parseAddend(input);
+    Parsed expr = parseComparg(input, options);
+    char inputCharacter = peekAfterSpaces(input);
+    if (inputCharacter == '=') {
+        
+        input.get();
+        if (input.peek() != '=') {
+            
+            throw runtime_error((string)"expected '=='");
+        }
+        input.get();
+        Parsed rightHandSide = parseExpression(input, options);
+        expr = node(new EqualsExpression(materialize(expr, options), materialize(rightHandSide, options)), options);
+    }
+    return expr;
+}
+
+/*
+ Takes an input stream that starts with an operand of `==`, consuming the largest one possible, where that is an expression that does not have `==` except within nested expressions.
+ */
+static Parsed parseComparg(istream &input, ParseOptions &options) {
+    
+    Parsed expr = parseAddend(input, options);
     char inputCharacter = peekAfterSpaces(input);
     if (inputCharacter == '+') {
         
         input >> inputCharacter;
-        Expression *rightHandSide = parseExpression(input);
-        expr = new Add(expr, rightHandSide);
+        Parsed rightHandSide = parseComparg(input, options);
+        if (expr.constant != nullptr && rightHandSide.constant != nullptr) {
+            
+            return Parsed{nullptr, expr.constant->addTo(rightHandSide.constant), expr.unfoldedNodes + rightHandSide.unfoldedNodes + 1};
+        }
+        expr = node(new Add(materialize(expr, options), materialize(rightHandSide, options)), options);
     }
     return expr;
 }
@@ -54,30 +131,54 @@ static Expression *parseExpression(istream &input) {
 /*
  Takes an input stream that starts with an addend, consuming the largest initial addend possible, where an addend is an expression that does not have `+` except within nested expressions (like parentheses).
  */
-static Expression *parseAddend(istream &input) {
+static Parsed parseAddend(istream &input, ParseOptions &options) {
     
-    Expression *expr = parseInner(input);
+    Parsed expr = parseMulticand(input, options);
     char inputCharacter = peekAfterSpaces(input);
     if (inputCharacter == '*') {
         
         inputCharacter = input.get();
-        Expression *rightHandSide = parseAddend(input);
-        expr = new Multiply(expr, rightHandSide);
+        Parsed rightHandSide = parseAddend(input, options);
+        if (expr.constant != nullptr && rightHandSide.constant != nullptr) {
+            
+            return Parsed{nullptr, expr.constant->multiplyWith(rightHandSide.constant), expr.unfoldedNodes + rightHandSide.unfoldedNodes + 1};
+        }
+        expr = node(new Multiply(materialize(expr, options), materialize(rightHandSide, options)), options);
     }
     return expr;
 }
 
 /*
- Parses something with no immediate `+` or `*` from `in`
+ Takes an input stream that starts with an operand of `*`, which is an inner expression followed by any number of parenthesized arguments to call it with
  */
-static Expression *parseInner(istream &input) {
+static Parsed parseMulticand(istream &input, ParseOptions &options) {
     
-    Expression *expr;
+    Parsed expr = parseInner(input, options);
+    while (peekAfterSpaces(input) == '(') {
+        
+        input.get();
+        Parsed argument = parseExpression(input, options);
+        if (peekAfterSpaces(input) != ')') {
+            
+            throw runtime_error("expected a close parenthesis");
+        }
+        input.get();
+        expr = node(new CallExpression(materialize(expr, options), materialize(argument, options)), options);
+    }
+    return expr;
+}
+
+/*
+ Parses something with no immediate `+`, `*` or call from `in`
+ */
+static Parsed parseInner(istream &input, ParseOptions &options) {
+    
+    Parsed expr;
     char inputCharacter = peekAfterSpaces(input);
     if (inputCharacter == '(') {
         
         inputCharacter = input.get();
-        expr = parseExpression(input);
+        expr = parseExpression(input, options);
         inputCharacter = peekAfterSpaces(input);
         if (inputCharacter == ')') {
             
@@ -89,33 +190,39 @@ static Expression *parseInner(istream &input) {
         
     } else if (isdigit(inputCharacter)) {
         
-        expr = parseNumber(input);
+        Value *value = parseNumber(input);
+        if (options.foldConstants) {
+            
+            return constant(value);
+        }
+        expr = node(value->toExpression(), options);
     } else if (isalpha(inputCharacter)) {
         
-        expr = parseVariable(input);
+        expr = node(parseVariable(input), options);
         
     } else if (inputCharacter == '_') {
         
         string keyword = parseKeyword(input);
                 if (keyword == "_true") {
         
-                    return new BoolExpression(true);
+                    return node(new BoolExpression(true), options);
                 } else if (keyword == "_false") {
         
-                    return new BoolExpression(false);
+                    return node(new BoolExpression(false), options);
                     
                 } else if (keyword == "_let") { //let x = 5 in x + 9 outputs 14
                     
                     //get variable name (maybe this should be a string instead?)
                     peekAfterSpaces(input);
                     Variable* subVariable = parseVariable(input);
+                    options.nodesCreated++;
                     Expression* subExpression;
                     Expression* subBody;
             
                     if (peekAfterSpaces(input) == '=') {
                         
                         input.get();
-                        subExpression = parseExpression(input);
+                        subExpression = materialize(parseExpression(input, options), options);
                     } else {
                         
                         throw runtime_error((string)"expected '=' after variable substitution");
@@ -123,13 +230,50 @@ static Expression *parseInner(istream &input) {
                     keyword = parseKeyword(input);
                     if (keyword == "_in") {
                         
-                        subBody = parseExpression(input);
-                        return (new LetExpression(subVariable, subExpression, subBody));
+                        subBody = materialize(parseExpression(input, options), options);
+                        return node(new LetExpression(subVariable, subExpression, subBody), options);
                         
                     } else {
                         
                         throw runtime_error((string)"expected keyword _in after _let substitution");
                     }
+                } else if (keyword == "_if") {
+                    
+                    Expression* test = materialize(parseExpression(input, options), options);
+                    peekAfterSpaces(input);
+                    if (parseKeyword(input) != "_then") {
+                        
+                        throw runtime_error((string)"expected keyword _then after _if test");
+                    }
+                    Expression* thenBranch = materialize(parseExpression(input, options), options);
+                    peekAfterSpaces(input);
+                    if (parseKeyword(input) != "_else") {
+                        
+                        throw runtime_error((string)"expected keyword _else after _then branch");
+                    }
+                    Expression* elseBranch = materialize(parseExpression(input, options), options);
+                    return node(new IfExpression(test, thenBranch, elseBranch), options);
+                } else if (keyword == "_fun") {
+                    
+                    if (peekAfterSpaces(input) != '(') {
+                        
+                        throw runtime_error((string)"expected '(' after _fun");
+                    }
+                    input.get();
+                    peekAfterSpaces(input);
+                    if (!isalpha(input.peek())) {
+                        
+                        throw runtime_error((string)"expected a variable for the _fun argument");
+                    }
+                    Variable* formalArgument = parseVariable(input);
+                    options.nodesCreated++;
+                    if (peekAfterSpaces(input) != ')') {
+                        
+                        throw runtime_error((string)"expected ')' after the _fun argument");
+                    }
+                    input.get();
+                    Expression* body = materialize(parseExpression(input, options), options);
+                    return node(new FunExpression(formalArgument, body), options);
                 } else {
         
                     throw std::runtime_error((std::string)"unexpected keyword " + keyword);
@@ -160,11 +304,13 @@ static string parseKeyword(istream &input) {
     return parseAlphabetic(input, "_");
 }
 
-// Parses a number, assuming that `in` starts with a digit.
-static Expression *parseNumber(istream &input) {
-    int num = 0;
-    input >> num;
-    return new Number(num);
+// Parses a number, assuming that `in` starts with a digit. Literals too large for an int are BigIntValues.
+static Value *parseNumber(istream &input) {
+    string digits;
+    while (isdigit(input.peek())) {
+        digits += input.get();
+    }
+    return BigIntValue::fromDigits(digits);
 }
 
 /*
@@ -234,6 +380,8 @@ TEST_CASE( "See if this works" ) {
                                                      new Number(4))) );
     CHECK( parse_str("xyz")->equals(new Variable("xyz")) );
     CHECK( parse_str("xyz+1")->equals(new Add(new Variable("xyz"), new Number(1))) );
+    CHECK( parse_str("12345678901234567890")->equals(new BigNumber(new BigIntValue((string)"12345678901234567890"))) );
+    CHECK( parse_str("2147483647 + 1")->evaluate()->toString() == "2147483648" );
     
     CHECK ( parse_str_error("!") == "expected a digit or open parenthesis at !" );
     CHECK ( parse_str_error("(1") == "expected a close parenthesis" );
@@ -261,6 +409,207 @@ TEST_CASE( "Boolean support test ") {
     CHECK( parse_str( " _true ")->equals(new BoolExpression(true)) );
 }
 
+TEST_CASE( "conditional parsing" ) {
+    CHECK( parse_str("1 + 2 == 3")->equals(new EqualsExpression(new Add(new Number(1), new Number(2)), new Number(3))) );
+    CHECK( parse_str("x == 2 * y")->equals(new EqualsExpression(new Variable("x"), new Multiply(new Number(2), new Variable("y")))) );
+    CHECK( parse_str("a == b == c")->equals(new EqualsExpression(new Variable("a"), new EqualsExpression(new Variable("b"), new Variable("c")))) );
+    CHECK( parse_str("(1 == 1) == _true")->evaluate()->equals(new BoolValue(true)) );
+    CHECK( parse_str("_if x == 0 _then 1 _else x + 2")->equals(new IfExpression(new EqualsExpression(new Variable("x"), new Number(0)), new Number(1), new Add(new Variable("x"), new Number(2)))) );
+    CHECK( parse_str("_let n = 3 _in _if n == 3 _then _if _false _then 1 _else 2 _else 4")->evaluate()->equals(new NumericValue(2)) );
+    CHECK( parse_str("(_if _true _then 1 _else 2) * 5")->evaluate()->equals(new NumericValue(5)) );
+    
+    CHECK ( parse_str_error("1 = 2") == "expected '=='" );
+    CHECK ( parse_str_error("_if _true _in 1 _else 2") == "expected keyword _then after _if test" );
+    CHECK ( parse_str_error("_if _true _then 1 _in 2") == "expected keyword _else after _then branch" );
+    
+    //constants are still folded on each side of `==`
+    ParseOptions options;
+    options.foldConstants = true;
+    std::istringstream in("1 + 2 == 3 * 1");
+    CHECK( parse(in, options)->equals(new EqualsExpression(new Number(3), new Number(3))) );
+}
+
+TEST_CASE( "function parsing" ) {
+    CHECK( parse_str("_fun (x) x + 1")->equals(new FunExpression(new Variable("x"), new Add(new Variable("x"), new Number(1)))) );
+    CHECK( parse_str("f(1) + g (2) * 3")->equals(new Add(new CallExpression(new Variable("f"), new Number(1)), new Multiply(new CallExpression(new Variable("g"), new Number(2)), new Number(3)))) );
+    CHECK( parse_str("f(g(x))(y)")->equals(new CallExpression(new CallExpression(new Variable("f"), new CallExpression(new Variable("g"), new Variable("x"))), new Variable("y"))) );
+    CHECK( parse_str("(_fun (x) x * 2)(21)")->evaluate()->equals(new NumericValue(42)) );
+    CHECK( parse_str("_fun (f) _fun (x) f(f(x))")->toString() == "_fun (f) _fun (x) f(f(x))" );
+    
+    CHECK ( parse_str_error("_fun x x") == "expected '(' after _fun" );
+    CHECK ( parse_str_error("_fun (1) 1") == "expected a variable for the _fun argument" );
+    CHECK ( parse_str_error("_fun (x y") == "expected ')' after the _fun argument" );
+    CHECK ( parse_str_error("f(1") == "expected a close parenthesis" );
+}
+
+/* for tests */
+static Expression *parse_folded_str(string s, ParseOptions &options) {
+    std::istringstream in(s);
+    options.foldConstants = true;
+    return parse(in, options);
+}
+
+TEST_CASE( "constant folding while parsing" ) {
+    ParseOptions options;
+    CHECK( parse_folded_str("2 + 3", options)->equals(new Number(5)) );
+    CHECK( options.nodesCreated == 1 );
+    CHECK( options.nodesFolded == 2 );
+    
+    options = ParseOptions();
+    CHECK( parse_folded_str("(1 + 2) * 4 + x * (2 * 3)", options)->equals(new Add(new Number(12), new Multiply(new Variable("x"), new Number(6)))) );
+    CHECK( options.nodesCreated == 5 );
+    CHECK( options.nodesFolded == 6 );
+    
+    //constants separated by a variable are left for optimize()
+    options = ParseOptions();
+    CHECK( parse_folded_str("1 + x + 2", options)->equals(new Add(new Number(1), new Add(new Variable("x"), new Number(2)))) );
+    CHECK( options.nodesFolded == 0 );
+    
+    options = ParseOptions();
+    CHECK( parse_folded_str("_let y = 3 * 3 _in y + 65536 * 65536", options)->equals(new LetExpression(new Variable("y"), new Number(9), new Add(new Variable("y"), new BigNumber(new BigIntValue(4294967296LL))))) );
+    CHECK( parse_folded_str("_true", options)->equals(new BoolExpression(true)) );
+    
+    //without folding, every node is created
+    ParseOptions unfolded;
+    std::istringstream in("(1 + 2) * 4");
+    CHECK( parse(in, unfolded)->equals(parse_str("(1 + 2) * 4")) );
+    CHECK( unfolded.nodesCreated == 5 );
+    CHECK( unfolded.nodesFolded == 0 );
+}
+
+/* for tests: an expression whose leaves are mostly literals */
+static void writeLiteralHeavy(ostream &out, int depth, unsigned &seed) {
+    seed = seed * 1103515245 + 12345;
+    if (depth == 0) {
+        if ((seed >> 16) % 10 == 0) {
+            out << "v";
+        } else {
+            out << (seed >> 16) % 100;
+        }
+        return;
+    }
+    out << "(";
+    writeLiteralHeavy(out, depth - 1, seed);
+    out << ((seed >> 20) % 2 == 0 ? " + " : " * ");
+    writeLiteralHeavy(out, depth - 1, seed);
+    out << ")";
+}
+
+TEST_CASE( "constant folding while parsing benchmark", "[.benchmark]" ) {
+    unsigned seed = 31;
+    for (int depth : {8, 12, 16}) {
+        std::ostringstream source;
+        writeLiteralHeavy(source, depth, seed);
+        ParseOptions unfolded;
+        ParseOptions folded;
+        folded.foldConstants = true;
+        std::istringstream unfoldedIn(source.str());
+        std::istringstream foldedIn(source.str());
+        
+        auto start = std::chrono::steady_clock::now();
+        parse(unfoldedIn, unfolded);
+        auto middle = std::chrono::steady_clock::now();
+        parse(foldedIn, folded);
+        auto end = std::chrono::steady_clock::now();
+        
+        cout << "depth " << depth << ": " << unfolded.nodesCreated << " nodes unfolded, " << folded.nodesCreated << " folded (" << folded.nodesFolded << " saved); "
+             << std::chrono::duration<double, std::milli>(middle - start).count() << " ms vs "
+             << std::chrono::duration<double, std::milli>(end - middle).count() << " ms\n";
+    }
+}
+
 TEST_CASE( "Let Expression support test" ) {
 //    CHECK( parse_str("_let x = 5 _in x + 2")->equals(new Number(7)));
 }
+
+/* for tests: a random expression with every kind of node, at most `depth` levels deep */
+static Expression* randomExpression(int depth, mt19937 &generator) {
+    
+    const char* names[] = { "x", "y", "f" };
+    uniform_int_distribution<int> kind(0, depth == 0 ? 3 : 12);
+    switch (kind(generator)) {
+        case 0:
+            return new Number(generator() % 100);
+        case 1:
+            return new BigNumber(new BigIntValue(to_string(3000000000ULL + generator() % 1000000000ULL)));
+        case 2:
+            return new Variable(names[generator() % 3]);
+        case 3:
+            return new BoolExpression(generator() % 2 == 0);
+        case 4:
+        case 5:
+            return new Add(randomExpression(depth - 1, generator), randomExpression(depth - 1, generator));
+        case 6:
+        case 7:
+            return new Multiply(randomExpression(depth - 1, generator), randomExpression(depth - 1, generator));
+        case 8:
+            return new EqualsExpression(randomExpression(depth - 1, generator), randomExpression(depth - 1, generator));
+        case 9:
+            return new LetExpression(new Variable(names[generator() % 3]), randomExpression(depth - 1, generator), randomExpression(depth - 1, generator));
+        case 10:
+            return new IfExpression(randomExpression(depth - 1, generator), randomExpression(depth - 1, generator), randomExpression(depth - 1, generator));
+        case 11:
+            return new FunExpression(new Variable(names[generator() % 3]), randomExpression(depth - 1, generator));
+        default:
+            return new CallExpression(randomExpression(depth - 1, generator), randomExpression(depth - 1, generator));
+    }
+}
+
+/* for tests: whether deleting any one pair of parentheses from `printed` leaves text that does not parse back to `expr` */
+static bool parenthesesAreNeeded(string printed, Expression* expr) {
+    
+    vector<size_t> open;
+    for (size_t i = 0; i < printed.size(); i++) {
+        
+        if (printed[i] == '(') {
+            
+            open.push_back(i);
+        } else if (printed[i] == ')') {
+            
+            string without = printed.substr(0, open.back()) + printed.substr(open.back() + 1, i - open.back() - 1) + printed.substr(i + 1);
+            open.pop_back();
+            if (parse_str_error(without) == "" && parse_str(without)->equals(expr)) {
+                
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+TEST_CASE( "printing round trip" ) {
+    
+    //parenthesized only where the grammar needs it
+    CHECK( parse_str("(2 + 3) * 4")->toString() == "(2 + 3) * 4" );
+    CHECK( parse_str("2 + (3 * 4)")->toString() == "2 + 3 * 4" );
+    CHECK( parse_str("(1 + 2) + (3 + 4)")->toString() == "(1 + 2) + 3 + 4" );
+    CHECK( parse_str("(a == b) == (c == d)")->toString() == "(a == b) == c == d" );
+    CHECK( parse_str("(_let x = 1 _in x) + (_let y = 2 _in y)")->toString() == "(_let x = 1 _in x) + _let y = 2 _in y" );
+    CHECK( parse_str("_let x = (_let y = 1 _in y) _in (_if x == 1 _then (_fun (z) z) _else f)(x)")->toString()
+           == "_let x = _let y = 1 _in y _in (_if x == 1 _then _fun (z) z _else f)(x)" );
+    CHECK( parse_str("(f(1))(2) * (g)(3 + 4)")->toString() == "f(1)(2) * g(3 + 4)" );
+    CHECK( parse_str("(2 * 3)(4)")->toString() == "(2 * 3)(4)" );
+    CHECK( parse_str("_true == (_false)")->toString() == "_true == _false" );
+    
+    //random trees print to text that parses back to the same tree, and every pair of parentheses in it is needed
+    mt19937 generator(49);
+    int roundTrips = 0;
+    vector<string> notMinimal;
+    for (int i = 0; i < 2000; i++) {
+        
+        Expression* expr = randomExpression(1 + i % 6, generator);
+        string printed = expr->toString();
+        INFO( printed );
+        REQUIRE( parse_str_error(printed) == "" );
+        if (parse_str(printed)->equals(expr)) {
+            
+            roundTrips++;
+        }
+        if (!parenthesesAreNeeded(printed, expr)) {
+            
+            notMinimal.push_back(printed);
+        }
+    }
+    CHECK( roundTrips == 2000 );
+    CHECK( notMinimal.empty() );
+}
@@ -13,6 +13,17 @@
 
 using namespace std;
 
+/*
+ Options and statistics for parse.  With `foldConstants` set, `+` and `*` whose operands are both integer constants are combined as they are parsed, so a constant region becomes a single Number without any intermediate nodes.  `nodesFolded` counts the nodes that folding avoided creating.
+ */
+struct ParseOptions {
+    bool foldConstants;
+    long nodesCreated;
+    long nodesFolded;
+    ParseOptions();
+};
+
 Expression *parse(istream &in);
+Expression *parse(istream &in, ParseOptions &options);
 
 #endif /* parser_hpp */
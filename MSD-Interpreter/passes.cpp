@@ -0,0 +1,206 @@
+//
+//  passes.cpp
+//  ParserImproved
+//
+//  Copyright © 2020 MSD Katie Rose. All rights reserved.
+//
+
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include "passes.hpp"
+#include "context.hpp"
+#include "cse.hpp"
+#include "egraph.hpp"
+#include "inliner.hpp"
+#include "interpreter.hpp"
+#include "parser.hpp"
+#include "polynomial.hpp"
+#include "rewrite.hpp"
+#include "catch.hpp"
+
+static Expression* foldPass(Expression* expr) {
+    
+    return expr->simplify();
+}
+
+static Expression* rewritePass(Expression* expr) {
+    
+    RewriteStats stats;
+    return rewrite(expr, stats);
+}
+
+static Expression* saturatePass(Expression* expr) {
+    
+    EGraphOptions options;
+    return saturate(expr, options);
+}
+
+static Expression* inlinePass(Expression* expr) {
+    
+    InlineStats stats;
+    return inlineLets(expr, stats);
+}
+
+static Expression* csePass(Expression* expr) {
+    
+    CSEStats stats;
+    return eliminateCommonSubexpressions(expr, stats);
+}
+
+const vector<Pass> &availablePasses() {
+    
+    static const vector<Pass> passes = {
+        { "fold", "fold constant subtrees", foldPass },
+        { "rewrite", "algebraic rewrite rules", rewritePass },
+        { "polynomial", "canonical sum of monomials", canonicalizePolynomial },
+        { "saturate", "equality saturation", saturatePass },
+        { "inline", "inline and eliminate _let bindings", inlinePass },
+        { "cse", "common subexpression elimination", csePass },
+    };
+    return passes;
+}
+
+PassReport::PassReport(string passName) {
+    
+    this->name = passName;
+    this->runs = 0;
+    this->milliseconds = 0;
+    this->nodesBefore = 0;
+    this->nodesAfter = 0;
+    this->bytesAllocated = 0;
+    this->allocations = 0;
+}
+
+PassManager::PassManager(string pipeline) {
+    
+    this->maxIterations = DEFAULT_PASS_ITERATIONS;
+    this->iterations = 0;
+    this->reachedFixpoint = false;
+    std::istringstream names(pipeline);
+    string name;
+    while (getline(names, name, ',')) {
+        
+        name.erase(0, name.find_first_not_of(' '));
+        name.erase(name.find_last_not_of(' ') + 1);
+        bool found = false;
+        for (const Pass &pass : availablePasses()) {
+            
+            if (pass.name == name) {
+                
+                this->pipeline.push_back(pass);
+                this->reports.push_back(PassReport(name));
+                found = true;
+            }
+        }
+        if (!found) {
+            
+            string available;
+            for (const Pass &pass : availablePasses()) {
+                
+                available += (available.empty() ? "" : ", ") + pass.name;
+            }
+            throw runtime_error("unknown pass '" + name + "'; available passes are " + available);
+        }
+    }
+    if (this->pipeline.empty()) {
+        
+        throw runtime_error("empty pass pipeline");
+    }
+}
+
+Expression* PassManager::run(Expression* expr) {
+    
+    this->iterations = 0;
+    this->reachedFixpoint = false;
+    while (this->iterations < this->maxIterations) {
+        
+        Expression* before = expr;
+        for (size_t i = 0; i < this->pipeline.size(); i++) {
+            
+            PassReport &report = this->reports[i];
+            size_t nodes = expr->nodeCount();
+            EvaluationContext context;
+            auto start = std::chrono::steady_clock::now();
+            {
+                EvaluationScope scope(&context);
+                expr = this->pipeline[i].transform(expr);
+            }
+            report.milliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            if (report.runs == 0) {
+                
+                report.nodesBefore = nodes;
+            }
+            report.runs++;
+            report.nodesAfter = expr->nodeCount();
+            report.bytesAllocated += context.bytesAllocated;
+            report.allocations += context.allocations;
+        }
+        this->iterations++;
+        if (expr == before || expr->equals(before)) {
+            
+            this->reachedFixpoint = true;
+            break;
+        }
+    }
+    return expr;
+}
+
+void PassManager::printReport(ostream &out) {
+    
+    out << left << setw(12) << "pass" << right << setw(6) << "runs" << setw(12) << "ms" << setw(14) << "nodes before" << setw(13) << "nodes after"
+        << setw(12) << "bytes" << setw(13) << "allocations" << "\n";
+    for (PassReport &report : this->reports) {
+        
+        out << left << setw(12) << report.name << right << setw(6) << report.runs << setw(12) << fixed << setprecision(3) << report.milliseconds
+            << setw(14) << report.nodesBefore << setw(13) << report.nodesAfter << setw(12) << report.bytesAllocated << setw(13) << report.allocations << "\n";
+    }
+    out << this->iterations << (this->iterations == 1 ? " iteration" : " iterations") << (this->reachedFixpoint ? ", reached a fixpoint" : ", stopped before a fixpoint") << "\n";
+}
+
+/* for tests */
+static Expression *parse_str(string s) {
+    std::istringstream in(s);
+    return parse(in);
+}
+
+TEST_CASE( "PassManager" ) {
+    
+    CHECK_THROWS_WITH( PassManager("fold,unroll"), "unknown pass 'unroll'; available passes are fold, rewrite, polynomial, saturate, inline, cse" );
+    CHECK_THROWS_WITH( PassManager(""), "empty pass pipeline" );
+    
+    PassManager passes("fold, cse,inline");
+    CHECK( passes.reports.size() == 3 );
+    Expression* original = parse_str("(x * x * x + 1) * (x * x * x + 1) * (x * x * x + 1) + (_let y = 2 _in y * 3)");
+    Expression* optimized = passes.run(original);
+    CHECK( optimized->equals(parse_str("(_let csea = x * x * x + 1 _in csea * csea * csea) + 6")) );
+    CHECK( passes.iterations == 2 );
+    CHECK( passes.reachedFixpoint );
+    CHECK( passes.reports[0].runs == 2 );
+    CHECK( passes.reports[0].nodesBefore == original->nodeCount() );
+    CHECK( passes.reports[1].nodesAfter == optimized->nodeCount() );
+    CHECK( passes.reports[1].nodesAfter < passes.reports[1].nodesBefore );
+    CHECK( passes.reports[1].allocations > 0 );
+    CHECK( passes.reports[1].bytesAllocated > 0 );
+    
+    //the cap stops pipelines that keep changing the expression
+    PassManager capped("rewrite");
+    capped.maxIterations = 1;
+    CHECK( capped.run(parse_str("1 + x + 2"))->equals(parse_str("x + 3")) );
+    CHECK( capped.iterations == 1 );
+    CHECK( ! capped.reachedFixpoint );
+    
+    std::ostringstream report;
+    passes.printReport(report);
+    CHECK( report.str().find("cse") != string::npos );
+    CHECK( report.str().find("2 iterations, reached a fixpoint") != string::npos );
+    
+    //closed expressions go through the pipeline too, rather than being evaluated
+    PassManager throughOptimize("fold");
+    CHECK( optimize(parse_str("2 * 3 + 1"), throughOptimize)->equals(new Number(7)) );
+    CHECK( throughOptimize.iterations > 0 );
+    CHECK( throughOptimize.reports[0].runs > 0 );
+    PassManager closed("fold");
+    CHECK( optimize(parse_str("_true + 1"), closed)->equals(parse_str("_true + 1")) );
+}
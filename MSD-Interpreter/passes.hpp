@@ -0,0 +1,79 @@
+//
+//  passes.hpp
+//  ParserImproved
+//
+//  Copyright © 2020 MSD Katie Rose. All rights reserved.
+//
+
+#ifndef passes_hpp
+#define passes_hpp
+
+#include <stdio.h>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "expression.hpp"
+
+using namespace std;
+
+/*
+ A named transform from an Expression to an equivalent one
+ */
+struct Pass {
+    string name;
+    string description;
+    Expression* (*transform)(Expression* expr);
+};
+
+/*
+ Every pass that can be named in a pipeline:
+   fold        Expression::simplify(), which folds constant subtrees and inlines `_let`s
+   rewrite     the algebraic rewrite rules of rewrite.hpp
+   polynomial  canonicalizePolynomial()
+   saturate    equality saturation with the default EGraphOptions
+   inline      inlineLets()
+   cse         eliminateCommonSubexpressions()
+ */
+const vector<Pass> &availablePasses();
+
+/*
+ What one pass of a pipeline cost, summed over every iteration it ran in.  `nodesBefore` is the size of its input the first time it ran and `nodesAfter` the size of its output the last time.
+ */
+struct PassReport {
+    string name;
+    long runs;
+    double milliseconds;
+    size_t nodesBefore;
+    size_t nodesAfter;
+    size_t bytesAllocated;
+    long allocations;
+    PassReport(string passName);
+};
+
+/*
+ The whole pipeline is rerun until an iteration leaves the expression unchanged, or this many times
+ */
+const int DEFAULT_PASS_ITERATIONS = 4;
+
+/*
+ PassManager runs a pipeline of passes, such as "fold,cse,inline", in order and to a fixpoint, recording a PassReport for each position in the pipeline.  Allocations are counted by installing a fresh EvaluationContext around each pass, so any context the caller installed does not see the work done by the passes.
+ */
+class PassManager {
+public:
+    
+    int maxIterations;
+    int iterations;
+    bool reachedFixpoint;
+    vector<PassReport> reports;
+    
+    //throws `runtime_error` for an empty pipeline or a name not in availablePasses()
+    PassManager(string pipeline);
+    Expression* run(Expression* expr);
+    void printReport(ostream &out);
+
+private:
+    
+    vector<Pass> pipeline;
+};
+
+#endif /* passes_hpp */
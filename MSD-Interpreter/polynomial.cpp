@@ -0,0 +1,405 @@
+//
+//  polynomial.cpp
+//  ParserImproved
+//
+//  Copyright © 2020 MSD Katie Rose. All rights reserved.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+#include "polynomial.hpp"
+#include "parser.hpp"
+#include "catch.hpp"
+
+/*
+ A monomial is a product of atoms raised to powers, stored sparsely as (atom, exponent) pairs sorted by atom.  Atoms are variables and opaque subexpressions, numbered as they are first seen.
+ */
+typedef vector<pair<int, int>> Monomial;
+
+struct MonomialHash {
+    size_t operator()(const Monomial &monomial) const {
+        size_t hash = 1469598103934665603ULL;
+        for (auto &factor : monomial) {
+            hash = (hash ^ (size_t)factor.first) * 1099511628211ULL;
+            hash = (hash ^ (size_t)factor.second) * 1099511628211ULL;
+        }
+        return hash;
+    }
+};
+
+/*
+ Maps each monomial to its coefficient.  Monomials whose coefficient becomes 0 are removed.
+ */
+typedef unordered_map<Monomial, Value*, MonomialHash> Polynomial;
+
+/*
+ Thrown when part of an arithmetic expression is not an integer polynomial
+ */
+struct NotPolynomial {};
+
+class PolynomialBuilder {
+public:
+    
+    Polynomial toPolynomial(Expression* expr);
+    Expression* emit(Polynomial &polynomial);
+
+private:
+    
+    vector<Expression*> atoms;
+    map<string, int> variableAtoms;
+    //the other atoms, bucketed by their structural hash as in cse.cpp
+    unordered_map<uint64_t, vector<int>> opaqueAtoms;
+    
+    int atomFor(Expression* expr);
+    string atomKey(int atom);
+    Expression* emitMonomial(const Monomial &monomial, Value* coefficient);
+};
+
+static bool isZero(Value* value) {
+    
+    NumericValue* numeric = dynamic_cast<NumericValue*>(value);
+    return numeric != nullptr && numeric->value == 0;
+}
+
+static bool isOne(Value* value) {
+    
+    NumericValue* numeric = dynamic_cast<NumericValue*>(value);
+    return numeric != nullptr && numeric->value == 1;
+}
+
+static void addTerm(Polynomial &polynomial, const Monomial &monomial, Value* coefficient) {
+    
+    auto existing = polynomial.find(monomial);
+    if (existing == polynomial.end()) {
+        
+        if (!isZero(coefficient)) {
+            
+            polynomial[monomial] = coefficient;
+        }
+        return;
+    }
+    existing->second = existing->second->addTo(coefficient);
+    if (isZero(existing->second)) {
+        
+        polynomial.erase(existing);
+    }
+}
+
+static Monomial multiplyMonomials(const Monomial &lhs, const Monomial &rhs) {
+    
+    Monomial product;
+    size_t i = 0, j = 0;
+    while (i < lhs.size() || j < rhs.size()) {
+        
+        if (j == rhs.size() || (i < lhs.size() && lhs[i].first < rhs[j].first)) {
+            
+            product.push_back(lhs[i++]);
+        } else if (i == lhs.size() || rhs[j].first < lhs[i].first) {
+            
+            product.push_back(rhs[j++]);
+        } else {
+            
+            product.push_back(make_pair(lhs[i].first, lhs[i].second + rhs[j].second));
+            i++;
+            j++;
+        }
+    }
+    return product;
+}
+
+int PolynomialBuilder::atomFor(Expression* expr) {
+    
+    if (Variable* variable = dynamic_cast<Variable*>(expr)) {
+        
+        auto existing = variableAtoms.find(variable->name);
+        if (existing != variableAtoms.end()) {
+            
+            return existing->second;
+        }
+        atoms.push_back(variable);
+        variableAtoms[variable->name] = (int)atoms.size() - 1;
+        return (int)atoms.size() - 1;
+    }
+    vector<int> &bucket = opaqueAtoms[expr->structuralHash().low];
+    for (int atom : bucket) {
+        
+        if (atoms[atom] == expr || atoms[atom]->equals(expr)) {
+            
+            return atom;
+        }
+    }
+    atoms.push_back(expr);
+    bucket.push_back((int)atoms.size() - 1);
+    return (int)atoms.size() - 1;
+}
+
+Polynomial PolynomialBuilder::toPolynomial(Expression* expr) {
+    
+    Polynomial polynomial;
+    if (dynamic_cast<Number*>(expr) != nullptr || dynamic_cast<BigNumber*>(expr) != nullptr) {
+        
+        addTerm(polynomial, Monomial(), expr->evaluate());
+    } else if (dynamic_cast<Variable*>(expr) != nullptr) {
+        
+        polynomial[Monomial{make_pair(atomFor(expr), 1)}] = new NumericValue(1);
+    } else if (Add* add = dynamic_cast<Add*>(expr)) {
+        
+        polynomial = toPolynomial(add->leftHandSide);
+        Polynomial rhs = toPolynomial(add->rightHandSide);
+        //merge the smaller sum into the larger one, so long chains stay linear
+        if (rhs.size() > polynomial.size()) {
+            
+            swap(polynomial, rhs);
+        }
+        for (auto &term : rhs) {
+            
+            addTerm(polynomial, term.first, term.second);
+        }
+    } else if (Multiply* multiply = dynamic_cast<Multiply*>(expr)) {
+        
+        Polynomial lhs = toPolynomial(multiply->leftHandSide);
+        Polynomial rhs = toPolynomial(multiply->rightHandSide);
+        if (lhs.size() * rhs.size() > MAX_POLYNOMIAL_TERMS) {
+            
+            //keep the product as one factor rather than multiplying it out
+            Expression* factor = new Multiply(emit(lhs), emit(rhs));
+            polynomial[Monomial{make_pair(atomFor(factor), 1)}] = new NumericValue(1);
+            return polynomial;
+        }
+        for (auto &lhsTerm : lhs) {
+            
+            for (auto &rhsTerm : rhs) {
+                
+                addTerm(polynomial, multiplyMonomials(lhsTerm.first, rhsTerm.first), lhsTerm.second->multiplyWith(rhsTerm.second));
+            }
+        }
+    } else if (LetExpression* let = dynamic_cast<LetExpression*>(expr)) {
+        
+        Expression* canonical = new LetExpression(let->subVariable, canonicalizePolynomial(let->subExpression), canonicalizePolynomial(let->subBody));
+        polynomial[Monomial{make_pair(atomFor(canonical), 1)}] = new NumericValue(1);
+    } else if (IfExpression* conditional = dynamic_cast<IfExpression*>(expr)) {
+        
+        Expression* canonical = new IfExpression(canonicalizePolynomial(conditional->test), canonicalizePolynomial(conditional->thenBranch), canonicalizePolynomial(conditional->elseBranch));
+        polynomial[Monomial{make_pair(atomFor(canonical), 1)}] = new NumericValue(1);
+    } else if (CallExpression* call = dynamic_cast<CallExpression*>(expr)) {
+        
+        Expression* canonical = new CallExpression(canonicalizePolynomial(call->toBeCalled), canonicalizePolynomial(call->actualArgument));
+        polynomial[Monomial{make_pair(atomFor(canonical), 1)}] = new NumericValue(1);
+    } else if (dynamic_cast<ThunkExpression*>(expr) != nullptr) {
+        
+        polynomial[Monomial{make_pair(atomFor(expr), 1)}] = new NumericValue(1);
+    } else {
+        
+        throw NotPolynomial();
+    }
+    return polynomial;
+}
+
+string PolynomialBuilder::atomKey(int atom) {
+    
+    if (Variable* variable = dynamic_cast<Variable*>(atoms[atom])) {
+        
+        return variable->name;
+    }
+    //opaque factors sort after all variables
+    return "~" + atoms[atom]->toString();
+}
+
+Expression* PolynomialBuilder::emitMonomial(const Monomial &monomial, Value* coefficient) {
+    
+    vector<Expression*> factors;
+    if (!isOne(coefficient) || monomial.empty()) {
+        
+        factors.push_back(coefficient->toExpression());
+    }
+    vector<pair<string, pair<int, int>>> ordered;
+    for (auto &factor : monomial) {
+        
+        ordered.push_back(make_pair(atomKey(factor.first), factor));
+    }
+    sort(ordered.begin(), ordered.end());
+    for (auto &factor : ordered) {
+        
+        for (int power = 0; power < factor.second.second; power++) {
+            
+            factors.push_back(atoms[factor.second.first]);
+        }
+    }
+    
+    Expression* product = factors.back();
+    for (size_t i = factors.size() - 1; i-- > 0; ) {
+        
+        product = new Multiply(factors[i], product);
+    }
+    return product;
+}
+
+/*
+ Emits the terms of `polynomial` as a right-nested sum, highest degree first and the constant last
+ */
+Expression* PolynomialBuilder::emit(Polynomial &polynomial) {
+    
+    if (polynomial.empty()) {
+        
+        return new Number(0);
+    }
+    
+    struct Term {
+        int degree;
+        vector<pair<string, int>> key;
+        const Monomial* monomial;
+        Value* coefficient;
+    };
+    vector<Term> terms;
+    for (auto &term : polynomial) {
+        
+        Term sortable = Term{0, {}, &term.first, term.second};
+        for (auto &factor : term.first) {
+            
+            sortable.degree += factor.second;
+            sortable.key.push_back(make_pair(atomKey(factor.first), -factor.second));
+        }
+        sort(sortable.key.begin(), sortable.key.end());
+        terms.push_back(sortable);
+    }
+    sort(terms.begin(), terms.end(), [](const Term &lhs, const Term &rhs) {
+        if (lhs.degree != rhs.degree) {
+            return lhs.degree > rhs.degree;
+        }
+        return lhs.key < rhs.key;
+    });
+    
+    Expression* sum = emitMonomial(*terms.back().monomial, terms.back().coefficient);
+    for (size_t i = terms.size() - 1; i-- > 0; ) {
+        
+        sum = new Add(emitMonomial(*terms[i].monomial, terms[i].coefficient), sum);
+    }
+    return sum;
+}
+
+Expression* canonicalizePolynomial(Expression* expr) {
+    
+    //a comparison is a boolean, so only its sides can be polynomials
+    if (EqualsExpression* comparison = dynamic_cast<EqualsExpression*>(expr)) {
+        
+        return new EqualsExpression(canonicalizePolynomial(comparison->leftHandSide), canonicalizePolynomial(comparison->rightHandSide));
+    }
+    //and a function is not a number at all, though its body may be
+    if (FunExpression* function = dynamic_cast<FunExpression*>(expr)) {
+        
+        return new FunExpression(function->formalArgument, canonicalizePolynomial(function->body));
+    }
+    try {
+        
+        PolynomialBuilder builder;
+        Polynomial polynomial = builder.toPolynomial(expr);
+        return builder.emit(polynomial);
+    } catch (NotPolynomial &) {
+        
+        return expr;
+    }
+}
+
+/* for tests */
+static Expression *parse_str(string s) {
+    std::istringstream in(s);
+    return parse(in);
+}
+
+TEST_CASE( "canonicalizePolynomial" ) {
+    
+    CHECK( canonicalizePolynomial(parse_str("x*2 + 3*x + 1 + 4"))->equals(parse_str("5 * x + 5")) );
+    CHECK( canonicalizePolynomial(parse_str("(x + 1) * (x + 1)"))->equals(parse_str("x * x + 2 * x + 1")) );
+    CHECK( canonicalizePolynomial(parse_str("y * x + x * y * 3"))->equals(parse_str("4 * x * y")) );
+    CHECK( canonicalizePolynomial(parse_str("b + a + 2 * 3"))->equals(parse_str("a + b + 6")) );
+    CHECK( canonicalizePolynomial(parse_str("x * 0 + 7"))->equals(new Number(7)) );
+    CHECK( canonicalizePolynomial(parse_str("x * 0"))->equals(new Number(0)) );
+    CHECK( canonicalizePolynomial(parse_str("x * 2 + x == 3 * x"))->equals(parse_str("3 * x == 3 * x")) );
+    CHECK( canonicalizePolynomial(parse_str("(_if x == 1 + y _then x + x _else 2) * 3"))->equals(parse_str("3 * (_if x == y + 1 _then 2 * x _else 2)")) );
+    CHECK( canonicalizePolynomial(parse_str("(x == 1) + 1"))->equals(parse_str("(x == 1) + 1")) );
+    CHECK( canonicalizePolynomial(parse_str("65536 * x * 65536"))->equals(new Multiply(new BigNumber(new BigIntValue(4294967296LL)), new Variable("x"))) );
+    
+    //let expressions are opaque factors, canonicalized inside
+    CHECK( canonicalizePolynomial(parse_str("2 * (_let y = 1 + 1 _in y + y) + (_let y = 2 _in 2 * y)"))->equals(parse_str("3 * (_let y = 2 _in 2 * y)")) );
+    
+    //calls are opaque factors too, and functions are canonicalized inside
+    CHECK( canonicalizePolynomial(parse_str("f(x + x) + f(2 * x) * 2"))->equals(parse_str("3 * f(2 * x)")) );
+    CHECK( canonicalizePolynomial(parse_str("_fun (x) x + 1 + x"))->equals(parse_str("_fun (x) 2 * x + 1")) );
+    CHECK( canonicalizePolynomial(parse_str("(_fun (x) x) + 1 + 1"))->equals(parse_str("(_fun (x) x) + 1 + 1")) );
+    
+    //many distinct opaque factors are told apart by their hash, and equal ones still merge
+    string calls;
+    for (int repeat = 0; repeat < 2; repeat++) {
+        
+        for (int i = 0; i < 3000; i++) {
+            
+            calls += (calls.empty() ? "" : " + ") + (string)"f(" + to_string(i) + ")";
+        }
+    }
+    CHECK( canonicalizePolynomial(parse_str(calls))->nodeCount() == 3000 * parse_str("2 * f(0)")->nodeCount() + 2999 );
+    
+    //booleans are left for evaluation to reject
+    CHECK( canonicalizePolynomial(parse_str("_true + 1 + 1"))->equals(parse_str("_true + 1 + 1")) );
+    
+    //canonical forms evaluate to the same value
+    Expression* original = parse_str("(a + 2 * b + 3) * (a * 4 + 5) * (b + 1)");
+    Expression* canonical = canonicalizePolynomial(original);
+    CHECK( canonical->substitute("a", new NumericValue(7))->substitute("b", new NumericValue(-3))->evaluate()->equals(original->substitute("a", new NumericValue(7))->substitute("b", new NumericValue(-3))->evaluate()) );
+}
+
+/* for tests: a sum of `terms` random products of the variables a..e and small constants */
+static string randomPolynomial(int terms, unsigned &seed) {
+    std::ostringstream out;
+    for (int term = 0; term < terms; term++) {
+        if (term > 0) {
+            out << " + ";
+        }
+        seed = seed * 1103515245 + 12345;
+        int factors = 1 + (seed >> 16) % 4;
+        for (int factor = 0; factor < factors; factor++) {
+            seed = seed * 1103515245 + 12345;
+            if (factor > 0) {
+                out << " * ";
+            }
+            if ((seed >> 16) % 3 == 0) {
+                out << (seed >> 18) % 10;
+            } else {
+                out << (char)('a' + (seed >> 18) % 5);
+            }
+        }
+    }
+    return out.str();
+}
+
+TEST_CASE( "canonicalizePolynomial benchmark", "[.benchmark]" ) {
+    
+    unsigned seed = 33;
+    for (int terms : {1000, 5000, 20000}) {
+        
+        Expression* original = parse_str(randomPolynomial(terms, seed));
+        auto start = std::chrono::steady_clock::now();
+        Expression* canonical = canonicalizePolynomial(original);
+        double canonicalizeMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        
+        Expression* bound[2] = { original, canonical };
+        double evaluateMilliseconds[2];
+        for (int i = 0; i < 2; i++) {
+            for (char name = 'a'; name <= 'e'; name++) {
+                bound[i] = bound[i]->substitute(string(1, name), new NumericValue(name - 'a' + 2));
+            }
+            start = std::chrono::steady_clock::now();
+            for (int repeat = 0; repeat < 10; repeat++) {
+                bound[i]->evaluate();
+            }
+            evaluateMilliseconds[i] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / 10;
+        }
+        CHECK( bound[0]->evaluate()->equals(bound[1]->evaluate()) );
+        cout << terms << " terms: " << original->nodeCount() << " nodes -> " << canonical->nodeCount() << " nodes in " << canonicalizeMilliseconds << " ms; evaluate "
+             << evaluateMilliseconds[0] << " ms -> " << evaluateMilliseconds[1] << " ms\n";
+    }
+}
@@ -0,0 +1,24 @@
+//
+//  polynomial.hpp
+//  ParserImproved
+//
+//  Copyright © 2020 MSD Katie Rose. All rights reserved.
+//
+
+#ifndef polynomial_hpp
+#define polynomial_hpp
+
+#include <stdio.h>
+#include "expression.hpp"
+
+/*
+ Products whose expansion would have more terms than this are kept as factors instead of being multiplied out
+ */
+const size_t MAX_POLYNOMIAL_TERMS = 4096;
+
+/*
+ Rewrites the `+`/`*` structure of `expr` as a canonical sum of monomials, collecting like terms and combining their integer coefficients, so `x*2 + 3*x + 1 + 4` becomes `5 * x + 5`.  Terms are ordered by descending degree and then by variable name.  Subexpressions that are not polynomials (like `_let`s and `_if`s) are treated as opaque factors, with their own parts canonicalized separately.  Expressions that mix in booleans are returned unchanged, so that evaluation still reports the type error.
+ */
+Expression* canonicalizePolynomial(Expression* expr);
+
+#endif /* polynomial_hpp */
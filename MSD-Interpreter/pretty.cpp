@@ -0,0 +1,560 @@
+//
+//  pretty.cpp
+//  ParserImproved
+//
+//  Copyright © 2020 MSD Katie Rose. All rights reserved.
+//
+
+#include <chrono>
+#include <climits>
+#include <iostream>
+#include <sstream>
+#include "pretty.hpp"
+#include "parser.hpp"
+#include "catch.hpp"
+
+/*
+ The size given to a group found to be wider than its line, so it is printed broken
+ */
+static const long long TOO_WIDE = LLONG_MAX;
+
+/*
+ How far the lines of a broken group are indented past the column it starts at
+ */
+static const int INDENT = 2;
+
+PrettyPrinter::PrettyPrinter(ostream &out, int lineWidth) {
+    
+    this->out = &out;
+    this->width = lineWidth;
+    this->remaining = lineWidth;
+    this->printedWidth = 0;
+    this->scannedWidth = 0;
+    this->firstToken = 0;
+    this->endedGroups = 0;
+}
+
+void PrettyPrinter::begin(int indent) {
+    
+    decideEndedGroups();
+    this->undecided.push_back(this->firstToken + this->tokens.size());
+    this->tokens.push_back(Token{BEGIN, -1 - this->scannedWidth, indent, ""});
+}
+
+void PrettyPrinter::end() {
+    
+    if (this->undecided.empty()) {
+        
+        this->frames.pop_back();
+        return;
+    }
+    // a group that has not been found too wide is decided at the next space, so that the text right after it counts towards its width
+    if (this->endedGroups < this->undecided.size()) {
+        
+        this->endedGroups++;
+    }
+    this->tokens.push_back(Token{END, 0, 0, ""});
+}
+
+void PrettyPrinter::text(const char* characters, size_t length) {
+    
+    if (this->undecided.empty()) {
+        
+        printText(characters, length);
+        this->printedWidth += length;
+        this->scannedWidth += length;
+        return;
+    }
+    this->tokens.push_back(Token{TEXT, (long long)length, 0, string(characters, length)});
+    this->scannedWidth += length;
+    checkWidth();
+}
+
+void PrettyPrinter::text(const string &characters) {
+    
+    text(characters.data(), characters.size());
+}
+
+void PrettyPrinter::space() {
+    
+    decideEndedGroups();
+    if (this->undecided.empty()) {
+        
+        printSpace();
+        this->printedWidth++;
+        this->scannedWidth++;
+        return;
+    }
+    this->tokens.push_back(Token{SPACE, 1, 0, ""});
+    this->scannedWidth++;
+    checkWidth();
+}
+
+void PrettyPrinter::flush() {
+    
+    // groups still open at the end fit if they got this far
+    while (!this->undecided.empty()) {
+        
+        decide(this->undecided.back());
+        this->undecided.pop_back();
+    }
+    this->endedGroups = 0;
+    advance();
+}
+
+/*
+ Gives the group begun at `token` the width it has so far
+ */
+void PrettyPrinter::decide(size_t token) {
+    
+    long long &size = this->tokens[token - this->firstToken].size;
+    size = this->scannedWidth + size + 1;
+}
+
+/*
+ Gives the groups that have ended their widths so far, which are final since text after them can no longer share their last line
+ */
+void PrettyPrinter::decideEndedGroups() {
+    
+    if (this->endedGroups == 0) {
+        
+        return;
+    }
+    while (this->endedGroups > 0) {
+        
+        decide(this->undecided.back());
+        this->undecided.pop_back();
+        this->endedGroups--;
+    }
+    advance();
+}
+
+/*
+ The first token held back is always the BEGIN of the outermost undecided group, which starts where printing has got to.  Once what follows it is wider than the rest of the line, that group cannot fit.
+ */
+void PrettyPrinter::checkWidth() {
+    
+    while (!this->undecided.empty() && this->scannedWidth - this->printedWidth > this->remaining) {
+        
+        this->tokens[this->undecided.front() - this->firstToken].size = TOO_WIDE;
+        this->undecided.pop_front();
+        if (this->endedGroups > this->undecided.size()) {
+            
+            this->endedGroups = this->undecided.size();
+        }
+        advance();
+    }
+}
+
+/*
+ Prints the tokens held back up to the first group whose width is still unknown
+ */
+void PrettyPrinter::advance() {
+    
+    while (!this->tokens.empty() && this->tokens.front().size >= 0) {
+        
+        Token &token = this->tokens.front();
+        print(token);
+        if (token.kind == TEXT || token.kind == SPACE) {
+            
+            this->printedWidth += token.size;
+        }
+        this->tokens.pop_front();
+        this->firstToken++;
+    }
+}
+
+void PrettyPrinter::print(Token &token) {
+    
+    switch (token.kind) {
+        case TEXT:
+            printText(token.characters.data(), token.characters.size());
+            break;
+        case SPACE:
+            printSpace();
+            break;
+        case BEGIN:
+            this->frames.push_back(Frame{this->width - this->remaining + token.indent, token.size > this->remaining});
+            break;
+        case END:
+            this->frames.pop_back();
+            break;
+    }
+}
+
+/*
+ Writes straight into the stream's buffer, like `print()`, setting `badbit` if the buffer does not take everything
+ */
+void PrettyPrinter::write(const char* characters, size_t length) {
+    
+    if (this->out->rdbuf()->sputn(characters, length) != (streamsize)length) {
+        
+        this->out->setstate(ios::badbit);
+    }
+}
+
+void PrettyPrinter::printText(const char* characters, size_t length) {
+    
+    write(characters, length);
+    this->remaining -= (int)length;
+}
+
+void PrettyPrinter::printSpace() {
+    
+    if (this->frames.empty() || !this->frames.back().broken) {
+        
+        write(" ", 1);
+        this->remaining--;
+        return;
+    }
+    static const char blanks[] = "                                                                ";
+    write("\n", 1);
+    int indentation = this->frames.back().indentation;
+    for (int left = indentation; left > 0; left -= sizeof(blanks) - 1) {
+        
+        write(blanks, min(left, (int)sizeof(blanks) - 1));
+    }
+    this->remaining = this->width - indentation;
+}
+
+static void layout(PrettyPrinter &printer, Expression* expr, bool open);
+
+/*
+ Lays out an operand, in parentheses when it needs them (see needsParentheses())
+ */
+static void layoutOperand(PrettyPrinter &printer, Expression* operand, Precedence precedence, bool open) {
+    
+    if (needsParentheses(operand, precedence, open)) {
+        
+        printer.text("(");
+        layout(printer, operand, true);
+        printer.text(")");
+    } else {
+        
+        layout(printer, operand, open);
+    }
+}
+
+/*
+ Lays out `a + b + c` and the like as one group, walking down the right-nested chain rather than recursing into it, so a long chain is neither indented further at each operator nor deep on the C++ stack
+ */
+template <typename Node>
+static void layoutChain(PrettyPrinter &printer, Node* node, const string &operatorText, Precedence left, Precedence right, bool open) {
+    
+    printer.begin(INDENT);
+    layoutOperand(printer, node->leftHandSide, left, false);
+    Expression* rest = node->rightHandSide;
+    Node* next;
+    while ((next = dynamic_cast<Node*>(rest)) != nullptr) {
+        
+        printer.space();
+        printer.text(operatorText);
+        layoutOperand(printer, next->leftHandSide, left, false);
+        rest = next->rightHandSide;
+    }
+    printer.space();
+    printer.text(operatorText);
+    layoutOperand(printer, rest, right, open);
+    printer.end();
+}
+
+/*
+ Lays out a chain of `_let`s as one group of bindings and the body, each `_let x = ... _in` in a group of its own
+ */
+static void layoutLets(PrettyPrinter &printer, LetExpression* let, bool open) {
+    
+    printer.begin(0);
+    Expression* body;
+    do {
+        
+        printer.begin(0);
+        printer.begin(INDENT);
+        printer.text("_let ");
+        printer.text(let->subVariable->name);
+        printer.text(" =");
+        printer.space();
+        layout(printer, let->subExpression, true);
+        printer.end();
+        printer.space();
+        printer.text("_in");
+        printer.end();
+        printer.space();
+        body = let->subBody;
+    } while ((let = dynamic_cast<LetExpression*>(body)) != nullptr);
+    layout(printer, body, open);
+    printer.end();
+}
+
+/*
+ Lays out one part of an `_if`: `keyword` and then `part`, indented under it if they do not fit on a line
+ */
+static void layoutClause(PrettyPrinter &printer, const string &keyword, Expression* part, bool open) {
+    
+    printer.begin(INDENT);
+    printer.text(keyword);
+    printer.space();
+    layout(printer, part, open);
+    printer.end();
+}
+
+static void layout(PrettyPrinter &printer, Expression* expr, bool open) {
+    
+    if (Add* add = dynamic_cast<Add*>(expr)) {
+        
+        layoutChain(printer, add, "+ ", MULTIPLY_PRECEDENCE, ADD_PRECEDENCE, open);
+    } else if (Multiply* multiply = dynamic_cast<Multiply*>(expr)) {
+        
+        layoutChain(printer, multiply, "* ", CALL_PRECEDENCE, MULTIPLY_PRECEDENCE, open);
+    } else if (Number* number = dynamic_cast<Number*>(expr)) {
+        
+        char digits[12];
+        int length = snprintf(digits, sizeof(digits), "%d", number->value);
+        printer.text(digits, length);
+    } else if (Variable* variable = dynamic_cast<Variable*>(expr)) {
+        
+        printer.text(variable->name);
+    } else if (LetExpression* let = dynamic_cast<LetExpression*>(expr)) {
+        
+        layoutLets(printer, let, open);
+    } else if (EqualsExpression* equals = dynamic_cast<EqualsExpression*>(expr)) {
+        
+        layoutChain(printer, equals, "== ", ADD_PRECEDENCE, EQUALS_PRECEDENCE, open);
+    } else if (IfExpression* conditional = dynamic_cast<IfExpression*>(expr)) {
+        
+        printer.begin(0);
+        layoutClause(printer, "_if", conditional->test, true);
+        printer.space();
+        layoutClause(printer, "_then", conditional->thenBranch, true);
+        printer.space();
+        layoutClause(printer, "_else", conditional->elseBranch, open);
+        printer.end();
+    } else if (FunExpression* fun = dynamic_cast<FunExpression*>(expr)) {
+        
+        printer.begin(INDENT);
+        printer.text("_fun (");
+        printer.text(fun->formalArgument->name);
+        printer.text(")");
+        printer.space();
+        layout(printer, fun->body, open);
+        printer.end();
+    } else if (CallExpression* call = dynamic_cast<CallExpression*>(expr)) {
+        
+        layoutOperand(printer, call->toBeCalled, CALL_PRECEDENCE, false);
+        printer.text("(");
+        layout(printer, call->actualArgument, true);
+        printer.text(")");
+    } else if (ThunkExpression* thunk = dynamic_cast<ThunkExpression*>(expr); thunk != nullptr && thunk->thunk->forced == nullptr) {
+        
+        printer.text("(");
+        layout(printer, thunk->thunk->expression, true);
+        printer.text(")");
+    } else {
+        
+        // BigNumber, BoolExpression and forced thunks are single words
+        printer.text(expr->toString());
+    }
+}
+
+void prettyPrint(Expression* expr, ostream &out, int width) {
+    
+    PrettyPrinter printer(out, width);
+    layout(printer, expr, true);
+    printer.flush();
+}
+
+/* for tests */
+static Expression *parse_str(string s) {
+    std::istringstream in(s);
+    return parse(in);
+}
+
+/* for tests */
+static string pretty(Expression* expr, int width) {
+    
+    ostringstream out;
+    prettyPrint(expr, out, width);
+    return out.str();
+}
+
+/* for tests: the length of the longest line of `text` */
+static size_t longestLine(const string &text) {
+    
+    size_t longest = 0;
+    size_t start = 0;
+    while (start <= text.size()) {
+        
+        size_t newline = text.find('\n', start);
+        if (newline == string::npos) {
+            
+            newline = text.size();
+        }
+        longest = max(longest, newline - start);
+        start = newline + 1;
+    }
+    return longest;
+}
+
+/* for tests: a stream buffer that takes `room` characters and then fails, like a full disk */
+class LimitedBuffer : public std::streambuf {
+public:
+    
+    size_t room;
+    
+    LimitedBuffer(size_t characters) {
+        
+        this->room = characters;
+    }
+    
+protected:
+    
+    int overflow(int character) override {
+        
+        if (this->room == 0 || character == EOF) {
+            
+            return EOF;
+        }
+        this->room--;
+        return character;
+    }
+};
+
+TEST_CASE( "pretty printing" ) {
+    
+    SECTION( "what fits stays on one line" ) {
+        
+        CHECK( pretty(parse_str("1 + 2 * 3"), 80) == "1 + 2 * 3" );
+        CHECK( pretty(parse_str("(1 + 2) * 3"), 80) == "(1 + 2) * 3" );
+        CHECK( pretty(parse_str("_let x = 5 _in x + 11"), 80) == "_let x = 5 _in x + 11" );
+        CHECK( pretty(parse_str("_if x == 3 _then _true _else _false"), 80) == "_if x == 3 _then _true _else _false" );
+        CHECK( pretty(parse_str("_fun (x) x * x"), 80) == "_fun (x) x * x" );
+        CHECK( pretty(parse_str("f(1)(2 + 3)"), 80) == "f(1)(2 + 3)" );
+        CHECK( pretty(parse_str("(_let x = 1 _in x) + 2"), 80) == "(_let x = 1 _in x) + 2" );
+        CHECK( pretty(parse_str("12345678901234567890"), 80) == "12345678901234567890" );
+        CHECK( pretty(parse_str("1 + 2"), 5) == "1 + 2" );
+    }
+    SECTION( "chains break before each operator" ) {
+        
+        CHECK( pretty(parse_str("1 + 2 + 3"), 4) == "1\n  + 2\n  + 3" );
+        CHECK( pretty(parse_str("10 * 20 + 30 * 40"), 11) == "10 * 20\n  + 30 * 40" );
+        CHECK( pretty(parse_str("x == 100 + 200"), 10) == "x\n  == 100\n       + 200" );
+    }
+    SECTION( "broken groups indent from the column they start at" ) {
+        
+        CHECK( pretty(parse_str("(100 + 200) * 3"), 12) == "(100 + 200)\n  * 3" );
+        CHECK( pretty(parse_str("1 + (20 + 30) * 4"), 12) == "1\n  + (20\n       + 30)\n      * 4" );
+    }
+    SECTION( "text right after a group counts towards its width" ) {
+        
+        // `1 + 2` fits after the `(`, but not with the `)` that follows it
+        CHECK( pretty(parse_str("(1 + 2) * 3"), 6) == "(1\n   + 2)\n  * 3" );
+        CHECK( pretty(parse_str("(1 + 2) * 3"), 7) == "(1 + 2)\n  * 3" );
+    }
+    SECTION( "_let chains give each binding a line" ) {
+        
+        CHECK( pretty(parse_str("_let x = 1 _in _let y = 2 _in x + y"), 20) == "_let x = 1 _in\n_let y = 2 _in\nx + y" );
+        CHECK( pretty(parse_str("_let x = 100 + 200 _in x"), 12) == "_let x =\n  100 + 200\n_in\nx" );
+        CHECK( pretty(parse_str("_let x = 100 _in x"), 12) == "_let x = 100\n_in\nx" );
+    }
+    SECTION( "_if, _then and _else line up" ) {
+        
+        CHECK( pretty(parse_str("_if x == 3 _then 100 _else 200"), 12) == "_if x == 3\n_then 100\n_else 200" );
+        CHECK( pretty(parse_str("_fun (x) x + 100"), 10) == "_fun (x)\n  x + 100" );
+    }
+    SECTION( "long sums stay within the width" ) {
+        
+        string sum = "1";
+        for (int i = 2; i <= 1000; i++) {
+            
+            sum += " + " + to_string(i);
+        }
+        string printed = pretty(parse_str(sum), 30);
+        CHECK( longestLine(printed) <= 30 );
+        CHECK( count(printed.begin(), printed.end(), '\n') == 999 );
+    }
+    SECTION( "output parses back to an equal tree at every width" ) {
+        
+        vector<string> programs = {
+            "(1 + 2) * (3 + 4 * (5 + 6)) + 7 * 8 * (9 + 10)",
+            "_let f = _fun (x) _if x == 0 _then 1 _else x * f(x + 1) _in _let y = f(3) + f(4) _in y * y + (_let z = y _in z)",
+            "_if (_if a == b _then _true _else c) _then (_fun (x) x + 1)(2) _else f(g(h(1 + 2)))(3 * (4 + 5))",
+            "x == (y == z) == (1 + 2 == 3)",
+            "_let x = _let y = 1 + 2 _in y * y _in _fun (z) x + z",
+            "12345678901234567890 * (x + 98765432109876543210)",
+        };
+        for (string &program : programs) {
+            
+            Expression* expr = parse_str(program);
+            for (int width = 1; width <= 80; width++) {
+                
+                CHECK( parse_str(pretty(expr, width))->equals(expr) );
+            }
+            CHECK( pretty(expr, 1000) == expr->toString() );
+        }
+    }
+    SECTION( "a stream that cannot take everything goes bad" ) {
+        
+        Expression* expr = parse_str("_let total = first + second _in total * total");
+        string expected = pretty(expr, 12);
+        for (size_t room = 0; room < expected.size(); room += 5) {
+            
+            LimitedBuffer buffer(room);
+            std::ostream limited(&buffer);
+            prettyPrint(expr, limited, 12);
+            CHECK( limited.bad() );
+        }
+        LimitedBuffer buffer(expected.size());
+        std::ostream roomy(&buffer);
+        prettyPrint(expr, roomy, 12);
+        CHECK( roomy.good() );
+    }
+}
+
+/* for tests: a balanced tree of `+` and `*` over small literals */
+static Expression* arithmeticTree(int depth, unsigned &seed) {
+    
+    seed = seed * 1103515245 + 12345;
+    if (depth == 0) {
+        
+        return new Number(1 + (seed >> 16) % 3);
+    }
+    Expression* lhs = arithmeticTree(depth - 1, seed);
+    Expression* rhs = arithmeticTree(depth - 1, seed);
+    if ((seed >> 20) % 4 == 0) {
+        
+        return new Multiply(lhs, rhs);
+    }
+    return new Add(lhs, rhs);
+}
+
+TEST_CASE( "pretty printing benchmark", "[.benchmark]" ) {
+    
+    //sizes double, so a printer that goes quadratic shows up as times that quadruple
+    unsigned seed = 50;
+    for (int depth = 16; depth <= 20; depth++) {
+        
+        Expression* tree = arithmeticTree(depth, seed);
+        Expression* lets = new Number(0);
+        for (int i = (1 << (depth - 4)); i >= 1; i--) {
+            
+            lets = new LetExpression(new Variable("x"), new Add(new Variable("x"), arithmeticTree(3, seed)), lets);
+        }
+        vector<pair<string, Expression*>> workloads = {
+            { "balanced tree, 2^" + to_string(depth) + " leaves", tree },
+            { "chain of 2^" + to_string(depth - 4) + " _lets", lets },
+        };
+        for (auto &workload : workloads) {
+            
+            auto start = std::chrono::steady_clock::now();
+            ostringstream flat;
+            workload.second->print(flat);
+            double flatMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            start = std::chrono::steady_clock::now();
+            ostringstream out;
+            prettyPrint(workload.second, out, 80);
+            double prettyMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            string printed = out.str();
+            cout << workload.first << ": print() " << flatMilliseconds << " ms, prettyPrint() " << prettyMilliseconds << " ms for "
+                 << count(printed.begin(), printed.end(), '\n') + 1 << " lines, the longest " << longestLine(printed) << " characters\n";
+        }
+    }
+}
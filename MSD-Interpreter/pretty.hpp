@@ -0,0 +1,86 @@
+//
+//  pretty.hpp
+//  ParserImproved
+//
+//  Copyright © 2020 MSD Katie Rose. All rights reserved.
+//
+
+#ifndef pretty_hpp
+#define pretty_hpp
+
+#include <stdio.h>
+#include <deque>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "expression.hpp"
+
+using namespace std;
+
+/*
+ PrettyPrinter lays out a stream of text, spaces and groups in lines of at most `width` columns where it can, in the style of Oppen's printer.  A group that fits on the rest of its line, together with any text that follows it up to the next space, is printed flat, with each of its spaces as a space.  Otherwise every space directly in it becomes a line break, indented to the column the group started at plus the group's `indent`.  Whether a group fits is known once the group ends or once it has grown wider than the line, so at most about a line of tokens is held back before being written to `out`, and printing takes time linear in the output and memory proportional to the line width and the nesting of groups, however large the output is.
+ */
+class PrettyPrinter {
+public:
+    
+    PrettyPrinter(ostream &out, int lineWidth);
+    
+    void begin(int indent);
+    void end();
+    void text(const char* characters, size_t length);
+    void text(const string &characters);
+    template <size_t length>
+    void text(const char (&literal)[length]) {
+        
+        text(literal, length - 1);
+    }
+    //a space, or a line break if the innermost group around it does not fit
+    void space();
+    //writes whatever is held back; call once everything has been printed
+    void flush();
+
+private:
+    
+    enum Kind { TEXT, SPACE, BEGIN, END };
+    
+    //`size` is the width of the token, or for a BEGIN the width of its group, which is not known while `size` is -1 minus the width scanned before it
+    struct Token {
+        Kind kind;
+        long long size;
+        int indent;
+        string characters;
+    };
+    struct Frame {
+        int indentation;
+        bool broken;
+    };
+    
+    ostream* out;
+    int width;
+    int remaining;
+    //the widths of everything printed and of everything seen so far, as if on one line
+    long long printedWidth;
+    long long scannedWidth;
+    deque<Token> tokens;
+    size_t firstToken;
+    //the indices of the BEGINs in `tokens` whose groups have unknown width, of which the last `endedGroups` have ended
+    deque<size_t> undecided;
+    size_t endedGroups;
+    vector<Frame> frames;
+    
+    void decide(size_t token);
+    void decideEndedGroups();
+    void checkWidth();
+    void advance();
+    void print(Token &token);
+    void write(const char* characters, size_t length);
+    void printText(const char* characters, size_t length);
+    void printSpace();
+};
+
+/*
+ Writes `expr` to `out` laid out by a PrettyPrinter in lines of `width` columns where possible, with the parentheses `print()` would use, so the output parses back to an equal tree.  Chains of `+`, `*` and `==` break before their operators, chains of `_let`s put each binding and the body on a line of its own, and `_if` puts `_then` and `_else` under it.  Nothing is added after the last line.
+ */
+void prettyPrint(Expression* expr, ostream &out, int width);
+
+#endif /* pretty_hpp */
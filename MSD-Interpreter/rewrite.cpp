@@ -0,0 +1,300 @@
+//
+//  rewrite.cpp
+//  ParserImproved
+//
+//  Copyright © 2020 MSD Katie Rose. All rights reserved.
+//
+
+#include <sstream>
+#include <vector>
+#include "rewrite.hpp"
+#include "parser.hpp"
+#include "catch.hpp"
+
+static Expression* rewriteNode(Expression* expr, map<string, long> &fired);
+
+RewriteStats::RewriteStats() {
+    
+    this->passes = 0;
+}
+
+static bool isLiteral(Expression* expr) {
+    
+    return dynamic_cast<Number*>(expr) != nullptr || dynamic_cast<BigNumber*>(expr) != nullptr;
+}
+
+static bool hasIntValue(Value* value, int integer) {
+    
+    NumericValue* numeric = dynamic_cast<NumericValue*>(value);
+    return numeric != nullptr && numeric->value == integer;
+}
+
+/*
+ Appends the operands of the `+` chain (or `*` chain) rooted at `expr` to `operands`, left to right
+ */
+static void collectChain(Expression* expr, bool isAdd, vector<Expression*> &operands) {
+    
+    vector<Expression*> pending;
+    pending.push_back(expr);
+    while (!pending.empty()) {
+        
+        Expression* next = pending.back();
+        pending.pop_back();
+        Add* add = dynamic_cast<Add*>(next);
+        Multiply* multiply = dynamic_cast<Multiply*>(next);
+        if (isAdd && add != nullptr) {
+            
+            pending.push_back(add->rightHandSide);
+            pending.push_back(add->leftHandSide);
+        } else if (!isAdd && multiply != nullptr) {
+            
+            pending.push_back(multiply->rightHandSide);
+            pending.push_back(multiply->leftHandSide);
+        } else {
+            
+            operands.push_back(next);
+        }
+    }
+}
+
+static Expression* rewriteChain(Expression* expr, bool isAdd, map<string, long> &fired) {
+    
+    vector<Expression*> chain;
+    collectChain(expr, isAdd, chain);
+    
+    bool changed = false;
+    bool hasBoolean = false;
+    vector<Expression*> operands;
+    for (Expression* operand : chain) {
+        
+        Expression* rewritten = rewriteNode(operand, fired);
+        if (rewritten != operand) {
+            
+            //an operand can turn into a chain of the same kind, as in `(a + b) * 1`, which joins this one
+            changed = true;
+            collectChain(rewritten, isAdd, operands);
+        } else {
+            
+            operands.push_back(operand);
+        }
+        //an `_if`, a call or a `_let` might be a boolean or a function too, so it is treated like one, as in the e-graph
+        hasBoolean = hasBoolean || dynamic_cast<BoolExpression*>(rewritten) != nullptr || dynamic_cast<EqualsExpression*>(rewritten) != nullptr
+            || dynamic_cast<FunExpression*>(rewritten) != nullptr || dynamic_cast<IfExpression*>(rewritten) != nullptr
+            || dynamic_cast<CallExpression*>(rewritten) != nullptr || dynamic_cast<LetExpression*>(rewritten) != nullptr;
+    }
+    
+    Value* constant = nullptr;
+    int constantCount = 0;
+    size_t constantPosition = 0;
+    vector<Expression*> others;
+    if (!hasBoolean) {
+        
+        for (size_t i = 0; i < operands.size(); i++) {
+            
+            if (isLiteral(operands[i])) {
+                
+                Value* value = operands[i]->evaluate();
+                constant = constant == nullptr ? value : isAdd ? constant->addTo(value) : constant->multiplyWith(value);
+                constantCount++;
+                constantPosition = i;
+            } else {
+                
+                others.push_back(operands[i]);
+            }
+        }
+    }
+    
+    if (constantCount >= 2) {
+        
+        fired["fold-constants"]++;
+        changed = true;
+    } else if (constantCount == 1 && !others.empty() && constantPosition != (isAdd ? operands.size() - 1 : 0)) {
+        
+        fired["reassociate"]++;
+        changed = true;
+    }
+    if (constant != nullptr && !others.empty()) {
+        
+        if (!isAdd && hasIntValue(constant, 0)) {
+            
+            fired["multiply-zero"]++;
+            return new Number(0);
+        } else if (isAdd && hasIntValue(constant, 0)) {
+            
+            fired["add-zero"]++;
+            constant = nullptr;
+            changed = true;
+        } else if (!isAdd && hasIntValue(constant, 1)) {
+            
+            fired["multiply-one"]++;
+            constant = nullptr;
+            changed = true;
+        }
+    }
+    if (!changed) {
+        
+        return expr;
+    }
+    if (hasBoolean) {
+        
+        others = operands;
+    } else if (constant != nullptr) {
+        
+        others.insert(isAdd ? others.end() : others.begin(), constant->toExpression());
+    }
+    
+    Expression* result = others.back();
+    for (size_t i = others.size() - 1; i-- > 0; ) {
+        
+        if (isAdd) {
+            
+            result = new Add(others[i], result);
+        } else {
+            
+            result = new Multiply(others[i], result);
+        }
+    }
+    return result;
+}
+
+static Expression* rewriteNode(Expression* expr, map<string, long> &fired) {
+    
+    if (dynamic_cast<Add*>(expr) != nullptr) {
+        
+        return rewriteChain(expr, true, fired);
+    } else if (dynamic_cast<Multiply*>(expr) != nullptr) {
+        
+        return rewriteChain(expr, false, fired);
+    } else if (LetExpression* let = dynamic_cast<LetExpression*>(expr)) {
+        
+        Expression* value = rewriteNode(let->subExpression, fired);
+        Expression* body = rewriteNode(let->subBody, fired);
+        if (value != let->subExpression || body != let->subBody) {
+            
+            return new LetExpression(let->subVariable, value, body);
+        }
+    } else if (EqualsExpression* comparison = dynamic_cast<EqualsExpression*>(expr)) {
+        
+        Expression* lhs = rewriteNode(comparison->leftHandSide, fired);
+        Expression* rhs = rewriteNode(comparison->rightHandSide, fired);
+        bool lhsConstant = isLiteral(lhs) || dynamic_cast<BoolExpression*>(lhs) != nullptr;
+        bool rhsConstant = isLiteral(rhs) || dynamic_cast<BoolExpression*>(rhs) != nullptr;
+        if (lhsConstant && rhsConstant) {
+            
+            fired["fold-equals"]++;
+            return new BoolExpression(lhs->evaluate()->equals(rhs->evaluate()));
+        }
+        if (lhs != comparison->leftHandSide || rhs != comparison->rightHandSide) {
+            
+            return new EqualsExpression(lhs, rhs);
+        }
+    } else if (IfExpression* conditional = dynamic_cast<IfExpression*>(expr)) {
+        
+        Expression* test = rewriteNode(conditional->test, fired);
+        if (BoolExpression* boolean = dynamic_cast<BoolExpression*>(test)) {
+            
+            fired["if-constant"]++;
+            return rewriteNode(boolean->boolean ? conditional->thenBranch : conditional->elseBranch, fired);
+        }
+        Expression* thenBranch = rewriteNode(conditional->thenBranch, fired);
+        Expression* elseBranch = rewriteNode(conditional->elseBranch, fired);
+        if (test != conditional->test || thenBranch != conditional->thenBranch || elseBranch != conditional->elseBranch) {
+            
+            return new IfExpression(test, thenBranch, elseBranch);
+        }
+    } else if (FunExpression* function = dynamic_cast<FunExpression*>(expr)) {
+        
+        Expression* body = rewriteNode(function->body, fired);
+        if (body != function->body) {
+            
+            return new FunExpression(function->formalArgument, body);
+        }
+    } else if (CallExpression* call = dynamic_cast<CallExpression*>(expr)) {
+        
+        Expression* callee = rewriteNode(call->toBeCalled, fired);
+        Expression* argument = rewriteNode(call->actualArgument, fired);
+        if (callee != call->toBeCalled || argument != call->actualArgument) {
+            
+            return new CallExpression(callee, argument);
+        }
+    }
+    return expr;
+}
+
+Expression* rewrite(Expression* expr, RewriteStats &stats) {
+    
+    for (int pass = 0; pass < MAX_REWRITE_PASSES; pass++) {
+        
+        map<string, long> fired;
+        expr = rewriteNode(expr, fired);
+        stats.passes++;
+        for (auto &rule : fired) {
+            
+            stats.fired[rule.first] += rule.second;
+        }
+        if (fired.empty()) {
+            
+            break;
+        }
+    }
+    return expr;
+}
+
+/* for tests */
+static Expression *parse_str(string s) {
+    std::istringstream in(s);
+    return parse(in);
+}
+
+TEST_CASE( "rewrite" ) {
+    
+    RewriteStats stats;
+    CHECK( rewrite(parse_str("1 + x + 2"), stats)->equals(parse_str("x + 3")) );
+    CHECK( stats.fired["fold-constants"] == 1 );
+    CHECK( stats.passes == 2 );
+    
+    stats = RewriteStats();
+    CHECK( rewrite(parse_str("x * 0 + y"), stats)->equals(new Variable("y")) );
+    CHECK( stats.fired["multiply-zero"] == 1 );
+    CHECK( stats.fired["add-zero"] == 1 );
+    
+    stats = RewriteStats();
+    CHECK( rewrite(parse_str("(a + b) * 1 + 2 * c * 3"), stats)->equals(parse_str("a + b + 6 * c")) );
+    CHECK( stats.fired["multiply-one"] == 1 );
+    CHECK( stats.fired["fold-constants"] == 1 );
+    
+    stats = RewriteStats();
+    CHECK( rewrite(parse_str("x * 4 + 5 + y"), stats)->equals(parse_str("4 * x + y + 5")) );
+    CHECK( stats.fired["reassociate"] == 2 );
+    
+    //already canonical trees come back untouched after one pass
+    stats = RewriteStats();
+    Expression* canonical = parse_str("2 * x + _let y = 3 * z _in y + 1");
+    CHECK( rewrite(canonical, stats) == canonical );
+    CHECK( stats.passes == 1 );
+    CHECK( stats.fired.empty() );
+    
+    //let bodies are rewritten too, and chains with booleans are left alone
+    stats = RewriteStats();
+    CHECK( rewrite(parse_str("_let y = 1 + z + 1 _in y * 1"), stats)->equals(parse_str("_let y = z + 2 _in y")) );
+    CHECK( rewrite(parse_str("_true + 0 + x"), stats)->equals(parse_str("_true + 0 + x")) );
+    
+    //comparisons of constants fold, and a constant `_if` test selects its branch
+    stats = RewriteStats();
+    CHECK( rewrite(parse_str("_if 1 + 1 == 2 _then x * 1 _else y"), stats)->equals(new Variable("x")) );
+    CHECK( stats.fired["fold-equals"] == 1 );
+    CHECK( stats.fired["if-constant"] == 1 );
+    CHECK( rewrite(parse_str("_if x == 0 _then 1 + 2 + y _else 0 + y"), stats)->equals(parse_str("_if x == 0 _then y + 3 _else y")) );
+    CHECK( rewrite(parse_str("(x == 1) + 0"), stats)->equals(parse_str("(x == 1) + 0")) );
+    
+    //function bodies and arguments are rewritten in place, and a function in arithmetic is left for evaluation to reject
+    stats = RewriteStats();
+    CHECK( rewrite(parse_str("(_fun (x) x * 1 + 0)(1 + 2)"), stats)->equals(parse_str("(_fun (x) x)(3)")) );
+    CHECK( rewrite(parse_str("(_fun (x) x) * 0"), stats)->equals(parse_str("(_fun (x) x) * 0")) );
+    
+    //so is an operand that might not be an integer
+    CHECK( rewrite(parse_str("(_if c _then _true _else _false) + 0"), stats)->equals(parse_str("(_if c _then _true _else _false) + 0")) );
+    CHECK( rewrite(parse_str("(_if c _then _true _else _false) * 0"), stats)->equals(parse_str("(_if c _then _true _else _false) * 0")) );
+    CHECK( rewrite(parse_str("f(1) * 0"), stats)->equals(parse_str("f(1) * 0")) );
+    CHECK( rewrite(parse_str("(_let y = _true _in y) * 1"), stats)->equals(parse_str("(_let y = _true _in y) * 1")) );
+}
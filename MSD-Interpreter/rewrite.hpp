@@ -0,0 +1,45 @@
+//
+//  rewrite.hpp
+//  ParserImproved
+//
+//  Copyright © 2020 MSD Katie Rose. All rights reserved.
+//
+
+#ifndef rewrite_hpp
+#define rewrite_hpp
+
+#include <stdio.h>
+#include <map>
+#include <string>
+#include "expression.hpp"
+
+using namespace std;
+
+/*
+ Counts how often each rewrite rule fired and how many passes were needed to reach the fixpoint
+ */
+struct RewriteStats {
+    long passes;
+    map<string, long> fired;
+    RewriteStats();
+};
+
+/*
+ Passes stop after this many even if rules are still firing.  In practice the second pass never changes anything, since every pass leaves each `+`/`*` chain in its final form.
+ */
+const int MAX_REWRITE_PASSES = 8;
+
+/*
+ Applies the algebraic rewrite rules bottom-up until none of them fire:
+   fold-constants   constants anywhere in a `+` or `*` chain are combined, so `1 + x + 2` becomes `x + 3`
+   reassociate      a single constant is moved to the end of a `+` chain or the front of a `*` chain
+   add-zero         `x + 0` becomes `x`
+   multiply-one     `x * 1` becomes `x`
+   multiply-zero    `x * 0` becomes `0`
+   fold-equals      `==` between two constants becomes `_true` or `_false`
+   if-constant      `_if` with a constant test becomes the branch it selects
+ Each pass flattens every chain once, so it is linear in the size of the tree.  Chains that contain booleans, or operands that might evaluate to one or to a function like an `_if`, a call or a `_let`, are left alone so that evaluation still reports the type error.
+ */
+Expression* rewrite(Expression* expr, RewriteStats &stats);
+
+#endif /* rewrite_hpp */
@@ -0,0 +1,634 @@
+//
+//  typecheck.cpp
+//  ParserImproved
+//
+//  Copyright © 2020 MSD Katie Rose. All rights reserved.
+//
+
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+#include "typecheck.hpp"
+#include "context.hpp"
+#include "parser.hpp"
+#include "catch.hpp"
+
+Type::Type(Kind typeKind) {
+    
+    this->kind = typeKind;
+    this->argument = nullptr;
+    this->result = nullptr;
+    this->instance = nullptr;
+    this->level = 0;
+    this->equality = false;
+}
+
+Type::Type(Type* argumentType, Type* resultType) {
+    
+    this->kind = FUNCTION;
+    this->argument = argumentType;
+    this->result = resultType;
+    this->instance = nullptr;
+    this->level = 0;
+    this->equality = false;
+}
+
+/*
+ Follows a unified type variable to the type it stands for
+ */
+static Type* resolve(Type* type) {
+    
+    while (type->kind == Type::VARIABLE && type->instance != nullptr) {
+        
+        type = type->instance;
+    }
+    return type;
+}
+
+static string typeString(Type* type, map<Type*, string> &names, bool parenthesizeFunctions) {
+    
+    type = resolve(type);
+    if (type->kind == Type::INT) {
+        
+        return "int";
+    } else if (type->kind == Type::BOOL) {
+        
+        return "bool";
+    } else if (type->kind == Type::VARIABLE) {
+        
+        auto named = names.find(type);
+        if (named != names.end()) {
+            
+            return named->second;
+        }
+        string name = (type->equality ? "''" : "'") + string(1, (char)('a' + names.size() % 26)) + (names.size() < 26 ? "" : to_string(names.size() / 26));
+        names[type] = name;
+        return name;
+    }
+    //`->` groups to the right, so only a function type on its left needs parentheses
+    string function = typeString(type->argument, names, true) + " -> " + typeString(type->result, names, false);
+    return parenthesizeFunctions ? "(" + function + ")" : function;
+}
+
+string Type::toString() {
+    
+    map<Type*, string> names;
+    return typeString(this, names, false);
+}
+
+TypeError::TypeError(string message) : runtime_error(message) {
+}
+
+/*
+ The state of inferring the type of one program
+ */
+struct TypeChecker {
+    
+    static Type* integer;
+    static Type* boolean;
+    
+    vector<pair<string, Type*>> scope;
+    map<string, Type*> freeVariables;
+    int level;
+    
+    //whether the integer evaluator can run the program: it has only integers that fit an `int`, booleans, arithmetic, `==`, `_if` and `_let`
+    bool integerOnly;
+    
+    TypeChecker() {
+        
+        this->level = 0;
+        this->integerOnly = true;
+    }
+    
+    Type* fresh() {
+        
+        Type* variable = new Type(Type::VARIABLE);
+        variable->level = this->level;
+        return variable;
+    }
+    
+    //true if `variable` occurs in `type`, lowering the levels of the variables in `type` to its own on the way, since they are now as old as it is
+    bool occurs(Type* variable, Type* type) {
+        
+        type = resolve(type);
+        if (type == variable) {
+            
+            return true;
+        }
+        if (type->kind == Type::VARIABLE) {
+            
+            type->level = min(type->level, variable->level);
+            return false;
+        }
+        return type->kind == Type::FUNCTION && (occurs(variable, type->argument) || occurs(variable, type->result));
+    }
+    
+    //false for function types; the variables in `type` become equality variables, since it is to stand for one
+    bool admitsEquality(Type* type) {
+        
+        type = resolve(type);
+        if (type->kind == Type::VARIABLE) {
+            
+            type->equality = true;
+        }
+        return type->kind != Type::FUNCTION;
+    }
+    
+    bool unifies(Type* lhs, Type* rhs) {
+        
+        lhs = resolve(lhs);
+        rhs = resolve(rhs);
+        if (lhs == rhs) {
+            
+            return true;
+        }
+        if (rhs->kind == Type::VARIABLE && lhs->kind != Type::VARIABLE) {
+            
+            swap(lhs, rhs);
+        }
+        if (lhs->kind == Type::VARIABLE) {
+            
+            if (occurs(lhs, rhs) || (lhs->equality && !admitsEquality(rhs))) {
+                
+                return false;
+            }
+            lhs->instance = rhs;
+            return true;
+        }
+        if (lhs->kind != rhs->kind) {
+            
+            return false;
+        }
+        return lhs->kind != Type::FUNCTION || (unifies(lhs->argument, rhs->argument) && unifies(lhs->result, rhs->result));
+    }
+    
+    //makes `found`, the type of `where`, the same as `expected`, or throws TypeError
+    void unify(Type* expected, Type* found, Expression* where) {
+        
+        if (!unifies(expected, found)) {
+            
+            map<Type*, string> names;
+            string expectedName = typeString(expected, names, false);
+            string foundName = typeString(found, names, false);
+            throw TypeError("type error: expected " + expectedName + " but found " + foundName + " in " + where->toString());
+        }
+    }
+    
+    //marks the type variables made inside a `_let`'s value and not unified with anything outside it as generic
+    void generalize(Type* type) {
+        
+        type = resolve(type);
+        if (type->kind == Type::VARIABLE && type->level > this->level) {
+            
+            type->level = Type::GENERIC_LEVEL;
+        } else if (type->kind == Type::FUNCTION) {
+            
+            generalize(type->argument);
+            generalize(type->result);
+        }
+    }
+    
+    Type* instantiate(Type* type, map<Type*, Type*> &copies) {
+        
+        type = resolve(type);
+        if (type->kind == Type::VARIABLE && type->level == Type::GENERIC_LEVEL) {
+            
+            Type* &copy = copies[type];
+            if (copy == nullptr) {
+                
+                copy = fresh();
+                copy->equality = type->equality;
+            }
+            return copy;
+        } else if (type->kind == Type::FUNCTION) {
+            
+            return new Type(instantiate(type->argument, copies), instantiate(type->result, copies));
+        }
+        return type;
+    }
+    
+    Type* infer(Expression* expr) {
+        
+        if (dynamic_cast<Number*>(expr) != nullptr) {
+            
+            return integer;
+        } else if (dynamic_cast<BigNumber*>(expr) != nullptr) {
+            
+            this->integerOnly = false;
+            return integer;
+        } else if (dynamic_cast<BoolExpression*>(expr) != nullptr) {
+            
+            return boolean;
+        } else if (Variable* variable = dynamic_cast<Variable*>(expr)) {
+            
+            for (size_t i = this->scope.size(); i-- > 0; ) {
+                
+                if (this->scope[i].first == variable->name) {
+                    
+                    map<Type*, Type*> copies;
+                    return instantiate(this->scope[i].second, copies);
+                }
+            }
+            Type* &free = this->freeVariables[variable->name];
+            if (free == nullptr) {
+                
+                //a free variable is never generalized, so all of its occurrences have the same type
+                free = new Type(Type::VARIABLE);
+            }
+            return free;
+        } else if (Add* add = dynamic_cast<Add*>(expr)) {
+            
+            unify(integer, infer(add->leftHandSide), add->leftHandSide);
+            unify(integer, infer(add->rightHandSide), add->rightHandSide);
+            return integer;
+        } else if (Multiply* multiply = dynamic_cast<Multiply*>(expr)) {
+            
+            unify(integer, infer(multiply->leftHandSide), multiply->leftHandSide);
+            unify(integer, infer(multiply->rightHandSide), multiply->rightHandSide);
+            return integer;
+        } else if (EqualsExpression* comparison = dynamic_cast<EqualsExpression*>(expr)) {
+            
+            Type* comparable = fresh();
+            comparable->equality = true;
+            unify(comparable, infer(comparison->leftHandSide), comparison->leftHandSide);
+            unify(comparable, infer(comparison->rightHandSide), comparison->rightHandSide);
+            return boolean;
+        } else if (IfExpression* conditional = dynamic_cast<IfExpression*>(expr)) {
+            
+            unify(boolean, infer(conditional->test), conditional->test);
+            Type* thenType = infer(conditional->thenBranch);
+            unify(thenType, infer(conditional->elseBranch), conditional->elseBranch);
+            return thenType;
+        } else if (LetExpression* let = dynamic_cast<LetExpression*>(expr)) {
+            
+            this->level++;
+            Type* value = infer(let->subExpression);
+            this->level--;
+            generalize(value);
+            this->scope.push_back({ let->subVariable->name, value });
+            Type* body = infer(let->subBody);
+            this->scope.pop_back();
+            return body;
+        } else if (FunExpression* function = dynamic_cast<FunExpression*>(expr)) {
+            
+            //the argument is not generalized, so every use of it in the body has the same type
+            this->integerOnly = false;
+            Type* argument = fresh();
+            this->scope.push_back({ function->formalArgument->name, argument });
+            Type* body = infer(function->body);
+            this->scope.pop_back();
+            return new Type(argument, body);
+        } else if (CallExpression* call = dynamic_cast<CallExpression*>(expr)) {
+            
+            this->integerOnly = false;
+            Type* callee = infer(call->toBeCalled);
+            Type* argument = infer(call->actualArgument);
+            Type* result = fresh();
+            if (!unifies(callee, new Type(argument, result))) {
+                
+                map<Type*, string> names;
+                string calleeName = typeString(callee, names, false);
+                string argumentName = typeString(argument, names, false);
+                throw TypeError("type error: cannot call " + calleeName + " with " + argumentName + " in " + expr->toString());
+            }
+            return result;
+        } else if (ThunkExpression* thunk = dynamic_cast<ThunkExpression*>(expr)) {
+            
+            this->integerOnly = false;
+            return infer(thunk->thunk->expression);
+        }
+        throw TypeError("type error: cannot type " + expr->toString());
+    }
+};
+
+Type* TypeChecker::integer = new Type(Type::INT);
+Type* TypeChecker::boolean = new Type(Type::BOOL);
+
+Type* inferType(Expression* expr) {
+    
+    TypeChecker checker;
+    return resolve(checker.infer(expr));
+}
+
+/*
+ Thrown by the integer evaluator for a program it cannot run: one outside the integer fragment, one that is ill-typed, or one with a result that does not fit in 64 bits
+ */
+struct NotIntegerOnly {
+};
+
+/*
+ Type checks and evaluates a program of only integers that fit an `int`, booleans, arithmetic, `==`, `_if` and `_let` in a single walk, with booleans as 0 and 1.  Such a program has no type variables, so its type checking is only a comparison of two kinds at each node, and it is done as the values are computed.  The branch an `_if` does not take is only checked.  Bindings are kept on a stack instead of being substituted, nodes are told apart by their exact class rather than by a chain of `dynamic_cast`s, and steps are counted here and charged once the whole program has been checked.
+ */
+class IntegerEvaluator {
+public:
+    
+    long steps;
+    
+    IntegerEvaluator() {
+        
+        this->steps = 0;
+    }
+    
+    struct Result {
+        long long value;
+        Type::Kind kind;
+    };
+    
+    //`value` is only computed when `evaluating`
+    Result run(Expression* expr, bool evaluating) {
+        
+        const type_info &node = typeid(*expr);
+        if (node == typeid(Number)) {
+            
+            return { static_cast<Number*>(expr)->value, Type::INT };
+        } else if (node == typeid(Add)) {
+            
+            Add* add = static_cast<Add*>(expr);
+            long long lhs = runInteger(add->leftHandSide, evaluating);
+            long long rhs = runInteger(add->rightHandSide, evaluating);
+            long long sum = 0;
+            if (evaluating) {
+                
+                this->steps++;
+                if (__builtin_add_overflow(lhs, rhs, &sum)) {
+                    
+                    throw NotIntegerOnly();
+                }
+            }
+            return { sum, Type::INT };
+        } else if (node == typeid(Multiply)) {
+            
+            Multiply* multiply = static_cast<Multiply*>(expr);
+            long long lhs = runInteger(multiply->leftHandSide, evaluating);
+            long long rhs = runInteger(multiply->rightHandSide, evaluating);
+            long long product = 0;
+            if (evaluating) {
+                
+                this->steps++;
+                if (__builtin_mul_overflow(lhs, rhs, &product)) {
+                    
+                    throw NotIntegerOnly();
+                }
+            }
+            return { product, Type::INT };
+        } else if (node == typeid(Variable)) {
+            
+            const string &name = static_cast<Variable*>(expr)->name;
+            for (size_t i = this->bindings.size(); i-- > 0; ) {
+                
+                if (*this->bindings[i].name == name) {
+                    
+                    return this->bindings[i].result;
+                }
+            }
+            //a free variable could have any type
+            throw NotIntegerOnly();
+        } else if (node == typeid(LetExpression)) {
+            
+            LetExpression* let = static_cast<LetExpression*>(expr);
+            this->steps += evaluating;
+            Result value = run(let->subExpression, evaluating);
+            this->bindings.push_back({ &let->subVariable->name, value });
+            Result body = run(let->subBody, evaluating);
+            this->bindings.pop_back();
+            return body;
+        } else if (node == typeid(EqualsExpression)) {
+            
+            EqualsExpression* comparison = static_cast<EqualsExpression*>(expr);
+            this->steps += evaluating;
+            Result lhs = run(comparison->leftHandSide, evaluating);
+            Result rhs = run(comparison->rightHandSide, evaluating);
+            if (lhs.kind != rhs.kind) {
+                
+                throw NotIntegerOnly();
+            }
+            return { lhs.value == rhs.value, Type::BOOL };
+        } else if (node == typeid(IfExpression)) {
+            
+            IfExpression* conditional = static_cast<IfExpression*>(expr);
+            this->steps += evaluating;
+            Result test = run(conditional->test, evaluating);
+            if (test.kind != Type::BOOL) {
+                
+                throw NotIntegerOnly();
+            }
+            bool taken = test.value != 0;
+            Result thenBranch = run(conditional->thenBranch, evaluating && taken);
+            Result elseBranch = run(conditional->elseBranch, evaluating && !taken);
+            if (thenBranch.kind != elseBranch.kind) {
+                
+                throw NotIntegerOnly();
+            }
+            return taken ? thenBranch : elseBranch;
+        } else if (node == typeid(BoolExpression)) {
+            
+            return { static_cast<BoolExpression*>(expr)->boolean, Type::BOOL };
+        }
+        throw NotIntegerOnly();
+    }
+
+private:
+    
+    struct Binding {
+        const string* name;
+        Result result;
+    };
+    vector<Binding> bindings;
+    
+    long long runInteger(Expression* expr, bool evaluating) {
+        
+        Result result = run(expr, evaluating);
+        if (result.kind != Type::INT) {
+            
+            throw NotIntegerOnly();
+        }
+        return result.value;
+    }
+};
+
+Value* interpretTyped(Expression* expr) {
+    
+    IntegerEvaluator evaluator;
+    IntegerEvaluator::Result result;
+    try {
+        
+        result = evaluator.run(expr, true);
+    } catch (NotIntegerOnly &) {
+        
+        //the checker gives the error for an ill-typed program
+        inferType(expr);
+        return expr->evaluate();
+    }
+    EvaluationContext::countSteps(evaluator.steps);
+    if (result.kind == Type::BOOL) {
+        
+        return new BoolValue(result.value != 0);
+    }
+    return BigIntValue::fromLongLong(result.value);
+}
+
+/* for tests */
+static Expression *parse_str(string s) {
+    std::istringstream in(s);
+    return parse(in);
+}
+
+static string typeOf(string s) {
+    
+    return inferType(parse_str(s))->toString();
+}
+
+TEST_CASE( "inferType" ) {
+    
+    CHECK( typeOf("1 + 2 * 3") == "int" );
+    CHECK( typeOf("1 == 2") == "bool" );
+    CHECK( typeOf("_if _true _then 1 _else 2") == "int" );
+    CHECK( typeOf("_let b = 1 == 1 _in _if b _then b _else _false") == "bool" );
+    CHECK( typeOf("x") == "'a" );
+    CHECK( typeOf("x + y") == "int" );
+    CHECK( typeOf("_fun (x) x + 1") == "int -> int" );
+    CHECK( typeOf("_fun (x) x") == "'a -> 'a" );
+    CHECK( typeOf("_fun (f) _fun (x) f(f(x))") == "('a -> 'a) -> 'a -> 'a" );
+    CHECK( typeOf("_fun (x) _fun (y) x == y") == "''a -> ''a -> bool" );
+    CHECK( typeOf("_fun (f) _fun (x) f(x) == x") == "(''a -> ''a) -> ''a -> bool" );
+    
+    //a `_let`-bound function can be used at more than one type, but an argument cannot
+    CHECK( typeOf("_let id = _fun (x) x _in _if id(_true) _then id(1) _else 2") == "int" );
+    CHECK( typeOf("_let id = _fun (x) x _in id(id)") == "'a -> 'a" );
+    CHECK_THROWS_AS( inferType(parse_str("(_fun (id) _if id(_true) _then id(1) _else 2)(_fun (x) x)")), TypeError );
+    
+    CHECK_THROWS_WITH( inferType(parse_str("_true + 1")), "type error: expected int but found bool in _true" );
+    CHECK_THROWS_AS( inferType(parse_str("_if x _then 2 _else _false")), TypeError );
+    CHECK_THROWS_AS( inferType(parse_str("1 == _true")), TypeError );
+    
+    //functions cannot be compared, even through a polymorphic `_let` or a free variable
+    CHECK_THROWS_WITH( inferType(parse_str("(_fun (x) x + x * x) == (_fun (x) x + x * x)")), "type error: expected ''a but found int -> int in _fun (x) x + x * x" );
+    CHECK_THROWS_AS( inferType(parse_str("_let eq = _fun (x) _fun (y) x == y _in eq(_fun (z) z)")), TypeError );
+    CHECK_THROWS_AS( inferType(parse_str("_if f == g _then f(1) _else 2")), TypeError );
+    CHECK( typeOf("_let eq = _fun (x) _fun (y) x == y _in _if eq(1)(2) _then eq(_true) _else eq(_false)") == "bool -> bool" );
+    CHECK_THROWS_AS( inferType(parse_str("x + _let y = x == _true _in 1")), TypeError );
+    CHECK_THROWS_WITH( inferType(parse_str("_if 1 _then 2 _else 3")), "type error: expected bool but found int in 1" );
+    CHECK_THROWS_WITH( inferType(parse_str("_let b = _true _in b * 2")), "type error: expected int but found bool in b" );
+    CHECK_THROWS_WITH( inferType(parse_str("1(2)")), "type error: cannot call int with int in 1(2)" );
+    CHECK_THROWS_WITH( inferType(parse_str("_fun (f) f(f)")), "type error: cannot call 'a with 'a in f(f)" );
+    
+    //errors are found without evaluating anything, even in code that would never run
+    CHECK_THROWS_AS( interpretTyped(parse_str("_if _true _then 1 _else _false + 1")), TypeError );
+}
+
+TEST_CASE( "interpretTyped" ) {
+    
+    CHECK( interpretTyped(parse_str("_let x = 5 _in _let y = x * x _in y + x"))->equals(new NumericValue(30)) );
+    CHECK( interpretTyped(parse_str("_let x = 5 _in x == 5"))->equals(new BoolValue(true)) );
+    CHECK( interpretTyped(parse_str("_let x = 1 _in x + _let x = 2 _in x * 10"))->equals(new NumericValue(21)) );
+    CHECK( interpretTyped(parse_str("_if 2 == 3 _then 1 _else _let b = _false _in _if b _then 2 _else 3"))->equals(new NumericValue(3)) );
+    
+    //results past an `int` are promoted, and past 64 bits they are computed again with big integers
+    CHECK( interpretTyped(parse_str("100000 * 100000"))->equals(new BigIntValue(10000000000LL)) );
+    CHECK( interpretTyped(parse_str("_let x = 4294967296 _in x * x"))->toString() == "18446744073709551616" );
+    CHECK( interpretTyped(parse_str("_let x = 65536 * 65536 _in x * x * x"))->toString() == "79228162514264337593543950336" );
+    
+    //functions and free variables take the usual path
+    CHECK( interpretTyped(parse_str("(_fun (x) x * 2)(21)"))->equals(new NumericValue(42)) );
+    CHECK_THROWS_WITH( interpretTyped(parse_str("x + 1")), "Incomplete substitution" );
+    
+    //nothing is allocated but the result
+    Expression* square = parse_str("_let x = 1 + 2 _in x * x");
+    EvaluationContext context;
+    {
+        EvaluationScope scope(&context);
+        interpretTyped(square);
+    }
+    CHECK( context.steps == 3 );
+    CHECK( context.bytesAllocated == sizeof(NumericValue) );
+    
+    //type errors found part way through the program, or in a branch that is not taken, are still found before any step is taken
+    EvaluationContext rejected;
+    {
+        EvaluationScope scope(&rejected);
+        CHECK_THROWS_WITH( interpretTyped(parse_str("_let x = 1 + 2 _in _if x == 3 _then x * x _else _true")), "type error: expected int but found bool in _true" );
+        CHECK_THROWS_AS( interpretTyped(parse_str("_if _true _then 1 _else 1 + _false")), TypeError );
+        CHECK_THROWS_AS( interpretTyped(parse_str("1 + 2 == _false")), TypeError );
+    }
+    CHECK( rejected.steps == 0 );
+    
+    //the steps are charged against the budget all the same
+    EvaluationContext budget;
+    budget.stepBudget = 2;
+    {
+        EvaluationScope scope(&budget);
+        CHECK_THROWS_AS( interpretTyped(square), EvaluationLimitError );
+    }
+}
+
+/* for tests: variables may only have letters, so `va`, `vb`, ..., `vz`, `vba`, ... */
+static string variableName(int index) {
+    
+    string name;
+    do {
+        
+        name.insert(name.begin(), (char)('a' + index % 26));
+        index /= 26;
+    } while (index > 0);
+    return "v" + name;
+}
+
+/* for tests: a chain of `_let`s, each binding used by the next and by a test */
+static string letChain(int length, unsigned &seed) {
+    
+    std::ostringstream program;
+    program << "_let " << variableName(0) << " = 3 _in ";
+    for (int i = 1; i < length; i++) {
+        
+        seed = seed * 1103515245 + 12345;
+        string previous = variableName(i - 1);
+        string current = variableName(i);
+        program << "_let " << current << " = " << previous << " + " << (seed >> 16) % 7 << " * " << (seed >> 8) % 3 << " _in _if " << current << " == 0 _then 1 _else ";
+    }
+    program << variableName(length - 1);
+    return program.str();
+}
+
+/* for tests: a balanced tree of sums over small literals, with products only near the leaves so that it fits 64 bits */
+static string arithmeticTree(int depth, unsigned &seed) {
+    
+    seed = seed * 1103515245 + 12345;
+    if (depth == 0) {
+        
+        return to_string(1 + (seed >> 16) % 3);
+    }
+    string lhs = arithmeticTree(depth - 1, seed);
+    string rhs = arithmeticTree(depth - 1, seed);
+    return "(" + lhs + (depth <= 2 && (seed >> 20) % 2 == 0 ? " * " : " + ") + rhs + ")";
+}
+
+TEST_CASE( "interpretTyped benchmark", "[.benchmark]" ) {
+    
+    unsigned seed = 45;
+    vector<pair<string, Expression*>> workloads = {
+        { "arithmetic tree, 2^20 leaves", parse_str(arithmeticTree(20, seed)) },
+        { "chain of 2000 _lets", parse_str(letChain(2000, seed)) },
+    };
+    for (auto &workload : workloads) {
+        
+        Expression* program = workload.second;
+        auto start = std::chrono::steady_clock::now();
+        Value* expected = program->evaluate();
+        double plainMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        
+        start = std::chrono::steady_clock::now();
+        inferType(program);
+        double checkMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        
+        start = std::chrono::steady_clock::now();
+        Value* result = interpretTyped(program);
+        double typedMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        CHECK( result->equals(expected) );
+        cout << workload.first << ": evaluate() " << plainMilliseconds << " ms, type check " << checkMilliseconds << " ms, interpretTyped() " << typedMilliseconds
+             << " ms including the check, " << plainMilliseconds / typedMilliseconds << "x\n";
+    }
+}
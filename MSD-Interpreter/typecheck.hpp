@@ -0,0 +1,60 @@
+//
+//  typecheck.hpp
+//  ParserImproved
+//
+//  Copyright © 2020 MSD Katie Rose. All rights reserved.
+//
+
+#ifndef typecheck_hpp
+#define typecheck_hpp
+
+#include <stdio.h>
+#include <stdexcept>
+#include <string>
+#include "expression.hpp"
+
+using namespace std;
+
+/*
+ The type of an expression: `int`, `bool`, a function type `argument -> result`, or a type variable standing for a type not known yet.  Unifying a variable with a type makes that type its `instance`.  An `equality` variable, made for the sides of `==`, can only stand for a type whose values can be compared, so never for a function type.  A variable's `level` is the number of `_let`s around the place it was made, and variables that were generalized at a `_let` have GENERIC_LEVEL and are copied afresh at each use of its variable.
+ */
+class Type {
+public:
+    
+    enum Kind { INT, BOOL, FUNCTION, VARIABLE };
+    static const int GENERIC_LEVEL = 1 << 30;
+    
+    Kind kind;
+    Type* argument;
+    Type* result;
+    Type* instance;
+    int level;
+    bool equality;
+    
+    Type(Kind typeKind);
+    Type(Type* argumentType, Type* resultType);
+    
+    //`int`, `bool`, `int -> bool`, with type variables named 'a, 'b, ... in order of appearance, and equality variables ''a, ''b, ...
+    string toString();
+};
+
+/*
+ Thrown for a program that can go wrong at run time, such as `_true + 1`
+ */
+class TypeError : public runtime_error {
+public:
+    
+    TypeError(string message);
+};
+
+/*
+ Infers the type of `expr` in the Hindley-Milner style, so the variable of a `_let` bound to a function can be used at different types, as in `_let id = _fun (x) x _in id(id)(1)`.  Free variables can have any type.  `+` and `*` need integers, the test of an `_if` needs a boolean and its branches the same type, and the sides of `==` need the same type too, which cannot be a function type, so `1 == _true` is rejected although it evaluates to `_false`, and so is `f == f` for a function `f`.  Throws TypeError for programs that do not have a type, which includes self-application like `f(f)`.
+ */
+Type* inferType(Expression* expr);
+
+/*
+ Type checks `expr` and evaluates it, throwing TypeError without taking a step if it is ill-typed.  Programs of only integers, booleans, arithmetic, `==`, `_if` and `_let` are checked and evaluated in one walk that keeps every value in a machine integer and never checks a value at run time, promoting to BigIntValue only if the result does not fit an `int`.  Other programs, ill-typed ones and ones that overflow 64 bits are type checked in full and evaluated the usual way.
+ */
+Value* interpretTyped(Expression* expr);
+
+#endif /* typecheck_hpp */
@@ -5,8 +5,19 @@
 //  Created by Katie Rose on 2/6/20.
 //  Copyright © 2020 MSD Katie Rose. All rights reserved.
 //
+#include <algorithm>
+#include <climits>
+#include <random>
+#include <typeinfo>
+#include <chrono>
+#include <iostream>
 #include "expression.hpp"
 #include "value.hpp"
+#include "context.hpp"
+#include "function.hpp"
+#include "catch.hpp"
+
+static vector<uint32_t> magnitudeOf(long long integer);
 
 NumericValue::NumericValue(int integer) {
     
@@ -18,7 +29,8 @@ bool NumericValue::equals(Value* value) {
     NumericValue* otherNumericValue = dynamic_cast<NumericValue*>(value);
     if (otherNumericValue == nullptr) {
         
-        return false;
+        //comparing with a function throws, whichever side it is on
+        return dynamic_cast<FunValue*>(value) != nullptr && value->equals(this);
     } else {
         return (this->value == otherNumericValue->value);
     }
@@ -29,9 +41,14 @@ Value* NumericValue::addTo(Value* value) {
     NumericValue* otherNumericValue = dynamic_cast<NumericValue*>(value);
     if (otherNumericValue == nullptr) {
         
+        BigIntValue* otherBigIntValue = dynamic_cast<BigIntValue*>(value);
+        if (otherBigIntValue != nullptr) {
+            
+            return otherBigIntValue->addTo(this);
+        }
         throw runtime_error("not a number");
     } else {
-        return new NumericValue(this->value + otherNumericValue->value);
+        return BigIntValue::fromLongLong((long long)this->value + otherNumericValue->value);
     }
 }
 
@@ -40,9 +57,14 @@ Value* NumericValue::multiplyWith(Value* value) {
     NumericValue* otherNumericValue = dynamic_cast<NumericValue*>(value);
     if (otherNumericValue == nullptr) {
         
+        BigIntValue* otherBigIntValue = dynamic_cast<BigIntValue*>(value);
+        if (otherBigIntValue != nullptr) {
+            
+            return otherBigIntValue->multiplyWith(this);
+        }
         throw runtime_error("not a number");
     } else {
-        return new NumericValue(this->value * otherNumericValue->value);
+        return BigIntValue::fromLongLong((long long)this->value * otherNumericValue->value);
     }
 }
 
@@ -66,7 +88,7 @@ bool BoolValue::equals(Value* value) {
     BoolValue* otherBoolValue = dynamic_cast<BoolValue*>(value);
     if (otherBoolValue == nullptr) {
         
-        return false;
+        return dynamic_cast<FunValue*>(value) != nullptr && value->equals(this);
     } else {
         return (this->value == otherBoolValue->value);
     }
@@ -97,3 +119,690 @@ string BoolValue::toString() {
         return "_false";
     }
 }
+
+ThunkValue::ThunkValue(Expression* delayed) {
+    
+    this->expression = delayed;
+    this->forced = nullptr;
+    this->reference = nullptr;
+}
+
+Value* ThunkValue::force() {
+    
+    if (this->forced == nullptr) {
+        
+        this->forced = this->expression->evaluate();
+        EvaluationContext* context = EvaluationContext::current();
+        if (context != nullptr) {
+            
+            context->lazyBindingsForced++;
+        }
+    }
+    return this->forced;
+}
+
+bool ThunkValue::equals(Value* value) {
+    
+    return force()->equals(value);
+}
+
+Value* ThunkValue::addTo(Value* value) {
+    
+    return force()->addTo(value);
+}
+
+Value* ThunkValue::multiplyWith(Value* value) {
+    
+    return force()->multiplyWith(value);
+}
+
+/*
+ Every use of the binding refers to the same ThunkExpression, so they all share one forced value
+ */
+Expression* ThunkValue::toExpression() {
+    
+    if (this->reference == nullptr) {
+        
+        this->reference = new ThunkExpression(this);
+    }
+    return this->reference;
+}
+
+string ThunkValue::toString() {
+    
+    return force()->toString();
+}
+
+FunValue::FunValue(FunExpression* functionExpression, Environment* closedOver) {
+    
+    this->function = functionExpression;
+    this->environment = closedOver;
+}
+
+/*
+ Whether two functions compute the same thing is undecidable, and comparing closures by identity would make `==` depend on whether an optimizer shared or copied a `_fun`, so functions cannot be compared at all
+ */
+bool FunValue::equals(Value* value) {
+    
+    throw runtime_error("comparison of functions not supported");
+}
+
+Value* FunValue::addTo(Value* value) {
+    
+    throw runtime_error("adding of functions not supported");
+}
+
+Value* FunValue::multiplyWith(Value* value) {
+    
+    throw runtime_error("multiplication of functions not supported");
+}
+
+/*
+ The values the closure captured are substituted into its body, so the expression means the same thing anywhere
+ */
+Expression* FunValue::toExpression() {
+    
+    if (this->environment == nullptr) {
+        
+        return this->function;
+    }
+    return closeOver(this->function, this->environment);
+}
+
+string FunValue::toString() {
+    
+    return toExpression()->toString();
+}
+
+/*
+ Multiplications where the smaller operand has fewer limbs than this use the schoolbook method; Karatsuba only pays for its extra additions above it.
+ */
+static const size_t KARATSUBA_THRESHOLD = 40;
+
+static void trimMagnitude(vector<uint32_t> &magnitude) {
+    
+    while (!magnitude.empty() && magnitude.back() == 0) {
+        
+        magnitude.pop_back();
+    }
+}
+
+static vector<uint32_t> magnitudeOf(long long integer) {
+    
+    // negate in unsigned arithmetic so that LLONG_MIN does not overflow
+    unsigned long long remaining = integer < 0 ? 0ULL - (unsigned long long)integer : (unsigned long long)integer;
+    vector<uint32_t> magnitude;
+    while (remaining != 0) {
+        
+        magnitude.push_back((uint32_t)(remaining % BigIntValue::BASE));
+        remaining /= BigIntValue::BASE;
+    }
+    return magnitude;
+}
+
+static int compareMagnitudes(const vector<uint32_t> &lhs, const vector<uint32_t> &rhs) {
+    
+    if (lhs.size() != rhs.size()) {
+        
+        return lhs.size() < rhs.size() ? -1 : 1;
+    }
+    for (size_t i = lhs.size(); i-- > 0; ) {
+        
+        if (lhs[i] != rhs[i]) {
+            
+            return lhs[i] < rhs[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+// Adds `rhs` shifted left by `shift` limbs into `lhs`
+static void addMagnitudeInPlace(vector<uint32_t> &lhs, const vector<uint32_t> &rhs, size_t shift) {
+    
+    if (lhs.size() < rhs.size() + shift) {
+        
+        lhs.resize(rhs.size() + shift, 0);
+    }
+    uint32_t carry = 0;
+    size_t i = 0;
+    for (; i < rhs.size() || carry != 0; i++) {
+        
+        if (i + shift == lhs.size()) {
+            
+            lhs.push_back(0);
+        }
+        uint32_t sum = lhs[i + shift] + carry + (i < rhs.size() ? rhs[i] : 0);
+        carry = sum >= BigIntValue::BASE ? 1 : 0;
+        lhs[i + shift] = carry ? sum - BigIntValue::BASE : sum;
+    }
+}
+
+// Subtracts `rhs` from `lhs`, assuming that `lhs` is at least as large
+static void subtractMagnitudeInPlace(vector<uint32_t> &lhs, const vector<uint32_t> &rhs) {
+    
+    int64_t borrow = 0;
+    for (size_t i = 0; i < rhs.size() || borrow != 0; i++) {
+        
+        int64_t difference = (int64_t)lhs[i] - borrow - (i < rhs.size() ? rhs[i] : 0);
+        borrow = difference < 0 ? 1 : 0;
+        lhs[i] = (uint32_t)(borrow ? difference + BigIntValue::BASE : difference);
+    }
+    trimMagnitude(lhs);
+}
+
+vector<uint32_t> BigIntValue::multiplySchoolbook(const vector<uint32_t> &lhs, const vector<uint32_t> &rhs) {
+    
+    if (lhs.empty() || rhs.empty()) {
+        
+        return vector<uint32_t>();
+    }
+    vector<uint32_t> product(lhs.size() + rhs.size(), 0);
+    for (size_t i = 0; i < lhs.size(); i++) {
+        
+        uint64_t carry = 0;
+        uint64_t digit = lhs[i];
+        for (size_t j = 0; j < rhs.size(); j++) {
+            
+            uint64_t current = product[i + j] + digit * rhs[j] + carry;
+            product[i + j] = (uint32_t)(current % BASE);
+            carry = current / BASE;
+        }
+        for (size_t k = i + rhs.size(); carry != 0; k++) {
+            
+            uint64_t current = product[k] + carry;
+            product[k] = (uint32_t)(current % BASE);
+            carry = current / BASE;
+        }
+    }
+    trimMagnitude(product);
+    return product;
+}
+
+static vector<uint32_t> multiplyKaratsuba(const vector<uint32_t> &lhs, const vector<uint32_t> &rhs) {
+    
+    const vector<uint32_t> &larger = lhs.size() >= rhs.size() ? lhs : rhs;
+    const vector<uint32_t> &smaller = lhs.size() >= rhs.size() ? rhs : lhs;
+    if (smaller.size() < KARATSUBA_THRESHOLD) {
+        
+        return BigIntValue::multiplySchoolbook(larger, smaller);
+    }
+    
+    //very unbalanced operands are multiplied a smaller-sized slice of the larger one at a time
+    if (smaller.size() * 2 <= larger.size()) {
+        
+        vector<uint32_t> product;
+        for (size_t start = 0; start < larger.size(); start += smaller.size()) {
+            
+            size_t end = min(larger.size(), start + smaller.size());
+            vector<uint32_t> slice(larger.begin() + start, larger.begin() + end);
+            trimMagnitude(slice);
+            addMagnitudeInPlace(product, multiplyKaratsuba(slice, smaller), start);
+        }
+        trimMagnitude(product);
+        return product;
+    }
+    
+    //(a1 B + a0)(b1 B + b0) = z2 B^2 + z1 B + z0 where z1 = (a0 + a1)(b0 + b1) - z2 - z0
+    size_t half = larger.size() / 2;
+    vector<uint32_t> lowLarger(larger.begin(), larger.begin() + half);
+    vector<uint32_t> highLarger(larger.begin() + half, larger.end());
+    vector<uint32_t> lowSmaller(smaller.begin(), smaller.begin() + min(half, smaller.size()));
+    vector<uint32_t> highSmaller(smaller.begin() + min(half, smaller.size()), smaller.end());
+    trimMagnitude(lowLarger);
+    trimMagnitude(lowSmaller);
+    
+    vector<uint32_t> z0 = multiplyKaratsuba(lowLarger, lowSmaller);
+    vector<uint32_t> z2 = multiplyKaratsuba(highLarger, highSmaller);
+    addMagnitudeInPlace(lowLarger, highLarger, 0);
+    addMagnitudeInPlace(lowSmaller, highSmaller, 0);
+    vector<uint32_t> z1 = multiplyKaratsuba(lowLarger, lowSmaller);
+    subtractMagnitudeInPlace(z1, z0);
+    subtractMagnitudeInPlace(z1, z2);
+    
+    vector<uint32_t> product = z0;
+    product.reserve(larger.size() + smaller.size());
+    addMagnitudeInPlace(product, z1, half);
+    addMagnitudeInPlace(product, z2, 2 * half);
+    trimMagnitude(product);
+    return product;
+}
+
+vector<uint32_t> BigIntValue::multiplyMagnitudes(const vector<uint32_t> &lhs, const vector<uint32_t> &rhs) {
+    
+    if (lhs.empty() || rhs.empty()) {
+        
+        return vector<uint32_t>();
+    }
+    return multiplyKaratsuba(lhs, rhs);
+}
+
+BigIntValue::BigIntValue(long long integer) {
+    
+    this->negative = integer < 0;
+    this->limbs = magnitudeOf(integer);
+    EvaluationContext::countBytes(this->limbs.size() * sizeof(uint32_t));
+}
+
+BigIntValue::BigIntValue(string digits) {
+    
+    this->negative = false;
+    size_t start = 0;
+    if (!digits.empty() && digits[0] == '-') {
+        
+        this->negative = true;
+        start = 1;
+    }
+    if (start == digits.size()) {
+        
+        throw runtime_error("expected digits");
+    }
+    for (size_t end = digits.size(); end > start; ) {
+        
+        size_t chunkStart = end >= start + BASE_DIGITS ? end - BASE_DIGITS : start;
+        uint32_t limb = 0;
+        for (size_t i = chunkStart; i < end; i++) {
+            
+            if (!isdigit(digits[i])) {
+                
+                throw runtime_error((string)"expected a digit at " + digits[i]);
+            }
+            limb = limb * 10 + (digits[i] - '0');
+        }
+        this->limbs.push_back(limb);
+        end = chunkStart;
+    }
+    trimMagnitude(this->limbs);
+    if (this->limbs.empty()) {
+        
+        this->negative = false;
+    }
+    EvaluationContext::countBytes(this->limbs.size() * sizeof(uint32_t));
+}
+
+BigIntValue::BigIntValue(bool isNegative, vector<uint32_t> magnitude) {
+    
+    trimMagnitude(magnitude);
+    this->negative = isNegative && !magnitude.empty();
+    this->limbs = magnitude;
+    // the limbs are most of the memory a large result takes, so they count against the context's byte budget too
+    EvaluationContext::countBytes(this->limbs.size() * sizeof(uint32_t));
+}
+
+/*
+ Returns a NumericValue when `integer` fits in an int, and a BigIntValue otherwise
+ */
+Value* BigIntValue::fromLongLong(long long integer) {
+    
+    if (integer >= INT_MIN && integer <= INT_MAX) {
+        
+        return new NumericValue((int)integer);
+    }
+    return new BigIntValue(integer);
+}
+
+Value* BigIntValue::fromDigits(string digits) {
+    
+    BigIntValue* parsed = new BigIntValue(digits);
+    return normalize(parsed->negative, parsed->limbs);
+}
+
+Value* BigIntValue::normalize(bool isNegative, vector<uint32_t> magnitude) {
+    
+    trimMagnitude(magnitude);
+    if (magnitude.size() <= 2) {
+        
+        long long integer = 0;
+        for (size_t i = magnitude.size(); i-- > 0; ) {
+            
+            integer = integer * BASE + magnitude[i];
+        }
+        return fromLongLong(isNegative ? -integer : integer);
+    }
+    return new BigIntValue(isNegative, magnitude);
+}
+
+bool BigIntValue::equals(Value* value) {
+    
+    BigIntValue* otherBigIntValue = dynamic_cast<BigIntValue*>(value);
+    if (otherBigIntValue == nullptr) {
+        
+        return dynamic_cast<FunValue*>(value) != nullptr && value->equals(this);
+    } else {
+        return (this->negative == otherBigIntValue->negative && this->limbs == otherBigIntValue->limbs);
+    }
+}
+
+Value* BigIntValue::addTo(Value* value) {
+    
+    bool otherNegative;
+    vector<uint32_t> otherLimbs;
+    NumericValue* otherNumericValue = dynamic_cast<NumericValue*>(value);
+    BigIntValue* otherBigIntValue = dynamic_cast<BigIntValue*>(value);
+    if (otherNumericValue != nullptr) {
+        
+        otherNegative = otherNumericValue->value < 0;
+        otherLimbs = magnitudeOf(otherNumericValue->value);
+    } else if (otherBigIntValue != nullptr) {
+        
+        otherNegative = otherBigIntValue->negative;
+        otherLimbs = otherBigIntValue->limbs;
+    } else {
+        throw runtime_error("not a number");
+    }
+    
+    if (this->negative == otherNegative) {
+        
+        vector<uint32_t> sum = this->limbs;
+        addMagnitudeInPlace(sum, otherLimbs, 0);
+        return normalize(this->negative, sum);
+    }
+    if (compareMagnitudes(this->limbs, otherLimbs) >= 0) {
+        
+        vector<uint32_t> difference = this->limbs;
+        subtractMagnitudeInPlace(difference, otherLimbs);
+        return normalize(this->negative, difference);
+    } else {
+        subtractMagnitudeInPlace(otherLimbs, this->limbs);
+        return normalize(otherNegative, otherLimbs);
+    }
+}
+
+Value* BigIntValue::multiplyWith(Value* value) {
+    
+    NumericValue* otherNumericValue = dynamic_cast<NumericValue*>(value);
+    BigIntValue* otherBigIntValue = dynamic_cast<BigIntValue*>(value);
+    if (otherNumericValue != nullptr) {
+        
+        return normalize(this->negative != (otherNumericValue->value < 0), multiplyMagnitudes(this->limbs, magnitudeOf(otherNumericValue->value)));
+    } else if (otherBigIntValue != nullptr) {
+        
+        return normalize(this->negative != otherBigIntValue->negative, multiplyMagnitudes(this->limbs, otherBigIntValue->limbs));
+    } else {
+        throw runtime_error("not a number");
+    }
+}
+
+Expression* BigIntValue::toExpression() {
+    
+    return new BigNumber(this);
+}
+
+string BigIntValue::toString() {
+    
+    if (this->limbs.empty()) {
+        
+        return "0";
+    }
+    string digits = this->negative ? "-" : "";
+    digits += to_string(this->limbs.back());
+    size_t start = digits.size();
+    digits.resize(start + (this->limbs.size() - 1) * BASE_DIGITS);
+    for (size_t i = this->limbs.size() - 1; i-- > 0; ) {
+        
+        uint32_t limb = this->limbs[i];
+        for (int digit = BASE_DIGITS - 1; digit >= 0; digit--) {
+            
+            digits[start + digit] = (char)('0' + limb % 10);
+            limb /= 10;
+        }
+        start += BASE_DIGITS;
+    }
+    return digits;
+}
+
+TaggedValue TaggedValue::of(Value* value) {
+    
+    if (value == nullptr) {
+        
+        return { 0 };
+    }
+    //the exact class is all that matters here, and comparing it is much cheaper than a `dynamic_cast`
+    const type_info &kind = typeid(*value);
+    if (kind == typeid(NumericValue)) {
+        
+        return fromInt(static_cast<NumericValue*>(value)->value);
+    } else if (kind == typeid(BoolValue)) {
+        
+        return fromBool(static_cast<BoolValue*>(value)->value);
+    } else if (kind == typeid(BigIntValue)) {
+        
+        BigIntValue* big = static_cast<BigIntValue*>(value);
+        if (big->limbs.size() <= 2) {
+            
+            long long integer = 0;
+            for (size_t i = big->limbs.size(); i-- > 0; ) {
+                
+                integer = integer * BigIntValue::BASE + big->limbs[i];
+            }
+            return fromInt(big->negative ? -integer : integer);
+        }
+    }
+    return { (uint64_t)(uintptr_t)value };
+}
+
+TaggedValue TaggedValue::fromInt(long long integer) {
+    
+    if (integer >= -MAX_IMMEDIATE && integer <= MAX_IMMEDIATE) {
+        
+        return { ((uint64_t)integer << 1) | 1 };
+    }
+    return { (uint64_t)(uintptr_t)new BigIntValue(integer) };
+}
+
+Value* TaggedValue::toValue() const {
+    
+    if (isInt()) {
+        
+        return BigIntValue::fromLongLong(intValue());
+    } else if (isBool()) {
+        
+        return new BoolValue(boolValue());
+    }
+    return pointer();
+}
+
+TaggedValue TaggedValue::add(TaggedValue other) const {
+    
+    if (isInt() && other.isInt()) {
+        
+        //both are below 10^18, so the sum cannot overflow
+        return fromInt(intValue() + other.intValue());
+    }
+    return of(toValue()->addTo(other.toValue()));
+}
+
+TaggedValue TaggedValue::multiply(TaggedValue other) const {
+    
+    long long product;
+    if (isInt() && other.isInt() && !__builtin_mul_overflow(intValue(), other.intValue(), &product)) {
+        
+        return fromInt(product);
+    }
+    return of(toValue()->multiplyWith(other.toValue()));
+}
+
+bool TaggedValue::equals(TaggedValue other) const {
+    
+    if (this->bits == other.bits) {
+        
+        return !isPointer() || pointer()->equals(pointer());
+    }
+    if (isPointer() || other.isPointer()) {
+        
+        return toValue()->equals(other.toValue());
+    }
+    return false;
+}
+
+Expression* TaggedValue::toExpression() const {
+    
+    if (isInt()) {
+        
+        long long integer = intValue();
+        if (integer >= INT_MIN && integer <= INT_MAX) {
+            
+            return new Number((int)integer);
+        }
+        return new BigNumber(new BigIntValue(integer));
+    } else if (isBool()) {
+        
+        return new BoolExpression(boolValue());
+    }
+    return pointer()->toExpression();
+}
+
+string TaggedValue::toString() const {
+    
+    if (isInt()) {
+        
+        return to_string(intValue());
+    } else if (isBool()) {
+        
+        return boolValue() ? "_true" : "_false";
+    }
+    return pointer()->toString();
+}
+
+/* for tests */
+static vector<uint32_t> randomMagnitude(size_t size, mt19937 &generator) {
+    
+    uniform_int_distribution<uint32_t> limb(0, BigIntValue::BASE - 1);
+    vector<uint32_t> magnitude(size);
+    for (size_t i = 0; i < size; i++) {
+        
+        magnitude[i] = limb(generator);
+    }
+    magnitude[size - 1] = max<uint32_t>(magnitude[size - 1], 1);
+    return magnitude;
+}
+
+TEST_CASE( "BigIntValue" ) {
+    
+    //overflowing an int promotes to a BigIntValue and small results come back as NumericValues
+    CHECK( (new NumericValue(2147483647))->addTo(new NumericValue(1))->equals(new BigIntValue(2147483648LL)) );
+    CHECK( (new NumericValue(65536))->multiplyWith(new NumericValue(65536))->toString() == "4294967296" );
+    CHECK( (new BigIntValue(2147483648LL))->addTo(new NumericValue(-1))->equals(new NumericValue(2147483647)) );
+    CHECK( (new BigIntValue(5000000000LL))->addTo(new BigIntValue(-5000000000LL))->equals(new NumericValue(0)) );
+    CHECK( (new BigIntValue(-3000000000LL))->multiplyWith(new NumericValue(-2))->toString() == "6000000000" );
+    CHECK( ! (new BigIntValue(3000000000LL))->equals(new NumericValue(3)) );
+    
+    CHECK( (new BigIntValue((string)"123456789012345678901234567890"))->toString() == "123456789012345678901234567890" );
+    CHECK( (new BigIntValue((string)"-1000000000000000000"))->toString() == "-1000000000000000000" );
+    CHECK( BigIntValue::fromDigits("00042")->equals(new NumericValue(42)) );
+    
+    //30!
+    Value* factorial = new NumericValue(1);
+    for (int i = 2; i <= 30; i++) {
+        
+        factorial = factorial->multiplyWith(new NumericValue(i));
+    }
+    CHECK( factorial->toString() == "265252859812191058636308480000000" );
+    
+    //Karatsuba has to agree with the schoolbook method on balanced and unbalanced operands
+    mt19937 generator(26);
+    size_t sizes[][2] = { {40, 40}, {97, 64}, {300, 41}, {513, 512} };
+    for (auto &size : sizes) {
+        
+        vector<uint32_t> lhs = randomMagnitude(size[0], generator);
+        vector<uint32_t> rhs = randomMagnitude(size[1], generator);
+        CHECK( BigIntValue::multiplyMagnitudes(lhs, rhs) == BigIntValue::multiplySchoolbook(lhs, rhs) );
+    }
+    
+    CHECK_THROWS_WITH( (new BigIntValue(3000000000LL))->addTo(new BoolValue(true)), "not a number" );
+}
+
+TEST_CASE( "BigIntValue multiplication benchmark", "[.benchmark]" ) {
+    
+    mt19937 generator(1);
+    for (size_t digits : {1000, 10000, 100000}) {
+        
+        size_t size = digits / BigIntValue::BASE_DIGITS;
+        vector<uint32_t> lhs = randomMagnitude(size, generator);
+        vector<uint32_t> rhs = randomMagnitude(size, generator);
+        
+        auto start = chrono::steady_clock::now();
+        vector<uint32_t> naive = BigIntValue::multiplySchoolbook(lhs, rhs);
+        auto middle = chrono::steady_clock::now();
+        vector<uint32_t> fast = BigIntValue::multiplyMagnitudes(lhs, rhs);
+        auto end = chrono::steady_clock::now();
+        
+        CHECK( naive == fast );
+        cout << digits << " digits: schoolbook " << chrono::duration<double, milli>(middle - start).count()
+             << " ms, karatsuba " << chrono::duration<double, milli>(end - middle).count() << " ms\n";
+    }
+}
+
+TEST_CASE( "TaggedValue" ) {
+    
+    //integers and booleans are held in the word, and unboxed when made from a Value
+    CHECK( TaggedValue::fromInt(-5).isInt() );
+    CHECK( TaggedValue::fromInt(-5).intValue() == -5 );
+    CHECK( TaggedValue::fromBool(true).isBool() );
+    CHECK( TaggedValue::fromBool(false).boolValue() == false );
+    CHECK( TaggedValue::of(new NumericValue(7)).bits == TaggedValue::fromInt(7).bits );
+    CHECK( TaggedValue::of(new BoolValue(true)).bits == TaggedValue::fromBool(true).bits );
+    CHECK( TaggedValue::of(new BigIntValue(5000000000LL)).bits == TaggedValue::fromInt(5000000000LL).bits );
+    CHECK( TaggedValue::of(nullptr).isNull() );
+    
+    //integers with 19 digits or more stay on the heap
+    TaggedValue largest = TaggedValue::fromInt(TaggedValue::MAX_IMMEDIATE);
+    CHECK( largest.isInt() );
+    TaggedValue larger = largest.add(TaggedValue::fromInt(1));
+    CHECK( larger.isPointer() );
+    CHECK( larger.toString() == "1000000000000000000" );
+    CHECK( larger.add(TaggedValue::fromInt(-1)).bits == largest.bits );
+    CHECK( TaggedValue::fromInt(-TaggedValue::MAX_IMMEDIATE - 1).isPointer() );
+    CHECK( TaggedValue::fromInt(3000000000LL).multiply(TaggedValue::fromInt(3000000000LL)).toString() == "9000000000000000000" );
+    CHECK( TaggedValue::fromInt(TaggedValue::MAX_IMMEDIATE).multiply(TaggedValue::fromInt(TaggedValue::MAX_IMMEDIATE)).toString()
+           == (new BigIntValue(TaggedValue::MAX_IMMEDIATE))->multiplyWith(new BigIntValue(TaggedValue::MAX_IMMEDIATE))->toString() );
+    
+    //the same answers and errors as the Values
+    CHECK( TaggedValue::fromInt(2147483647).add(TaggedValue::fromInt(1)).toValue()->equals(new BigIntValue(2147483648LL)) );
+    CHECK( TaggedValue::fromInt(2147483647).add(TaggedValue::fromInt(-1)).toValue()->equals(new NumericValue(2147483646)) );
+    CHECK( TaggedValue::fromInt(3).equals(TaggedValue::fromInt(3)) );
+    CHECK( ! TaggedValue::fromInt(1).equals(TaggedValue::fromBool(true)) );
+    CHECK( larger.equals(TaggedValue::of(new BigIntValue((string)"1000000000000000000"))) );
+    CHECK( ! larger.equals(largest) );
+    CHECK_THROWS_WITH( TaggedValue::fromBool(true).add(TaggedValue::fromInt(1)), "adding of booleans not supported" );
+    CHECK_THROWS_WITH( TaggedValue::fromInt(1).multiply(TaggedValue::fromBool(true)), "not a number" );
+    CHECK( TaggedValue::fromInt(5000000000LL).toExpression()->equals(new BigNumber(new BigIntValue(5000000000LL))) );
+    CHECK( TaggedValue::fromInt(-3).toExpression()->equals(new Number(-3)) );
+    CHECK( TaggedValue::fromBool(false).toString() == "_false" );
+    
+    //small integers allocate nothing
+    EvaluationContext context;
+    EvaluationScope scope(&context);
+    TaggedValue sum = TaggedValue::fromInt(0);
+    for (int i = 0; i < 100; i++) {
+        
+        sum = sum.add(TaggedValue::fromInt(i)).multiply(TaggedValue::fromInt(1));
+    }
+    CHECK( sum.intValue() == 4950 );
+    CHECK( context.allocations == 0 );
+}
+
+TEST_CASE( "TaggedValue benchmark", "[.benchmark]" ) {
+    
+    const int iterations = 10000000;
+    EvaluationContext context;
+    EvaluationScope scope(&context);
+    auto start = chrono::steady_clock::now();
+    Value* boxed = new NumericValue(0);
+    for (int i = 0; i < iterations; i++) {
+        
+        boxed = boxed->addTo(new NumericValue(i % 100))->multiplyWith(new NumericValue(1));
+    }
+    double boxedMilliseconds = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    size_t boxedBytes = context.bytesAllocated;
+    
+    start = chrono::steady_clock::now();
+    TaggedValue tagged = TaggedValue::fromInt(0);
+    for (int i = 0; i < iterations; i++) {
+        
+        tagged = tagged.add(TaggedValue::fromInt(i % 100)).multiply(TaggedValue::fromInt(1));
+    }
+    double taggedMilliseconds = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    CHECK( tagged.equals(TaggedValue::of(boxed)) );
+    cout << iterations << " additions and multiplications: Values " << boxedMilliseconds << " ms and " << boxedBytes / iterations
+         << " bytes per iteration, TaggedValues " << taggedMilliseconds << " ms and " << (context.bytesAllocated - boxedBytes) / iterations << " bytes per iteration\n";
+}
@@ -10,11 +10,16 @@
 #define value_hpp
 
 #include <stdio.h>
+#include <stdint.h>
 #include <string>
+#include <vector>
+#include "context.hpp"
 
 using namespace std;
 
 class Expression;
+class FunExpression;
+struct Environment;
 
 /*
  Value is the most simplified version of an Expression.
@@ -22,6 +27,15 @@ class Expression;
 class Value {
 public:
     
+    //allocations are charged to the current EvaluationContext's byte budget, inline like Expression's
+    static void* operator new(size_t size) {
+        EvaluationContext::countBytes(size);
+        return ::operator new(size);
+    }
+    static void operator delete(void* pointer) {
+        ::operator delete(pointer);
+    }
+    
     virtual bool equals(Value* value) = 0;
     virtual Value* addTo(Value* otherValue) = 0;
     virtual Value* multiplyWith(Value* otherVal) = 0;
@@ -53,4 +67,117 @@ public:
   string toString() override;
 };
 
+/*
+ BigIntValue is an integer that does not fit in an int.  The magnitude is stored as base 10^9 limbs, least significant limb first, so that converting to decimal is linear in the number of digits.  Arithmetic that produces a result small enough for an int hands back a NumericValue instead, so a BigIntValue never equals a NumericValue.
+ */
+class BigIntValue : public Value {
+    
+public:
+    static const uint32_t BASE = 1000000000;
+    static const int BASE_DIGITS = 9;
+    
+    bool negative;
+    vector<uint32_t> limbs;
+    BigIntValue(long long integer);
+    BigIntValue(string digits);
+    BigIntValue(bool isNegative, vector<uint32_t> magnitude);
+    bool equals(Value* value) override;
+    Value* addTo(Value* otherValue) override;
+    Value* multiplyWith(Value* otherValue) override;
+    Expression* toExpression() override;
+    string toString() override;
+    
+    static Value* fromLongLong(long long integer);
+    static Value* fromDigits(string digits);
+    static Value* normalize(bool isNegative, vector<uint32_t> magnitude);
+    static vector<uint32_t> multiplySchoolbook(const vector<uint32_t> &lhs, const vector<uint32_t> &rhs);
+    static vector<uint32_t> multiplyMagnitudes(const vector<uint32_t> &lhs, const vector<uint32_t> &rhs);
+};
+
+/*
+ ThunkValue stands in for the value of a lazy `_let` binding.  It holds the bound expression unevaluated, evaluates it the first time it is used and remembers the result, so the expression is evaluated at most once.
+ */
+class ThunkValue : public Value {
+    
+public:
+    Expression* expression;
+    Value* forced;
+    Expression* reference;
+    ThunkValue(Expression* delayed);
+    Value* force();
+    bool equals(Value* value) override;
+    Value* addTo(Value* otherValue) override;
+    Value* multiplyWith(Value* otherValue) override;
+    Expression* toExpression() override;
+    string toString() override;
+};
+
+/*
+ FunValue is a closure: the FunExpression it was made from and the environment of the variables bound around it when it was made.  Functions cannot be added, multiplied or compared with `==`.
+ */
+class FunValue : public Value {
+
+public:
+    FunExpression* function;
+    Environment* environment;
+    FunValue(FunExpression* functionExpression, Environment* closedOver);
+    bool equals(Value* value) override;
+    Value* addTo(Value* otherValue) override;
+    Value* multiplyWith(Value* otherValue) override;
+    Expression* toExpression() override;
+    string toString() override;
+};
+
+/*
+ TaggedValue is a value in one 64-bit word.  Integers with at most 18 digits, the ones a BigIntValue would keep in two limbs, and booleans are held in the word itself, so making, adding and comparing them touches no heap.  Every other value is a pointer to a Value, which is allocated at least 8-byte aligned, so the low bits of the word tell the three apart: an integer has a 1 in bit 0 and the integer in the bits above it, a boolean has 10 in the low bits and the boolean in bit 2, and a pointer has 00.
+ 
+ The encoding is canonical: `of()` unboxes every NumericValue and BoolValue and every BigIntValue small enough, so two TaggedValues hold equal values only if their words are equal or both are pointers to equal values.  The word 0 is no value, like nullptr.
+ */
+class TaggedValue {
+public:
+    
+    static const long long MAX_IMMEDIATE = 999999999999999999LL;
+    
+    uint64_t bits;
+    
+    static TaggedValue of(Value* value);
+    static TaggedValue fromInt(long long integer);
+    static inline TaggedValue fromBool(bool boolean) {
+        return { 2 | ((uint64_t)boolean << 2) };
+    }
+    
+    inline bool isNull() const {
+        return this->bits == 0;
+    }
+    inline bool isInt() const {
+        return (this->bits & 1) != 0;
+    }
+    inline bool isBool() const {
+        return (this->bits & 3) == 2;
+    }
+    inline bool isPointer() const {
+        return (this->bits & 3) == 0 && this->bits != 0;
+    }
+    inline long long intValue() const {
+        return (long long)this->bits >> 1;
+    }
+    inline bool boolValue() const {
+        return (this->bits & 4) != 0;
+    }
+    inline Value* pointer() const {
+        return (Value*)(uintptr_t)this->bits;
+    }
+    
+    //the value as a Value, allocating one for an integer or a boolean
+    Value* toValue() const;
+    
+    //the same results and errors as `addTo()`, `multiplyWith()` and `equals()` on the values
+    TaggedValue add(TaggedValue other) const;
+    TaggedValue multiply(TaggedValue other) const;
+    bool equals(TaggedValue other) const;
+    
+    Expression* toExpression() const;
+    string toString() const;
+};
+
 #endif /* value_hpp */